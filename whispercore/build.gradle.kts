@@ -36,6 +36,13 @@ android {
 					"-DGGML_OPENCL_OFF=ON",
 					"-DGGML_VULKAN_OFF=ON"
 				))
+				// Opt-in: ship one libggml-cpu-<variant>.so per CPU feature level and
+				// load the best one at runtime (-PwhisperCore.cpuVariants=true).
+				// Needs packaging.jniLibs.useLegacyPackaging = true in the app so
+				// the variants are extracted to the native library directory.
+				if (project.findProperty("whisperCore.cpuVariants")?.toString() == "true") {
+					arguments.add("-DWHISPER_CORE_CPU_VARIANTS=ON")
+				}
 				// ABI Filters: Specify which native architectures to build for.
 				// It's good practice to define these.
 				// Choose based on what you want to support. arm64-v8a is common.
@@ -230,7 +230,7 @@ class JniDirectTest {
 
 			// 3. Call fullTranscribe
 			Log.i(TAG, "Calling WhisperJNIBridge.fullTranscribe...")
-			WhisperJNIBridge.fullTranscribe(contextPtr, numThreads, audioData)
+			WhisperJNIBridge.fullTranscribe(contextPtr, numThreads, 0, audioData)
 			// No direct return value to assert, but we expect it not to crash
 			// and to populate segments in the native context.
 			Log.i(TAG, "WhisperJNIBridge.fullTranscribe completed.")
@@ -0,0 +1,111 @@
+// Shared helpers for the host benchmark tools.
+//
+// Everything here is header-only and host-only: the tools are never built
+// for Android, so they are free to use POSIX APIs directly.
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#if defined(__linux__) || defined(__APPLE__)
+#include <sys/resource.h>
+#endif
+
+namespace bench {
+
+struct latency_stats {
+    double mean = 0.0;
+    double min  = 0.0;
+    double max  = 0.0;
+    double p50  = 0.0;
+    double p90  = 0.0;
+    double p99  = 0.0;
+};
+
+// nearest-rank percentile over an already sorted sample
+static inline double percentile_sorted(const std::vector<double> & v, double p) {
+    if (v.empty()) {
+        return 0.0;
+    }
+    const size_t rank = (size_t) std::max(0.0, std::min((double) v.size() - 1, p/100.0*(double) v.size() + 0.5 - 1.0));
+    return v[rank];
+}
+
+static inline latency_stats compute_stats(std::vector<double> v) {
+    latency_stats s;
+    if (v.empty()) {
+        return s;
+    }
+    std::sort(v.begin(), v.end());
+    double sum = 0.0;
+    for (double x : v) {
+        sum += x;
+    }
+    s.mean = sum / v.size();
+    s.min  = v.front();
+    s.max  = v.back();
+    s.p50  = percentile_sorted(v, 50.0);
+    s.p90  = percentile_sorted(v, 90.0);
+    s.p99  = percentile_sorted(v, 99.0);
+    return s;
+}
+
+// peak resident set size of this process in KiB, or 0 if unknown
+static inline int64_t peak_rss_kb() {
+#if defined(__linux__)
+    struct rusage ru;
+    if (getrusage(RUSAGE_SELF, &ru) == 0) {
+        return (int64_t) ru.ru_maxrss;
+    }
+#elif defined(__APPLE__)
+    struct rusage ru;
+    if (getrusage(RUSAGE_SELF, &ru) == 0) {
+        return (int64_t) ru.ru_maxrss / 1024;
+    }
+#endif
+    return 0;
+}
+
+// user + system CPU time of this process in seconds, or 0 if unknown
+static inline double process_cpu_s() {
+#if defined(__linux__) || defined(__APPLE__)
+    struct rusage ru;
+    if (getrusage(RUSAGE_SELF, &ru) == 0) {
+        return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) + 1e-6*(ru.ru_utime.tv_usec + ru.ru_stime.tv_usec);
+    }
+#endif
+    return 0.0;
+}
+
+static inline std::string json_escape(const std::string & s) {
+    std::string out;
+    out.reserve(s.size() + 2);
+    for (char c : s) {
+        switch (c) {
+            case '"':  out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n";  break;
+            case '\r': out += "\\r";  break;
+            case '\t': out += "\\t";  break;
+            default:
+                if ((unsigned char) c < 0x20) {
+                    char buf[8];
+                    snprintf(buf, sizeof(buf), "\\u%04x", c);
+                    out += buf;
+                } else {
+                    out += c;
+                }
+        }
+    }
+    return out;
+}
+
+static inline void print_stats_json(FILE * f, const char * key, const latency_stats & s, const char * indent) {
+    fprintf(f, "%s\"%s\": { \"mean\": %.3f, \"min\": %.3f, \"max\": %.3f, \"p50\": %.3f, \"p90\": %.3f, \"p99\": %.3f }",
+            indent, key, s.mean, s.min, s.max, s.p50, s.p90, s.p99);
+}
+
+} // namespace bench
@@ -0,0 +1,416 @@
+// Load-balancing benchmark for the ggml CPU ops on asymmetric cores.
+//
+// On big.LITTLE phones, and on VMs with noisy neighbours, some of the compute
+// threads run slower than others, and every op waits at its closing barrier
+// for the slowest one. This tool reproduces that on a workstation: the
+// threadpool pins worker i to core i, and "noise" threads spin on the cores of
+// the first -s workers, so those workers only get part of a core.
+//
+// Each whisper-shaped op is timed with and without the noise, once per
+// chunks-per-thread setting (ggml_cpu_set_chunks_per_thread). One chunk per
+// thread is the old static split; with more chunks the fast threads pick up
+// the rows the slow ones do not get to. The "slowdown" column is noisy/quiet.
+//
+// Pinning needs a build without OpenMP (-DGGML_OPENMP=OFF): the OpenMP
+// runtime ignores the threadpool affinity. With OpenMP the noise threads still
+// compete with the workers, just not with a fixed set of them.
+//
+// usage: whisper-core-asym-bench [-m base] [-t 4] [-s 1] [-c 1,4,8] [-o norm,soft_max]
+
+#include "ggml.h"
+#include "ggml-backend.h"
+#include "ggml-cpu.h"
+#include "bench-common.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace {
+
+struct model_dims {
+    const char * name;
+    int n_state;
+    int n_head;
+};
+
+const model_dims k_models[] = {
+    { "tiny",     384,  6 },
+    { "base",     512,  8 },
+    { "small",    768, 12 },
+    { "medium",  1024, 16 },
+    { "large-v3",1280, 20 },
+};
+
+const int k_n_audio_ctx = 1500;
+
+struct asym_params {
+    std::string              model  = "base";
+    int                      n_threads = std::max(2, (int) std::thread::hardware_concurrency());
+    int                      n_slow = 1;
+    std::vector<int>         chunks = { 1, 4, 8 };
+    std::vector<std::string> ops;
+
+    double min_time = 0.5; // seconds per measurement
+    int    n_max    = 50;  // max runs per measurement
+};
+
+struct asym_case {
+    std::string op;
+    std::string shape;
+    std::function<ggml_tensor * (ggml_context * ctx)> build;
+};
+
+std::vector<std::string> split(const std::string & s, char sep) {
+    std::vector<std::string> out;
+    std::stringstream ss(s);
+    std::string item;
+    while (std::getline(ss, item, sep)) {
+        if (!item.empty()) {
+            out.push_back(item);
+        }
+    }
+    return out;
+}
+
+void print_usage(char ** argv, const asym_params & params) {
+    fprintf(stderr, "\n");
+    fprintf(stderr, "usage: %s [options]\n", argv[0]);
+    fprintf(stderr, "\n");
+    fprintf(stderr, "options:\n");
+    fprintf(stderr, "  -h,          --help            show this help message and exit\n");
+    fprintf(stderr, "  -m NAME,     --model NAME      [%-8s] model size (tiny,base,small,medium,large-v3)\n", params.model.c_str());
+    fprintf(stderr, "  -t N,        --threads N       [%-8d] compute threads, pinned to cores 0..N-1\n", params.n_threads);
+    fprintf(stderr, "  -s N,        --slow N          [%-8d] workers that share their core with a noise thread\n", params.n_slow);
+    fprintf(stderr, "  -c LIST,     --chunks LIST     chunks per thread to compare (default 1,4,8)\n");
+    fprintf(stderr, "  -o LIST,     --ops LIST        only run these ops (default all)\n");
+    fprintf(stderr, "  -st SECONDS, --min-time SEC    [%-8.1f] minimum measured time per case\n", params.min_time);
+    fprintf(stderr, "  -n N,        --max-runs N      [%-8d] maximum runs per case\n", params.n_max);
+    fprintf(stderr, "\n");
+}
+
+bool parse_params(int argc, char ** argv, asym_params & params) {
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+
+        auto next = [&]() -> std::string {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "error: missing value for argument: %s\n", arg.c_str());
+                exit(1);
+            }
+            return argv[++i];
+        };
+
+        if (arg == "-h" || arg == "--help") {
+            print_usage(argv, params);
+            exit(0);
+        } else if (arg == "-m" || arg == "--model") {
+            params.model = next();
+        } else if (arg == "-t" || arg == "--threads") {
+            params.n_threads = std::max(1, std::stoi(next()));
+        } else if (arg == "-s" || arg == "--slow") {
+            params.n_slow = std::max(0, std::stoi(next()));
+        } else if (arg == "-c" || arg == "--chunks") {
+            params.chunks.clear();
+            for (const auto & s : split(next(), ',')) {
+                params.chunks.push_back(std::max(1, std::stoi(s)));
+            }
+        } else if (arg == "-o" || arg == "--ops") {
+            params.ops = split(next(), ',');
+        } else if (arg == "-st" || arg == "--min-time") {
+            params.min_time = std::stod(next());
+        } else if (arg == "-n" || arg == "--max-runs") {
+            params.n_max = std::max(1, std::stoi(next()));
+        } else {
+            fprintf(stderr, "error: unknown argument: %s\n", arg.c_str());
+            print_usage(argv, params);
+            return false;
+        }
+    }
+
+    params.n_slow = std::min(params.n_slow, params.n_threads);
+
+    return true;
+}
+
+// the ops whisper's graphs spend their non-mul_mat time in, with encoder shapes
+std::vector<asym_case> make_cases(const model_dims & m, const asym_params & params) {
+    std::vector<asym_case> cases;
+
+    const int n_state = m.n_state;
+    const int n_head  = m.n_head;
+    const int d_head  = n_state/n_head;
+    const int n_ctx   = k_n_audio_ctx;
+
+    char shape[128];
+
+    snprintf(shape, sizeof(shape), "[%d x %d]", n_state, n_ctx);
+    cases.push_back({ "norm", shape, [=](ggml_context * ctx) {
+        return ggml_norm(ctx, ggml_new_tensor_2d(ctx, GGML_TYPE_F32, n_state, n_ctx), 1e-5f);
+    } });
+    cases.push_back({ "add", shape, [=](ggml_context * ctx) {
+        return ggml_add(ctx, ggml_new_tensor_2d(ctx, GGML_TYPE_F32, n_state, n_ctx), ggml_new_tensor_1d(ctx, GGML_TYPE_F32, n_state));
+    } });
+    cases.push_back({ "mul", shape, [=](ggml_context * ctx) {
+        return ggml_mul(ctx, ggml_new_tensor_2d(ctx, GGML_TYPE_F32, n_state, n_ctx), ggml_new_tensor_1d(ctx, GGML_TYPE_F32, n_state));
+    } });
+    cases.push_back({ "cpy_f16", shape, [=](ggml_context * ctx) {
+        // storing K into the cache
+        return ggml_cpy(ctx, ggml_new_tensor_2d(ctx, GGML_TYPE_F32, n_state, n_ctx), ggml_new_tensor_2d(ctx, GGML_TYPE_F16, n_state, n_ctx));
+    } });
+    cases.push_back({ "cont", shape, [=](ggml_context * ctx) {
+        ggml_tensor * x = ggml_new_tensor_3d(ctx, GGML_TYPE_F32, d_head, n_head, n_ctx);
+        return ggml_cont(ctx, ggml_permute(ctx, x, 0, 2, 1, 3));
+    } });
+
+    snprintf(shape, sizeof(shape), "[%d x %d]", 4*n_state, n_ctx);
+    cases.push_back({ "gelu", shape, [=](ggml_context * ctx) {
+        return ggml_gelu(ctx, ggml_new_tensor_2d(ctx, GGML_TYPE_F32, 4*n_state, n_ctx));
+    } });
+
+    snprintf(shape, sizeof(shape), "[%d x %d x %d]", n_ctx, n_ctx, n_head);
+    cases.push_back({ "soft_max", shape, [=](ggml_context * ctx) {
+        ggml_tensor * kq = ggml_new_tensor_3d(ctx, GGML_TYPE_F32, n_ctx, n_ctx, n_head);
+        return ggml_soft_max_ext(ctx, kq, nullptr, 1.0f/sqrtf(float(d_head)), 0.0f);
+    } });
+
+    {
+        const int n_ctx_pad = GGML_PAD(n_ctx, 256);
+        snprintf(shape, sizeof(shape), "q [%d x %d x %d], kv [%d x %d x %d] f16", d_head, n_ctx, n_head, d_head, n_ctx_pad, n_head);
+        cases.push_back({ "flash_attn", shape, [=](ggml_context * ctx) {
+            ggml_tensor * q = ggml_new_tensor_3d(ctx, GGML_TYPE_F32, d_head, n_ctx,     n_head);
+            ggml_tensor * k = ggml_new_tensor_3d(ctx, GGML_TYPE_F16, d_head, n_ctx_pad, n_head);
+            ggml_tensor * v = ggml_new_tensor_3d(ctx, GGML_TYPE_F16, d_head, n_ctx_pad, n_head);
+            return ggml_flash_attn_ext(ctx, q, k, v, nullptr, 1.0f/sqrtf(float(d_head)), 0.0f, 0.0f);
+        } });
+    }
+
+    snprintf(shape, sizeof(shape), "[%d x %d] x [%d x %d]", n_state, 4*n_state, n_state, n_ctx);
+    cases.push_back({ "mul_mat", shape, [=](ggml_context * ctx) {
+        // already chunked dynamically, for reference
+        ggml_tensor * w = ggml_new_tensor_2d(ctx, GGML_TYPE_F16, n_state, 4*n_state);
+        ggml_tensor * x = ggml_new_tensor_2d(ctx, GGML_TYPE_F32, n_state, n_ctx);
+        return ggml_mul_mat(ctx, w, x);
+    } });
+
+    if (!params.ops.empty()) {
+        cases.erase(std::remove_if(cases.begin(), cases.end(), [&](const asym_case & c) {
+            return std::find(params.ops.begin(), params.ops.end(), c.op) == params.ops.end();
+        }), cases.end());
+    }
+
+    return cases;
+}
+
+void fill_random(ggml_tensor * t, std::mt19937 & rng) {
+    const int64_t n = ggml_nelements(t);
+
+    std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+
+    std::vector<float> f32(n);
+    for (auto & x : f32) {
+        x = dist(rng);
+    }
+
+    if (t->type == GGML_TYPE_F32) {
+        ggml_backend_tensor_set(t, f32.data(), 0, ggml_nbytes(t));
+    } else if (t->type == GGML_TYPE_F16) {
+        std::vector<ggml_fp16_t> f16(n);
+        ggml_fp32_to_fp16_row(f32.data(), f16.data(), n);
+        ggml_backend_tensor_set(t, f16.data(), 0, ggml_nbytes(t));
+    }
+}
+
+// threads that spin on a given core while a measurement runs
+struct noise_threads {
+    std::atomic<bool> stop { false };
+    std::vector<std::thread> threads;
+
+    void start(int n, int n_cores) {
+        stop = false;
+        for (int i = 0; i < n; ++i) {
+            threads.emplace_back([this, i, n_cores]() {
+#if defined(__linux__)
+                cpu_set_t set;
+                CPU_ZERO(&set);
+                CPU_SET(i % n_cores, &set);
+                pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+                (void) i;
+                (void) n_cores;
+#endif
+                volatile uint64_t x = 0;
+                while (!stop.load(std::memory_order_relaxed)) {
+                    x = x + 1;
+                }
+            });
+        }
+    }
+
+    void join() {
+        stop = true;
+        for (auto & t : threads) {
+            t.join();
+        }
+        threads.clear();
+    }
+};
+
+double time_graph(ggml_backend_t backend, ggml_cgraph * gf, const asym_params & params) {
+    ggml_backend_graph_compute(backend, gf); // warm-up
+
+    std::vector<double> t_ms;
+    double tsum = 0.0;
+    while ((int) t_ms.size() < params.n_max) {
+        const int64_t t0 = ggml_time_us();
+        ggml_backend_graph_compute(backend, gf);
+        const int64_t t1 = ggml_time_us();
+
+        t_ms.push_back((t1 - t0)/1000.0);
+        tsum += (t1 - t0)*1e-6;
+
+        if (tsum >= params.min_time && t_ms.size() >= 3) {
+            break;
+        }
+    }
+
+    return bench::compute_stats(t_ms).p50;
+}
+
+bool has_openmp(ggml_backend_reg_t reg) {
+    auto get_features = (ggml_backend_get_features_t) ggml_backend_reg_get_proc_address(reg, "ggml_backend_get_features");
+    if (!get_features) {
+        return false;
+    }
+    for (ggml_backend_feature * f = get_features(reg); f->name; ++f) {
+        if (strcmp(f->name, "OPENMP") == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+} // namespace
+
+int main(int argc, char ** argv) {
+    asym_params params;
+    if (!parse_params(argc, argv, params)) {
+        return 1;
+    }
+
+    const model_dims * m = nullptr;
+    for (const auto & md : k_models) {
+        if (params.model == md.name) {
+            m = &md;
+        }
+    }
+    if (!m) {
+        fprintf(stderr, "error: unknown model size: %s\n", params.model.c_str());
+        return 1;
+    }
+
+    ggml_time_init();
+
+    ggml_backend_t backend = ggml_backend_cpu_init();
+    if (!backend) {
+        fprintf(stderr, "error: failed to initialize the CPU backend\n");
+        return 1;
+    }
+
+    const int n_cores = std::max(1, (int) std::thread::hardware_concurrency());
+
+    if (has_openmp(ggml_backend_dev_backend_reg(ggml_backend_get_device(backend)))) {
+        fprintf(stderr, "warning: ggml uses OpenMP, the workers are not pinned (configure with -DGGML_OPENMP=OFF)\n");
+    }
+    if (params.n_threads > n_cores) {
+        fprintf(stderr, "warning: %d threads on %d cores, the cores are oversubscribed even without noise\n", params.n_threads, n_cores);
+    }
+
+    // worker i runs on core i
+    ggml_threadpool_params tpp = ggml_threadpool_params_default(params.n_threads);
+    for (int i = 0; i < params.n_threads; ++i) {
+        tpp.cpumask[i % n_cores] = true;
+    }
+    tpp.strict_cpu = true;
+
+    ggml_threadpool_t threadpool = ggml_threadpool_new(&tpp);
+    if (!threadpool) {
+        fprintf(stderr, "error: failed to create the threadpool\n");
+        return 1;
+    }
+
+    ggml_backend_cpu_set_threadpool(backend, threadpool);
+    ggml_backend_cpu_set_n_threads(backend, params.n_threads);
+
+    printf("| %-10s | %-42s | %6s | %10s | %10s | %8s |\n", "op", "shape", "chunks", "quiet ms", "noisy ms", "slowdown");
+    printf("|%s|%s|%s|%s|%s|%s|\n",
+            std::string(12, '-').c_str(), std::string(44, '-').c_str(), std::string(8, '-').c_str(),
+            std::string(12, '-').c_str(), std::string(12, '-').c_str(), std::string(10, '-').c_str());
+
+    for (const auto & ac : make_cases(*m, params)) {
+        ggml_init_params ip = {
+            /*.mem_size   =*/ 16*ggml_tensor_overhead() + ggml_graph_overhead(),
+            /*.mem_buffer =*/ nullptr,
+            /*.no_alloc   =*/ true,
+        };
+
+        ggml_context * ctx = ggml_init(ip);
+
+        ggml_cgraph * gf = ggml_new_graph(ctx);
+        ggml_build_forward_expand(gf, ac.build(ctx));
+
+        ggml_backend_buffer_t buf = ggml_backend_alloc_ctx_tensors(ctx, backend);
+        if (!buf) {
+            fprintf(stderr, "error: failed to allocate %s\n", ac.op.c_str());
+            ggml_free(ctx);
+            continue;
+        }
+
+        std::mt19937 rng(42);
+        for (ggml_tensor * t = ggml_get_first_tensor(ctx); t; t = ggml_get_next_tensor(ctx, t)) {
+            if (t->op == GGML_OP_NONE && t->view_src == nullptr) {
+                fill_random(t, rng);
+            }
+        }
+
+        for (int n_chunks : params.chunks) {
+            ggml_cpu_set_chunks_per_thread(n_chunks);
+
+            const double t_quiet = time_graph(backend, gf, params);
+
+            noise_threads noise;
+            noise.start(params.n_slow, n_cores);
+            const double t_noisy = time_graph(backend, gf, params);
+            noise.join();
+
+            printf("| %-10s | %-42s | %6d | %10.3f | %10.3f | %7.2fx |\n",
+                    ac.op.c_str(), ac.shape.c_str(), n_chunks, t_quiet, t_noisy, t_noisy/t_quiet);
+            fflush(stdout);
+        }
+
+        ggml_backend_buffer_free(buf);
+        ggml_free(ctx);
+    }
+
+    ggml_cpu_set_chunks_per_thread(0);
+
+    ggml_backend_free(backend);
+    ggml_threadpool_free(threadpool);
+
+    return 0;
+}
@@ -0,0 +1,276 @@
+// Barrier benchmark for the ggml threadpool.
+//
+// Every node of a ggml graph ends with a barrier, and whisper's decoder runs
+// graphs of a few hundred tiny nodes per token, so the cost of the barrier
+// and what the waiting threads do meanwhile matter on phones. This tool times
+// two graphs with each barrier mode (GGML_BARRIER_SPIN, GGML_BARRIER_HYBRID):
+//
+//   tiny        many small adds, so the time per node is mostly the barrier
+//   imbalanced  single-row soft_max nodes: one thread works, the rest wait
+//
+// Besides the wall time it reports the process CPU time divided by the wall
+// time. With the spin barrier the waiting threads burn a full core each; the
+// hybrid barrier should keep the tiny graph as fast while using less CPU on
+// the imbalanced one.
+//
+// The barrier modes only exist in builds without OpenMP (-DGGML_OPENMP=OFF).
+//
+// usage: whisper-core-barrier-bench [-t 1,2,4] [-n 256] [-s 0]
+
+#include "ggml.h"
+#include "ggml-backend.h"
+#include "ggml-cpu.h"
+#include "bench-common.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+struct barrier_params {
+    std::vector<int> threads;
+    int      n_nodes = 256;
+    uint32_t spin    = 0; // 0 - default spin budget of the hybrid barrier
+
+    double min_time = 0.5; // seconds per measurement
+    int    n_max    = 200; // max runs per measurement
+};
+
+struct barrier_case {
+    std::string name;
+    std::function<void (ggml_context * ctx, ggml_cgraph * gf, int n_nodes)> build;
+};
+
+std::vector<std::string> split(const std::string & s, char sep) {
+    std::vector<std::string> out;
+    std::stringstream ss(s);
+    std::string item;
+    while (std::getline(ss, item, sep)) {
+        if (!item.empty()) {
+            out.push_back(item);
+        }
+    }
+    return out;
+}
+
+void print_usage(char ** argv, const barrier_params & params) {
+    fprintf(stderr, "\n");
+    fprintf(stderr, "usage: %s [options]\n", argv[0]);
+    fprintf(stderr, "\n");
+    fprintf(stderr, "options:\n");
+    fprintf(stderr, "  -h,          --help            show this help message and exit\n");
+    fprintf(stderr, "  -t LIST,     --threads LIST    thread counts to compare (default 1,2,4,...,hardware threads)\n");
+    fprintf(stderr, "  -n N,        --nodes N         [%-8d] nodes per graph\n", params.n_nodes);
+    fprintf(stderr, "  -s N,        --spin N          [%-8u] max spin iterations of the hybrid barrier (0 - default)\n", params.spin);
+    fprintf(stderr, "  -st SECONDS, --min-time SEC    [%-8.1f] minimum measured time per case\n", params.min_time);
+    fprintf(stderr, "  -r N,        --max-runs N      [%-8d] maximum runs per case\n", params.n_max);
+    fprintf(stderr, "\n");
+}
+
+bool parse_params(int argc, char ** argv, barrier_params & params) {
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+
+        auto next = [&]() -> std::string {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "error: missing value for argument: %s\n", arg.c_str());
+                exit(1);
+            }
+            return argv[++i];
+        };
+
+        if (arg == "-h" || arg == "--help") {
+            print_usage(argv, params);
+            exit(0);
+        } else if (arg == "-t" || arg == "--threads") {
+            params.threads.clear();
+            for (const auto & s : split(next(), ',')) {
+                params.threads.push_back(std::max(1, std::stoi(s)));
+            }
+        } else if (arg == "-n" || arg == "--nodes") {
+            params.n_nodes = std::max(1, std::stoi(next()));
+        } else if (arg == "-s" || arg == "--spin") {
+            params.spin = (uint32_t) std::max(0, std::stoi(next()));
+        } else if (arg == "-st" || arg == "--min-time") {
+            params.min_time = std::stod(next());
+        } else if (arg == "-r" || arg == "--max-runs") {
+            params.n_max = std::max(1, std::stoi(next()));
+        } else {
+            fprintf(stderr, "error: unknown argument: %s\n", arg.c_str());
+            print_usage(argv, params);
+            return false;
+        }
+    }
+
+    if (params.threads.empty()) {
+        const int n_hw = std::max(1, (int) std::thread::hardware_concurrency());
+        for (int n = 1; n < n_hw; n *= 2) {
+            params.threads.push_back(n);
+        }
+        params.threads.push_back(n_hw);
+    }
+
+    return true;
+}
+
+std::vector<barrier_case> make_cases() {
+    std::vector<barrier_case> cases;
+
+    // a chain of adds on a decoder-sized row: a few hundred ns of work per node
+    cases.push_back({ "tiny", [](ggml_context * ctx, ggml_cgraph * gf, int n_nodes) {
+        ggml_tensor * b = ggml_new_tensor_1d(ctx, GGML_TYPE_F32, 512);
+        ggml_tensor * x = ggml_new_tensor_1d(ctx, GGML_TYPE_F32, 512);
+        for (int i = 0; i < n_nodes; ++i) {
+            x = ggml_add(ctx, x, b);
+        }
+        ggml_build_forward_expand(gf, x);
+    } });
+
+    // soft_max splits by rows, so a single long row keeps one thread busy
+    cases.push_back({ "imbalanced", [](ggml_context * ctx, ggml_cgraph * gf, int n_nodes) {
+        ggml_tensor * x = ggml_new_tensor_1d(ctx, GGML_TYPE_F32, 64*1024);
+        for (int i = 0; i < std::max(1, n_nodes/16); ++i) {
+            x = ggml_soft_max(ctx, x);
+        }
+        ggml_build_forward_expand(gf, x);
+    } });
+
+    return cases;
+}
+
+struct timing {
+    double ms;      // median wall time per graph
+    double cpu_pct; // process CPU time / wall time over all runs, in %
+};
+
+timing time_graph(ggml_backend_t backend, ggml_cgraph * gf, const barrier_params & params) {
+    ggml_backend_graph_compute(backend, gf); // warm-up
+
+    std::vector<double> t_ms;
+    double tsum = 0.0;
+
+    const double cpu0 = bench::process_cpu_s();
+
+    while ((int) t_ms.size() < params.n_max) {
+        const int64_t t0 = ggml_time_us();
+        ggml_backend_graph_compute(backend, gf);
+        const int64_t t1 = ggml_time_us();
+
+        t_ms.push_back((t1 - t0)/1000.0);
+        tsum += (t1 - t0)*1e-6;
+
+        if (tsum >= params.min_time && t_ms.size() >= 3) {
+            break;
+        }
+    }
+
+    const double cpu = bench::process_cpu_s() - cpu0;
+
+    return { bench::compute_stats(t_ms).p50, tsum > 0.0 ? 100.0*cpu/tsum : 0.0 };
+}
+
+bool has_openmp(ggml_backend_reg_t reg) {
+    auto get_features = (ggml_backend_get_features_t) ggml_backend_reg_get_proc_address(reg, "ggml_backend_get_features");
+    if (!get_features) {
+        return false;
+    }
+    for (ggml_backend_feature * f = get_features(reg); f->name; ++f) {
+        if (strcmp(f->name, "OPENMP") == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+} // namespace
+
+int main(int argc, char ** argv) {
+    barrier_params params;
+    if (!parse_params(argc, argv, params)) {
+        return 1;
+    }
+
+    ggml_time_init();
+
+    ggml_backend_t backend = ggml_backend_cpu_init();
+    if (!backend) {
+        fprintf(stderr, "error: failed to initialize the CPU backend\n");
+        return 1;
+    }
+
+    if (has_openmp(ggml_backend_dev_backend_reg(ggml_backend_get_device(backend)))) {
+        fprintf(stderr, "warning: ggml uses OpenMP, both modes use the OpenMP barrier (configure with -DGGML_OPENMP=OFF)\n");
+    }
+
+    const enum ggml_barrier_mode modes[] = { GGML_BARRIER_SPIN, GGML_BARRIER_HYBRID };
+
+    printf("| %-10s | %5s | %7s | %10s | %10s | %8s |\n", "graph", "nodes", "threads", "barrier", "us/node", "cpu %");
+    printf("|%s|%s|%s|%s|%s|%s|\n",
+            std::string(12, '-').c_str(), std::string(7, '-').c_str(), std::string(9, '-').c_str(),
+            std::string(12, '-').c_str(), std::string(12, '-').c_str(), std::string(10, '-').c_str());
+
+    for (const auto & bc : make_cases()) {
+        ggml_init_params ip = {
+            /*.mem_size   =*/ (params.n_nodes + 16)*ggml_tensor_overhead() + ggml_graph_overhead_custom(params.n_nodes + 16, false),
+            /*.mem_buffer =*/ nullptr,
+            /*.no_alloc   =*/ true,
+        };
+
+        ggml_context * ctx = ggml_init(ip);
+
+        ggml_cgraph * gf = ggml_new_graph_custom(ctx, params.n_nodes + 16, false);
+        bc.build(ctx, gf, params.n_nodes);
+
+        ggml_backend_buffer_t buf = ggml_backend_alloc_ctx_tensors(ctx, backend);
+        if (!buf) {
+            fprintf(stderr, "error: failed to allocate %s\n", bc.name.c_str());
+            ggml_free(ctx);
+            continue;
+        }
+        ggml_backend_buffer_clear(buf, 0);
+
+        const int n_nodes = ggml_graph_n_nodes(gf);
+
+        for (int n_threads : params.threads) {
+            for (enum ggml_barrier_mode mode : modes) {
+                ggml_threadpool_params tpp = ggml_threadpool_params_default(n_threads);
+                tpp.barrier      = mode;
+                tpp.barrier_spin = params.spin;
+
+                ggml_threadpool_t threadpool = ggml_threadpool_new(&tpp);
+                if (!threadpool) {
+                    fprintf(stderr, "error: failed to create the threadpool\n");
+                    return 1;
+                }
+
+                ggml_backend_cpu_set_threadpool(backend, threadpool);
+                ggml_backend_cpu_set_n_threads(backend, n_threads);
+
+                const timing t = time_graph(backend, gf, params);
+
+                ggml_backend_cpu_set_threadpool(backend, nullptr);
+                ggml_threadpool_free(threadpool);
+
+                printf("| %-10s | %5d | %7d | %10s | %10.3f | %8.0f |\n",
+                        bc.name.c_str(), n_nodes, n_threads, mode == GGML_BARRIER_SPIN ? "spin" : "hybrid",
+                        1000.0*t.ms/n_nodes, t.cpu_pct);
+                fflush(stdout);
+            }
+        }
+
+        ggml_backend_buffer_free(buf);
+        ggml_free(ctx);
+    }
+
+    ggml_backend_free(backend);
+
+    return 0;
+}
@@ -0,0 +1,667 @@
+// End-to-end benchmark driver for whisper_core.
+//
+// Loads a model and a 16 kHz WAV file, runs a number of warm-up and measured
+// whisper_full() iterations and prints a JSON report with per-stage timings,
+// real-time factor, tokens/s, peak RSS and latency percentiles.
+//
+// With --logits-type the output logits read a quantized copy of the token
+// embedding; the report then also compares the transcript of the last run with
+// one made by a second context without the copy ("logits_diff").
+//
+// usage: whisper-core-bench -m ggml-tiny.en.bin -f jfk.wav [options]
+
+#include "whisper.h"
+#include "bench-common.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct bench_params {
+    std::string model = "";
+    std::string fname = "";
+    std::string out   = "";
+    std::string language = "en";
+    std::string trace;
+    std::string autotune_cache;
+    std::string cpumask;
+
+    int32_t n_threads   = std::min(4, (int32_t) std::thread::hardware_concurrency());
+
+    // per-phase thread counts, 0 - n_threads, -1 - auto (see whisper_full_params)
+    int32_t n_threads_mel    = 0;
+    int32_t n_threads_encode = 0;
+    int32_t n_threads_prompt = WHISPER_N_THREADS_AUTO;
+    int32_t n_threads_decode = WHISPER_N_THREADS_AUTO;
+    int32_t n_threads_sample = WHISPER_N_THREADS_AUTO;
+    int32_t n_warmup    = 1;
+    int32_t n_iter      = 5;
+    int32_t beam_size   = -1;
+    int32_t best_of     = 5;
+    int32_t audio_ctx   = 0;
+    int32_t duration_ms = 0;
+    int32_t poll        = 50;
+    int32_t prio        = 0;
+
+    ggml_type type_kv_self  = GGML_TYPE_F16;
+    ggml_type type_kv_cross = GGML_TYPE_F16;
+    ggml_type type_logits   = GGML_TYPE_COUNT; // none
+
+    bool flash_attn    = false;
+    bool translate     = false;
+    bool no_timestamps = false;
+    bool print_text    = false;
+    bool profile       = false;
+    bool autotune      = false;
+    bool no_threadpool = false;
+    bool barrier_spin  = false;
+};
+
+static void bench_print_usage(int /*argc*/, char ** argv, const bench_params & params) {
+    fprintf(stderr, "\n");
+    fprintf(stderr, "usage: %s [options]\n", argv[0]);
+    fprintf(stderr, "\n");
+    fprintf(stderr, "options:\n");
+    fprintf(stderr, "  -h,       --help          [default] show this help message and exit\n");
+    fprintf(stderr, "  -m FNAME, --model FNAME   [%-7s] model path\n",                            params.model.c_str());
+    fprintf(stderr, "  -f FNAME, --file FNAME    [%-7s] input WAV file (16 kHz, PCM16 or float)\n", params.fname.c_str());
+    fprintf(stderr, "  -o FNAME, --output FNAME  [%-7s] write the JSON report here (default stdout)\n", params.out.c_str());
+    fprintf(stderr, "  -t N,     --threads N     [%-7d] number of threads to use during computation\n", params.n_threads);
+    fprintf(stderr, "  -tm N,    --threads-mel N    [%-7d] mel threads (0 - n_threads, -1 - auto)\n",            params.n_threads_mel);
+    fprintf(stderr, "  -te N,    --threads-encode N [%-7d] encoder threads (0 - n_threads, -1 - auto)\n",        params.n_threads_encode);
+    fprintf(stderr, "  -tp N,    --threads-prompt N [%-7d] prompt decode threads (0 - n_threads, -1 - auto)\n",  params.n_threads_prompt);
+    fprintf(stderr, "  -td N,    --threads-decode N [%-7d] decoder step threads (0 - n_threads, -1 - auto)\n",   params.n_threads_decode);
+    fprintf(stderr, "  -ts N,    --threads-sample N [%-7d] sampling threads (0 - n_threads, -1 - auto)\n",       params.n_threads_sample);
+    fprintf(stderr, "  -w N,     --warmup N      [%-7d] number of warm-up iterations\n",               params.n_warmup);
+    fprintf(stderr, "  -n N,     --iter N        [%-7d] number of measured iterations\n",              params.n_iter);
+    fprintf(stderr, "  -l LANG,  --language LANG [%-7s] spoken language\n",                            params.language.c_str());
+    fprintf(stderr, "  -bs N,    --beam-size N   [%-7d] beam size for beam search (<= 1: greedy)\n",   params.beam_size);
+    fprintf(stderr, "  -bo N,    --best-of N     [%-7d] number of best candidates to keep\n",          params.best_of);
+    fprintf(stderr, "  -ac N,    --audio-ctx N   [%-7d] audio context size (0 - all)\n",               params.audio_ctx);
+    fprintf(stderr, "  -d N,     --duration N    [%-7d] duration of audio to process in ms (0 - all)\n", params.duration_ms);
+    fprintf(stderr, "  -fa,      --flash-attn    [%-7s] enable flash attention\n",                     params.flash_attn ? "true" : "false");
+    fprintf(stderr, "  -kvs T,   --kv-self T     [%-7s] decoder self-attention cache type: f16, q8_0 (q8_0 needs -fa)\n", ggml_type_name(params.type_kv_self));
+    fprintf(stderr, "  -kvc T,   --kv-cross T    [%-7s] cross-attention cache type: f16, q8_0, q4_0 (quantized needs -fa)\n", ggml_type_name(params.type_kv_cross));
+    fprintf(stderr, "  -lt T,    --logits-type T [%-7s] quantized copy of the token embedding for the logits: q8_0, q6_K\n", params.type_logits == GGML_TYPE_COUNT ? "none" : ggml_type_name(params.type_logits));
+    fprintf(stderr, "  -tr,      --translate     [%-7s] translate from source language to english\n",  params.translate ? "true" : "false");
+    fprintf(stderr, "  -nt,      --no-timestamps [%-7s] do not generate timestamps\n",                 params.no_timestamps ? "true" : "false");
+    fprintf(stderr, "  -pt,      --print-text    [%-7s] print the transcription of the last run to stderr\n", params.print_text ? "true" : "false");
+    fprintf(stderr, "  -prof,    --profile       [%-7s] per-op profile of the measured iterations (adds overhead)\n", params.profile ? "true" : "false");
+    fprintf(stderr, "  -at,      --autotune      [%-7s] run whisper_autotune() first and use its settings\n", params.autotune ? "true" : "false");
+    fprintf(stderr, "  -atc FNAME, --autotune-cache FNAME [%-7s] cache file for --autotune\n", params.autotune_cache.c_str());
+    fprintf(stderr, "  -C MASK,  --cpu-mask MASK [%-7s] hex mask of the cores for the threadpool, e.g. 0xf0\n", params.cpumask.empty() ? "default" : params.cpumask.c_str());
+    fprintf(stderr, "  --poll N                  [%-7d] threadpool polling level (0 - sleep, 100 - spin)\n", params.poll);
+    fprintf(stderr, "  --prio N                  [%-7d] threadpool priority (0 - normal, 1 - medium, 2 - high, 3 - realtime)\n", params.prio);
+    fprintf(stderr, "  --barrier MODE            [%-7s] threadpool barrier: spin or hybrid (spin, then sleep)\n", params.barrier_spin ? "spin" : "hybrid");
+    fprintf(stderr, "  -ntp,     --no-threadpool [%-7s] let the CPU backend manage its threads\n", params.no_threadpool ? "true" : "false");
+    fprintf(stderr, "  -tf FNAME, --trace FNAME  [%-7s] write a Chrome trace of all runs (needs -DWHISPER_TRACE=ON)\n", params.trace.c_str());
+    fprintf(stderr, "\n");
+}
+
+static ggml_type bench_parse_kv_type(const std::string & s) {
+    for (ggml_type type : { GGML_TYPE_F16, GGML_TYPE_Q8_0, GGML_TYPE_Q4_0 }) {
+        if (s == ggml_type_name(type)) {
+            return type;
+        }
+    }
+    fprintf(stderr, "error: unknown KV cache type: %s\n", s.c_str());
+    exit(1);
+}
+
+static ggml_type bench_parse_logits_type(const std::string & s) {
+    if (s == "none") {
+        return GGML_TYPE_COUNT;
+    }
+    for (ggml_type type : { GGML_TYPE_Q8_0, GGML_TYPE_Q6_K }) {
+        if (s == ggml_type_name(type)) {
+            return type;
+        }
+    }
+    fprintf(stderr, "error: unknown logits type: %s\n", s.c_str());
+    exit(1);
+}
+
+static bool bench_params_parse(int argc, char ** argv, bench_params & params) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+
+        const bool has_next = i + 1 < argc;
+        auto next = [&]() -> const char * {
+            if (!has_next) {
+                fprintf(stderr, "error: missing value for argument: %s\n", arg.c_str());
+                exit(1);
+            }
+            return argv[++i];
+        };
+
+        if (arg == "-h" || arg == "--help") {
+            bench_print_usage(argc, argv, params);
+            exit(0);
+        }
+        else if (arg == "-m"  || arg == "--model")         { params.model       = next(); }
+        else if (arg == "-f"  || arg == "--file")          { params.fname       = next(); }
+        else if (arg == "-o"  || arg == "--output")        { params.out         = next(); }
+        else if (arg == "-t"  || arg == "--threads")       { params.n_threads   = std::stoi(next()); }
+        else if (arg == "-tm" || arg == "--threads-mel")    { params.n_threads_mel    = std::stoi(next()); }
+        else if (arg == "-te" || arg == "--threads-encode") { params.n_threads_encode = std::stoi(next()); }
+        else if (arg == "-tp" || arg == "--threads-prompt") { params.n_threads_prompt = std::stoi(next()); }
+        else if (arg == "-td" || arg == "--threads-decode") { params.n_threads_decode = std::stoi(next()); }
+        else if (arg == "-ts" || arg == "--threads-sample") { params.n_threads_sample = std::stoi(next()); }
+        else if (arg == "-w"  || arg == "--warmup")        { params.n_warmup    = std::stoi(next()); }
+        else if (arg == "-n"  || arg == "--iter")          { params.n_iter      = std::stoi(next()); }
+        else if (arg == "-l"  || arg == "--language")      { params.language    = next(); }
+        else if (arg == "-bs" || arg == "--beam-size")     { params.beam_size   = std::stoi(next()); }
+        else if (arg == "-bo" || arg == "--best-of")       { params.best_of     = std::stoi(next()); }
+        else if (arg == "-ac" || arg == "--audio-ctx")     { params.audio_ctx   = std::stoi(next()); }
+        else if (arg == "-d"  || arg == "--duration")      { params.duration_ms = std::stoi(next()); }
+        else if (arg == "-fa" || arg == "--flash-attn")    { params.flash_attn    = true; }
+        else if (arg == "-kvs" || arg == "--kv-self")      { params.type_kv_self  = bench_parse_kv_type(next()); }
+        else if (arg == "-kvc" || arg == "--kv-cross")     { params.type_kv_cross = bench_parse_kv_type(next()); }
+        else if (arg == "-lt" || arg == "--logits-type")  { params.type_logits   = bench_parse_logits_type(next()); }
+        else if (arg == "-tr" || arg == "--translate")     { params.translate     = true; }
+        else if (arg == "-nt" || arg == "--no-timestamps") { params.no_timestamps = true; }
+        else if (arg == "-pt" || arg == "--print-text")    { params.print_text    = true; }
+        else if (arg == "-prof" || arg == "--profile")     { params.profile       = true; }
+        else if (arg == "-tf" || arg == "--trace")         { params.trace       = next(); }
+        else if (arg == "-C"  || arg == "--cpu-mask")      { params.cpumask     = next(); }
+        else if (                arg == "--poll")          { params.poll        = std::stoi(next()); }
+        else if (                arg == "--prio")          { params.prio        = std::stoi(next()); }
+        else if (                arg == "--barrier")       {
+            const std::string mode = next();
+            if (mode != "spin" && mode != "hybrid") {
+                fprintf(stderr, "error: unknown barrier mode: %s\n", mode.c_str());
+                return false;
+            }
+            params.barrier_spin = mode == "spin";
+        }
+        else if (arg == "-ntp" || arg == "--no-threadpool") { params.no_threadpool = true; }
+        else if (arg == "-at" || arg == "--autotune")      { params.autotune      = true; }
+        else if (arg == "-atc" || arg == "--autotune-cache") { params.autotune = true; params.autotune_cache = next(); }
+        else {
+            fprintf(stderr, "error: unknown argument: %s\n", arg.c_str());
+            bench_print_usage(argc, argv, params);
+            return false;
+        }
+    }
+
+    if (params.model.empty() || params.fname.empty()) {
+        fprintf(stderr, "error: both a model (-m) and an input file (-f) are required\n");
+        bench_print_usage(argc, argv, params);
+        return false;
+    }
+
+    params.n_threads = std::max(1, params.n_threads);
+    params.n_warmup  = std::max(0, params.n_warmup);
+    params.n_iter    = std::max(1, params.n_iter);
+
+    return true;
+}
+
+static uint32_t read_u32_le(const uint8_t * p) {
+    return (uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static uint16_t read_u16_le(const uint8_t * p) {
+    return (uint16_t) (p[0] | (p[1] << 8));
+}
+
+// minimal RIFF/WAVE reader: PCM16 or IEEE float, mono or multi-channel
+// (downmixed), must already be at WHISPER_SAMPLE_RATE
+static bool read_wav(const std::string & fname, std::vector<float> & pcmf32) {
+    FILE * f = fopen(fname.c_str(), "rb");
+    if (!f) {
+        fprintf(stderr, "error: failed to open '%s'\n", fname.c_str());
+        return false;
+    }
+
+    std::vector<uint8_t> buf;
+    {
+        uint8_t tmp[1 << 16];
+        size_t n;
+        while ((n = fread(tmp, 1, sizeof(tmp), f)) > 0) {
+            buf.insert(buf.end(), tmp, tmp + n);
+        }
+        fclose(f);
+    }
+
+    if (buf.size() < 12 || memcmp(buf.data(), "RIFF", 4) != 0 || memcmp(buf.data() + 8, "WAVE", 4) != 0) {
+        fprintf(stderr, "error: '%s' is not a RIFF/WAVE file\n", fname.c_str());
+        return false;
+    }
+
+    uint16_t format      = 0;
+    uint16_t channels    = 0;
+    uint32_t sample_rate = 0;
+    uint16_t bits        = 0;
+
+    const uint8_t * data   = nullptr;
+    size_t          n_data = 0;
+
+    size_t pos = 12;
+    while (pos + 8 <= buf.size()) {
+        const uint8_t * chunk = buf.data() + pos;
+        const uint32_t  size  = read_u32_le(chunk + 4);
+        const size_t    avail = std::min((size_t) size, buf.size() - pos - 8);
+
+        if (memcmp(chunk, "fmt ", 4) == 0 && avail >= 16) {
+            format      = read_u16_le(chunk + 8);
+            channels    = read_u16_le(chunk + 10);
+            sample_rate = read_u32_le(chunk + 12);
+            bits        = read_u16_le(chunk + 22);
+            if (format == 0xFFFE && avail >= 26) {
+                // WAVE_FORMAT_EXTENSIBLE: the sub-format GUID starts with the actual format tag
+                format = read_u16_le(chunk + 8 + 24);
+            }
+        } else if (memcmp(chunk, "data", 4) == 0) {
+            data   = chunk + 8;
+            n_data = avail;
+        }
+
+        pos += 8 + size + (size & 1);
+    }
+
+    if (data == nullptr || channels == 0) {
+        fprintf(stderr, "error: '%s' has no fmt/data chunk\n", fname.c_str());
+        return false;
+    }
+
+    if (sample_rate != WHISPER_SAMPLE_RATE) {
+        fprintf(stderr, "error: '%s' has sample rate %u, expected %d\n", fname.c_str(), sample_rate, WHISPER_SAMPLE_RATE);
+        return false;
+    }
+
+    const bool is_pcm16 = format == 1 && bits == 16;
+    const bool is_f32   = format == 3 && bits == 32;
+    if (!is_pcm16 && !is_f32) {
+        fprintf(stderr, "error: '%s' has unsupported format %u/%u bits (need PCM16 or float32)\n", fname.c_str(), format, bits);
+        return false;
+    }
+
+    const size_t n_frames = n_data / (channels*(bits/8));
+    pcmf32.resize(n_frames);
+
+    for (size_t i = 0; i < n_frames; ++i) {
+        float acc = 0.0f;
+        for (uint16_t c = 0; c < channels; ++c) {
+            const uint8_t * p = data + (i*channels + c)*(bits/8);
+            if (is_pcm16) {
+                acc += (float) (int16_t) read_u16_le(p) / 32768.0f;
+            } else {
+                float v;
+                memcpy(&v, p, sizeof(v));
+                acc += v;
+            }
+        }
+        pcmf32[i] = acc / channels;
+    }
+
+    return true;
+}
+
+// all tokens of the last whisper_full() run, including timestamps and special tokens
+static std::vector<whisper_token> bench_tokens(whisper_context * ctx) {
+    std::vector<whisper_token> tokens;
+    const int n_segments = whisper_full_n_segments(ctx);
+    for (int i = 0; i < n_segments; ++i) {
+        const int n = whisper_full_n_tokens(ctx, i);
+        for (int j = 0; j < n; ++j) {
+            tokens.push_back(whisper_full_get_token_id(ctx, i, j));
+        }
+    }
+    return tokens;
+}
+
+static std::string bench_text(whisper_context * ctx) {
+    std::string text;
+    const int n_segments = whisper_full_n_segments(ctx);
+    for (int i = 0; i < n_segments; ++i) {
+        text += whisper_full_get_segment_text(ctx, i);
+    }
+    return text;
+}
+
+static int bench_edit_distance(const std::vector<whisper_token> & a, const std::vector<whisper_token> & b) {
+    std::vector<int> row(b.size() + 1);
+    for (size_t j = 0; j <= b.size(); ++j) {
+        row[j] = (int) j;
+    }
+    for (size_t i = 1; i <= a.size(); ++i) {
+        int diag = row[0];
+        row[0] = (int) i;
+        for (size_t j = 1; j <= b.size(); ++j) {
+            const int up = row[j];
+            row[j] = std::min({ row[j] + 1, row[j - 1] + 1, diag + (a[i - 1] != b[j - 1]) });
+            diag = up;
+        }
+    }
+    return row[b.size()];
+}
+
+int main(int argc, char ** argv) {
+    bench_params params;
+
+    if (!bench_params_parse(argc, argv, params)) {
+        return 1;
+    }
+
+    std::vector<float> pcmf32;
+    if (!read_wav(params.fname, pcmf32)) {
+        return 2;
+    }
+
+    const double audio_s = params.duration_ms > 0
+        ? std::min((double) pcmf32.size() / WHISPER_SAMPLE_RATE, params.duration_ms / 1000.0)
+        : (double) pcmf32.size() / WHISPER_SAMPLE_RATE;
+
+    struct whisper_context_params cparams = whisper_context_default_params();
+    cparams.use_gpu    = false;
+    cparams.flash_attn = params.flash_attn;
+    cparams.profile    = params.profile;
+
+    cparams.type_kv_self  = params.type_kv_self;
+    cparams.type_kv_cross = params.type_kv_cross;
+    cparams.type_logits   = params.type_logits;
+
+    cparams.threadpool.enabled   = !params.no_threadpool;
+    cparams.threadpool.n_threads = params.n_threads;
+    cparams.threadpool.cpumask   = params.cpumask.empty() ? nullptr : params.cpumask.c_str();
+    cparams.threadpool.poll      = params.poll;
+    cparams.threadpool.prio      = params.prio;
+    cparams.threadpool.barrier   = params.barrier_spin ? GGML_BARRIER_SPIN : GGML_BARRIER_HYBRID;
+
+    const int64_t t_load_start_us = ggml_time_us();
+
+    struct whisper_context * ctx = whisper_init_from_file_with_params(params.model.c_str(), cparams);
+    if (ctx == nullptr) {
+        fprintf(stderr, "error: failed to initialize whisper context from '%s'\n", params.model.c_str());
+        return 3;
+    }
+
+    const double load_ms = (ggml_time_us() - t_load_start_us) / 1000.0;
+
+    fprintf(stderr, "system_info: n_threads = %d / %d | %s\n",
+            params.n_threads, (int) std::thread::hardware_concurrency(), whisper_print_system_info());
+
+    if (params.autotune) {
+        struct whisper_autotune_params aparams = whisper_autotune_default_params();
+        aparams.n_threads_max = params.n_threads;
+        aparams.cache_path    = params.autotune_cache.empty() ? nullptr : params.autotune_cache.c_str();
+
+        struct whisper_autotune_result ares;
+        if (whisper_autotune(ctx, aparams, &ares) != 0) {
+            fprintf(stderr, "error: whisper_autotune() failed\n");
+            return 4;
+        }
+
+        fprintf(stderr, "autotune: encode n_threads = %d, decode n_threads = %d, flash_attn = %d, use_extra_bufts = %d%s\n",
+                ares.n_threads_encode, ares.n_threads_decode, ares.flash_attn, ares.use_extra_bufts, ares.from_cache ? " (cached)" : "");
+
+        params.n_threads_encode = ares.n_threads_encode;
+        params.n_threads_decode = ares.n_threads_decode;
+        params.flash_attn = ares.flash_attn;
+    }
+
+    const bool beam = params.beam_size > 1;
+
+    struct whisper_full_params wparams = whisper_full_default_params(beam ? WHISPER_SAMPLING_BEAM_SEARCH : WHISPER_SAMPLING_GREEDY);
+    wparams.n_threads        = params.n_threads;
+    wparams.n_threads_mel    = params.n_threads_mel;
+    wparams.n_threads_encode = params.n_threads_encode;
+    wparams.n_threads_prompt = params.n_threads_prompt;
+    wparams.n_threads_decode = params.n_threads_decode;
+    wparams.n_threads_sample = params.n_threads_sample;
+    wparams.language         = params.language.c_str();
+    wparams.translate        = params.translate;
+    wparams.no_timestamps    = params.no_timestamps;
+    wparams.audio_ctx        = params.audio_ctx;
+    wparams.duration_ms      = params.duration_ms;
+    wparams.print_progress   = false;
+    wparams.print_realtime   = false;
+    wparams.print_special    = false;
+    wparams.print_timestamps = false;
+    wparams.greedy.best_of        = params.best_of;
+    wparams.beam_search.beam_size = params.beam_size;
+
+    std::vector<double> wall_ms;
+    std::vector<double> cpu_ms;
+    std::vector<double> stage_sample_ms, stage_encode_ms, stage_decode_ms, stage_batchd_ms, stage_prompt_ms;
+
+    int64_t n_tokens_total = 0;
+
+    const whisper_token token_eot = whisper_token_eot(ctx);
+
+    for (int it = 0; it < params.n_warmup + params.n_iter; ++it) {
+        const bool measured = it >= params.n_warmup;
+
+        whisper_reset_timings(ctx);
+
+        if (it == params.n_warmup) {
+            whisper_reset_profile(ctx);
+        }
+
+        const int64_t t_start_us = ggml_time_us();
+        const double  cpu_start  = bench::process_cpu_s();
+
+        if (whisper_full(ctx, wparams, pcmf32.data(), (int) pcmf32.size()) != 0) {
+            fprintf(stderr, "error: whisper_full failed on iteration %d\n", it);
+            whisper_free(ctx);
+            return 4;
+        }
+
+        const double ms        = (ggml_time_us() - t_start_us) / 1000.0;
+        const double cpu_ms_it = (bench::process_cpu_s() - cpu_start) * 1000.0;
+
+        int n_tokens = 0;
+        const int n_segments = whisper_full_n_segments(ctx);
+        for (int i = 0; i < n_segments; ++i) {
+            const int n = whisper_full_n_tokens(ctx, i);
+            for (int j = 0; j < n; ++j) {
+                if (whisper_full_get_token_id(ctx, i, j) < token_eot) {
+                    ++n_tokens;
+                }
+            }
+        }
+
+        fprintf(stderr, "%s %3d: %9.2f ms, %4d tokens\n", measured ? "iter  " : "warmup", measured ? it - params.n_warmup : it, ms, n_tokens);
+
+        if (!measured) {
+            continue;
+        }
+
+        wall_ms.push_back(ms);
+        cpu_ms.push_back(cpu_ms_it);
+        n_tokens_total += n_tokens;
+
+        struct whisper_timings * timings = whisper_get_timings(ctx);
+        if (timings) {
+            stage_sample_ms.push_back(timings->sample_ms);
+            stage_encode_ms.push_back(timings->encode_ms);
+            stage_decode_ms.push_back(timings->decode_ms);
+            stage_batchd_ms.push_back(timings->batchd_ms);
+            stage_prompt_ms.push_back(timings->prompt_ms);
+            delete timings;
+        }
+    }
+
+    if (params.print_text) {
+        fprintf(stderr, "%s\n", bench_text(ctx).c_str());
+    }
+
+    // output of the same settings without the logits copy, decoded once
+    struct {
+        std::vector<whisper_token> tokens;
+        std::vector<whisper_token> ref_tokens;
+        size_t common_prefix = 0;
+        int    edit_distance = 0;
+        double ref_decode_ms = 0.0;
+    } logits_diff;
+
+    if (params.type_logits != GGML_TYPE_COUNT) {
+        logits_diff.tokens = bench_tokens(ctx);
+
+        struct whisper_context_params cparams_ref = cparams;
+        cparams_ref.type_logits = GGML_TYPE_COUNT;
+
+        struct whisper_context * ctx_ref = whisper_init_from_file_with_params(params.model.c_str(), cparams_ref);
+        if (ctx_ref == nullptr) {
+            fprintf(stderr, "error: failed to initialize the reference context\n");
+            whisper_free(ctx);
+            return 3;
+        }
+
+        if (whisper_full(ctx_ref, wparams, pcmf32.data(), (int) pcmf32.size()) != 0) {
+            fprintf(stderr, "error: whisper_full failed on the reference context\n");
+            whisper_free(ctx_ref);
+            whisper_free(ctx);
+            return 4;
+        }
+
+        logits_diff.ref_tokens = bench_tokens(ctx_ref);
+
+        struct whisper_timings * timings = whisper_get_timings(ctx_ref);
+        if (timings) {
+            logits_diff.ref_decode_ms = timings->decode_ms;
+            delete timings;
+        }
+
+        const auto & a = logits_diff.tokens;
+        const auto & b = logits_diff.ref_tokens;
+        while (logits_diff.common_prefix < std::min(a.size(), b.size()) && a[logits_diff.common_prefix] == b[logits_diff.common_prefix]) {
+            logits_diff.common_prefix++;
+        }
+        logits_diff.edit_distance = bench_edit_distance(a, b);
+
+        fprintf(stderr, "logits %s vs none: %d token edits, %zu/%zu tokens before the first difference\n",
+                ggml_type_name(params.type_logits), logits_diff.edit_distance, logits_diff.common_prefix, b.size());
+        if (a != b) {
+            fprintf(stderr, "  %-5s: %s\n", ggml_type_name(params.type_logits), bench_text(ctx).c_str());
+            fprintf(stderr, "  %-5s: %s\n", "none", bench_text(ctx_ref).c_str());
+        }
+
+        whisper_free(ctx_ref);
+    }
+
+    const bench::latency_stats wall = bench::compute_stats(wall_ms);
+
+    double wall_total_ms = 0.0;
+    for (double ms : wall_ms) {
+        wall_total_ms += ms;
+    }
+
+    const double rtf          = audio_s > 0.0 ? (wall.mean / 1000.0) / audio_s : 0.0;
+    const double tokens_per_s = wall_total_ms > 0.0 ? n_tokens_total / (wall_total_ms / 1000.0) : 0.0;
+
+    // every decode call samples one token per decoder, so with greedy sampling this is the per-token rate
+    const bench::latency_stats decode = bench::compute_stats(stage_decode_ms);
+    const double decode_tokens_per_s = decode.mean > 0.0 ? 1000.0 / decode.mean : 0.0;
+
+    FILE * fout = stdout;
+    if (!params.out.empty()) {
+        fout = fopen(params.out.c_str(), "w");
+        if (!fout) {
+            fprintf(stderr, "error: failed to open '%s' for writing\n", params.out.c_str());
+            whisper_free(ctx);
+            return 5;
+        }
+    }
+
+    fprintf(fout, "{\n");
+    fprintf(fout, "  \"model\": \"%s\",\n",       bench::json_escape(params.model).c_str());
+    fprintf(fout, "  \"model_type\": \"%s\",\n",  whisper_model_type_readable(ctx));
+    fprintf(fout, "  \"audio\": \"%s\",\n",       bench::json_escape(params.fname).c_str());
+    fprintf(fout, "  \"audio_s\": %.3f,\n",       audio_s);
+    fprintf(fout, "  \"system_info\": \"%s\",\n", bench::json_escape(whisper_print_system_info()).c_str());
+    fprintf(fout, "  \"params\": { \"n_threads\": %d, \"n_threads_phase\": { \"mel\": %d, \"encode\": %d, \"prompt\": %d, \"decode\": %d, \"sample\": %d }, \"threadpool\": { \"enabled\": %s, \"cpumask\": \"%s\", \"poll\": %d, \"prio\": %d, \"barrier\": \"%s\" }, \"n_warmup\": %d, \"n_iter\": %d, \"sampling\": \"%s\", \"beam_size\": %d, \"best_of\": %d, \"audio_ctx\": %d, \"flash_attn\": %s, \"kv_types\": { \"self\": \"%s\", \"cross\": \"%s\" }, \"logits_type\": \"%s\", \"language\": \"%s\" },\n",
+            params.n_threads, params.n_threads_mel, params.n_threads_encode, params.n_threads_prompt, params.n_threads_decode, params.n_threads_sample,
+            params.no_threadpool ? "false" : "true", bench::json_escape(params.cpumask).c_str(), params.poll, params.prio, params.barrier_spin ? "spin" : "hybrid",
+            params.n_warmup, params.n_iter, beam ? "beam_search" : "greedy", params.beam_size, params.best_of,
+            params.audio_ctx, params.flash_attn ? "true" : "false", ggml_type_name(params.type_kv_self), ggml_type_name(params.type_kv_cross),
+            params.type_logits == GGML_TYPE_COUNT ? "none" : ggml_type_name(params.type_logits),
+            bench::json_escape(params.language).c_str());
+    fprintf(fout, "  \"load_ms\": %.3f,\n", load_ms);
+    bench::print_stats_json(fout, "wall_ms", wall, "  ");
+    fprintf(fout, ",\n");
+    // CPU time across all threads, time spent spinning at barriers shows up here
+    bench::print_stats_json(fout, "cpu_ms", bench::compute_stats(cpu_ms), "  ");
+    fprintf(fout, ",\n");
+    fprintf(fout, "  \"stages_ms_per_call\": {\n");
+    bench::print_stats_json(fout, "sample", bench::compute_stats(stage_sample_ms), "    "); fprintf(fout, ",\n");
+    bench::print_stats_json(fout, "encode", bench::compute_stats(stage_encode_ms), "    "); fprintf(fout, ",\n");
+    bench::print_stats_json(fout, "decode", decode, "    "); fprintf(fout, ",\n");
+    bench::print_stats_json(fout, "batchd", bench::compute_stats(stage_batchd_ms), "    "); fprintf(fout, ",\n");
+    bench::print_stats_json(fout, "prompt", bench::compute_stats(stage_prompt_ms), "    "); fprintf(fout, "\n");
+    fprintf(fout, "  },\n");
+    fprintf(fout, "  \"rtf\": %.5f,\n",          rtf);
+    fprintf(fout, "  \"tokens\": %lld,\n",       (long long) n_tokens_total);
+    fprintf(fout, "  \"tokens_per_s\": %.3f,\n", tokens_per_s);
+    fprintf(fout, "  \"decode_tokens_per_s\": %.3f,\n", decode_tokens_per_s);
+    if (params.type_logits != GGML_TYPE_COUNT) {
+        fprintf(fout, "  \"logits_diff\": { \"tokens\": %zu, \"ref_tokens\": %zu, \"common_prefix\": %zu, \"edit_distance\": %d, \"identical\": %s, \"ref_decode_tokens_per_s\": %.3f },\n",
+                logits_diff.tokens.size(), logits_diff.ref_tokens.size(), logits_diff.common_prefix, logits_diff.edit_distance,
+                logits_diff.tokens == logits_diff.ref_tokens ? "true" : "false",
+                logits_diff.ref_decode_ms > 0.0 ? 1000.0 / logits_diff.ref_decode_ms : 0.0);
+    }
+    fprintf(fout, "  \"peak_rss_kb\": %lld,\n", (long long) bench::peak_rss_kb());
+
+    {
+        const whisper_memory_usage mem = whisper_get_memory_usage(ctx, nullptr);
+
+        auto print_entry = [&](const whisper_memory_entry & e, bool last) {
+            fprintf(fout, "    \"%s\": { \"cur\": %zu, \"peak\": %zu }%s\n", e.name, e.cur, e.peak, last ? "" : ",");
+        };
+
+        fprintf(fout, "  \"memory_bytes\": {\n");
+        fprintf(fout, "    \"weights\": {");
+        for (int i = 0; i < mem.n_weights; ++i) {
+            fprintf(fout, "%s \"%s\": %zu", i > 0 ? "," : "", bench::json_escape(mem.weights[i].name).c_str(), mem.weights[i].cur);
+        }
+        fprintf(fout, " },\n");
+        for (const auto * e : { &mem.kv_self, &mem.kv_cross, &mem.kv_pad,
+                                &mem.compute_conv, &mem.compute_encode, &mem.compute_cross, &mem.compute_decode,
+                                &mem.mel, &mem.logits, &mem.host, &mem.vad, &mem.dtw_masks, &mem.dtw_work }) {
+            print_entry(*e, false);
+        }
+        fprintf(fout, "    \"total\": { \"cur\": %zu, \"peak\": %zu }\n", mem.total, mem.total_peak);
+        fprintf(fout, "  }%s\n", params.profile ? "," : "");
+    }
+
+    if (params.profile) {
+        const whisper_profile * prof = whisper_get_profile(ctx);
+
+        auto print_entries = [&](const char * key, const whisper_profile_entry * entries, int n, bool last) {
+            fprintf(fout, "    \"%s\": [\n", key);
+            for (int i = 0; i < n; ++i) {
+                fprintf(fout, "      { \"name\": \"%s\", \"n\": %lld, \"ms\": %.3f }%s\n",
+                        bench::json_escape(entries[i].name).c_str(), (long long) entries[i].n, entries[i].t_us/1000.0, i + 1 < n ? "," : "");
+            }
+            fprintf(fout, "    ]%s\n", last ? "" : ",");
+        };
+
+        fprintf(fout, "  \"profile\": {\n");
+        fprintf(fout, "    \"total_ms\": %.3f,\n", prof ? prof->t_total_us/1000.0 : 0.0);
+        print_entries("graphs", prof ? prof->graphs : nullptr, prof ? prof->n_graphs : 0, false);
+        print_entries("ops",    prof ? prof->ops    : nullptr, prof ? prof->n_ops    : 0, false);
+        print_entries("scopes", prof ? prof->scopes : nullptr, prof ? prof->n_scopes : 0, true);
+        fprintf(fout, "  }\n");
+
+        whisper_print_profile(ctx);
+    }
+    fprintf(fout, "}\n");
+
+    if (fout != stdout) {
+        fclose(fout);
+    }
+
+    if (!params.trace.empty()) {
+        whisper_trace_dump(params.trace.c_str());
+    }
+
+    whisper_free(ctx);
+
+    return 0;
+}
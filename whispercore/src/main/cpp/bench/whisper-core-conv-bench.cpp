@@ -0,0 +1,417 @@
+// Parity check and benchmark of the encoder front-end convolutions.
+//
+// whisper_build_graph_conv() runs two k=3 convolutions over the mel
+// spectrogram, each followed by the bias and a GELU:
+//
+//   conv1  s=1, n_mels  -> n_state over 3000 frames
+//   conv2  s=2, n_state -> n_state, 3000 -> 1500 frames
+//
+// This tool builds that chain for every model size with each implementation:
+//
+//   im2col  ggml_conv_1d_ph: im2col to an F16 [K*IC x OL] buffer, then mul_mat
+//   direct  ggml_conv_1d_direct, fusion of the bias and GELU disabled
+//   fused   ggml_conv_1d_direct with the bias and GELU applied per output tile
+//
+// For the parity check, a few output channels of conv + bias are recomputed
+// in double precision from the same inputs. The direct kernel must match that
+// reference to F32 accuracy. The im2col path rounds the input to F16, so it
+// is only expected to be close. The GELU (an F16 table in the CPU backend) is
+// checked by requiring the fused output to be bitwise identical to the
+// unfused one, for every thread count. The tool exits with 1 if a case fails.
+//
+// usage: whisper-core-conv-bench [-m tiny,base] [-t 1,4]
+
+#include "ggml.h"
+#include "ggml-backend.h"
+#include "ggml-cpu.h"
+#include "bench-common.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+struct model_dims {
+    const char * name;
+    int n_state;
+    int n_mels;
+};
+
+const model_dims k_models[] = {
+    { "tiny",     384,  80 },
+    { "base",     512,  80 },
+    { "small",    768,  80 },
+    { "medium",  1024,  80 },
+    { "large-v3",1280, 128 },
+};
+
+const int k_n_frames = 3000;
+
+// output channels checked against the double precision reference
+const int k_n_check = 8;
+
+// max error vs the reference, relative to the largest reference value
+const double k_tol_direct = 1e-5;
+const double k_tol_im2col = 1e-2;
+
+struct conv_params {
+    std::vector<std::string> models = { "tiny", "base", "small", "medium", "large-v3" };
+    std::vector<int>         threads;
+
+    double min_time = 1.0; // seconds per measurement
+    int    n_max    = 50;  // max runs per measurement
+};
+
+enum conv_impl {
+    CONV_IMPL_IM2COL,
+    CONV_IMPL_DIRECT,
+    CONV_IMPL_FUSED,
+};
+
+const char * conv_impl_name(conv_impl impl) {
+    switch (impl) {
+        case CONV_IMPL_IM2COL: return "im2col";
+        case CONV_IMPL_DIRECT: return "direct";
+        case CONV_IMPL_FUSED:  return "fused";
+    }
+    return "?";
+}
+
+std::vector<std::string> split(const std::string & s, char sep) {
+    std::vector<std::string> out;
+    std::stringstream ss(s);
+    std::string item;
+    while (std::getline(ss, item, sep)) {
+        if (!item.empty()) {
+            out.push_back(item);
+        }
+    }
+    return out;
+}
+
+void print_usage(char ** argv, const conv_params & params) {
+    fprintf(stderr, "\n");
+    fprintf(stderr, "usage: %s [options]\n", argv[0]);
+    fprintf(stderr, "\n");
+    fprintf(stderr, "options:\n");
+    fprintf(stderr, "  -h,          --help            show this help message and exit\n");
+    fprintf(stderr, "  -m LIST,     --models LIST     model sizes (tiny,base,small,medium,large-v3)\n");
+    fprintf(stderr, "  -t LIST,     --threads LIST    thread counts (default 1,%d)\n", (int) std::thread::hardware_concurrency());
+    fprintf(stderr, "  -s SECONDS,  --min-time SEC    [%-4.1f] minimum measured time per case\n", params.min_time);
+    fprintf(stderr, "  -n N,        --max-runs N      [%-4d] maximum runs per case\n", params.n_max);
+    fprintf(stderr, "\n");
+}
+
+bool parse_params(int argc, char ** argv, conv_params & params) {
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+
+        auto next = [&]() -> std::string {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "error: missing value for argument: %s\n", arg.c_str());
+                exit(1);
+            }
+            return argv[++i];
+        };
+
+        if (arg == "-h" || arg == "--help") {
+            print_usage(argv, params);
+            exit(0);
+        } else if (arg == "-m" || arg == "--models") {
+            params.models = split(next(), ',');
+        } else if (arg == "-t" || arg == "--threads") {
+            params.threads.clear();
+            for (const auto & s : split(next(), ',')) {
+                params.threads.push_back(std::max(1, std::stoi(s)));
+            }
+        } else if (arg == "-s" || arg == "--min-time") {
+            params.min_time = std::stod(next());
+        } else if (arg == "-n" || arg == "--max-runs") {
+            params.n_max = std::max(1, std::stoi(next()));
+        } else {
+            fprintf(stderr, "error: unknown argument: %s\n", arg.c_str());
+            print_usage(argv, params);
+            return false;
+        }
+    }
+
+    if (params.threads.empty()) {
+        params.threads.push_back(1);
+        const int n_hw = (int) std::thread::hardware_concurrency();
+        if (n_hw > 1) {
+            params.threads.push_back(n_hw);
+        }
+    }
+
+    return true;
+}
+
+// one convolution of the front-end, with host copies of the inputs for the reference
+struct conv_case {
+    std::string name;
+    int c_in;
+    int c_out;
+    int stride;
+
+    std::vector<ggml_fp16_t> w; // [3, c_in, c_out]
+    std::vector<float>       x; // [k_n_frames, c_in]
+    std::vector<float>       b; // [c_out]
+
+    int n_out() const {
+        return k_n_frames/stride;
+    }
+
+    // conv(x) + b for output channel oc, padding 1
+    std::vector<double> reference(int oc) const {
+        std::vector<double> y(n_out());
+        for (int t = 0; t < n_out(); ++t) {
+            double sum = b[oc];
+            for (int ic = 0; ic < c_in; ++ic) {
+                for (int k = 0; k < 3; ++k) {
+                    const int i = t*stride + k - 1;
+                    if (i >= 0 && i < k_n_frames) {
+                        sum += (double) ggml_fp16_to_fp32(w[((size_t) oc*c_in + ic)*3 + k]) * x[(size_t) ic*k_n_frames + i];
+                    }
+                }
+            }
+            y[t] = sum;
+        }
+        return y;
+    }
+};
+
+conv_case make_case(const std::string & name, int c_in, int c_out, int stride, std::mt19937 & rng) {
+    conv_case cc;
+    cc.name   = name;
+    cc.c_in   = c_in;
+    cc.c_out  = c_out;
+    cc.stride = stride;
+
+    // roughly the scale of the trained weights, so that the GELU sees both signs
+    std::uniform_real_distribution<float> dist_w(-1.0f/sqrtf(3.0f*c_in), 1.0f/sqrtf(3.0f*c_in));
+    std::uniform_real_distribution<float> dist_x(-1.0f, 1.0f);
+
+    cc.w.resize((size_t) 3*c_in*c_out);
+    for (auto & v : cc.w) {
+        v = ggml_fp32_to_fp16(dist_w(rng));
+    }
+    cc.x.resize((size_t) k_n_frames*c_in);
+    for (auto & v : cc.x) {
+        v = dist_x(rng);
+    }
+    cc.b.resize(c_out);
+    for (auto & v : cc.b) {
+        v = 0.1f*dist_x(rng);
+    }
+
+    return cc;
+}
+
+struct conv_result {
+    double ms;
+    double err; // max error of conv + bias vs the reference, relative to max |reference|
+
+    std::vector<float> y; // output of the whole chain
+};
+
+bool run_impl(ggml_backend_t backend, const conv_case & cc, conv_impl impl, const std::vector<int> & threads, const conv_params & params, std::vector<conv_result> & res) {
+    ggml_init_params ip = {
+        /*.mem_size   =*/ 16*ggml_tensor_overhead() + 2*ggml_graph_overhead(),
+        /*.mem_buffer =*/ nullptr,
+        /*.no_alloc   =*/ true,
+    };
+
+    ggml_context * ctx = ggml_init(ip);
+
+    ggml_tensor * w = ggml_new_tensor_3d(ctx, GGML_TYPE_F16, 3, cc.c_in, cc.c_out);
+    ggml_tensor * x = ggml_new_tensor_2d(ctx, GGML_TYPE_F32, k_n_frames, cc.c_in);
+    ggml_tensor * b = ggml_new_tensor_2d(ctx, GGML_TYPE_F32, 1, cc.c_out);
+
+    auto conv = [&]() {
+        return impl == CONV_IMPL_IM2COL
+            ? ggml_conv_1d_ph    (ctx, w, x, cc.stride, 1)
+            : ggml_conv_1d_direct(ctx, w, x, cc.stride, 1, 1);
+    };
+
+    // conv + bias for the comparison with the reference
+    ggml_tensor * pre = ggml_add(ctx, conv(), b);
+
+    ggml_cgraph * gf_pre = ggml_new_graph(ctx);
+    ggml_build_forward_expand(gf_pre, pre);
+
+    // same chain as whisper_build_graph_conv()
+    ggml_tensor * cur = ggml_gelu(ctx, ggml_add(ctx, conv(), b));
+
+    ggml_cgraph * gf = ggml_new_graph(ctx);
+    ggml_build_forward_expand(gf, cur);
+
+    ggml_backend_buffer_t buf = ggml_backend_alloc_ctx_tensors(ctx, backend);
+    if (!buf) {
+        fprintf(stderr, "error: failed to allocate %s\n", cc.name.c_str());
+        ggml_free(ctx);
+        return false;
+    }
+
+    ggml_backend_tensor_set(w, cc.w.data(), 0, ggml_nbytes(w));
+    ggml_backend_tensor_set(x, cc.x.data(), 0, ggml_nbytes(x));
+    ggml_backend_tensor_set(b, cc.b.data(), 0, ggml_nbytes(b));
+
+    ggml_cpu_set_fusion(impl != CONV_IMPL_DIRECT);
+
+    bool ok = true;
+
+    for (int n_threads : threads) {
+        ggml_backend_cpu_set_n_threads(backend, n_threads);
+
+        if (ggml_backend_graph_compute(backend, gf_pre) != GGML_STATUS_SUCCESS ||
+            ggml_backend_graph_compute(backend, gf)     != GGML_STATUS_SUCCESS) {
+            fprintf(stderr, "error: graph compute failed for %s/%s\n", cc.name.c_str(), conv_impl_name(impl));
+            ok = false;
+            break;
+        }
+
+        // check the output of every thread count, the split of the work depends on it
+        std::vector<float> y(ggml_nelements(pre));
+        ggml_backend_tensor_get(pre, y.data(), 0, ggml_nbytes(pre));
+
+        double err = 0.0;
+        double amax = 0.0;
+        for (int i = 0; i < k_n_check; ++i) {
+            const int oc = (int) ((int64_t) i*(cc.c_out - 1)/(k_n_check - 1));
+            const std::vector<double> ref = cc.reference(oc);
+            for (int t = 0; t < cc.n_out(); ++t) {
+                err  = std::max(err,  std::fabs(ref[t] - y[(size_t) oc*cc.n_out() + t]));
+                amax = std::max(amax, std::fabs(ref[t]));
+            }
+        }
+
+        std::vector<double> t_ms;
+        double tsum = 0.0;
+        while ((int) t_ms.size() < params.n_max) {
+            const int64_t t0 = ggml_time_us();
+            ggml_backend_graph_compute(backend, gf);
+            const int64_t t1 = ggml_time_us();
+
+            t_ms.push_back((t1 - t0)/1000.0);
+            tsum += (t1 - t0)*1e-6;
+
+            if (tsum >= params.min_time && t_ms.size() >= 3) {
+                break;
+            }
+        }
+
+        ggml_backend_tensor_get(cur, y.data(), 0, ggml_nbytes(cur));
+
+        res.push_back({ bench::compute_stats(t_ms).p50, amax > 0.0 ? err/amax : err, y });
+    }
+
+    ggml_cpu_set_fusion(true);
+
+    ggml_backend_buffer_free(buf);
+    ggml_free(ctx);
+
+    return ok;
+}
+
+} // namespace
+
+int main(int argc, char ** argv) {
+    conv_params params;
+    if (!parse_params(argc, argv, params)) {
+        return 1;
+    }
+
+    ggml_time_init();
+
+    ggml_backend_t backend = ggml_backend_cpu_init();
+    if (!backend) {
+        fprintf(stderr, "error: failed to initialize the CPU backend\n");
+        return 1;
+    }
+
+    const conv_impl impls[] = { CONV_IMPL_IM2COL, CONV_IMPL_DIRECT, CONV_IMPL_FUSED };
+
+    printf("| %-8s | %-5s | %-38s | %-6s | %3s | %10s | %8s | %9s | %-4s |\n",
+            "model", "op", "shape", "impl", "thr", "ms (p50)", "GFLOPS", "rel err", "ok");
+    printf("|%s|%s|%s|%s|%s|%s|%s|%s|%s|\n",
+            std::string(10, '-').c_str(), std::string(7, '-').c_str(), std::string(40, '-').c_str(), std::string(8, '-').c_str(),
+            std::string(5, '-').c_str(), std::string(12, '-').c_str(), std::string(10, '-').c_str(), std::string(11, '-').c_str(),
+            std::string(6, '-').c_str());
+
+    std::mt19937 rng(42);
+
+    bool pass = true;
+
+    for (const auto & name : params.models) {
+        const model_dims * m = nullptr;
+        for (const auto & md : k_models) {
+            if (name == md.name) {
+                m = &md;
+            }
+        }
+        if (!m) {
+            fprintf(stderr, "error: unknown model size: %s\n", name.c_str());
+            continue;
+        }
+
+        const conv_case cases[] = {
+            make_case("conv1", m->n_mels,  m->n_state, 1, rng),
+            make_case("conv2", m->n_state, m->n_state, 2, rng),
+        };
+
+        for (const auto & cc : cases) {
+            char shape[64];
+            snprintf(shape, sizeof(shape), "k=3 s=%d [%d x %d] -> [%d x %d]", cc.stride, k_n_frames, cc.c_in, cc.n_out(), cc.c_out);
+
+            const double flops = 2.0*3*cc.c_in*cc.c_out*cc.n_out();
+
+            // output of the unfused direct kernel, that the fused one must reproduce
+            std::vector<float> y_direct;
+
+            for (conv_impl impl : impls) {
+                std::vector<conv_result> res;
+                if (!run_impl(backend, cc, impl, params.threads, params, res)) {
+                    pass = false;
+                    continue;
+                }
+
+                const double tol = impl == CONV_IMPL_IM2COL ? k_tol_im2col : k_tol_direct;
+
+                for (size_t i = 0; i < res.size(); ++i) {
+                    if (impl == CONV_IMPL_DIRECT && y_direct.empty()) {
+                        y_direct = res[i].y;
+                    }
+
+                    const bool same = impl == CONV_IMPL_IM2COL || (!y_direct.empty() &&
+                        memcmp(res[i].y.data(), y_direct.data(), y_direct.size()*sizeof(float)) == 0);
+
+                    const bool ok = res[i].err <= tol && same;
+                    pass = pass && ok;
+
+                    printf("| %-8s | %-5s | %-38s | %-6s | %3d | %10.3f | %8.1f | %9.2e | %-4s |\n",
+                            m->name, cc.name.c_str(), shape, conv_impl_name(impl), params.threads[i],
+                            res[i].ms, flops/(res[i].ms*1e-3)*1e-9, res[i].err, ok ? "yes" : "NO");
+                    fflush(stdout);
+                }
+            }
+        }
+    }
+
+    ggml_backend_free(backend);
+
+    if (!pass) {
+        fprintf(stderr, "error: parity check failed\n");
+        return 1;
+    }
+
+    return 0;
+}
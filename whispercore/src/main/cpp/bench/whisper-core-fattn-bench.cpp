@@ -0,0 +1,493 @@
+// Parity check and benchmark of the blocked flash_attn_ext CPU kernel.
+//
+// The CPU backend runs flash_attn_ext with 16 or more query rows as tiles of
+// queries against tiles of K/V, and fewer rows with the per-row kernel. This
+// tool runs the same attention both ways: once over all queries (tiled), and
+// once as a chain of 8-row views of Q and the mask (per row). The cases have
+// whisper's head size:
+//
+//   enc      encoder self-attention, 1500 queries and keys, no mask
+//   enc_pad  the same against 1600 K/V cells; keys 1500 and up are masked for
+//            every query, so the last K/V tile is masked entirely and the one
+//            before it in part
+//   prompt   a 40-token prompt after 100 tokens of KV cache, with the causal
+//            mask over a 448-cell cache
+//
+// The masked K/V cells hold NaN, as unused KV cache cells may. The output of
+// both kernels must be finite. A few query rows are recomputed in double
+// precision from the same (dequantized) K/V. The tiled kernel, which keeps
+// K/V in F32, must match that reference to F32 accuracy. The per-row kernel
+// converts Q to the K type and accumulates F16 V in F16, so it is only
+// expected to be close to the reference and to the tiled output. The tool
+// exits with 1 if a case fails.
+//
+// usage: whisper-core-fattn-bench [-k f16,q8_0] [-t 1,4]
+
+#include "ggml.h"
+#include "ggml-backend.h"
+#include "ggml-cpu.h"
+#include "bench-common.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+const int k_d_head = 64;
+const int k_n_head = 6;
+
+// query rows per view of the per-row run, below the tiled kernel's threshold
+const int k_rows = 8;
+
+// query rows checked against the double precision reference
+const int k_n_check = 16;
+
+// max error relative to the largest reference value; F16 accumulation over 1500 keys costs the
+// per-row kernel about 1e-2
+const double k_tol_tiled = 1e-5;
+const double k_tol_rows  = 5e-2;
+
+struct fattn_params {
+    std::vector<std::string> types = { "f32", "f16", "q8_0" };
+    std::vector<int>         threads;
+
+    double min_time = 1.0; // seconds per measurement
+    int    n_max    = 50;  // max runs per measurement
+};
+
+std::vector<std::string> split(const std::string & s, char sep) {
+    std::vector<std::string> out;
+    std::stringstream ss(s);
+    std::string item;
+    while (std::getline(ss, item, sep)) {
+        if (!item.empty()) {
+            out.push_back(item);
+        }
+    }
+    return out;
+}
+
+ggml_type parse_type(const std::string & s) {
+    if (s == "f32")  return GGML_TYPE_F32;
+    if (s == "f16")  return GGML_TYPE_F16;
+    if (s == "q8_0") return GGML_TYPE_Q8_0;
+    if (s == "q4_0") return GGML_TYPE_Q4_0;
+    return GGML_TYPE_COUNT;
+}
+
+void print_usage(char ** argv, const fattn_params & params) {
+    fprintf(stderr, "\n");
+    fprintf(stderr, "usage: %s [options]\n", argv[0]);
+    fprintf(stderr, "\n");
+    fprintf(stderr, "options:\n");
+    fprintf(stderr, "  -h,          --help            show this help message and exit\n");
+    fprintf(stderr, "  -k LIST,     --kv-types LIST   K/V types (f32,f16,q8_0,q4_0)\n");
+    fprintf(stderr, "  -t LIST,     --threads LIST    thread counts (default 1,%d)\n", (int) std::thread::hardware_concurrency());
+    fprintf(stderr, "  -s SECONDS,  --min-time SEC    [%-4.1f] minimum measured time per case\n", params.min_time);
+    fprintf(stderr, "  -n N,        --max-runs N      [%-4d] maximum runs per case\n", params.n_max);
+    fprintf(stderr, "\n");
+}
+
+bool parse_params(int argc, char ** argv, fattn_params & params) {
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+
+        auto next = [&]() -> std::string {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "error: missing value for argument: %s\n", arg.c_str());
+                exit(1);
+            }
+            return argv[++i];
+        };
+
+        if (arg == "-h" || arg == "--help") {
+            print_usage(argv, params);
+            exit(0);
+        } else if (arg == "-k" || arg == "--kv-types") {
+            params.types = split(next(), ',');
+        } else if (arg == "-t" || arg == "--threads") {
+            params.threads.clear();
+            for (const auto & s : split(next(), ',')) {
+                params.threads.push_back(std::max(1, std::stoi(s)));
+            }
+        } else if (arg == "-s" || arg == "--min-time") {
+            params.min_time = std::stod(next());
+        } else if (arg == "-n" || arg == "--max-runs") {
+            params.n_max = std::max(1, std::stoi(next()));
+        } else {
+            fprintf(stderr, "error: unknown argument: %s\n", arg.c_str());
+            print_usage(argv, params);
+            return false;
+        }
+    }
+
+    if (params.threads.empty()) {
+        params.threads.push_back(1);
+        const int n_hw = (int) std::thread::hardware_concurrency();
+        if (n_hw > 1) {
+            params.threads.push_back(n_hw);
+        }
+    }
+
+    return true;
+}
+
+// one attention problem, with host copies of the inputs for the reference
+struct fattn_case {
+    std::string name;
+    ggml_type   type;
+    int n_q;
+    int n_kv;
+    bool masked;
+
+    std::vector<float>   q;    // [d_head, n_q, n_head]
+    std::vector<uint8_t> k;    // [d_head, n_kv, n_head] of type
+    std::vector<uint8_t> v;
+    std::vector<float>   kf;   // k and v as F32, as the kernels see them
+    std::vector<float>   vf;
+    std::vector<float>   mask; // [n_kv, n_q], 0 or -INFINITY
+
+    float scale() const {
+        return 1.0f/sqrtf((float) k_d_head);
+    }
+
+    // rows of the mask tensor: padded for the flash_attn_ext check, plus one view of the per-row run
+    int n_mask_rows() const {
+        return GGML_PAD(n_q, GGML_KQ_MASK_PAD) + GGML_KQ_MASK_PAD;
+    }
+
+    // softmax(q k^T + mask) v for query iq of head h
+    std::vector<double> reference(int iq, int h) const {
+        std::vector<double> s(n_kv, -INFINITY);
+        double smax = -INFINITY;
+        for (int j = 0; j < n_kv; ++j) {
+            if (masked && mask[(size_t) iq*n_kv + j] == -INFINITY) {
+                continue;
+            }
+            double dot = 0.0;
+            for (int d = 0; d < k_d_head; ++d) {
+                dot += (double) q[((size_t) h*n_q + iq)*k_d_head + d] * kf[((size_t) h*n_kv + j)*k_d_head + d];
+            }
+            s[j] = dot*scale();
+            smax = std::max(smax, s[j]);
+        }
+
+        std::vector<double> y(k_d_head, 0.0);
+        double sum = 0.0;
+        for (int j = 0; j < n_kv; ++j) {
+            if (s[j] == -INFINITY) {
+                continue;
+            }
+            const double p = exp(s[j] - smax);
+            sum += p;
+            for (int d = 0; d < k_d_head; ++d) {
+                y[d] += p*vf[((size_t) h*n_kv + j)*k_d_head + d];
+            }
+        }
+        for (auto & x : y) {
+            x /= sum;
+        }
+        return y;
+    }
+};
+
+// K/V of type, with the cells in [n_valid, n_kv) of every head filled with NaN
+void make_kv(ggml_type type, int n_kv, int n_valid, std::mt19937 & rng, std::vector<uint8_t> & data, std::vector<float> & f) {
+    std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+
+    std::vector<float> x((size_t) k_d_head*n_kv*k_n_head);
+    for (auto & val : x) {
+        val = dist(rng);
+    }
+
+    const size_t row_size = ggml_row_size(type, k_d_head);
+
+    data.resize(row_size*n_kv*k_n_head);
+    ggml_quantize_chunk(type, x.data(), data.data(), 0, (int64_t) n_kv*k_n_head, k_d_head, nullptr);
+
+    // all-ones bytes are NaN in F32 and F16, and a NaN scale in the quantized blocks
+    for (int h = 0; h < k_n_head; ++h) {
+        memset(data.data() + ((size_t) h*n_kv + n_valid)*row_size, 0xff, (size_t) (n_kv - n_valid)*row_size);
+    }
+
+    f.resize(x.size());
+    for (size_t r = 0; r < (size_t) n_kv*k_n_head; ++r) {
+        const uint8_t * src = data.data() + r*row_size;
+        float * dst = f.data() + r*k_d_head;
+        if (type == GGML_TYPE_F32) {
+            memcpy(dst, src, row_size);
+        } else {
+            ggml_get_type_traits(type)->to_float(src, dst, k_d_head);
+        }
+    }
+}
+
+// K/V cells from n_valid on are unused and masked; with causal, query i of the last n_q cells sees them up to itself
+fattn_case make_case(const std::string & name, ggml_type type, int n_q, int n_kv, int n_valid, bool causal, std::mt19937 & rng) {
+    fattn_case fc;
+    fc.name   = name;
+    fc.type   = type;
+    fc.n_q    = n_q;
+    fc.n_kv   = n_kv;
+    fc.masked = causal || n_valid < n_kv;
+
+    // twice the unit scale, so that the softmax is not flat
+    std::uniform_real_distribution<float> dist(-2.0f, 2.0f);
+
+    fc.q.resize((size_t) k_d_head*n_q*k_n_head);
+    for (auto & val : fc.q) {
+        val = dist(rng);
+    }
+
+    make_kv(type, n_kv, n_valid, rng, fc.k, fc.kf);
+    make_kv(type, n_kv, n_valid, rng, fc.v, fc.vf);
+
+    if (fc.masked) {
+        fc.mask.assign((size_t) fc.n_mask_rows()*n_kv, -INFINITY);
+        for (int i = 0; i < n_q; ++i) {
+            const int n_seen = causal ? n_valid - n_q + i + 1 : n_valid;
+            for (int j = 0; j < n_seen; ++j) {
+                fc.mask[(size_t) i*n_kv + j] = 0.0f;
+            }
+        }
+    }
+
+    return fc;
+}
+
+struct fattn_result {
+    double ms;
+    std::vector<float> y; // [d_head, n_head, n_q]
+};
+
+bool run_case(ggml_backend_t backend, const fattn_case & fc, bool tiled, const std::vector<int> & threads, const fattn_params & params, std::vector<fattn_result> & res) {
+    const int n_views = (fc.n_q + k_rows - 1)/k_rows;
+
+    ggml_init_params ip = {
+        /*.mem_size   =*/ (8 + 4*n_views)*ggml_tensor_overhead() + ggml_graph_overhead(),
+        /*.mem_buffer =*/ nullptr,
+        /*.no_alloc   =*/ true,
+    };
+
+    ggml_context * ctx = ggml_init(ip);
+
+    ggml_tensor * q = ggml_new_tensor_3d(ctx, GGML_TYPE_F32, k_d_head, fc.n_q,  k_n_head);
+    ggml_tensor * k = ggml_new_tensor_3d(ctx, fc.type,       k_d_head, fc.n_kv, k_n_head);
+    ggml_tensor * v = ggml_new_tensor_3d(ctx, fc.type,       k_d_head, fc.n_kv, k_n_head);
+
+    ggml_tensor * m = nullptr;
+    if (fc.masked) {
+        m = ggml_new_tensor_2d(ctx, GGML_TYPE_F16, fc.n_kv, fc.n_mask_rows());
+    }
+
+    ggml_cgraph * gf = ggml_new_graph(ctx);
+
+    // the outputs, in the order of the query rows
+    std::vector<ggml_tensor *> outs;
+
+    if (tiled) {
+        outs.push_back(ggml_flash_attn_ext(ctx, q, k, v, m, fc.scale(), 0.0f, 0.0f));
+    } else {
+        for (int i0 = 0; i0 < fc.n_q; i0 += k_rows) {
+            const int n = std::min(k_rows, fc.n_q - i0);
+
+            ggml_tensor * qv = ggml_view_3d(ctx, q, k_d_head, n, k_n_head, q->nb[1], q->nb[2], i0*q->nb[1]);
+            ggml_tensor * mv = m ? ggml_view_2d(ctx, m, fc.n_kv, GGML_KQ_MASK_PAD, m->nb[1], i0*m->nb[1]) : nullptr;
+
+            outs.push_back(ggml_flash_attn_ext(ctx, qv, k, v, mv, fc.scale(), 0.0f, 0.0f));
+        }
+    }
+    for (ggml_tensor * out : outs) {
+        ggml_build_forward_expand(gf, out);
+    }
+
+    ggml_backend_buffer_t buf = ggml_backend_alloc_ctx_tensors(ctx, backend);
+    if (!buf) {
+        fprintf(stderr, "error: failed to allocate %s\n", fc.name.c_str());
+        ggml_free(ctx);
+        return false;
+    }
+
+    ggml_backend_tensor_set(q, fc.q.data(), 0, ggml_nbytes(q));
+    ggml_backend_tensor_set(k, fc.k.data(), 0, ggml_nbytes(k));
+    ggml_backend_tensor_set(v, fc.v.data(), 0, ggml_nbytes(v));
+    if (m) {
+        std::vector<ggml_fp16_t> m16(fc.mask.size());
+        ggml_fp32_to_fp16_row(fc.mask.data(), m16.data(), (int64_t) m16.size());
+        ggml_backend_tensor_set(m, m16.data(), 0, ggml_nbytes(m));
+    }
+
+    bool ok = true;
+
+    for (int n_threads : threads) {
+        ggml_backend_cpu_set_n_threads(backend, n_threads);
+
+        std::vector<double> t_ms;
+        double tsum = 0.0;
+        while ((int) t_ms.size() < params.n_max) {
+            const int64_t t0 = ggml_time_us();
+            if (ggml_backend_graph_compute(backend, gf) != GGML_STATUS_SUCCESS) {
+                fprintf(stderr, "error: graph compute failed for %s\n", fc.name.c_str());
+                ok = false;
+                break;
+            }
+            const int64_t t1 = ggml_time_us();
+
+            t_ms.push_back((t1 - t0)/1000.0);
+            tsum += (t1 - t0)*1e-6;
+
+            if (tsum >= params.min_time && t_ms.size() >= 3) {
+                break;
+            }
+        }
+        if (!ok) {
+            break;
+        }
+
+        // check the output of every thread count, the split of the work depends on it
+        std::vector<float> y;
+        for (ggml_tensor * out : outs) {
+            const size_t n0 = y.size();
+            y.resize(n0 + ggml_nelements(out));
+            ggml_backend_tensor_get(out, y.data() + n0, 0, ggml_nbytes(out));
+        }
+
+        res.push_back({ bench::compute_stats(t_ms).p50, y });
+    }
+
+    ggml_backend_buffer_free(buf);
+    ggml_free(ctx);
+
+    return ok;
+}
+
+// max error of y vs the reference rows, relative to max |reference|, infinite if y is not finite
+double check_ref(const fattn_case & fc, const std::vector<float> & y) {
+    for (float x : y) {
+        if (!std::isfinite(x)) {
+            return std::numeric_limits<double>::infinity();
+        }
+    }
+
+    double err  = 0.0;
+    double amax = 0.0;
+    for (int c = 0; c < k_n_check; ++c) {
+        const int iq = (int) ((int64_t) c*(fc.n_q - 1)/(k_n_check - 1));
+        for (int h = 0; h < k_n_head; ++h) {
+            const std::vector<double> ref = fc.reference(iq, h);
+            for (int d = 0; d < k_d_head; ++d) {
+                err  = std::max(err,  std::fabs(ref[d] - y[((size_t) iq*k_n_head + h)*k_d_head + d]));
+                amax = std::max(amax, std::fabs(ref[d]));
+            }
+        }
+    }
+
+    return amax > 0.0 ? err/amax : err;
+}
+
+// max difference of a vs b, relative to max |b|
+double check_diff(const std::vector<float> & a, const std::vector<float> & b) {
+    double err  = 0.0;
+    double amax = 0.0;
+    for (size_t i = 0; i < a.size(); ++i) {
+        const double d = std::fabs((double) a[i] - b[i]);
+        err  = std::isfinite(d) ? std::max(err, d) : std::numeric_limits<double>::infinity();
+        amax = std::max(amax, std::fabs((double) b[i]));
+    }
+    return amax > 0.0 ? err/amax : err;
+}
+
+} // namespace
+
+int main(int argc, char ** argv) {
+    fattn_params params;
+    if (!parse_params(argc, argv, params)) {
+        return 1;
+    }
+
+    ggml_time_init();
+
+    ggml_backend_t backend = ggml_backend_cpu_init();
+    if (!backend) {
+        fprintf(stderr, "error: failed to initialize the CPU backend\n");
+        return 1;
+    }
+
+    printf("| %-8s | %-4s | %-28s | %-5s | %3s | %10s | %9s | %9s | %-4s |\n",
+            "case", "kv", "shape", "impl", "thr", "ms (p50)", "ref err", "vs rows", "ok");
+    printf("|%s|%s|%s|%s|%s|%s|%s|%s|%s|\n",
+            std::string(10, '-').c_str(), std::string(6, '-').c_str(), std::string(30, '-').c_str(), std::string(7, '-').c_str(),
+            std::string(5, '-').c_str(), std::string(12, '-').c_str(), std::string(11, '-').c_str(), std::string(11, '-').c_str(),
+            std::string(6, '-').c_str());
+
+    std::mt19937 rng(42);
+
+    bool pass = true;
+
+    for (const auto & name : params.types) {
+        const ggml_type type = parse_type(name);
+        if (type == GGML_TYPE_COUNT) {
+            fprintf(stderr, "error: unknown K/V type: %s\n", name.c_str());
+            continue;
+        }
+
+        const fattn_case cases[] = {
+            make_case("enc",     type, 1500, 1500, 1500, false, rng),
+            make_case("enc_pad", type, 1500, 1600, 1500, false, rng),
+            make_case("prompt",  type,   40,  448,  140, true,  rng),
+        };
+
+        for (const auto & fc : cases) {
+            char shape[64];
+            snprintf(shape, sizeof(shape), "q [%d x %d x %d], kv %d", k_d_head, fc.n_q, k_n_head, fc.n_kv);
+
+            std::vector<fattn_result> res_rows;
+            std::vector<fattn_result> res_tiled;
+            if (!run_case(backend, fc, false, params.threads, params, res_rows) ||
+                !run_case(backend, fc, true,  params.threads, params, res_tiled)) {
+                pass = false;
+                continue;
+            }
+
+            for (size_t i = 0; i < res_rows.size(); ++i) {
+                const double err = check_ref(fc, res_rows[i].y);
+                const bool   ok  = err <= k_tol_rows;
+                pass = pass && ok;
+
+                printf("| %-8s | %-4s | %-28s | %-5s | %3d | %10.3f | %9.2e | %9s | %-4s |\n",
+                        fc.name.c_str(), name.c_str(), shape, "rows", params.threads[i], res_rows[i].ms, err, "", ok ? "yes" : "NO");
+                fflush(stdout);
+            }
+
+            for (size_t i = 0; i < res_tiled.size(); ++i) {
+                const double err  = check_ref(fc, res_tiled[i].y);
+                const double diff = check_diff(res_tiled[i].y, res_rows[i].y);
+                const bool   ok   = err <= k_tol_tiled && diff <= k_tol_rows;
+                pass = pass && ok;
+
+                printf("| %-8s | %-4s | %-28s | %-5s | %3d | %10.3f | %9.2e | %9.2e | %-4s |\n",
+                        fc.name.c_str(), name.c_str(), shape, "tiled", params.threads[i], res_tiled[i].ms, err, diff, ok ? "yes" : "NO");
+                fflush(stdout);
+            }
+        }
+    }
+
+    ggml_backend_free(backend);
+
+    if (!pass) {
+        fprintf(stderr, "error: parity check failed\n");
+        return 1;
+    }
+
+    return 0;
+}
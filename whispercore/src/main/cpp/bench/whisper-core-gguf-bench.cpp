@@ -0,0 +1,320 @@
+// GGUF loading: reading the tensor data versus mapping the file.
+//
+// gguf_init_from_file() normally reads the whole tensor data section into a
+// freshly allocated ggml context. With use_mmap the tensors point into a
+// private mapping of the file instead, which shares its pages with the page
+// cache (and with every other process that maps the same file). This tool
+// loads a GGUF file both ways and reports, for each case:
+//
+//   init ms    time spent in gguf_init_from_file
+//   touch ms   time to read every byte of the tensor data once afterwards
+//   anon MiB   growth of the anonymous resident memory (RssAnon) of the process
+//
+// Afterwards it loads the file both ways at once and checks that the mapped
+// tensor data is byte for byte the data that was read.
+//
+// Without -m it writes a synthetic file of -s MiB first and removes it again.
+// The file is in the page cache for every case after the first, so the times
+// are those of a warm load.
+//
+// usage: whisper-core-gguf-bench [-m model.gguf] [-s 512] [-n 3]
+
+#include "ggml.h"
+#include "gguf.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace {
+
+volatile uint64_t g_sink;
+
+struct gguf_bench_params {
+    std::string fname;
+    std::string fname_tmp = "whisper-core-gguf-bench.gguf";
+    int size_mib = 512;
+    int n_iter   = 3;
+};
+
+void print_usage(char ** argv, const gguf_bench_params & params) {
+    fprintf(stderr, "\n");
+    fprintf(stderr, "usage: %s [options]\n", argv[0]);
+    fprintf(stderr, "\n");
+    fprintf(stderr, "options:\n");
+    fprintf(stderr, "  -h,      --help          show this help message and exit\n");
+    fprintf(stderr, "  -m FILE, --model FILE    [%-6s] GGUF file to load\n", params.fname.empty() ? "none" : params.fname.c_str());
+    fprintf(stderr, "  -s N,    --size N        [%-6d] MiB of tensor data in the synthetic file written without -m\n", params.size_mib);
+    fprintf(stderr, "  -n N,    --iter N        [%-6d] loads per case\n", params.n_iter);
+    fprintf(stderr, "\n");
+}
+
+bool parse_params(int argc, char ** argv, gguf_bench_params & params) {
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+
+        auto next = [&]() -> std::string {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "error: missing value for argument: %s\n", arg.c_str());
+                exit(1);
+            }
+            return argv[++i];
+        };
+
+        if (arg == "-h" || arg == "--help") {
+            print_usage(argv, params);
+            exit(0);
+        } else if (arg == "-m" || arg == "--model") {
+            params.fname = next();
+        } else if (arg == "-s" || arg == "--size") {
+            params.size_mib = std::max(1, std::stoi(next()));
+        } else if (arg == "-n" || arg == "--iter") {
+            params.n_iter = std::max(1, std::stoi(next()));
+        } else {
+            fprintf(stderr, "error: unknown argument: %s\n", arg.c_str());
+            print_usage(argv, params);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// anonymous resident memory of this process in KiB, or 0 if unknown
+int64_t rss_anon_kb() {
+    int64_t kb = 0;
+#if defined(__linux__)
+    FILE * f = fopen("/proc/self/status", "r");
+    if (f) {
+        char line[256];
+        while (fgets(line, sizeof(line), f)) {
+            if (strncmp(line, "RssAnon:", 8) == 0) {
+                kb = strtoll(line + 8, nullptr, 10);
+                break;
+            }
+        }
+        fclose(f);
+    }
+#endif
+    return kb;
+}
+
+// a file shaped like a whisper model: a few large F16 matrices and their biases
+bool write_synthetic(const std::string & fname, int size_mib) {
+    const int64_t n_state = 1024;
+    const int64_t n_rows  = 4*n_state;
+    const size_t  nbytes  = n_state*n_rows*sizeof(ggml_fp16_t);
+    const int     n_mat   = std::max<int>(1, (int) (((size_t) size_mib << 20)/nbytes));
+
+    ggml_init_params ip = {
+        /*.mem_size   =*/ 2*n_mat*ggml_tensor_overhead(),
+        /*.mem_buffer =*/ nullptr,
+        /*.no_alloc   =*/ true,
+    };
+    ggml_context * ctx = ggml_init(ip);
+
+    std::vector<ggml_fp16_t> w(n_state*n_rows);
+    for (size_t i = 0; i < w.size(); ++i) {
+        w[i] = ggml_fp32_to_fp16((float) (i % 251)/251.0f - 0.5f);
+    }
+    std::vector<float> b(n_rows, 0.25f);
+
+    gguf_context * gctx = gguf_init_empty();
+    gguf_set_val_str(gctx, "general.architecture", "whisper");
+    for (int i = 0; i < n_mat; ++i) {
+        ggml_tensor * tw = ggml_new_tensor_2d(ctx, GGML_TYPE_F16, n_state, n_rows);
+        ggml_tensor * tb = ggml_new_tensor_1d(ctx, GGML_TYPE_F32, n_rows);
+        ggml_format_name(tw, "blk.%d.weight", i);
+        ggml_format_name(tb, "blk.%d.bias", i);
+        tw->data = w.data();
+        tb->data = b.data();
+        gguf_add_tensor(gctx, tw);
+        gguf_add_tensor(gctx, tb);
+    }
+
+    const bool ok = gguf_write_to_file(gctx, fname.c_str(), /*only_meta =*/ false);
+
+    gguf_free(gctx);
+    ggml_free(ctx);
+
+    return ok;
+}
+
+struct load_timing {
+    double init_ms  = 0.0;
+    double touch_ms = 0.0;
+    double anon_mib = 0.0;
+    size_t nbytes   = 0;
+    bool   mmap     = false;
+};
+
+bool load(const std::string & fname, bool use_mmap, gguf_mmap_advice advice, load_timing & t) {
+    const int64_t anon0 = rss_anon_kb();
+
+    ggml_context * ctx = nullptr;
+
+    gguf_init_params params = {
+        /*.no_alloc    =*/ false,
+        /*.ctx         =*/ &ctx,
+        /*.use_mmap    =*/ use_mmap,
+        /*.mmap_advice =*/ advice,
+    };
+
+    const int64_t t0 = ggml_time_us();
+    gguf_context * gctx = gguf_init_from_file(fname.c_str(), params);
+    const int64_t t1 = ggml_time_us();
+
+    if (!gctx) {
+        return false;
+    }
+
+    // read one byte per cache line so that every page is faulted in
+    uint64_t sum = 0;
+    size_t nbytes = 0;
+    for (int64_t id = 0; id < gguf_get_n_tensors(gctx); ++id) {
+        const uint8_t * p = (const uint8_t *) gguf_get_tensor_data(gctx, id);
+        const size_t n = gguf_get_tensor_size(gctx, id);
+        for (size_t i = 0; i < n; i += 64) {
+            sum += p[i];
+        }
+        nbytes += n;
+    }
+    const int64_t t2 = ggml_time_us();
+
+    g_sink = sum;
+
+    t.init_ms  += (t1 - t0)/1000.0;
+    t.touch_ms += (t2 - t1)/1000.0;
+    t.anon_mib += (rss_anon_kb() - anon0)/1024.0;
+    t.nbytes    = nbytes;
+    t.mmap      = gguf_is_mmap(gctx);
+
+    ggml_free(ctx);
+    gguf_free(gctx);
+
+    return true;
+}
+
+// load the file both ways at once and compare the tensor data byte for byte
+bool verify(const std::string & fname, size_t & nbytes) {
+    ggml_context * ctx_read = nullptr;
+    ggml_context * ctx_mmap = nullptr;
+
+    gguf_init_params params_read = {
+        /*.no_alloc    =*/ false,
+        /*.ctx         =*/ &ctx_read,
+        /*.use_mmap    =*/ false,
+        /*.mmap_advice =*/ GGUF_MMAP_ADVICE_NORMAL,
+    };
+    gguf_init_params params_mmap = params_read;
+    params_mmap.ctx      = &ctx_mmap;
+    params_mmap.use_mmap = true;
+
+    gguf_context * gctx_read = gguf_init_from_file(fname.c_str(), params_read);
+    gguf_context * gctx_mmap = gguf_init_from_file(fname.c_str(), params_mmap);
+
+    bool ok = gctx_read && gctx_mmap && gguf_get_n_tensors(gctx_read) == gguf_get_n_tensors(gctx_mmap);
+
+    nbytes = 0;
+    for (int64_t id = 0; ok && id < gguf_get_n_tensors(gctx_read); ++id) {
+        const size_t n = gguf_get_tensor_size(gctx_read, id);
+        ok = n == gguf_get_tensor_size(gctx_mmap, id) &&
+            memcmp(gguf_get_tensor_data(gctx_read, id), gguf_get_tensor_data(gctx_mmap, id), n) == 0;
+        if (!ok) {
+            fprintf(stderr, "error: tensor '%s' differs between the read and the mapped file\n", gguf_get_tensor_name(gctx_read, id));
+        }
+        nbytes += n;
+    }
+
+    if (gctx_mmap) {
+        ggml_free(ctx_mmap);
+        gguf_free(gctx_mmap);
+    }
+    if (gctx_read) {
+        ggml_free(ctx_read);
+        gguf_free(gctx_read);
+    }
+
+    return ok;
+}
+
+} // namespace
+
+int main(int argc, char ** argv) {
+    gguf_bench_params params;
+    if (!parse_params(argc, argv, params)) {
+        return 1;
+    }
+
+    ggml_time_init();
+
+    const bool synthetic = params.fname.empty();
+    if (synthetic) {
+        params.fname = params.fname_tmp;
+        if (!write_synthetic(params.fname, params.size_mib)) {
+            fprintf(stderr, "error: failed to write %s\n", params.fname.c_str());
+            return 1;
+        }
+    }
+
+    struct load_case {
+        const char * name;
+        bool use_mmap;
+        gguf_mmap_advice advice;
+    };
+
+    const load_case cases[] = {
+        { "read",       false, GGUF_MMAP_ADVICE_NORMAL     },
+        { "mmap",       true,  GGUF_MMAP_ADVICE_NORMAL     },
+        { "mmap seq",   true,  GGUF_MMAP_ADVICE_SEQUENTIAL },
+        { "mmap rand",  true,  GGUF_MMAP_ADVICE_RANDOM     },
+        { "mmap will",  true,  GGUF_MMAP_ADVICE_WILLNEED   },
+    };
+
+    printf("| %-10s | %9s | %9s | %9s | %9s |\n", "load", "data MiB", "init ms", "touch ms", "anon MiB");
+    printf("|%s|%s|%s|%s|%s|\n",
+            std::string(12, '-').c_str(), std::string(11, '-').c_str(), std::string(11, '-').c_str(),
+            std::string(11, '-').c_str(), std::string(11, '-').c_str());
+
+    int ret = 0;
+
+    for (const auto & lc : cases) {
+        load_timing t;
+        bool ok = true;
+        for (int it = 0; it < params.n_iter && ok; ++it) {
+            ok = load(params.fname, lc.use_mmap, lc.advice, t);
+        }
+        if (!ok) {
+            fprintf(stderr, "error: failed to load %s\n", params.fname.c_str());
+            ret = 1;
+            break;
+        }
+        if (lc.use_mmap && !t.mmap) {
+            fprintf(stderr, "warning: %s fell back to reading the file\n", lc.name);
+        }
+
+        printf("| %-10s | %9.1f | %9.2f | %9.2f | %9.1f |\n",
+                lc.name, t.nbytes/1048576.0, t.init_ms/params.n_iter, t.touch_ms/params.n_iter, t.anon_mib/params.n_iter);
+        fflush(stdout);
+    }
+
+    if (ret == 0) {
+        size_t nbytes = 0;
+        if (verify(params.fname, nbytes)) {
+            printf("\nverify: the mapped tensor data equals the read data (%.1f MiB)\n", nbytes/1048576.0);
+        } else {
+            fprintf(stderr, "error: the mapped tensor data differs from the read data\n");
+            ret = 1;
+        }
+    }
+
+    if (synthetic) {
+        remove(params.fname.c_str());
+    }
+
+    return ret;
+}
@@ -0,0 +1,574 @@
+// Whisper-shaped ggml kernel microbenchmarks.
+//
+// whisper_bench_ggml_mul_mat_str() times square N x N matrix multiplications,
+// which look nothing like the workloads whisper actually runs. This tool
+// builds the individual ops with the shapes used by the whisper graphs, for
+// each model size and weight type, and reports GFLOPS and GB/s per op and
+// thread count:
+//
+//   enc_attn_proj  [n_state x n_state]   x [n_state x 1500]   (q/k/v/out projections)
+//   enc_mlp_up     [n_state x 4*n_state] x [n_state x 1500]
+//   enc_mlp_down   [4*n_state x n_state] x [4*n_state x 1500]
+//   dec_mlp_up     [n_state x 4*n_state] x [n_state x n_tok]
+//   dec_head       [n_state x n_vocab]   x [n_state x n_tok]   (logits)
+//   conv1          k=3, s=1, n_mels  -> n_state over 3000 frames
+//   conv2          k=3, s=2, n_state -> n_state over 3000 frames
+//   flash_attn     encoder self-attention, 1500 x 1500 (K/V padded to 1536)
+//   soft_max       encoder KQ soft_max, 1500 x 1500 x n_head
+//   norm, gelu     1500 x n_state (resp. 1500 x 4*n_state)
+//
+// The weight type only applies to the mul_mat ops. The convolution kernels
+// are always F16 (as in the model loader), and attention K/V are F16.
+// Quantized weights are placed in the CPU "extra" buffer types when the op
+// supports it (runtime repacking), the same way the model loader does.
+//
+// GB/s counts each source and the destination once, i.e. the minimum
+// traffic. For the element-wise ops the FLOP counts are nominal.
+//
+// usage: whisper-core-kernel-bench [-m tiny,base] [-w f16,q4_0] [-t 1,4] [-o enc_mlp_up,dec_head]
+
+#include "ggml.h"
+#include "ggml-backend.h"
+#include "ggml-cpu.h"
+#include "bench-common.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+struct model_dims {
+    const char * name;
+    int n_state;
+    int n_head;
+    int n_mels;
+    int n_vocab;
+};
+
+const model_dims k_models[] = {
+    { "tiny",     384,  6,  80, 51865 },
+    { "base",     512,  8,  80, 51865 },
+    { "small",    768, 12,  80, 51865 },
+    { "medium",  1024, 16,  80, 51865 },
+    { "large-v3",1280, 20, 128, 51866 },
+};
+
+const int k_n_audio_ctx = 1500;
+const int k_n_frames    = 2*k_n_audio_ctx;
+
+struct kernel_params {
+    std::vector<std::string> models = { "tiny", "base", "small", "medium", "large-v3" };
+    std::vector<ggml_type>   wtypes = { GGML_TYPE_F16, GGML_TYPE_Q8_0, GGML_TYPE_Q5_K, GGML_TYPE_Q4_0 };
+    std::vector<int>         threads;
+    std::vector<int>         n_tok  = { 1, 5 };
+    std::vector<std::string> ops;
+
+    double min_time   = 1.0;  // seconds per measurement
+    int    n_max      = 100;  // max runs per measurement
+    bool   use_extra  = true; // allow the CPU extra buffer types for weights
+    std::string json  = "";
+};
+
+// a single whisper-shaped op
+struct kernel_case {
+    std::string op;
+    std::string shape;
+    ggml_type   wtype; // GGML_TYPE_COUNT if the op has no weight operand
+    int64_t     wrow;  // row size of the weight operand
+    double      flops;
+
+    // build the op: weights go to ctx_w, everything else to ctx
+    std::function<ggml_tensor * (ggml_context * ctx_w, ggml_context * ctx)> build;
+};
+
+struct kernel_result {
+    std::string model;
+    std::string op;
+    std::string shape;
+    std::string wtype;
+    std::string buft;
+    int         n_threads;
+    int         n_runs;
+    double      ms;
+    double      gflops;
+    double      gbps;
+};
+
+std::vector<std::string> split(const std::string & s, char sep) {
+    std::vector<std::string> out;
+    std::stringstream ss(s);
+    std::string item;
+    while (std::getline(ss, item, sep)) {
+        if (!item.empty()) {
+            out.push_back(item);
+        }
+    }
+    return out;
+}
+
+std::string to_lower(std::string s) {
+    std::transform(s.begin(), s.end(), s.begin(), [](unsigned char c) { return (char) tolower(c); });
+    return s;
+}
+
+bool parse_type(const std::string & s, ggml_type & type) {
+    for (int t = 0; t < GGML_TYPE_COUNT; ++t) {
+        const char * name = ggml_type_name((ggml_type) t);
+        if (name && to_lower(name) == to_lower(s)) {
+            type = (ggml_type) t;
+            return true;
+        }
+    }
+    return false;
+}
+
+void print_usage(char ** argv, const kernel_params & params) {
+    fprintf(stderr, "\n");
+    fprintf(stderr, "usage: %s [options]\n", argv[0]);
+    fprintf(stderr, "\n");
+    fprintf(stderr, "options:\n");
+    fprintf(stderr, "  -h,          --help            show this help message and exit\n");
+    fprintf(stderr, "  -m LIST,     --models LIST     model sizes (tiny,base,small,medium,large-v3)\n");
+    fprintf(stderr, "  -w LIST,     --wtypes LIST     weight types for the mul_mat ops (default f16,q8_0,q5_K,q4_0)\n");
+    fprintf(stderr, "  -t LIST,     --threads LIST    thread counts (default 1,%d)\n", (int) std::thread::hardware_concurrency());
+    fprintf(stderr, "  -p LIST,     --tokens LIST     decoder tokens per step (default 1,5)\n");
+    fprintf(stderr, "  -o LIST,     --ops LIST        only run these ops (default all)\n");
+    fprintf(stderr, "  -s SECONDS,  --min-time SEC    [%-4.1f] minimum measured time per case\n", params.min_time);
+    fprintf(stderr, "  -n N,        --max-runs N      [%-4d] maximum runs per case\n", params.n_max);
+    fprintf(stderr, "  -ne,         --no-extra        keep weights in the plain CPU buffer (no repacking)\n");
+    fprintf(stderr, "  -j FNAME,    --json FNAME      also write the results as JSON\n");
+    fprintf(stderr, "\n");
+}
+
+bool parse_params(int argc, char ** argv, kernel_params & params) {
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+
+        auto next = [&]() -> std::string {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "error: missing value for argument: %s\n", arg.c_str());
+                exit(1);
+            }
+            return argv[++i];
+        };
+
+        if (arg == "-h" || arg == "--help") {
+            print_usage(argv, params);
+            exit(0);
+        } else if (arg == "-m" || arg == "--models") {
+            params.models = split(next(), ',');
+        } else if (arg == "-w" || arg == "--wtypes") {
+            params.wtypes.clear();
+            for (const auto & s : split(next(), ',')) {
+                ggml_type type;
+                if (!parse_type(s, type)) {
+                    fprintf(stderr, "error: unknown type: %s\n", s.c_str());
+                    return false;
+                }
+                params.wtypes.push_back(type);
+            }
+        } else if (arg == "-t" || arg == "--threads") {
+            params.threads.clear();
+            for (const auto & s : split(next(), ',')) {
+                params.threads.push_back(std::max(1, std::stoi(s)));
+            }
+        } else if (arg == "-p" || arg == "--tokens") {
+            params.n_tok.clear();
+            for (const auto & s : split(next(), ',')) {
+                params.n_tok.push_back(std::max(1, std::stoi(s)));
+            }
+        } else if (arg == "-o" || arg == "--ops") {
+            params.ops = split(next(), ',');
+        } else if (arg == "-s" || arg == "--min-time") {
+            params.min_time = std::stod(next());
+        } else if (arg == "-n" || arg == "--max-runs") {
+            params.n_max = std::max(1, std::stoi(next()));
+        } else if (arg == "-ne" || arg == "--no-extra") {
+            params.use_extra = false;
+        } else if (arg == "-j" || arg == "--json") {
+            params.json = next();
+        } else {
+            fprintf(stderr, "error: unknown argument: %s\n", arg.c_str());
+            print_usage(argv, params);
+            return false;
+        }
+    }
+
+    if (params.threads.empty()) {
+        params.threads.push_back(1);
+        const int n_hw = (int) std::thread::hardware_concurrency();
+        if (n_hw > 1) {
+            params.threads.push_back(n_hw);
+        }
+    }
+
+    return true;
+}
+
+// fill a tensor with random values in [-scale, scale], converting/quantizing as needed
+void fill_random(ggml_tensor * t, std::mt19937 & rng, float scale) {
+    const int64_t n     = ggml_nelements(t);
+    const int64_t ne0   = t->ne[0];
+    const int64_t nrows = n/ne0;
+
+    std::uniform_real_distribution<float> dist(-scale, scale);
+
+    std::vector<float> f32(n);
+    for (auto & x : f32) {
+        x = dist(rng);
+    }
+
+    if (t->type == GGML_TYPE_F32) {
+        ggml_backend_tensor_set(t, f32.data(), 0, ggml_nbytes(t));
+    } else if (t->type == GGML_TYPE_F16) {
+        std::vector<ggml_fp16_t> f16(n);
+        ggml_fp32_to_fp16_row(f32.data(), f16.data(), n);
+        ggml_backend_tensor_set(t, f16.data(), 0, ggml_nbytes(t));
+    } else if (t->type == GGML_TYPE_I32) {
+        std::vector<int32_t> i32(n, 0);
+        ggml_backend_tensor_set(t, i32.data(), 0, ggml_nbytes(t));
+    } else {
+        std::vector<uint8_t> q(ggml_row_size(t->type, ne0)*nrows);
+        ggml_quantize_chunk(t->type, f32.data(), q.data(), 0, nrows, ne0, nullptr);
+        ggml_backend_tensor_set(t, q.data(), 0, q.size());
+    }
+}
+
+std::vector<kernel_case> make_cases(const model_dims & m, const kernel_params & params) {
+    std::vector<kernel_case> cases;
+
+    const int n_state = m.n_state;
+    const int n_head  = m.n_head;
+    const int d_head  = n_state/n_head;
+    const int n_ctx   = k_n_audio_ctx;
+
+    char shape[128];
+
+    auto add_mul_mat = [&](const char * op, int k, int n, int n_rhs, ggml_type wtype) {
+        snprintf(shape, sizeof(shape), "[%d x %d] x [%d x %d]", k, n, k, n_rhs);
+        cases.push_back({ op, shape, wtype, k, 2.0*k*n*n_rhs,
+            [=](ggml_context * ctx_w, ggml_context * ctx) {
+                ggml_tensor * w = ggml_new_tensor_2d(ctx_w, wtype,         k, n);
+                ggml_tensor * x = ggml_new_tensor_2d(ctx,   GGML_TYPE_F32, k, n_rhs);
+                return ggml_mul_mat(ctx, w, x);
+            } });
+    };
+
+    for (ggml_type wtype : params.wtypes) {
+        add_mul_mat("enc_attn_proj",   n_state,   n_state, n_ctx, wtype);
+        add_mul_mat("enc_mlp_up",      n_state, 4*n_state, n_ctx, wtype);
+        add_mul_mat("enc_mlp_down",  4*n_state,   n_state, n_ctx, wtype);
+        for (int n_tok : params.n_tok) {
+            add_mul_mat("dec_mlp_up", n_state, 4*n_state, n_tok, wtype);
+            add_mul_mat("dec_head",   n_state, m.n_vocab, n_tok, wtype);
+        }
+    }
+
+    auto add_conv = [&](const char * op, int c_in, int stride) {
+        const int n_out = k_n_frames/stride;
+        snprintf(shape, sizeof(shape), "k=3 s=%d [%d x %d] -> [%d x %d]", stride, k_n_frames, c_in, n_out, n_state);
+        cases.push_back({ op, shape, GGML_TYPE_COUNT, 3, 2.0*3*c_in*n_state*n_out,
+            [=](ggml_context * ctx_w, ggml_context * ctx) {
+                ggml_tensor * w = ggml_new_tensor_3d(ctx_w, GGML_TYPE_F16, 3, c_in, n_state);
+                ggml_tensor * x = ggml_new_tensor_2d(ctx,   GGML_TYPE_F32, k_n_frames, c_in);
+                return ggml_conv_1d_direct(ctx, w, x, stride, 1, 1);
+            } });
+    };
+
+    add_conv("conv1", m.n_mels,  1);
+    add_conv("conv2", n_state,   2);
+
+    {
+        const int n_ctx_pad = GGML_PAD(n_ctx, 256);
+        snprintf(shape, sizeof(shape), "q [%d x %d x %d], kv [%d x %d x %d] f16", d_head, n_ctx, n_head, d_head, n_ctx_pad, n_head);
+        cases.push_back({ "flash_attn", shape, GGML_TYPE_COUNT, 0, 4.0*d_head*n_ctx*n_ctx_pad*n_head,
+            [=](ggml_context * /*ctx_w*/, ggml_context * ctx) {
+                // same layout as the encoder: Q is a permuted view, K/V are views into a padded buffer
+                ggml_tensor * q  = ggml_new_tensor_3d(ctx, GGML_TYPE_F32, d_head, n_head, n_ctx);
+                ggml_tensor * kb = ggml_new_tensor_1d(ctx, GGML_TYPE_F16, (int64_t) n_state*n_ctx_pad);
+                ggml_tensor * vb = ggml_new_tensor_1d(ctx, GGML_TYPE_F16, (int64_t) n_state*n_ctx_pad);
+
+                ggml_tensor * Q = ggml_permute(ctx, q, 0, 2, 1, 3);
+                ggml_tensor * K = ggml_view_3d(ctx, kb, d_head, n_ctx_pad, n_head, ggml_element_size(kb)*n_state, ggml_element_size(kb)*d_head, 0);
+                ggml_tensor * V = ggml_view_3d(ctx, vb, d_head, n_ctx_pad, n_head, ggml_element_size(vb)*n_state, ggml_element_size(vb)*d_head, 0);
+
+                return ggml_flash_attn_ext(ctx, Q, K, V, nullptr, 1.0f/sqrtf(float(d_head)), 0.0f, 0.0f);
+            } });
+    }
+
+    snprintf(shape, sizeof(shape), "[%d x %d x %d]", n_ctx, n_ctx, n_head);
+    cases.push_back({ "soft_max", shape, GGML_TYPE_COUNT, 0, 5.0*n_ctx*n_ctx*n_head,
+        [=](ggml_context * /*ctx_w*/, ggml_context * ctx) {
+            ggml_tensor * kq = ggml_new_tensor_3d(ctx, GGML_TYPE_F32, n_ctx, n_ctx, n_head);
+            return ggml_soft_max_ext(ctx, kq, nullptr, 1.0f/sqrtf(float(d_head)), 0.0f);
+        } });
+
+    snprintf(shape, sizeof(shape), "[%d x %d]", n_state, n_ctx);
+    cases.push_back({ "norm", shape, GGML_TYPE_COUNT, 0, 5.0*n_state*n_ctx,
+        [=](ggml_context * /*ctx_w*/, ggml_context * ctx) {
+            ggml_tensor * x = ggml_new_tensor_2d(ctx, GGML_TYPE_F32, n_state, n_ctx);
+            return ggml_norm(ctx, x, 1e-5f);
+        } });
+
+    snprintf(shape, sizeof(shape), "[%d x %d]", 4*n_state, n_ctx);
+    cases.push_back({ "gelu", shape, GGML_TYPE_COUNT, 0, 8.0*4*n_state*n_ctx,
+        [=](ggml_context * /*ctx_w*/, ggml_context * ctx) {
+            ggml_tensor * x = ggml_new_tensor_2d(ctx, GGML_TYPE_F32, 4*n_state, n_ctx);
+            return ggml_gelu(ctx, x);
+        } });
+
+    if (!params.ops.empty()) {
+        cases.erase(std::remove_if(cases.begin(), cases.end(), [&](const kernel_case & c) {
+            return std::find(params.ops.begin(), params.ops.end(), c.op) == params.ops.end();
+        }), cases.end());
+    }
+
+    return cases;
+}
+
+std::vector<ggml_backend_buffer_type_t> get_extra_bufts(ggml_backend_dev_t cpu_dev) {
+    std::vector<ggml_backend_buffer_type_t> res;
+
+    auto * cpu_reg = ggml_backend_dev_backend_reg(cpu_dev);
+    auto get_extra_bufts_fn = (ggml_backend_dev_get_extra_bufts_t)
+        ggml_backend_reg_get_proc_address(cpu_reg, "ggml_backend_dev_get_extra_bufts");
+    if (get_extra_bufts_fn) {
+        ggml_backend_buffer_type_t * extra_bufts = get_extra_bufts_fn(cpu_dev);
+        while (extra_bufts && *extra_bufts) {
+            res.push_back(*extra_bufts);
+            ++extra_bufts;
+        }
+    }
+
+    return res;
+}
+
+// pick the buffer type for the weight tensor w used by node, same as select_weight_buft() in whisper.cpp
+ggml_backend_buffer_type_t select_buft(ggml_backend_dev_t cpu_dev, const std::vector<ggml_backend_buffer_type_t> & extra, ggml_tensor * w, ggml_tensor * node) {
+    for (auto * buft : extra) {
+        GGML_ASSERT(w->buffer == nullptr);
+        w->buffer = ggml_backend_buft_alloc_buffer(buft, 0);
+        const bool ok = ggml_backend_dev_supports_op(cpu_dev, node);
+        ggml_backend_buffer_free(w->buffer);
+        w->buffer = nullptr;
+        if (ok) {
+            return buft;
+        }
+    }
+    return ggml_backend_cpu_buffer_type();
+}
+
+bool run_case(
+        ggml_backend_t backend,
+        ggml_backend_dev_t cpu_dev,
+        const std::vector<ggml_backend_buffer_type_t> & extra,
+        const model_dims & m,
+        const kernel_case & kc,
+        const kernel_params & params,
+        std::vector<kernel_result> & results) {
+    if (kc.wtype != GGML_TYPE_COUNT) {
+        // e.g. Q5_K needs rows that are a multiple of 256, which tiny (384) does not have
+        if (kc.wrow % ggml_blck_size(kc.wtype) != 0) {
+            fprintf(stderr, "%-8s %-14s %-5s skipped: row size %lld is not a multiple of the block size %lld\n",
+                    m.name, kc.op.c_str(), ggml_type_name(kc.wtype), (long long) kc.wrow, (long long) ggml_blck_size(kc.wtype));
+            return true;
+        }
+    }
+
+    ggml_init_params ip = {
+        /*.mem_size   =*/ 64*ggml_tensor_overhead() + ggml_graph_overhead(),
+        /*.mem_buffer =*/ nullptr,
+        /*.no_alloc   =*/ true,
+    };
+
+    ggml_context * ctx_w = ggml_init(ip);
+    ggml_context * ctx   = ggml_init(ip);
+
+    ggml_tensor * out = kc.build(ctx_w, ctx);
+
+    ggml_cgraph * gf = ggml_new_graph(ctx);
+    ggml_build_forward_expand(gf, out);
+
+    ggml_tensor * w = ggml_get_first_tensor(ctx_w);
+
+    ggml_backend_buffer_type_t buft_w = ggml_backend_cpu_buffer_type();
+    if (w && kc.wtype != GGML_TYPE_COUNT && params.use_extra) {
+        ggml_tensor * node = nullptr;
+        for (int i = 0; i < ggml_graph_n_nodes(gf); ++i) {
+            ggml_tensor * t = ggml_graph_node(gf, i);
+            if (t->src[0] == w) {
+                node = t;
+                break;
+            }
+        }
+        if (node) {
+            buft_w = select_buft(cpu_dev, extra, w, node);
+        }
+    }
+
+    ggml_backend_buffer_t buf_w = w ? ggml_backend_alloc_ctx_tensors_from_buft(ctx_w, buft_w) : nullptr;
+    ggml_backend_buffer_t buf   = ggml_backend_alloc_ctx_tensors(ctx, backend);
+
+    if ((w && !buf_w) || !buf) {
+        fprintf(stderr, "%s: failed to allocate buffers for %s/%s\n", __func__, m.name, kc.op.c_str());
+        ggml_backend_buffer_free(buf_w);
+        ggml_backend_buffer_free(buf);
+        ggml_free(ctx_w);
+        ggml_free(ctx);
+        return false;
+    }
+
+    std::mt19937 rng(42);
+
+    // fill the inputs and count the minimum memory traffic
+    double bytes = (double) ggml_nbytes(out);
+    for (ggml_tensor * t = ggml_get_first_tensor(ctx_w); t; t = ggml_get_next_tensor(ctx_w, t)) {
+        fill_random(t, rng, 0.05f);
+        bytes += ggml_nbytes(t);
+    }
+    for (ggml_tensor * t = ggml_get_first_tensor(ctx); t; t = ggml_get_next_tensor(ctx, t)) {
+        if (t->op == GGML_OP_NONE && t->view_src == nullptr) {
+            fill_random(t, rng, 1.0f);
+            bytes += ggml_nbytes(t);
+        }
+    }
+
+    for (int n_threads : params.threads) {
+        ggml_backend_cpu_set_n_threads(backend, n_threads);
+
+        // warm-up
+        if (ggml_backend_graph_compute(backend, gf) != GGML_STATUS_SUCCESS) {
+            fprintf(stderr, "%s: graph compute failed for %s/%s\n", __func__, m.name, kc.op.c_str());
+            break;
+        }
+
+        std::vector<double> t_ms;
+        double tsum = 0.0;
+        while ((int) t_ms.size() < params.n_max) {
+            const int64_t t0 = ggml_time_us();
+            ggml_backend_graph_compute(backend, gf);
+            const int64_t t1 = ggml_time_us();
+
+            t_ms.push_back((t1 - t0)/1000.0);
+            tsum += (t1 - t0)*1e-6;
+
+            if (tsum >= params.min_time && t_ms.size() >= 3) {
+                break;
+            }
+        }
+
+        const bench::latency_stats st = bench::compute_stats(t_ms);
+
+        kernel_result r;
+        r.model     = m.name;
+        r.op        = kc.op;
+        r.shape     = kc.shape;
+        r.wtype     = kc.wtype == GGML_TYPE_COUNT ? "-" : ggml_type_name(kc.wtype);
+        r.buft      = w ? ggml_backend_buft_name(buft_w) : "-";
+        r.n_threads = n_threads;
+        r.n_runs    = (int) t_ms.size();
+        r.ms        = st.p50;
+        r.gflops    = kc.flops/(st.p50*1e-3)*1e-9;
+        r.gbps      = bytes/(st.p50*1e-3)*1e-9;
+
+        printf("| %-8s | %-14s | %-42s | %-5s | %-10s | %3d | %10.3f | %9.1f | %8.1f | %4d |\n",
+                r.model.c_str(), r.op.c_str(), r.shape.c_str(), r.wtype.c_str(), r.buft.c_str(),
+                r.n_threads, r.ms, r.gflops, r.gbps, r.n_runs);
+        fflush(stdout);
+
+        results.push_back(r);
+    }
+
+    ggml_backend_buffer_free(buf_w);
+    ggml_backend_buffer_free(buf);
+    ggml_free(ctx_w);
+    ggml_free(ctx);
+
+    return true;
+}
+
+void write_json(const std::string & fname, const std::vector<kernel_result> & results) {
+    FILE * f = fopen(fname.c_str(), "w");
+    if (!f) {
+        fprintf(stderr, "error: failed to open '%s' for writing\n", fname.c_str());
+        return;
+    }
+
+    fprintf(f, "[\n");
+    for (size_t i = 0; i < results.size(); ++i) {
+        const auto & r = results[i];
+        fprintf(f, "  { \"model\": \"%s\", \"op\": \"%s\", \"shape\": \"%s\", \"wtype\": \"%s\", \"buft\": \"%s\", "
+                   "\"n_threads\": %d, \"n_runs\": %d, \"ms\": %.4f, \"gflops\": %.3f, \"gbps\": %.3f }%s\n",
+                r.model.c_str(), r.op.c_str(), bench::json_escape(r.shape).c_str(), r.wtype.c_str(), bench::json_escape(r.buft).c_str(),
+                r.n_threads, r.n_runs, r.ms, r.gflops, r.gbps, i + 1 < results.size() ? "," : "");
+    }
+    fprintf(f, "]\n");
+
+    fclose(f);
+}
+
+} // namespace
+
+int main(int argc, char ** argv) {
+    kernel_params params;
+    if (!parse_params(argc, argv, params)) {
+        return 1;
+    }
+
+    ggml_time_init();
+
+    ggml_backend_t backend = ggml_backend_cpu_init();
+    if (!backend) {
+        fprintf(stderr, "error: failed to initialize the CPU backend\n");
+        return 1;
+    }
+
+    ggml_backend_dev_t cpu_dev = ggml_backend_dev_by_type(GGML_BACKEND_DEVICE_TYPE_CPU);
+
+    const std::vector<ggml_backend_buffer_type_t> extra = get_extra_bufts(cpu_dev);
+
+    printf("| %-8s | %-14s | %-42s | %-5s | %-10s | %3s | %10s | %9s | %8s | %4s |\n",
+            "model", "op", "shape", "wtype", "buft", "thr", "ms (p50)", "GFLOPS", "GB/s", "runs");
+    printf("|%s|%s|%s|%s|%s|%s|%s|%s|%s|%s|\n",
+            std::string(10, '-').c_str(), std::string(16, '-').c_str(), std::string(44, '-').c_str(), std::string(7, '-').c_str(),
+            std::string(12, '-').c_str(), std::string(5, '-').c_str(), std::string(12, '-').c_str(), std::string(11, '-').c_str(),
+            std::string(10, '-').c_str(), std::string(6, '-').c_str());
+
+    std::vector<kernel_result> results;
+
+    for (const auto & name : params.models) {
+        const model_dims * m = nullptr;
+        for (const auto & md : k_models) {
+            if (name == md.name) {
+                m = &md;
+            }
+        }
+        if (!m) {
+            fprintf(stderr, "error: unknown model size: %s\n", name.c_str());
+            continue;
+        }
+
+        for (const auto & kc : make_cases(*m, params)) {
+            run_case(backend, cpu_dev, extra, *m, kc, params, results);
+        }
+    }
+
+    if (!params.json.empty()) {
+        write_json(params.json, results);
+    }
+
+    ggml_backend_free(backend);
+
+    return 0;
+}
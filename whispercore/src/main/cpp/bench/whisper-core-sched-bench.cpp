@@ -0,0 +1,469 @@
+// Backend scheduler overhead per decoder step.
+//
+// whisper builds a new graph for every decoded token and hands it to
+// ggml_backend_sched_alloc_graph(), which assigns each node to a backend,
+// splits the graph and allocates it, then ggml_backend_sched_reset() clears
+// that state again. From one token to the next the graph only differs in the
+// cache slot it writes and, every 32 tokens, in the padded number of cached
+// tokens it reads. This tool rebuilds a graph shaped like one step of the
+// whisper decoder (self- and cross-attention against a KV cache, FFN, logits)
+// and times those calls without computing the graph:
+//
+//   cpu      the CPU backend only, which is how whisper_core runs
+//   cpu+cpu  two CPU backends, which takes the full multi-backend assignment
+//
+// -c also computes each graph, to put the overhead in proportion.
+//
+// usage: whisper-core-sched-bench [-l 4] [-s 384] [-p 64] [-n 2000] [-c] [-t 4]
+
+#include "ggml.h"
+#include "ggml-alloc.h"
+#include "ggml-backend.h"
+#include "bench-common.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+struct sched_params {
+    int n_layer = 4;    // tiny
+    int n_state = 384;
+    int n_head  = 6;
+    int n_past  = 64;   // tokens already in the self-attention cache
+    int n_audio = 1500; // frames in the cross-attention cache
+    int n_vocab = 51865;
+    int n_iter  = 2000;
+    int n_threads = std::max(1, (int) std::thread::hardware_concurrency());
+
+    bool compute = false;
+};
+
+void print_usage(char ** argv, const sched_params & params) {
+    fprintf(stderr, "\n");
+    fprintf(stderr, "usage: %s [options]\n", argv[0]);
+    fprintf(stderr, "\n");
+    fprintf(stderr, "options:\n");
+    fprintf(stderr, "  -h,      --help          show this help message and exit\n");
+    fprintf(stderr, "  -l N,    --layers N      [%-6d] decoder layers\n", params.n_layer);
+    fprintf(stderr, "  -s N,    --state N       [%-6d] embedding size\n", params.n_state);
+    fprintf(stderr, "  -nh N,   --heads N       [%-6d] attention heads\n", params.n_head);
+    fprintf(stderr, "  -p N,    --past N        [%-6d] tokens in the self-attention cache\n", params.n_past);
+    fprintf(stderr, "  -n N,    --iter N        [%-6d] decoder steps per case\n", params.n_iter);
+    fprintf(stderr, "  -c,      --compute       [%-6s] also compute every graph\n", params.compute ? "true" : "false");
+    fprintf(stderr, "  -t N,    --threads N     [%-6d] threads used with -c\n", params.n_threads);
+    fprintf(stderr, "\n");
+}
+
+bool parse_params(int argc, char ** argv, sched_params & params) {
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+
+        auto next = [&]() -> std::string {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "error: missing value for argument: %s\n", arg.c_str());
+                exit(1);
+            }
+            return argv[++i];
+        };
+
+        if (arg == "-h" || arg == "--help") {
+            print_usage(argv, params);
+            exit(0);
+        } else if (arg == "-l" || arg == "--layers") {
+            params.n_layer = std::max(1, std::stoi(next()));
+        } else if (arg == "-s" || arg == "--state") {
+            params.n_state = std::max(64, std::stoi(next()));
+        } else if (arg == "-nh" || arg == "--heads") {
+            params.n_head = std::max(1, std::stoi(next()));
+        } else if (arg == "-p" || arg == "--past") {
+            params.n_past = std::max(0, std::stoi(next()));
+        } else if (arg == "-n" || arg == "--iter") {
+            params.n_iter = std::max(1, std::stoi(next()));
+        } else if (arg == "-c" || arg == "--compute") {
+            params.compute = true;
+        } else if (arg == "-t" || arg == "--threads") {
+            params.n_threads = std::max(1, std::stoi(next()));
+        } else {
+            fprintf(stderr, "error: unknown argument: %s\n", arg.c_str());
+            print_usage(argv, params);
+            return false;
+        }
+    }
+
+    if (params.n_state % params.n_head != 0) {
+        fprintf(stderr, "error: the embedding size must be a multiple of the number of heads\n");
+        return false;
+    }
+
+    return true;
+}
+
+struct layer_weights {
+    ggml_tensor * attn_ln_w, * attn_ln_b;
+    ggml_tensor * attn_q_w, * attn_q_b, * attn_k_w, * attn_v_w, * attn_v_b, * attn_o_w, * attn_o_b;
+
+    ggml_tensor * cross_ln_w, * cross_ln_b;
+    ggml_tensor * cross_q_w, * cross_q_b, * cross_o_w, * cross_o_b;
+
+    ggml_tensor * mlp_ln_w, * mlp_ln_b;
+    ggml_tensor * mlp_0_w, * mlp_0_b, * mlp_1_w, * mlp_1_b;
+};
+
+struct decoder_model {
+    ggml_tensor * token_embd;
+    ggml_tensor * ln_w, * ln_b;
+    std::vector<layer_weights> layers;
+
+    // self-attention cache [n_state*n_ctx*n_layer] and cross-attention cache
+    ggml_tensor * k, * v;
+    ggml_tensor * k_cross, * v_cross;
+    int n_ctx;
+
+    ggml_context * ctx    = nullptr;
+    ggml_context * ctx_kv = nullptr;
+    ggml_backend_buffer_t buf_w  = nullptr;
+    ggml_backend_buffer_t buf_kv = nullptr;
+};
+
+bool model_init(decoder_model & model, ggml_backend_t backend, const sched_params & p) {
+    const int n_state = p.n_state;
+    const int n_ctx   = std::max(448, GGML_PAD(p.n_past + 32, 32));
+
+    ggml_init_params ip = {
+        /*.mem_size   =*/ (size_t) (32 + 24*p.n_layer)*ggml_tensor_overhead(),
+        /*.mem_buffer =*/ nullptr,
+        /*.no_alloc   =*/ true,
+    };
+    model.ctx   = ggml_init(ip);
+    model.n_ctx = n_ctx;
+
+    ggml_context * ctx = model.ctx;
+
+    auto mat = [&](int ne0, int ne1) { return ggml_new_tensor_2d(ctx, GGML_TYPE_F16, ne0, ne1); };
+    auto vec = [&](int ne0)          { return ggml_new_tensor_1d(ctx, GGML_TYPE_F32, ne0); };
+
+    model.token_embd = mat(n_state, p.n_vocab);
+    model.ln_w = vec(n_state);
+    model.ln_b = vec(n_state);
+
+    model.layers.resize(p.n_layer);
+    for (auto & l : model.layers) {
+        l.attn_ln_w  = vec(n_state);     l.attn_ln_b  = vec(n_state);
+        l.attn_q_w   = mat(n_state, n_state); l.attn_q_b = vec(n_state);
+        l.attn_k_w   = mat(n_state, n_state);
+        l.attn_v_w   = mat(n_state, n_state); l.attn_v_b = vec(n_state);
+        l.attn_o_w   = mat(n_state, n_state); l.attn_o_b = vec(n_state);
+        l.cross_ln_w = vec(n_state);     l.cross_ln_b = vec(n_state);
+        l.cross_q_w  = mat(n_state, n_state); l.cross_q_b = vec(n_state);
+        l.cross_o_w  = mat(n_state, n_state); l.cross_o_b = vec(n_state);
+        l.mlp_ln_w   = vec(n_state);     l.mlp_ln_b   = vec(n_state);
+        l.mlp_0_w    = mat(n_state, 4*n_state); l.mlp_0_b = vec(4*n_state);
+        l.mlp_1_w    = mat(4*n_state, n_state); l.mlp_1_b = vec(n_state);
+    }
+
+    model.buf_w = ggml_backend_alloc_ctx_tensors(ctx, backend);
+    if (!model.buf_w) {
+        return false;
+    }
+    ggml_backend_buffer_set_usage(model.buf_w, GGML_BACKEND_BUFFER_USAGE_WEIGHTS);
+    ggml_backend_buffer_clear(model.buf_w, 0);
+
+    // the caches live in their own buffer, like whisper_kv_cache
+    ggml_init_params ip_kv = {
+        /*.mem_size   =*/ 8*ggml_tensor_overhead(),
+        /*.mem_buffer =*/ nullptr,
+        /*.no_alloc   =*/ true,
+    };
+    model.ctx_kv = ggml_init(ip_kv);
+
+    ggml_context * ctx_kv = model.ctx_kv;
+
+    model.k       = ggml_new_tensor_1d(ctx_kv, GGML_TYPE_F16, (int64_t) n_state*n_ctx*p.n_layer);
+    model.v       = ggml_new_tensor_1d(ctx_kv, GGML_TYPE_F16, (int64_t) n_state*n_ctx*p.n_layer);
+    model.k_cross = ggml_new_tensor_1d(ctx_kv, GGML_TYPE_F16, (int64_t) n_state*p.n_audio*p.n_layer);
+    model.v_cross = ggml_new_tensor_1d(ctx_kv, GGML_TYPE_F16, (int64_t) n_state*p.n_audio*p.n_layer);
+
+    model.buf_kv = ggml_backend_alloc_ctx_tensors(ctx_kv, backend);
+    if (!model.buf_kv) {
+        return false;
+    }
+    ggml_backend_buffer_clear(model.buf_kv, 0);
+
+    return true;
+}
+
+void model_free(decoder_model & model) {
+    ggml_backend_buffer_free(model.buf_kv);
+    ggml_backend_buffer_free(model.buf_w);
+    ggml_free(model.ctx_kv);
+    ggml_free(model.ctx);
+}
+
+// one decoder step for a single token written to cache slot kv_head, following whisper_build_graph_decoder
+ggml_cgraph * build_decoder_step(ggml_context * ctx, const decoder_model & model, const sched_params & p, int kv_head) {
+    const int n_state = p.n_state;
+    const int n_head  = p.n_head;
+    const int d_head  = n_state/n_head;
+    const int n_kv    = GGML_PAD(kv_head + 1, 32); // whisper_kv_cache_get_padding without flash attention
+
+    const float KQscale = 1.0f/sqrtf((float) d_head);
+
+    ggml_cgraph * gf = ggml_new_graph_custom(ctx, 4096, false);
+
+    ggml_tensor * embd = ggml_new_tensor_1d(ctx, GGML_TYPE_I32, 1);
+    ggml_set_name(embd, "embd");
+    ggml_set_input(embd);
+
+    ggml_tensor * mask = ggml_new_tensor_2d(ctx, GGML_TYPE_F32, n_kv, 1);
+    ggml_set_name(mask, "KQ_mask");
+    ggml_set_input(mask);
+
+    ggml_tensor * inpL = ggml_get_rows(ctx, model.token_embd, embd);
+
+    for (int il = 0; il < p.n_layer; ++il) {
+        const auto & layer = model.layers[il];
+
+        // self-attention
+        ggml_tensor * cur = ggml_norm(ctx, inpL, 1e-5f);
+        cur = ggml_add(ctx, ggml_mul(ctx, cur, layer.attn_ln_w), layer.attn_ln_b);
+
+        ggml_tensor * Qcur = ggml_add(ctx, ggml_mul_mat(ctx, layer.attn_q_w, cur), layer.attn_q_b);
+        ggml_tensor * Kcur = ggml_mul_mat(ctx, layer.attn_k_w, cur);
+        ggml_tensor * Vcur = ggml_add(ctx, ggml_mul_mat(ctx, layer.attn_v_w, cur), layer.attn_v_b);
+
+        {
+            ggml_tensor * k = ggml_view_1d(ctx, model.k, n_state,
+                    ggml_element_size(model.k)*n_state*(il*model.n_ctx + kv_head));
+            ggml_tensor * v = ggml_view_1d(ctx, model.v, n_state,
+                    ggml_element_size(model.v)*n_state*(il*model.n_ctx + kv_head));
+
+            ggml_build_forward_expand(gf, ggml_cpy(ctx, Kcur, k));
+            ggml_build_forward_expand(gf, ggml_cpy(ctx, Vcur, v));
+        }
+
+        ggml_tensor * Q = ggml_permute(ctx, ggml_reshape_3d(ctx, Qcur, d_head, n_head, 1), 0, 2, 1, 3);
+
+        ggml_tensor * K = ggml_view_3d(ctx, model.k, d_head, n_kv, n_head,
+                ggml_element_size(model.k)*n_state,
+                ggml_element_size(model.k)*d_head,
+                ggml_element_size(model.k)*n_state*model.n_ctx*il);
+
+        ggml_tensor * KQ = ggml_mul_mat(ctx, K, Q);
+        ggml_tensor * KQ_soft_max = ggml_soft_max_ext(ctx, KQ, mask, KQscale, 0.0f);
+
+        ggml_tensor * V = ggml_view_3d(ctx, model.v, n_kv, d_head, n_head,
+                n_state*ggml_element_size(model.v),
+                n_state*ggml_element_size(model.v)*d_head,
+                n_state*ggml_element_size(model.v)*model.n_ctx*il);
+
+        ggml_tensor * KQV = ggml_mul_mat(ctx, V, KQ_soft_max);
+        cur = ggml_cont_2d(ctx, ggml_permute(ctx, KQV, 0, 2, 1, 3), n_state, 1);
+        cur = ggml_add(ctx, ggml_mul_mat(ctx, layer.attn_o_w, cur), layer.attn_o_b);
+
+        ggml_tensor * inpCA = ggml_add(ctx, cur, inpL);
+
+        // cross-attention
+        cur = ggml_norm(ctx, inpCA, 1e-5f);
+        cur = ggml_add(ctx, ggml_mul(ctx, cur, layer.cross_ln_w), layer.cross_ln_b);
+
+        Qcur = ggml_add(ctx, ggml_mul_mat(ctx, layer.cross_q_w, cur), layer.cross_q_b);
+        Q = ggml_permute(ctx, ggml_reshape_3d(ctx, Qcur, d_head, n_head, 1), 0, 2, 1, 3);
+
+        ggml_tensor * Kcross = ggml_view_3d(ctx, model.k_cross, d_head, p.n_audio, n_head,
+                ggml_element_size(model.k_cross)*n_state,
+                ggml_element_size(model.k_cross)*d_head,
+                ggml_element_size(model.k_cross)*n_state*p.n_audio*il);
+
+        ggml_tensor * Vcross = ggml_view_3d(ctx, model.v_cross, p.n_audio, d_head, n_head,
+                p.n_audio*ggml_element_size(model.v_cross),
+                p.n_audio*ggml_element_size(model.v_cross)*d_head,
+                p.n_audio*ggml_element_size(model.v_cross)*n_state*il);
+
+        KQ = ggml_mul_mat(ctx, Kcross, Q);
+        KQ_soft_max = ggml_soft_max_ext(ctx, KQ, nullptr, KQscale, 0.0f);
+        KQV = ggml_mul_mat(ctx, Vcross, KQ_soft_max);
+
+        cur = ggml_cont_2d(ctx, ggml_permute(ctx, KQV, 0, 2, 1, 3), n_state, 1);
+        cur = ggml_add(ctx, ggml_mul_mat(ctx, layer.cross_o_w, cur), layer.cross_o_b);
+
+        ggml_tensor * inpFF = ggml_add(ctx, cur, inpCA);
+
+        // feed-forward
+        cur = ggml_norm(ctx, inpFF, 1e-5f);
+        cur = ggml_add(ctx, ggml_mul(ctx, cur, layer.mlp_ln_w), layer.mlp_ln_b);
+        cur = ggml_gelu(ctx, ggml_add(ctx, ggml_mul_mat(ctx, layer.mlp_0_w, cur), layer.mlp_0_b));
+        cur = ggml_add(ctx, ggml_mul_mat(ctx, layer.mlp_1_w, cur), layer.mlp_1_b);
+
+        inpL = ggml_add(ctx, cur, inpFF);
+    }
+
+    ggml_tensor * cur = ggml_norm(ctx, inpL, 1e-5f);
+    cur = ggml_add(ctx, ggml_mul(ctx, cur, model.ln_w), model.ln_b);
+
+    ggml_tensor * logits = ggml_mul_mat(ctx, model.token_embd, cur);
+    ggml_set_name(logits, "logits");
+    ggml_set_output(logits);
+
+    ggml_build_forward_expand(gf, logits);
+
+    return gf;
+}
+
+struct step_timing {
+    int    n_nodes  = 0;
+    double build_us = 0.0; // graph construction
+    double alloc_us = 0.0; // ggml_backend_sched_alloc_graph
+    double reset_us = 0.0; // ggml_backend_sched_reset
+    double comp_us  = 0.0; // ggml_backend_sched_graph_compute, with -c
+};
+
+bool run_case(std::vector<ggml_backend_t> & backends, const decoder_model & model, const sched_params & p, step_timing & res) {
+    ggml_backend_sched_t sched = ggml_backend_sched_new(backends.data(), nullptr, (int) backends.size(), 4096, false, true);
+
+    // whisper keeps the graph metadata in one buffer that is reused for every step
+    std::vector<uint8_t> meta(ggml_tensor_overhead()*4096 + ggml_graph_overhead_custom(4096, false));
+
+    auto new_ctx = [&]() {
+        ggml_init_params ip = {
+            /*.mem_size   =*/ meta.size(),
+            /*.mem_buffer =*/ meta.data(),
+            /*.no_alloc   =*/ true,
+        };
+        return ggml_init(ip);
+    };
+
+    {
+        ggml_context * ctx = new_ctx();
+        const bool ok = ggml_backend_sched_reserve(sched, build_decoder_step(ctx, model, p, model.n_ctx - 1));
+        ggml_free(ctx);
+        if (!ok) {
+            ggml_backend_sched_free(sched);
+            return false;
+        }
+    }
+
+    std::vector<double> t_build, t_alloc, t_reset, t_comp;
+
+    for (int it = 0; it < p.n_iter + 1; ++it) {
+        const int64_t t0 = ggml_time_us();
+        ggml_context * ctx = new_ctx();
+        ggml_cgraph * gf = build_decoder_step(ctx, model, p, p.n_past + it % 32);
+
+        const int64_t t1 = ggml_time_us();
+        if (!ggml_backend_sched_alloc_graph(sched, gf)) {
+            ggml_free(ctx);
+            ggml_backend_sched_free(sched);
+            return false;
+        }
+        const int64_t t2 = ggml_time_us();
+
+        if (p.compute) {
+            ggml_backend_tensor_memset(ggml_graph_get_tensor(gf, "embd"),    0, 0, ggml_nbytes(ggml_graph_get_tensor(gf, "embd")));
+            ggml_backend_tensor_memset(ggml_graph_get_tensor(gf, "KQ_mask"), 0, 0, ggml_nbytes(ggml_graph_get_tensor(gf, "KQ_mask")));
+            ggml_backend_sched_graph_compute(sched, gf);
+        }
+        const int64_t t3 = ggml_time_us();
+
+        ggml_backend_sched_reset(sched);
+        const int64_t t4 = ggml_time_us();
+
+        res.n_nodes = ggml_graph_n_nodes(gf);
+        ggml_free(ctx);
+
+        if (it == 0) {
+            continue; // warm-up
+        }
+
+        t_build.push_back(t1 - t0);
+        t_alloc.push_back(t2 - t1);
+        t_comp .push_back(t3 - t2);
+        t_reset.push_back(t4 - t3);
+    }
+
+    res.build_us = bench::compute_stats(t_build).mean;
+    res.alloc_us = bench::compute_stats(t_alloc).mean;
+    res.comp_us  = bench::compute_stats(t_comp).mean;
+    res.reset_us = bench::compute_stats(t_reset).mean;
+
+    ggml_backend_sched_free(sched);
+
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char ** argv) {
+    sched_params params;
+    if (!parse_params(argc, argv, params)) {
+        return 1;
+    }
+
+    ggml_time_init();
+
+    ggml_backend_t cpu0 = ggml_backend_init_by_type(GGML_BACKEND_DEVICE_TYPE_CPU, nullptr);
+    ggml_backend_t cpu1 = ggml_backend_init_by_type(GGML_BACKEND_DEVICE_TYPE_CPU, nullptr);
+    if (!cpu0 || !cpu1) {
+        fprintf(stderr, "error: failed to initialize the CPU backend\n");
+        return 1;
+    }
+
+    // through the registry, so that this also works when the CPU backend is loaded at runtime
+    {
+        ggml_backend_reg_t reg = ggml_backend_dev_backend_reg(ggml_backend_get_device(cpu0));
+        auto set_n_threads = (ggml_backend_set_n_threads_t) ggml_backend_reg_get_proc_address(reg, "ggml_backend_set_n_threads");
+        if (set_n_threads) {
+            set_n_threads(cpu0, params.n_threads);
+            set_n_threads(cpu1, params.n_threads);
+        }
+    }
+
+    decoder_model model;
+    if (!model_init(model, cpu0, params)) {
+        fprintf(stderr, "error: failed to allocate the model\n");
+        return 1;
+    }
+
+    struct sched_case {
+        const char * name;
+        std::vector<ggml_backend_t> backends;
+    };
+
+    std::vector<sched_case> cases = {
+        { "cpu",     { cpu0 } },
+        { "cpu+cpu", { cpu1, cpu0 } },
+    };
+
+    printf("| %-8s | %6s | %6s | %9s | %9s | %9s | %9s | %8s |\n",
+            "sched", "layers", "nodes", "build us", "alloc us", "reset us", "compute us", "ns/node");
+    printf("|%s|%s|%s|%s|%s|%s|%s|%s|\n",
+            std::string(10, '-').c_str(), std::string(8, '-').c_str(), std::string(8, '-').c_str(),
+            std::string(11, '-').c_str(), std::string(11, '-').c_str(), std::string(11, '-').c_str(),
+            std::string(12, '-').c_str(), std::string(10, '-').c_str());
+
+    for (auto & sc : cases) {
+        step_timing t;
+        if (!run_case(sc.backends, model, params, t)) {
+            fprintf(stderr, "error: failed to schedule the %s graph\n", sc.name);
+            continue;
+        }
+
+        printf("| %-8s | %6d | %6d | %9.1f | %9.1f | %9.1f | %10.1f | %8.1f |\n",
+                sc.name, params.n_layer, t.n_nodes, t.build_us, t.alloc_us, t.reset_us,
+                params.compute ? t.comp_us : 0.0, 1000.0*(t.alloc_us + t.reset_us)/t.n_nodes);
+        fflush(stdout);
+    }
+
+    model_free(model);
+
+    ggml_backend_free(cpu1);
+    ggml_backend_free(cpu0);
+
+    return 0;
+}
@@ -411,7 +411,7 @@ Java_com_redravencomputing_whispercore_WhisperJNIBridge_freeContext(
 
 JNIEXPORT void JNICALL
 Java_com_redravencomputing_whispercore_WhisperJNIBridge_fullTranscribe(
-        JNIEnv *env, jobject thiz, jlong context_ptr, jint num_threads, jfloatArray audio_data) {
+        JNIEnv *env, jobject thiz, jlong context_ptr, jint num_threads, jint num_threads_decode, jfloatArray audio_data) {
     UNUSED(thiz);
     struct whisper_context *context = (struct whisper_context *) context_ptr;
     jfloat *audio_data_arr = (*env)->GetFloatArrayElements(env, audio_data, NULL);
@@ -424,12 +424,15 @@ Java_com_redravencomputing_whispercore_WhisperJNIBridge_fullTranscribe(
     params.print_special = false;
     params.translate = false;
     params.language = "en";
-    params.n_threads = num_threads;
+    // the encoder and decoder counts can differ after autotune, the pool is sized for the larger
+    params.n_threads = num_threads_decode > num_threads ? num_threads_decode : num_threads;
+    params.n_threads_encode = num_threads;
+    params.n_threads_decode = num_threads_decode > 0 ? num_threads_decode : WHISPER_N_THREADS_AUTO;
     params.offset_ms = 0;
     params.no_context = true;
     params.single_segment = false;
 
-    LOGI("WhisperJNI: fullTranscribe called with: n_threads=%d, audio_length=%d, print_realtime=%d",params.n_threads, (int)audio_data_length, params.print_realtime);
+    LOGI("WhisperJNI: fullTranscribe called with: n_threads=%d, n_threads_encode=%d, n_threads_decode=%d, audio_length=%d, print_realtime=%d",params.n_threads, params.n_threads_encode, params.n_threads_decode, (int)audio_data_length, params.print_realtime);
 
     if (context == NULL) {
         LOGE("WhisperJNI: whisper_context is NULL. Aborting fullTranscribe.");
@@ -488,11 +491,60 @@ Java_com_redravencomputing_whispercore_WhisperJNIBridge_fullTranscribe(
         }
     }
 
+    // Park the threadpool until the next request, it resumes on the next computation
+    whisper_threadpool_pause(context);
+
     // Release the Java array elements
     (*env)->ReleaseFloatArrayElements(env, audio_data, audio_data_arr, JNI_ABORT);
 }
 
 
+JNIEXPORT jintArray JNICALL
+Java_com_redravencomputing_whispercore_WhisperJNIBridge_autotune(
+        JNIEnv *env, jobject thiz, jlong context_ptr, jstring cache_path_str) {
+    UNUSED(thiz);
+    struct whisper_context *context = (struct whisper_context *) context_ptr;
+    if (context == NULL) {
+        LOGE("WhisperJNI: whisper_context is NULL. Aborting autotune.");
+        return NULL;
+    }
+
+    const char *cache_path_chars = cache_path_str ? (*env)->GetStringUTFChars(env, cache_path_str, NULL) : NULL;
+
+    struct whisper_autotune_params params = whisper_autotune_default_params();
+    params.cache_path = cache_path_chars;
+
+    struct whisper_autotune_result result;
+    const int ret = whisper_autotune(context, params, &result);
+
+    if (cache_path_chars) {
+        (*env)->ReleaseStringUTFChars(env, cache_path_str, cache_path_chars);
+    }
+
+    if (ret != 0) {
+        LOGE("WhisperJNI: whisper_autotune failed with code: %d", ret);
+        return NULL;
+    }
+
+    LOGI("WhisperJNI: autotune: encode threads=%d, decode threads=%d, flash_attn=%d, extra_bufts=%d%s",
+         result.n_threads_encode, result.n_threads_decode, result.flash_attn, result.use_extra_bufts,
+         result.from_cache ? " (cached)" : "");
+
+    // [n_threads_encode, n_threads_decode, flash_attn, use_extra_bufts]
+    const jint values[4] = {
+            result.n_threads_encode,
+            result.n_threads_decode,
+            result.flash_attn ? 1 : 0,
+            result.use_extra_bufts ? 1 : 0,
+    };
+
+    jintArray array = (*env)->NewIntArray(env, 4);
+    if (array != NULL) {
+        (*env)->SetIntArrayRegion(env, array, 0, 4, values);
+    }
+    return array;
+}
+
 JNIEXPORT jint JNICALL
 Java_com_redravencomputing_whispercore_WhisperJNIBridge_getTextSegmentCount(
         JNIEnv *env, jobject thiz, jlong context_ptr) {
@@ -0,0 +1,304 @@
+// whisper_full_parallel() called twice on the same context.
+//
+// The states of the extra processors are kept in the context between calls.
+// Each call must still transcribe its chunks as if those states were new: in
+// particular without the text of the previous call as context when
+// no_context is false. The test loads a small model with random weights from
+// memory, so it needs no model file, and checks that the second call gives
+// the chunks after the first split exactly the segments of the first call.
+//
+// With parallel_split_on_silence the first split of 3 chunks moves from 10 s
+// into a silent gap at 11.5 s - 12.3 s, and stays at 10 s without the option
+// or without the gap. The split is seen in the start of the first segment
+// after 10 s: max_initial_ts is 0.5 s, so a chunk's first segment starts at
+// most 0.5 s after the chunk does.
+//
+// usage: test-full-parallel [n_processors]
+
+#include "whisper.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace {
+
+// a whisper model in the ggml file format, with the shapes of a one-layer tiny.en
+struct model_writer {
+    static const int n_vocab = 51864;
+    static const int n_ctx_a = 1500;
+    static const int n_ctx_t = 448;
+    static const int n_state = 64;
+    static const int n_head  = 2;
+    static const int n_layer = 1;
+    static const int n_mels  = 80;
+    static const int n_fft   = 201;
+
+    std::vector<uint8_t> buf;
+    uint64_t rng = 0x9e3779b97f4a7c15ULL;
+
+    void put(const void * data, size_t size) {
+        buf.insert(buf.end(), (const uint8_t *) data, (const uint8_t *) data + size);
+    }
+
+    void put_i32(int32_t v) {
+        put(&v, sizeof(v));
+    }
+
+    void put_f32(float v) {
+        put(&v, sizeof(v));
+    }
+
+    // uniform in [-1, 1)
+    float uniform() {
+        rng = rng*6364136223846793005ULL + 1442695040888963407ULL;
+        return (float) (rng >> 40)/(float) (1 << 23) - 1.0f;
+    }
+
+    enum init { init_zero, init_one, init_rand };
+
+    void tensor(const std::string & name, std::vector<int32_t> ne, init kind) {
+        put_i32((int32_t) ne.size());
+        put_i32((int32_t) name.size());
+        put_i32(0); // F32
+
+        int64_t n = 1;
+        for (int32_t v : ne) {
+            put_i32(v);
+            n *= v;
+        }
+        put(name.data(), name.size());
+
+        // scaled so that every block changes its input noticeably
+        const float scale = 1.0f/sqrtf((float) ne[0]);
+        for (int64_t i = 0; i < n; ++i) {
+            put_f32(kind == init_zero ? 0.0f : kind == init_one ? 1.0f : scale*uniform());
+        }
+    }
+
+    void block(const std::string & prefix, bool cross) {
+        std::vector<std::string> attns = { "" };
+        if (cross) {
+            attns.push_back("cross_");
+        }
+
+        for (const auto & attn : attns) {
+            tensor(prefix + attn + "attn_ln.weight",    { n_state },          init_one);
+            tensor(prefix + attn + "attn_ln.bias",      { n_state },          init_zero);
+            tensor(prefix + attn + "attn.query.weight", { n_state, n_state }, init_rand);
+            tensor(prefix + attn + "attn.query.bias",   { n_state },          init_zero);
+            tensor(prefix + attn + "attn.key.weight",   { n_state, n_state }, init_rand);
+            tensor(prefix + attn + "attn.value.weight", { n_state, n_state }, init_rand);
+            tensor(prefix + attn + "attn.value.bias",   { n_state },          init_zero);
+            tensor(prefix + attn + "attn.out.weight",   { n_state, n_state }, init_rand);
+            tensor(prefix + attn + "attn.out.bias",     { n_state },          init_zero);
+        }
+
+        tensor(prefix + "mlp_ln.weight", { n_state },            init_one);
+        tensor(prefix + "mlp_ln.bias",   { n_state },            init_zero);
+        tensor(prefix + "mlp.0.weight",  { n_state, 4*n_state }, init_rand);
+        tensor(prefix + "mlp.0.bias",    { 4*n_state },          init_zero);
+        tensor(prefix + "mlp.2.weight",  { 4*n_state, n_state }, init_rand);
+        tensor(prefix + "mlp.2.bias",    { n_state },            init_zero);
+    }
+
+    void write() {
+        put_i32(0x67676d6c); // ggml
+
+        const int32_t hparams[] = { n_vocab, n_ctx_a, n_state, n_head, n_layer, n_ctx_t, n_state, n_head, n_layer, n_mels, 0 };
+        put(hparams, sizeof(hparams));
+
+        put_i32(n_mels);
+        put_i32(n_fft);
+        for (int i = 0; i < n_mels*n_fft; ++i) {
+            put_f32(0.01f*(1.0f + uniform()));
+        }
+
+        // the byte tokens, the rest of the text tokens are added by the loader
+        put_i32(256);
+        for (int i = 0; i < 256; ++i) {
+            const char c = (char) i;
+            put_i32(1);
+            put(&c, 1);
+        }
+
+        tensor("encoder.positional_embedding", { n_state, n_ctx_a },    init_rand);
+        tensor("encoder.conv1.weight",         { 3, n_mels, n_state },  init_rand);
+        tensor("encoder.conv1.bias",           { 1, n_state },          init_zero);
+        tensor("encoder.conv2.weight",         { 3, n_state, n_state }, init_rand);
+        tensor("encoder.conv2.bias",           { 1, n_state },          init_zero);
+        tensor("encoder.ln_post.weight",       { n_state },             init_one);
+        tensor("encoder.ln_post.bias",         { n_state },             init_zero);
+        for (int i = 0; i < n_layer; ++i) {
+            block("encoder.blocks." + std::to_string(i) + ".", false);
+        }
+
+        tensor("decoder.positional_embedding",   { n_state, n_ctx_t }, init_rand);
+        tensor("decoder.token_embedding.weight", { n_state, n_vocab }, init_rand);
+        tensor("decoder.ln.weight",              { n_state },          init_one);
+        tensor("decoder.ln.bias",                { n_state },          init_zero);
+        for (int i = 0; i < n_layer; ++i) {
+            block("decoder.blocks." + std::to_string(i) + ".", true);
+        }
+    }
+};
+
+struct segment {
+    int64_t     t0;
+    int64_t     t1;
+    std::string text;
+};
+
+// the segments that start at or after t_min (in centiseconds)
+std::vector<segment> segments_from(whisper_context * ctx, int64_t t_min) {
+    std::vector<segment> result;
+    for (int i = 0; i < whisper_full_n_segments(ctx); ++i) {
+        const int64_t t0 = whisper_full_get_segment_t0(ctx, i);
+        if (t0 >= t_min) {
+            result.push_back({ t0, whisper_full_get_segment_t1(ctx, i), whisper_full_get_segment_text(ctx, i) });
+        }
+    }
+    return result;
+}
+
+void print_segments(const char * name, const std::vector<segment> & segments) {
+    fprintf(stderr, "%s: %zu segments\n", name, segments.size());
+    for (const auto & s : segments) {
+        fprintf(stderr, "  [%lld, %lld] '%s'\n", (long long) s.t0, (long long) s.t1, s.text.c_str());
+    }
+}
+
+// 30 s of tones that change every 0.7 s over a little noise, silent from gap0 to gap1 (in seconds)
+std::vector<float> make_pcm(double gap0, double gap1) {
+    std::vector<float> pcm(30*WHISPER_SAMPLE_RATE);
+    uint64_t rng = 1;
+    for (size_t i = 0; i < pcm.size(); ++i) {
+        rng = rng*6364136223846793005ULL + 1442695040888963407ULL;
+        const float  noise = 0.01f*((float) (rng >> 40)/(float) (1 << 23) - 1.0f);
+        const int    step  = (int) (i/(7*WHISPER_SAMPLE_RATE/10));
+        const double freq  = 200.0 + 150.0*(step*7 % 11);
+        const double t     = (double) i/WHISPER_SAMPLE_RATE;
+        pcm[i] = t >= gap0 && t < gap1 ? 0.0f : 0.3f*(float) sin(2.0*3.14159265358979323846*freq*i/WHISPER_SAMPLE_RATE) + noise;
+    }
+    return pcm;
+}
+
+// the start of the first segment at or after t_min, -1 if there is none
+int64_t first_t0_from(whisper_context * ctx, int64_t t_min) {
+    const std::vector<segment> segments = segments_from(ctx, t_min);
+    return segments.empty() ? -1 : segments[0].t0;
+}
+
+void log_quiet(ggml_log_level level, const char * text, void * /*user_data*/) {
+    if (level == GGML_LOG_LEVEL_ERROR) {
+        fputs(text, stderr);
+    }
+}
+
+} // namespace
+
+int main(int argc, char ** argv) {
+    const int n_processors = argc > 1 ? std::max(2, atoi(argv[1])) : 3;
+
+    whisper_log_set(log_quiet, nullptr);
+
+    model_writer model;
+    model.write();
+
+    whisper_context_params cparams = whisper_context_default_params();
+    cparams.use_gpu = false;
+
+    whisper_context * ctx = whisper_init_from_buffer_with_params(model.buf.data(), model.buf.size(), cparams);
+    if (ctx == nullptr) {
+        fprintf(stderr, "error: failed to load the test model\n");
+        return 1;
+    }
+
+    const std::vector<float> pcm = make_pcm(0.0, 0.0);
+
+    whisper_full_params params = whisper_full_default_params(WHISPER_SAMPLING_GREEDY);
+    params.n_threads      = 1;
+    params.no_context     = false;
+    params.print_progress = false;
+
+    // the chunks after the first split, as whisper_full_parallel() splits them without parallel_split_on_silence
+    const int64_t t_split = (100*(int64_t) (pcm.size()/n_processors))/WHISPER_SAMPLE_RATE;
+
+    std::vector<segment> first;
+    std::vector<segment> second;
+
+    int ret = whisper_full_parallel(ctx, params, pcm.data(), (int) pcm.size(), n_processors);
+    if (ret == 0) {
+        first = segments_from(ctx, t_split);
+        ret = whisper_full_parallel(ctx, params, pcm.data(), (int) pcm.size(), n_processors);
+        second = segments_from(ctx, t_split);
+    }
+
+    // the first split with a silent gap near it, with and without parallel_split_on_silence, and without the gap
+    const std::vector<float> pcm_gap = make_pcm(11.5, 12.3);
+
+    whisper_full_params params_split = params;
+    params_split.max_initial_ts = 0.5f;
+
+    int64_t t0_moved = -1;
+    int64_t t0_kept  = -1;
+    int64_t t0_tone  = -1;
+    int64_t t0_tone2 = -1;
+
+    if (ret == 0) {
+        params_split.parallel_split_on_silence = true;
+        ret = whisper_full_parallel(ctx, params_split, pcm_gap.data(), (int) pcm_gap.size(), 3);
+        t0_moved = first_t0_from(ctx, 1000);
+    }
+    if (ret == 0) {
+        params_split.parallel_split_on_silence = false;
+        ret = whisper_full_parallel(ctx, params_split, pcm_gap.data(), (int) pcm_gap.size(), 3);
+        t0_kept = first_t0_from(ctx, 1000);
+    }
+    if (ret == 0) {
+        params_split.parallel_split_on_silence = true;
+        ret = whisper_full_parallel(ctx, params_split, pcm.data(), (int) pcm.size(), 3);
+        t0_tone  = first_t0_from(ctx, 1000);
+        t0_tone2 = first_t0_from(ctx, 2000);
+    }
+
+    whisper_free(ctx);
+
+    if (ret != 0) {
+        fprintf(stderr, "error: whisper_full_parallel failed (%d)\n", ret);
+        return 1;
+    }
+
+    const bool moved = t0_moved >= 1150 && t0_moved <= 1280;
+    const bool kept  = t0_kept  >= 1000 && t0_kept  <= 1050;
+    const bool tone  = t0_tone  >= 1000 && t0_tone  <= 1050 && t0_tone2 >= 2000 && t0_tone2 <= 2050;
+
+    if (!moved || !kept || !tone) {
+        fprintf(stderr, "error: the first segments after the splits start at %.2f s (silence split, gap 11.50 s - 12.30 s), "
+                "%.2f s (even split) and %.2f s, %.2f s (silence split, no gap)\n",
+                t0_moved/100.0, t0_kept/100.0, t0_tone/100.0, t0_tone2/100.0);
+        return 1;
+    }
+
+    bool same = first.size() == second.size();
+    for (size_t i = 0; same && i < first.size(); ++i) {
+        same = first[i].t0 == second[i].t0 && first[i].t1 == second[i].t1 && first[i].text == second[i].text;
+    }
+
+    if (first.empty() || !same) {
+        fprintf(stderr, "error: %s\n", first.empty() ? "no segments after the first split" : "the second call gave different segments");
+        print_segments("first call",  first);
+        print_segments("second call", second);
+        return 1;
+    }
+
+    printf("ok: %zu segments after %.2f s, identical in both calls\n", first.size(), t_split/100.0);
+    printf("ok: the first split moved into the silence (next segment at %.2f s), and stayed at 10 s without the option or the silence\n", t0_moved/100.0);
+
+    return 0;
+}
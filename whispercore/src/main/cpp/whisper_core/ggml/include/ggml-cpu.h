@@ -58,6 +58,13 @@ extern "C" {
     GGML_BACKEND_API void                          ggml_threadpool_pause         (struct ggml_threadpool * threadpool);
     GGML_BACKEND_API void                          ggml_threadpool_resume        (struct ggml_threadpool * threadpool);
 
+    // chunks per thread for the ops that hand out their rows dynamically (0 - default)
+    // more chunks absorb slow threads (efficiency cores, noisy neighbours) better, 1 is equivalent to a static split
+    GGML_BACKEND_API void ggml_cpu_set_chunks_per_thread(int n_chunks);
+
+    // compute chains like norm -> mul -> add in one pass (default on, GGML_CPU_DISABLE_FUSION=1 turns it off)
+    GGML_BACKEND_API void ggml_cpu_set_fusion(bool enabled);
+
     // ggml_graph_plan() has to be called before ggml_graph_compute()
     // when plan.work_size > 0, caller must allocate memory for plan.work_data
     GGML_BACKEND_API struct ggml_cplan ggml_graph_plan(
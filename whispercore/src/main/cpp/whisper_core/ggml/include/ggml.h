@@ -489,6 +489,7 @@ extern "C" {
         GGML_OP_CONV_TRANSPOSE_1D,
         GGML_OP_IM2COL,
         GGML_OP_IM2COL_BACK,
+        GGML_OP_CONV_1D,
         GGML_OP_CONV_2D,
         GGML_OP_CONV_2D_DW,
         GGML_OP_CONV_TRANSPOSE_2D,
@@ -1775,6 +1776,19 @@ extern "C" {
             int                   s,  // stride
             int                   d); // dilation
 
+    // 1D convolution computed directly from the input, without an im2col buffer
+    // may be faster than ggml_conv_1d for small kernels, but not available in all backends
+    // a:   K     IC    OC        convolution kernel
+    // b:   L     IC    N         input data
+    // res: L_out OC    N
+    GGML_API struct ggml_tensor * ggml_conv_1d_direct(
+            struct ggml_context * ctx,
+            struct ggml_tensor  * a,   // convolution kernel
+            struct ggml_tensor  * b,   // data
+            int                   s0,  // stride
+            int                   p0,  // padding
+            int                   d0); // dilation
+
     // depthwise
     // TODO: this is very likely wrong for some cases! - needs more testing
     GGML_API struct ggml_tensor * ggml_conv_1d_dw(
@@ -2381,6 +2395,13 @@ extern "C" {
         GGML_SCHED_PRIO_REALTIME
     };
 
+    // how the threads wait for each other at the barrier after each graph node
+    // (OpenMP builds use the OpenMP barrier, see OMP_WAIT_POLICY)
+    enum ggml_barrier_mode {
+        GGML_BARRIER_SPIN,   // spin until the last thread arrives
+        GGML_BARRIER_HYBRID, // spin for an adaptive, bounded number of iterations, then sleep (futex on Linux)
+    };
+
     // threadpool params
     // Use ggml_threadpool_params_default() or ggml_threadpool_params_init() to populate the defaults
     struct ggml_threadpool_params {
@@ -2390,6 +2411,8 @@ extern "C" {
         uint32_t            poll;                        // polling level (0 - no polling, 100 - aggressive polling)
         bool                strict_cpu;                  // strict cpu placement
         bool                paused;                      // start in paused state
+        enum ggml_barrier_mode barrier;                  // barrier implementation
+        uint32_t            barrier_spin;                // GGML_BARRIER_HYBRID: max spin iterations before sleeping (0 - default)
     };
 
     struct ggml_threadpool;     // forward declaration, see ggml.c
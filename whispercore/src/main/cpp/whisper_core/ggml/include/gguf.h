@@ -69,11 +69,26 @@ extern "C" {
 
     struct gguf_context;
 
+    // how the tensor data of a memory-mapped file is going to be read, passed on to madvise
+    enum gguf_mmap_advice {
+        GGUF_MMAP_ADVICE_NORMAL,
+        GGUF_MMAP_ADVICE_SEQUENTIAL, // read once from front to back, e.g. copied into a backend buffer
+        GGUF_MMAP_ADVICE_RANDOM,     // read in place in any order, e.g. used directly by the CPU backend
+        GGUF_MMAP_ADVICE_WILLNEED,   // start reading the whole data section in the background
+    };
+
     struct gguf_init_params {
         bool no_alloc;
 
         // if not NULL, create a ggml_context and allocate the tensor data in it
         struct ggml_context ** ctx;
+
+        // map the file instead of reading the tensor data: the tensors in ctx and gguf_get_tensor_data point into
+        //   the mapping, which shares its pages with the page cache until they are written to (copy-on-write)
+        // the mapping is owned by the gguf_context, so free the gguf_context only after ctx
+        // falls back to reading the file if it cannot be mapped
+        bool use_mmap;
+        enum gguf_mmap_advice mmap_advice;
     };
 
     GGML_API struct gguf_context * gguf_init_empty(void);
@@ -125,6 +140,12 @@ extern "C" {
     GGML_API enum ggml_type gguf_get_tensor_type  (const struct gguf_context * ctx, int64_t tensor_id);
     GGML_API size_t         gguf_get_tensor_size  (const struct gguf_context * ctx, int64_t tensor_id);
 
+    // data of a tensor read or mapped by gguf_init_from_file, NULL if the data was not loaded
+    GGML_API const void *   gguf_get_tensor_data  (const struct gguf_context * ctx, int64_t tensor_id);
+
+    // true if the tensor data is mapped from the file (use_mmap)
+    GGML_API bool           gguf_is_mmap          (const struct gguf_context * ctx);
+
     // removes key if it exists, returns id that the key had prior to removal (-1 if it didn't exist)
     GGML_API int64_t gguf_remove_key(struct gguf_context * ctx, const char * key);
 
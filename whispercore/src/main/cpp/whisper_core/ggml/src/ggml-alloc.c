@@ -328,9 +328,20 @@ struct hash_node {
     int n_views;
     int buffer_id;
     size_t offset; // offset within the buffer
+    int block_id;  // 1 + index of the planner block holding the data, 0 if none
     bool allocated;
 };
 
+// memory allocated by ggml_dyn_tallocr_alloc while simulating the graph, shared by in-place children
+// [t_alloc, t_free] are the steps during which it is in use: 0 for leafs and inputs, i + 1 for node i
+struct alloc_block {
+    int buffer_id;
+    size_t size;   // aligned
+    int t_alloc;
+    int t_free;    // INT_MAX if never freed
+    size_t offset; // planned offset
+};
+
 struct tensor_alloc {
     int buffer_id;
     size_t offset;
@@ -360,6 +371,13 @@ struct ggml_gallocr {
 
     struct leaf_alloc * leaf_allocs; // [n_leafs]
     int n_leafs;
+
+    // lifetime planner
+    bool plan;                   // false: keep the offsets of the allocation in graph order
+    struct alloc_block * blocks; // [n_blocks]
+    int n_blocks;
+    int blocks_capacity;
+    int cur_step;
 };
 
 ggml_gallocr_t ggml_gallocr_new_n(ggml_backend_buffer_type_t * bufts, int n_bufs) {
@@ -394,6 +412,10 @@ ggml_gallocr_t ggml_gallocr_new_n(ggml_backend_buffer_type_t * bufts, int n_bufs
     }
     galloc->n_buffers = n_bufs;
 
+    // GGML_ALLOC_PLAN=0 keeps the allocation in graph order, e.g. to compare the buffer sizes
+    const char * GGML_ALLOC_PLAN = getenv("GGML_ALLOC_PLAN");
+    galloc->plan = GGML_ALLOC_PLAN == NULL || atoi(GGML_ALLOC_PLAN) != 0;
+
     return galloc;
 }
 
@@ -442,6 +464,7 @@ void ggml_gallocr_free(ggml_gallocr_t galloc) {
     free(galloc->buf_tallocs);
     free(galloc->node_allocs);
     free(galloc->leaf_allocs);
+    free(galloc->blocks);
     free(galloc);
 }
 
@@ -460,6 +483,23 @@ static bool ggml_gallocr_is_allocated(ggml_gallocr_t galloc, struct ggml_tensor
     return t->data != NULL || ggml_gallocr_hash_get(galloc, t)->allocated;
 }
 
+static int ggml_gallocr_new_block(ggml_gallocr_t galloc, int buffer_id, size_t size) {
+    if (galloc->n_blocks == galloc->blocks_capacity) {
+        galloc->blocks_capacity = MAX(256, 2*galloc->blocks_capacity);
+        galloc->blocks = realloc(galloc->blocks, galloc->blocks_capacity * sizeof(struct alloc_block));
+        GGML_ASSERT(galloc->blocks != NULL);
+    }
+
+    struct alloc_block * block = &galloc->blocks[galloc->n_blocks];
+    block->buffer_id = buffer_id;
+    block->size      = aligned_offset(NULL, size, galloc->buf_tallocs[buffer_id]->alignment);
+    block->t_alloc   = galloc->cur_step;
+    block->t_free    = INT_MAX;
+    block->offset    = 0;
+
+    return galloc->n_blocks++;
+}
+
 static void ggml_gallocr_allocate_node(ggml_gallocr_t galloc, struct ggml_tensor * node, int buffer_id) {
     GGML_ASSERT(buffer_id >= 0);
     struct hash_node * hn = ggml_gallocr_hash_get(galloc, node);
@@ -503,6 +543,7 @@ static void ggml_gallocr_allocate_node(ggml_gallocr_t galloc, struct ggml_tensor
                             assert(view_src_hn->offset == p_hn->offset);
                             hn->buffer_id = p_hn->buffer_id;
                             hn->offset = p_hn->offset;
+                            hn->block_id = view_src_hn->block_id;
                             p_hn->allocated = false; // avoid freeing the parent
                             view_src_hn->allocated = false;
                             return;
@@ -511,6 +552,7 @@ static void ggml_gallocr_allocate_node(ggml_gallocr_t galloc, struct ggml_tensor
                         AT_PRINTF("reusing parent %s for %s\n", parent->name, node->name);
                         hn->buffer_id = p_hn->buffer_id;
                         hn->offset = p_hn->offset;
+                        hn->block_id = p_hn->block_id;
                         p_hn->allocated = false; // avoid freeing the parent
                         return;
                     }
@@ -524,6 +566,7 @@ static void ggml_gallocr_allocate_node(ggml_gallocr_t galloc, struct ggml_tensor
         size_t offset = ggml_dyn_tallocr_alloc(alloc, size, node);
         hn->buffer_id = buffer_id;
         hn->offset = offset;
+        hn->block_id = 1 + ggml_gallocr_new_block(galloc, buffer_id, size);
     }
 }
 
@@ -542,6 +585,8 @@ static void ggml_gallocr_free_node(ggml_gallocr_t galloc, struct ggml_tensor * n
     size_t size = ggml_backend_buft_get_alloc_size(buft, node);
     ggml_dyn_tallocr_free_tensor(alloc, offset, size, node);
     hn->allocated = false;
+
+    galloc->blocks[hn->block_id - 1].t_free = galloc->cur_step;
 }
 
 static int get_node_buffer_id(const int * node_buffer_ids, int i) {
@@ -553,6 +598,9 @@ static void ggml_gallocr_alloc_graph_impl(ggml_gallocr_t galloc, struct ggml_cgr
     ggml_hash_set_reset(&galloc->hash_set);
     memset(galloc->hash_values, 0, sizeof(struct hash_node) * galloc->hash_set.size);
 
+    galloc->n_blocks = 0;
+    galloc->cur_step = 0;
+
     // allocate leafs
     // these may be tensors that the application is not using in the graph, but may still want to allocate for other purposes
     for (int i = 0; i < graph->n_leafs; i++) {
@@ -598,6 +646,8 @@ static void ggml_gallocr_alloc_graph_impl(ggml_gallocr_t galloc, struct ggml_cgr
         struct ggml_tensor * node = graph->nodes[i];
         int buffer_id = get_node_buffer_id(node_buffer_ids, i);
 
+        galloc->cur_step = i + 1;
+
         // allocate parents (only leafs need to be allocated at this point)
         for (int j = 0; j < GGML_MAX_SRC; j++) {
             struct ggml_tensor * parent = node->src[j];
@@ -655,6 +705,131 @@ static void ggml_gallocr_alloc_graph_impl(ggml_gallocr_t galloc, struct ggml_cgr
     }
 }
 
+static int ggml_gallocr_block_cmp(const void * a, const void * b) {
+    const struct alloc_block * ba = *(const struct alloc_block * const *) a;
+    const struct alloc_block * bb = *(const struct alloc_block * const *) b;
+    if (ba->size != bb->size) {
+        return ba->size > bb->size ? -1 : 1;
+    }
+    if (ba->t_alloc != bb->t_alloc) {
+        return ba->t_alloc < bb->t_alloc ? -1 : 1;
+    }
+    return ba < bb ? -1 : (ba > bb ? 1 : 0);
+}
+
+// offline placement of the blocks of one allocator, knowing all the lifetimes in advance:
+// the largest blocks are placed first, each in the smallest gap between the blocks already placed
+// that are alive at the same time (greedy by size with best fit), returns the size of the buffer
+static size_t ggml_gallocr_plan_blocks(struct alloc_block ** blocks, int n_blocks) {
+    qsort(blocks, n_blocks, sizeof(struct alloc_block *), ggml_gallocr_block_cmp);
+
+    // placed blocks, sorted by offset
+    struct alloc_block ** placed = malloc(MAX(1, n_blocks) * sizeof(struct alloc_block *));
+    GGML_ASSERT(placed != NULL);
+    int n_placed = 0;
+
+    size_t max_size = 0;
+
+    for (int i = 0; i < n_blocks; i++) {
+        struct alloc_block * b = blocks[i];
+
+        size_t best_offset = SIZE_MAX;
+        size_t best_gap    = SIZE_MAX;
+        size_t prev_end    = 0;
+        for (int j = 0; j < n_placed; j++) {
+            const struct alloc_block * p = placed[j];
+            if (p->t_alloc > b->t_free || b->t_alloc > p->t_free) {
+                continue; // not alive at the same time
+            }
+            if (p->offset >= prev_end) {
+                const size_t gap = p->offset - prev_end;
+                if (gap >= b->size && gap < best_gap) {
+                    best_gap    = gap;
+                    best_offset = prev_end;
+                }
+            }
+            prev_end = MAX(prev_end, p->offset + p->size);
+        }
+        b->offset = best_offset != SIZE_MAX ? best_offset : prev_end;
+        max_size = MAX(max_size, b->offset + b->size);
+
+        int pos = n_placed;
+        while (pos > 0 && placed[pos - 1]->offset > b->offset) {
+            placed[pos] = placed[pos - 1];
+            pos--;
+        }
+        placed[pos] = b;
+        n_placed++;
+    }
+
+    free(placed);
+
+    return max_size;
+}
+
+// replaces the offsets of the allocation in graph order with the planned ones for every allocator
+// where the plan needs less memory
+static void ggml_gallocr_plan(ggml_gallocr_t galloc) {
+    struct alloc_block ** blocks = malloc(MAX(1, galloc->n_blocks) * sizeof(struct alloc_block *));
+    GGML_ASSERT(blocks != NULL);
+
+    for (int i = 0; i < galloc->n_buffers; i++) {
+        struct ggml_dyn_tallocr * alloc = galloc->buf_tallocs[i];
+
+        // buffers of the same type share the allocator, plan them once
+        bool seen = false;
+        for (int j = 0; j < i; j++) {
+            if (galloc->buf_tallocs[j] == alloc) {
+                seen = true;
+                break;
+            }
+        }
+        if (seen) {
+            continue;
+        }
+
+        int n = 0;
+        for (int b = 0; b < galloc->n_blocks; b++) {
+            if (galloc->buf_tallocs[galloc->blocks[b].buffer_id] == alloc) {
+                blocks[n++] = &galloc->blocks[b];
+            }
+        }
+
+        const size_t planned_size = ggml_gallocr_plan_blocks(blocks, n);
+
+        AT_PRINTF("%s: buffer %d: %d blocks, graph order %zu bytes, planned %zu bytes\n", __func__, i, n, alloc->max_size, planned_size);
+
+        if (planned_size >= alloc->max_size) {
+            // keep the graph order offsets
+            for (int b = 0; b < n; b++) {
+                blocks[b]->offset = SIZE_MAX;
+            }
+            continue;
+        }
+
+        alloc->max_size = planned_size;
+    }
+
+    free(blocks);
+
+    // move the tensors to the planned offsets
+    for (size_t i = 0; i < galloc->hash_set.size; i++) {
+        if (!ggml_bitset_get(galloc->hash_set.used, i)) {
+            continue;
+        }
+        struct ggml_tensor * t = galloc->hash_set.keys[i];
+        struct hash_node * hn = &galloc->hash_values[i];
+        if (t->data != NULL || t->view_src != NULL || hn->block_id == 0) {
+            continue;
+        }
+        const struct alloc_block * block = &galloc->blocks[hn->block_id - 1];
+        if (block->offset != SIZE_MAX) {
+            GGML_ASSERT(galloc->buf_tallocs[block->buffer_id] == galloc->buf_tallocs[hn->buffer_id]);
+            hn->offset = block->offset;
+        }
+    }
+}
+
 bool ggml_gallocr_reserve_n(ggml_gallocr_t galloc, struct ggml_cgraph * graph, const int * node_buffer_ids, const int * leaf_buffer_ids) {
     size_t min_hash_size = graph->n_nodes + graph->n_leafs;
     // add 25% margin to avoid hash collisions
@@ -679,6 +854,10 @@ bool ggml_gallocr_reserve_n(ggml_gallocr_t galloc, struct ggml_cgraph * graph, c
     // allocate in hash table
     ggml_gallocr_alloc_graph_impl(galloc, graph, node_buffer_ids, leaf_buffer_ids);
 
+    if (galloc->plan) {
+        ggml_gallocr_plan(galloc);
+    }
+
     // set the node_allocs from the hash table
     if (galloc->n_nodes < graph->n_nodes) {
         free(galloc->node_allocs);
@@ -636,6 +636,13 @@ struct ggml_backend_sched {
     int * prev_node_backend_ids; // [graph_size]
     int * prev_leaf_backend_ids; // [graph_size]
 
+    // backend assignment of the last graph, reused for the next graph with the same topology key
+    bool       assign_valid;
+    size_t   * assign_hash_ids;         // [hash_set.size] hash slot of the leafs, then the nodes of the graph
+    uint64_t   assign_key;
+    int      * assign_node_backend_ids; // [hash_set.size]
+    int      * assign_leaf_backend_ids; // [hash_set.size]
+
     // copy of the graph with modified inputs
     struct ggml_cgraph graph;
 
@@ -847,26 +854,8 @@ static void ggml_backend_sched_set_if_supported(ggml_backend_sched_t sched, stru
     }
 }
 
-// assigns backends to ops and splits the graph into subgraphs that can be computed on the same backend
-static void ggml_backend_sched_split_graph(ggml_backend_sched_t sched, struct ggml_cgraph * graph) {
-    // reset splits
-    sched->n_splits = 0;
-    sched->n_graph_inputs = 0;
-    sched->is_reset = false;
-
-    struct ggml_init_params params = {
-        /* .mem_size =   */ sched->context_buffer_size,
-        /* .mem_buffer = */ sched->context_buffer,
-        /* .no_alloc =   */ true
-    };
-
-    ggml_free(sched->ctx);
-
-    sched->ctx = ggml_init(params);
-    if (sched->ctx == NULL) {
-        GGML_ABORT("%s: failed to initialize context\n", __func__);
-    }
-
+// assigns a backend to every node and leaf of the graph
+static void ggml_backend_sched_assign_backends(ggml_backend_sched_t sched, struct ggml_cgraph * graph) {
     // pass 1: assign backends to ops with pre-allocated inputs
     for (int i = 0; i < graph->n_leafs; i++) {
         struct ggml_tensor * leaf = graph->leafs[i];
@@ -1071,9 +1060,147 @@ static void ggml_backend_sched_split_graph(ggml_backend_sched_t sched, struct gg
             }
         }
     }
+}
+
+// hash of everything the backend assignment depends on: the tensors of the graph and how they are
+// connected, their ops, types, shapes and buffers, and the backends set by the user
+// graphs rebuilt step by step in the same context get the same tensor addresses, so hashing the
+// addresses identifies the connections without looking up every source
+// also stores the hash slot of every leaf and node in assign_hash_ids
+static uint64_t ggml_backend_sched_graph_key(ggml_backend_sched_t sched, struct ggml_cgraph * graph) {
+    enum {
+        N_OP_PARAMS = GGML_MAX_OP_PARAMS/sizeof(uint64_t),
+        N_WORDS     = 6 + 2*GGML_MAX_DIMS + GGML_MAX_SRC + N_OP_PARAMS,
+        N_LANES     = 4,
+    };
+
+    // FNV-1a over 64-bit words, in independent lanes so that the multiplies do not form one long chain
+    const uint64_t prime = 0x100000001b3ULL;
+    uint64_t h[N_LANES] = {
+        0xcbf29ce484222325ULL ^ (uint64_t) graph->n_leafs, 0xcbf29ce484222325ULL ^ (uint64_t) graph->n_nodes,
+        0x84222325cbf29ce4ULL, 0x22325cbf29ce4842ULL,
+    };
+
+    uint64_t w[(N_WORDS + N_LANES - 1)/N_LANES*N_LANES] = { 0 };
+
+    for (int i = 0; i < graph->n_leafs + graph->n_nodes; i++) {
+        struct ggml_tensor * t = i < graph->n_leafs ? graph->leafs[i] : graph->nodes[i - graph->n_leafs];
+
+        const size_t id = hash_id(t);
+        sched->assign_hash_ids[i] = id;
+
+        w[0] = (uint64_t) (uintptr_t) t;
+        w[1] = (uint64_t) (int64_t) sched->hv_tensor_backend_ids[id];
+        w[2] = ((uint64_t) t->op << 32) | ((uint64_t) t->type << 16) | (uint64_t) t->flags;
+        w[3] = t->buffer ? (uint64_t) (uintptr_t) t->buffer->buft : 0;
+        w[4] = t->buffer ? (uint64_t) t->buffer->usage + 1 : 0;
+        w[5] = (uint64_t) (uintptr_t) t->view_src;
+        for (int j = 0; j < GGML_MAX_DIMS; j++) {
+            w[6 + j]                 = (uint64_t) t->ne[j];
+            w[6 + GGML_MAX_DIMS + j] = (uint64_t) t->nb[j];
+        }
+        for (int j = 0; j < GGML_MAX_SRC; j++) {
+            w[6 + 2*GGML_MAX_DIMS + j] = (uint64_t) (uintptr_t) t->src[j];
+        }
+        // the offset of a view (e.g. the KV cache slot written by this token) does not change where it runs
+        if (ggml_is_view_op(t->op)) {
+            memset(&w[N_WORDS - N_OP_PARAMS], 0, sizeof(t->op_params));
+        } else {
+            memcpy(&w[N_WORDS - N_OP_PARAMS], t->op_params, sizeof(t->op_params));
+        }
+
+        for (size_t j = 0; j < sizeof(w)/sizeof(w[0]); j += N_LANES) {
+            for (int l = 0; l < N_LANES; l++) {
+                h[l] = (h[l] ^ w[j + l])*prime;
+            }
+        }
+    }
+
+    uint64_t key = 0;
+    for (int l = 0; l < N_LANES; l++) {
+        // murmur3 finalizer, so that every lane affects all the bits of the key
+        uint64_t x = h[l];
+        x ^= x >> 33; x *= 0xff51afd7ed558ccdULL;
+        x ^= x >> 33; x *= 0xc4ceb9fe1a85ec53ULL;
+        x ^= x >> 33;
+        key = (key ^ x)*prime;
+    }
+
+    return key;
+}
+
+// assigns backends to ops and splits the graph into subgraphs that can be computed on the same backend
+static void ggml_backend_sched_split_graph(ggml_backend_sched_t sched, struct ggml_cgraph * graph) {
+    // reset splits
+    sched->n_splits = 0;
+    sched->n_graph_inputs = 0;
+    sched->is_reset = false;
+
+    struct ggml_init_params params = {
+        /* .mem_size =   */ sched->context_buffer_size,
+        /* .mem_buffer = */ sched->context_buffer,
+        /* .no_alloc =   */ true
+    };
+
+    ggml_free(sched->ctx);
+
+    sched->ctx = ggml_init(params);
+    if (sched->ctx == NULL) {
+        GGML_ABORT("%s: failed to initialize context\n", __func__);
+    }
+
+    // with a single backend every node runs on it, so the whole graph is one split without inputs
+    // (input copies are only needed for pipeline parallelism)
+    // GGML_SCHED_DEBUG prints what the assignment passes decide (with their causes when those are
+    // compiled in), so take the full passes then, as the assignment cache below does
+    const bool single_backend = sched->n_backends == 1 && sched->n_copies == 1 && !sched->debug;
+
+    if (single_backend) {
+        for (int i = 0; i < graph->n_leafs; i++) {
+            tensor_backend_id(graph->leafs[i]) = 0;
+        }
+        for (int i = 0; i < graph->n_nodes; i++) {
+            tensor_backend_id(graph->nodes[i]) = 0;
+        }
+
+        struct ggml_backend_sched_split * split = &sched->splits[0];
+        split->backend_id = 0;
+        split->i_start    = 0;
+        split->i_end      = graph->n_nodes;
+        split->n_inputs   = 0;
+        sched->n_splits   = 1;
+    } else {
+        // decoders rebuild the same graph for every token: when the topology key matches
+        // the last graph, reuse its assignment instead of running the passes again
+        // the debug output needs the causes of the assignment, so always recompute it then
+        const bool cacheable = !sched->debug;
+        const uint64_t key = cacheable ? ggml_backend_sched_graph_key(sched, graph) : 0;
+
+        if (cacheable && sched->assign_valid && sched->assign_key == key) {
+            for (int i = 0; i < graph->n_leafs; i++) {
+                sched->hv_tensor_backend_ids[sched->assign_hash_ids[i]] = sched->assign_leaf_backend_ids[i];
+            }
+            for (int i = 0; i < graph->n_nodes; i++) {
+                sched->hv_tensor_backend_ids[sched->assign_hash_ids[graph->n_leafs + i]] = sched->assign_node_backend_ids[i];
+            }
+        } else {
+            ggml_backend_sched_assign_backends(sched, graph);
+
+            sched->assign_valid = cacheable;
+            sched->assign_key   = key;
+            if (cacheable) {
+                for (int i = 0; i < graph->n_leafs; i++) {
+                    sched->assign_leaf_backend_ids[i] = sched->hv_tensor_backend_ids[sched->assign_hash_ids[i]];
+                }
+                for (int i = 0; i < graph->n_nodes; i++) {
+                    sched->assign_node_backend_ids[i] = sched->hv_tensor_backend_ids[sched->assign_hash_ids[graph->n_leafs + i]];
+                }
+            }
+        }
+    }
 
     // pass 5: split graph, find tensors that need to be copied
-    {
+    if (!single_backend) {
         int i_split = 0;
         struct ggml_backend_sched_split * split = &sched->splits[0];
         // find the backend of the first split, skipping view ops
@@ -1235,6 +1362,23 @@ static void ggml_backend_sched_split_graph(ggml_backend_sched_t sched, struct gg
 
     struct ggml_cgraph * graph_copy = &sched->graph;
 
+    if (single_backend) {
+        sched->splits[0].graph = ggml_graph_view(graph, 0, graph->n_nodes);
+
+        for (int i = 0; i < graph->n_nodes; i++) {
+            sched->node_backend_ids[i] = 0;
+            graph_copy->nodes[i] = graph->nodes[i];
+        }
+        for (int i = 0; i < graph->n_leafs; i++) {
+            sched->leaf_backend_ids[i] = 0;
+            graph_copy->leafs[i] = graph->leafs[i];
+        }
+        graph_copy->n_nodes = graph->n_nodes;
+        graph_copy->n_leafs = graph->n_leafs;
+
+        return;
+    }
+
     for (int i = 0; i < sched->n_splits; i++) {
         struct ggml_backend_sched_split * split = &sched->splits[i];
         split->graph = ggml_graph_view(graph, split->i_start, split->i_end);
@@ -1469,6 +1613,10 @@ ggml_backend_sched_t ggml_backend_sched_new(
     sched->prev_node_backend_ids = (int *) calloc(nodes_size, sizeof(sched->prev_node_backend_ids[0]));
     sched->prev_leaf_backend_ids = (int *) calloc(nodes_size, sizeof(sched->prev_leaf_backend_ids[0]));
 
+    sched->assign_hash_ids         = (size_t *) calloc(sched->hash_set.size, sizeof(sched->assign_hash_ids[0]));
+    sched->assign_node_backend_ids = (int *) calloc(sched->hash_set.size, sizeof(sched->assign_node_backend_ids[0]));
+    sched->assign_leaf_backend_ids = (int *) calloc(sched->hash_set.size, sizeof(sched->assign_leaf_backend_ids[0]));
+
     sched->context_buffer_size = ggml_sched_max_splits*GGML_SCHED_MAX_SPLIT_INPUTS*2*sizeof(struct ggml_tensor) + ggml_graph_overhead_custom(graph_size, false);
     sched->context_buffer = (char *) malloc(sched->context_buffer_size);
 
@@ -1515,6 +1663,9 @@ void ggml_backend_sched_free(ggml_backend_sched_t sched) {
     free(sched->leaf_backend_ids);
     free(sched->prev_node_backend_ids);
     free(sched->prev_leaf_backend_ids);
+    free(sched->assign_hash_ids);
+    free(sched->assign_node_backend_ids);
+    free(sched->assign_leaf_backend_ids);
     free(sched->context_buffer);
     free(sched->graph.nodes);
     free(sched->graph.leafs);
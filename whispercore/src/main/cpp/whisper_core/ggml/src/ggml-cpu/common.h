@@ -70,4 +70,12 @@ static std::pair<int64_t, int64_t> get_thread_range(const struct ggml_compute_pa
     return {ir0, ir1};
 }
 
+// rows per chunk for ggml_compute_chunk_next() in row-wise elementwise ops,
+// at least min_elems elements so that short rows are not handed out one by one
+static int64_t get_chunk_size(const struct ggml_compute_params * params, const struct ggml_tensor * src0, int64_t min_elems = 4096) {
+    const int64_t nc = src0->ne[0];
+
+    return ggml_compute_chunk_size(params, ggml_nrows(src0), (min_elems + nc - 1)/nc);
+}
+
 #endif
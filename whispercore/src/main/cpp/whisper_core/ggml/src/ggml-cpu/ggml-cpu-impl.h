@@ -24,6 +24,9 @@ struct ggml_compute_params {
     void * wdata;
 
     struct ggml_threadpool * threadpool;
+
+    // index of the step (node, or run of fused nodes) being computed, selects the counter used by ggml_compute_chunk_next()
+    int node_n;
 };
 
 
@@ -512,6 +515,76 @@ void ggml_barrier(struct ggml_threadpool * tp);
 void ggml_threadpool_chunk_set(struct ggml_threadpool * tp, int value);
 int  ggml_threadpool_chunk_add(struct ggml_threadpool * tp, int value);
 
+int  ggml_threadpool_node_chunk_next(struct ggml_threadpool * tp, int node_n);
+
+// Dynamic work distribution for row-parallel ops
+//
+// Instead of giving thread ith the rows ith, ith + nth, ..., the rows are split into chunks
+// that the threads take on demand, so a thread that runs slow (an efficiency core, a preempted
+// vCPU) ends up with less work instead of holding up the barrier at the end of the op.
+//
+//     const int64_t dr = ggml_compute_chunk_size(params, nr, 4);
+//
+//     int64_t ir0, ir1;
+//     while (ggml_compute_chunk_next(params, nr, dr, &ir0, &ir1)) {
+//         // process rows [ir0, ir1)
+//     }
+//
+// Every thread must use the same nr and dr, and an op may only make one such pass over its rows.
+
+// default number of chunks per thread: more chunks balance better, fewer chunks cost fewer atomics
+#define GGML_COMPUTE_CHUNKS_PER_THREAD 4
+
+// rows per chunk, at least min_rows so that cheap ops amortize the atomic over enough work
+int64_t ggml_compute_chunk_size(const struct ggml_compute_params * params, int64_t nr, int64_t min_rows);
+
+static inline bool ggml_compute_chunk_next(const struct ggml_compute_params * params, int64_t nr, int64_t dr, int64_t * ir0, int64_t * ir1) {
+    const int64_t ir = (int64_t) ggml_threadpool_node_chunk_next(params->threadpool, params->node_n) * dr;
+
+    if (ir >= nr) {
+        return false;
+    }
+
+    *ir0 = ir;
+    *ir1 = ir + dr < nr ? ir + dr : nr;
+
+    return true;
+}
+
+// conv_1d runs on a copy of the input that is zero-padded and split by stride phase, so that every
+// kernel tap reads a contiguous row; each task then computes GGML_CONV_1D_TILE_OC output channels
+// x GGML_CONV_1D_TILE_L output samples, reducing over GGML_CONV_1D_TILE_IC input channels at a time
+#define GGML_CONV_1D_TILE_OC 16
+#define GGML_CONV_1D_TILE_L  256
+#define GGML_CONV_1D_TILE_IC 128
+
+// length of one stride phase of the conv_1d input copy
+static inline int64_t ggml_conv_1d_phase_len(int64_t OL, int64_t K, int s0, int d0) {
+    return OL + ((K - 1)*d0)/s0;
+}
+
+// work buffer of conv_1d in floats: the shared input copy, then a kernel tile per thread
+static inline int64_t ggml_conv_1d_wsize(int64_t K, int64_t IC, int64_t N, int64_t OL, int s0, int d0, int n_threads) {
+    return N*IC*s0*ggml_conv_1d_phase_len(OL, K, s0, d0)
+         + n_threads*GGML_CONV_1D_TILE_OC*GGML_CONV_1D_TILE_IC*K;
+}
+
+// flash_attn_ext with enough query rows runs blocked: GGML_FA_TILE_Q queries of one head
+// against GGML_FA_TILE_KV keys at a time, so that each K/V tile is reused by the whole query tile
+#define GGML_FA_TILE_Q  64
+#define GGML_FA_TILE_KV 64
+
+// per-thread work buffer of flash_attn_ext in floats, for either path
+static inline int64_t ggml_flash_attn_ext_wsize(int64_t DK, int64_t DV) {
+    const int64_t row   = 1*DK + 2*DV;
+    const int64_t tiled = DK*GGML_FA_TILE_Q                // Q tile, transposed
+                        + GGML_FA_TILE_KV*(DK + DV)      // K and V tiles
+                        + GGML_FA_TILE_KV*GGML_FA_TILE_Q // KQ^T / softmax tile
+                        + GGML_FA_TILE_Q*DV              // VKQ accumulators
+                        + 3*GGML_FA_TILE_Q;              // running max and sum, tile max
+    return MAX(row, tiled);
+}
+
 #ifdef __cplusplus
 }
 #endif
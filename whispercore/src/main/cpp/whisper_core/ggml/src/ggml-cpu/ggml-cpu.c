@@ -38,6 +38,13 @@
 #include <syscall.h>
 #endif
 
+#if defined(__linux__) && !defined(GGML_USE_OPENMP)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#define GGML_BARRIER_USE_FUTEX
+#endif
+
 #ifdef GGML_USE_OPENMP
 #include <omp.h>
 #endif
@@ -443,8 +450,15 @@ struct ggml_threadpool {
     atomic_int n_graph;       // incremented when there is work to be done (i.e each graph)
     atomic_int GGML_CACHE_ALIGN n_barrier;
     atomic_int GGML_CACHE_ALIGN n_barrier_passed;
+    atomic_int GGML_CACHE_ALIGN n_barrier_sleepers; // GGML_BARRIER_HYBRID: threads sleeping on n_barrier_passed
     atomic_int GGML_CACHE_ALIGN current_chunk; // currently processing chunk during Mat_Mul, shared between all the threads.
 
+    // chunk counters for ggml_compute_chunk_next(), consecutive nodes alternate between the two
+    // so the next node's counter can be reset without an extra barrier
+    struct {
+        atomic_int GGML_CACHE_ALIGN value;
+    } node_chunk[2];
+
     // these are atomic as an annotation for thread-sanitizer
     atomic_bool stop;         // Used for stopping the threadpool altogether
     atomic_bool pause;        // Used for pausing the threadpool or individual threads
@@ -457,6 +471,10 @@ struct ggml_threadpool {
     int32_t      prio;        // Scheduling priority
     uint32_t     poll;        // Polling level (0 - no polling)
 
+    enum ggml_barrier_mode barrier;
+    int32_t      barrier_spin_max; // GGML_BARRIER_HYBRID: upper bound of the spin budget
+    atomic_int   barrier_spin;     // GGML_BARRIER_HYBRID: current spin budget, adapted to the observed waits
+
     enum ggml_status ec;
 };
 
@@ -520,6 +538,62 @@ struct ggml_state {
 
 static struct ggml_state g_state = {0};
 
+#ifndef GGML_USE_OPENMP
+
+// GGML_BARRIER_HYBRID spin budget, in ggml_thread_cpu_relax() iterations
+#define GGML_BARRIER_SPIN_MIN     64
+#define GGML_BARRIER_SPIN_DEFAULT 16384
+
+static void ggml_barrier_sleep(struct ggml_threadpool * tp, int n_passed) {
+#ifdef GGML_BARRIER_USE_FUTEX
+    // returns right away if the barrier has been passed in the meantime
+    syscall(SYS_futex, &tp->n_barrier_passed, FUTEX_WAIT_PRIVATE, n_passed, NULL, NULL, 0);
+#else
+    GGML_UNUSED(tp);
+    GGML_UNUSED(n_passed);
+    sched_yield();
+#endif
+}
+
+static void ggml_barrier_wake(struct ggml_threadpool * tp) {
+#ifdef GGML_BARRIER_USE_FUTEX
+    syscall(SYS_futex, &tp->n_barrier_passed, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+#else
+    GGML_UNUSED(tp);
+#endif
+}
+
+// spin while the wait is likely to be short, then sleep until the last thread arrives
+// the spin budget follows twice the waits that ended while spinning and grows when a thread had to sleep,
+// the same way adaptive mutexes tune their spinning
+static void ggml_barrier_wait_hybrid(struct ggml_threadpool * tp, int n_passed) {
+    const int spin = atomic_load_explicit(&tp->barrier_spin, memory_order_relaxed);
+
+    for (int i = 0; i < spin; i++) {
+        if (atomic_load_explicit(&tp->n_barrier_passed, memory_order_relaxed) != n_passed) {
+            const int target = MIN(MAX(2*i, GGML_BARRIER_SPIN_MIN), tp->barrier_spin_max);
+            atomic_store_explicit(&tp->barrier_spin, spin + (target - spin)/8, memory_order_relaxed);
+            return;
+        }
+        ggml_thread_cpu_relax();
+    }
+
+    // the wait outlasted the budget, grow it
+    atomic_store_explicit(&tp->barrier_spin, MIN(spin + spin/8 + 1, tp->barrier_spin_max), memory_order_relaxed);
+
+    // the last thread checks for sleepers after it bumps n_barrier_passed, and we check n_barrier_passed
+    // after announcing ourselves, both seq-cst, so the wake-up cannot be missed
+    atomic_fetch_add_explicit(&tp->n_barrier_sleepers, 1, memory_order_seq_cst);
+
+    while (atomic_load_explicit(&tp->n_barrier_passed, memory_order_seq_cst) == n_passed) {
+        ggml_barrier_sleep(tp, n_passed);
+    }
+
+    atomic_fetch_sub_explicit(&tp->n_barrier_sleepers, 1, memory_order_relaxed);
+}
+
+#endif // GGML_USE_OPENMP
+
 void ggml_barrier(struct ggml_threadpool * tp) {
     int n_threads = atomic_load_explicit(&tp->n_threads_cur, memory_order_relaxed);
     if (n_threads == 1) {
@@ -540,12 +614,20 @@ void ggml_barrier(struct ggml_threadpool * tp) {
 
         // exit barrier (fill seq-cst fence)
         atomic_fetch_add_explicit(&tp->n_barrier_passed, 1, memory_order_seq_cst);
+
+        if (tp->barrier == GGML_BARRIER_HYBRID && atomic_load_explicit(&tp->n_barrier_sleepers, memory_order_seq_cst) > 0) {
+            ggml_barrier_wake(tp);
+        }
         return;
     }
 
     // wait for other threads
-    while (atomic_load_explicit(&tp->n_barrier_passed, memory_order_relaxed) == n_passed) {
-        ggml_thread_cpu_relax();
+    if (tp->barrier == GGML_BARRIER_HYBRID) {
+        ggml_barrier_wait_hybrid(tp, n_passed);
+    } else {
+        while (atomic_load_explicit(&tp->n_barrier_passed, memory_order_relaxed) == n_passed) {
+            ggml_thread_cpu_relax();
+        }
     }
 
     // exit barrier (full seq-cst fence)
@@ -566,6 +648,36 @@ int ggml_threadpool_chunk_add(struct ggml_threadpool * tp, int value) {
     return atomic_fetch_add_explicit(&tp->current_chunk, value, memory_order_relaxed);
 }
 
+int ggml_threadpool_node_chunk_next(struct ggml_threadpool * tp, int node_n) {
+    return atomic_fetch_add_explicit(&tp->node_chunk[node_n & 1].value, 1, memory_order_relaxed);
+}
+
+static int ggml_compute_chunks_per_thread = GGML_COMPUTE_CHUNKS_PER_THREAD;
+
+void ggml_cpu_set_chunks_per_thread(int n_chunks) {
+    ggml_compute_chunks_per_thread = n_chunks > 0 ? n_chunks : GGML_COMPUTE_CHUNKS_PER_THREAD;
+}
+
+int64_t ggml_compute_chunk_size(const struct ggml_compute_params * params, int64_t nr, int64_t min_rows) {
+    if (params->nth == 1) {
+        return MAX(nr, 1);
+    }
+
+    const int64_t n_chunks = (int64_t) params->nth * ggml_compute_chunks_per_thread;
+
+    // a single chunk per thread is a static split, keep it exact
+    if (ggml_compute_chunks_per_thread == 1) {
+        return MAX((nr + params->nth - 1)/params->nth, 1);
+    }
+
+    return MAX(nr/n_chunks, MAX(min_rows, 1));
+}
+
+static void ggml_threadpool_node_chunk_reset(struct ggml_threadpool * tp) {
+    atomic_store_explicit(&tp->node_chunk[0].value, 0, memory_order_relaxed);
+    atomic_store_explicit(&tp->node_chunk[1].value, 0, memory_order_relaxed);
+}
+
 #if defined(__gnu_linux__)
 static cpu_set_t ggml_get_numa_affinity(void) {
     cpu_set_t cpuset;
@@ -1193,6 +1305,135 @@ static void ggml_compute_forward_mul_mat_one_chunk(
     }
 }
 
+// small-batch mul_mat: the decoder steps multiply every weight by 1 .. n_decoders columns,
+// which is bandwidth bound, so each weight row is streamed once and used for all columns
+
+// the rows are split statically between the threads in units of GGML_MUL_MAT_GEMV_ROWS, so that the
+// output of each thread starts on a cache line of dst (the op is also called from within other ops,
+// so it does not use the per-node chunk counters)
+#define GGML_MUL_MAT_GEMV_ROWS (CACHE_LINE_SIZE/(int) sizeof(float))
+
+// weight rows to prefetch ahead of the row being multiplied
+#define GGML_MUL_MAT_GEMV_PREFETCH 2
+
+static bool ggml_compute_forward_mul_mat_use_gemv(const struct ggml_tensor * src0, const struct ggml_tensor * src1) {
+    return src1->ne[1] <= GGML_VEC_DOT_COLS_MAX && src1->type == GGML_TYPE_F32 && src0->ne[1] >= GGML_MUL_MAT_GEMV_ROWS;
+}
+
+static inline void ggml_mul_mat_gemv_prefetch(const char * row, size_t size) {
+#if defined(__GNUC__)
+    for (size_t off = 0; off < size; off += CACHE_LINE_SIZE) {
+        __builtin_prefetch(row + off, 0, 3);
+    }
+#else
+    GGML_UNUSED(row);
+    GGML_UNUSED(size);
+#endif
+}
+
+static void ggml_compute_forward_mul_mat_gemv(
+        const struct ggml_compute_params * params,
+              struct ggml_tensor * dst) {
+
+    const struct ggml_tensor * src0 = dst->src[0];
+    const struct ggml_tensor * src1 = dst->src[1];
+
+    GGML_TENSOR_BINARY_OP_LOCALS
+
+    const int ith = params->ith;
+    const int nth = params->nth;
+
+    enum ggml_type    const vec_dot_type = type_traits_cpu[src0->type].vec_dot_type;
+    ggml_from_float_t const from_float   = type_traits_cpu[vec_dot_type].from_float;
+    ggml_vec_dot_t    const vec_dot      = type_traits_cpu[src0->type].vec_dot;
+
+    // F16 weights read the F32 columns directly, the other types need them in vec_dot_type
+    const bool direct = src0->type == GGML_TYPE_F16 || vec_dot_type == GGML_TYPE_F32;
+
+    const void * wdata = src1->data;
+    size_t wb1 = nb11;
+    size_t wb2 = nb12;
+    size_t wb3 = nb13;
+
+    if (!direct) {
+        wb1 = ggml_row_size(vec_dot_type, ne10);
+        wb2 = wb1*ne11;
+        wb3 = wb2*ne12;
+
+        assert(params->wsize >= ne13*wb3);
+
+        // split every column by blocks, there are too few columns to split by rows
+        const int64_t bs  = ggml_blck_size(vec_dot_type);
+        const int64_t nbk = ne10/bs;
+        const int64_t ib0 = (ith*nbk)/nth;
+        const int64_t ib1 = ((ith + 1)*nbk)/nth;
+
+        for (int64_t i13 = 0; i13 < ne13; ++i13) {
+            for (int64_t i12 = 0; i12 < ne12; ++i12) {
+                for (int64_t i11 = 0; i11 < ne11; ++i11) {
+                    from_float((const float *) ((const char *) src1->data + i13*nb13 + i12*nb12 + i11*nb11 + ib0*bs*nb10),
+                               (char *) params->wdata + i13*wb3 + i12*wb2 + i11*wb1 + ib0*ggml_type_size(vec_dot_type),
+                               (ib1 - ib0)*bs);
+                }
+            }
+        }
+
+        wdata = params->wdata;
+
+        ggml_barrier(params->threadpool);
+    }
+
+    // broadcast factors
+    const int64_t r2 = ne12/ne02;
+    const int64_t r3 = ne13/ne03;
+
+    const int nc = (int) ne11;
+
+    const size_t row_size = ggml_row_size(src0->type, ne00);
+
+    // units of GGML_MUL_MAT_GEMV_ROWS rows of one batch
+    const int64_t nu0 = (ne01 + GGML_MUL_MAT_GEMV_ROWS - 1)/GGML_MUL_MAT_GEMV_ROWS;
+    const int64_t nu  = nu0*ne12*ne13;
+
+    const int64_t iu0 = (ith*nu)/nth;
+    const int64_t iu1 = ((ith + 1)*nu)/nth;
+
+    for (int64_t iu = iu0; iu < iu1; ++iu) {
+        const int64_t i13 = iu/(nu0*ne12);
+        const int64_t i12 = (iu/nu0) % ne12;
+
+        const int64_t ir0 = (iu % nu0)*GGML_MUL_MAT_GEMV_ROWS;
+        const int64_t ir1 = MIN(ir0 + GGML_MUL_MAT_GEMV_ROWS, ne01);
+
+        const char * src0_batch = (const char *) src0->data + (i12/r2)*nb02 + (i13/r3)*nb03;
+        const char * src1_batch = (const char *) wdata      + i12*wb2 + i13*wb3;
+              char * dst_batch  = (char *) dst->data        + i12*nb2 + i13*nb3;
+
+        float tmp[GGML_VEC_DOT_COLS_MAX];
+
+        for (int64_t ir = ir0; ir < ir1; ++ir) {
+            const char * src0_row = src0_batch + ir*nb01;
+
+            // the next unit of the thread continues with the following rows
+            if (ir + GGML_MUL_MAT_GEMV_PREFETCH < ne01) {
+                ggml_mul_mat_gemv_prefetch(src0_row + GGML_MUL_MAT_GEMV_PREFETCH*nb01, row_size);
+            }
+
+            if (src0->type == GGML_TYPE_F16) {
+                ggml_vec_dot_f16_f32_cols(ne00, tmp, (const ggml_fp16_t *) src0_row, (const float *) src1_batch, wb1, nc);
+            } else {
+                for (int c = 0; c < nc; ++c) {
+                    vec_dot(ne00, &tmp[c], 0, src0_row, 0, src1_batch + c*wb1, 0, 1);
+                }
+            }
+
+            for (int c = 0; c < nc; ++c) {
+                *(float *) (dst_batch + c*nb1 + ir*nb0) = tmp[c];
+            }
+        }
+    }
+}
+
 void ggml_compute_forward_mul_mat(
         const struct ggml_compute_params * params,
               struct ggml_tensor * dst) {
@@ -1227,6 +1468,11 @@ void ggml_compute_forward_mul_mat(
     // nb01 >= nb00 - src0 is not transposed
     //   compute by src0 rows
 
+    if (ggml_compute_forward_mul_mat_use_gemv(src0, src1)) {
+        ggml_compute_forward_mul_mat_gemv(params, dst);
+        return;
+    }
+
     // TODO: extract to "extra_op"
 #if GGML_USE_LLAMAFILE
     // broadcast factors
@@ -1866,6 +2112,10 @@ static void ggml_compute_forward(struct ggml_compute_params * params, struct ggm
             {
                 ggml_compute_forward_im2col_back_f32(params, tensor);
             } break;
+        case GGML_OP_CONV_1D:
+            {
+                ggml_compute_forward_conv_1d(params, tensor);
+            } break;
         case GGML_OP_CONV_2D:
             {
                 ggml_compute_forward_conv_2d(params, tensor);
@@ -2023,6 +2273,176 @@ static void ggml_compute_forward(struct ggml_compute_params * params, struct ggm
     }
 }
 
+// fusion of elementwise chains
+//
+// Runs of nodes like norm -> mul -> add are computed in a single pass over the last node's rows,
+// without writing the intermediate tensors and without the barriers between them. conv_1d -> add -> gelu
+// applies the bias and the activation to each output tile while it is still in cache. Every thread
+// makes the same decision from the graph alone. Set GGML_CPU_DISABLE_FUSION to turn it off.
+
+static bool ggml_cpu_fusion_enabled = true;
+
+void ggml_cpu_set_fusion(bool enabled) {
+    ggml_cpu_fusion_enabled = enabled;
+}
+
+static bool ggml_cpu_tensors_overlap(const struct ggml_tensor * a, const struct ggml_tensor * b) {
+    const char * a0 = (const char *) a->data;
+    const char * a1 = a0 + ggml_nbytes(a);
+    const char * b0 = (const char *) b->data;
+    const char * b1 = b0 + ggml_nbytes(b);
+
+    return a0 < b1 && b0 < a1;
+}
+
+// src can be read row by row while dst is written: F32 rows of the same length, broadcast over rows,
+// and either no overlap with dst or, if the kernel allows it, exactly the same elements (in-place)
+static bool ggml_cpu_fused_src_ok(const struct ggml_tensor * src, const struct ggml_tensor * dst, bool inplace_ok) {
+    if (src->type != GGML_TYPE_F32 || src->nb[0] != sizeof(float) || src->ne[0] != dst->ne[0] || !ggml_can_repeat(src, dst)) {
+        return false;
+    }
+
+    if (!ggml_cpu_tensors_overlap(src, dst)) {
+        return true;
+    }
+
+    return inplace_ok && src->data == dst->data && ggml_are_same_shape(src, dst) && ggml_are_same_stride(src, dst);
+}
+
+// conv_1d -> add(b) [-> gelu] with a per-channel bias b of shape [1, OC]
+static int ggml_graph_compute_n_fused_conv_1d(const struct ggml_cgraph * cgraph, int node_n) {
+    static const enum ggml_op ops_add[]  = { GGML_OP_CONV_1D, GGML_OP_ADD };
+    static const enum ggml_op ops_gelu[] = { GGML_OP_CONV_1D, GGML_OP_ADD, GGML_OP_UNARY };
+
+    if (!ggml_can_fuse(cgraph, node_n, ops_add, 2)) {
+        return 1;
+    }
+
+    const struct ggml_tensor * conv = cgraph->nodes[node_n];
+    const struct ggml_tensor * add  = cgraph->nodes[node_n + 1];
+    const struct ggml_tensor * b    = add->src[1];
+
+    if (add->src[0] != conv || add->type != GGML_TYPE_F32 || add->nb[0] != sizeof(float) ||
+        b->type != GGML_TYPE_F32 || b->ne[0] != 1 || b->ne[1] != conv->ne[1] || b->ne[2] != 1 || b->ne[3] != 1) {
+        return 1;
+    }
+
+    int n_fused = 2;
+    const struct ggml_tensor * last = add;
+
+    if (ggml_can_fuse(cgraph, node_n, ops_gelu, 3)) {
+        const struct ggml_tensor * gelu = cgraph->nodes[node_n + 2];
+
+        if (ggml_get_unary_op(gelu) == GGML_UNARY_OP_GELU && gelu->type == GGML_TYPE_F32 && gelu->nb[0] == sizeof(float)) {
+            n_fused = 3;
+            last    = gelu;
+        }
+    }
+
+    // the conv input is copied to the work buffer before any output is written, but the bias is read throughout
+    if (ggml_cpu_tensors_overlap(b, last)) {
+        return 1;
+    }
+
+    return n_fused;
+}
+
+// number of nodes starting at node_n that are computed as one, 1 if the node is not fused
+static int ggml_graph_compute_n_fused(const struct ggml_cgraph * cgraph, int node_n) {
+    if (!ggml_cpu_fusion_enabled) {
+        return 1;
+    }
+
+    const struct ggml_tensor * node = cgraph->nodes[node_n];
+
+    if (node->op == GGML_OP_CONV_1D) {
+        return ggml_graph_compute_n_fused_conv_1d(cgraph, node_n);
+    }
+
+    if (node->type != GGML_TYPE_F32 || node->src[0] == NULL || node->src[0]->type != GGML_TYPE_F32 || node->src[0]->nb[0] != sizeof(float)) {
+        return 1;
+    }
+
+    switch (node->op) {
+        case GGML_OP_NORM:
+            {
+                static const enum ggml_op ops[] = { GGML_OP_NORM, GGML_OP_MUL, GGML_OP_ADD };
+                if (ggml_can_fuse(cgraph, node_n, ops, 3)) {
+                    const struct ggml_tensor * mul = cgraph->nodes[node_n + 1];
+                    const struct ggml_tensor * add = cgraph->nodes[node_n + 2];
+
+                    // the mul/add writes would clobber w/b before later rows read them, so no aliasing there
+                    if (mul->src[0] == node && add->src[0] == mul && add->type == GGML_TYPE_F32 && add->nb[0] == sizeof(float) &&
+                        ggml_cpu_fused_src_ok(node->src[0], add, true) &&
+                        ggml_cpu_fused_src_ok(mul->src[1],  add, false) &&
+                        ggml_cpu_fused_src_ok(add->src[1],  add, false)) {
+                        return 3;
+                    }
+                }
+            } break;
+        case GGML_OP_ADD:
+            {
+                static const enum ggml_op ops_gelu[] = { GGML_OP_ADD, GGML_OP_UNARY };
+                static const enum ggml_op ops_add[]  = { GGML_OP_ADD, GGML_OP_ADD };
+
+                if (ggml_can_fuse(cgraph, node_n, ops_gelu, 2)) {
+                    const struct ggml_tensor * gelu = cgraph->nodes[node_n + 1];
+
+                    if (ggml_get_unary_op(gelu) == GGML_UNARY_OP_GELU && gelu->type == GGML_TYPE_F32 && gelu->nb[0] == sizeof(float) &&
+                        ggml_cpu_fused_src_ok(node->src[0], gelu, true) &&
+                        ggml_cpu_fused_src_ok(node->src[1], gelu, true)) {
+                        return 2;
+                    }
+                }
+
+                if (ggml_can_fuse(cgraph, node_n, ops_add, 2)) {
+                    const struct ggml_tensor * add = cgraph->nodes[node_n + 1];
+                    const struct ggml_tensor * r   = add->src[0] == node ? add->src[1] : add->src[0];
+
+                    if (add->type == GGML_TYPE_F32 && add->nb[0] == sizeof(float) &&
+                        ggml_cpu_fused_src_ok(node->src[0], add, true) &&
+                        ggml_cpu_fused_src_ok(node->src[1], add, true) &&
+                        ggml_cpu_fused_src_ok(r,            add, true)) {
+                        return 2;
+                    }
+                }
+            } break;
+        default:
+            break;
+    }
+
+    return 1;
+}
+
+static void ggml_compute_forward_fused(struct ggml_compute_params * params, const struct ggml_cgraph * cgraph, int node_n, int n_fused) {
+    struct ggml_tensor * node = cgraph->nodes[node_n];
+    struct ggml_tensor * last = cgraph->nodes[node_n + n_fused - 1];
+
+    switch (node->op) {
+        case GGML_OP_NORM:
+            {
+                ggml_compute_forward_norm_mul_add(params, node, cgraph->nodes[node_n + 1], last);
+            } break;
+        case GGML_OP_CONV_1D:
+            {
+                ggml_compute_forward_conv_1d_add(params, node, cgraph->nodes[node_n + 1], last);
+            } break;
+        case GGML_OP_ADD:
+            {
+                if (last->op == GGML_OP_UNARY) {
+                    ggml_compute_forward_add_gelu(params, node, last);
+                } else {
+                    ggml_compute_forward_add_add(params, node, last);
+                }
+            } break;
+        default:
+            {
+                GGML_ABORT("fatal error");
+            }
+    }
+}
+
+
 // Android's libc implementation "bionic" does not support setting affinity
 #if defined(__gnu_linux__)
 static void set_numa_thread_affinity(int thread_n) {
@@ -2234,6 +2654,7 @@ static int ggml_get_n_tasks(struct ggml_tensor * node, int n_threads) {
             } break;
         case GGML_OP_IM2COL:
         case GGML_OP_IM2COL_BACK:
+        case GGML_OP_CONV_1D:
         case GGML_OP_CONV_2D:
         case GGML_OP_CONV_2D_DW:
         case GGML_OP_CONV_TRANSPOSE_1D:
@@ -2753,6 +3174,13 @@ struct ggml_cplan ggml_graph_plan(
                             GGML_ABORT("fatal error");
                         }
                     } break;
+                case GGML_OP_CONV_1D:
+                    {
+                        const int32_t s0 = ggml_get_op_params_i32(node, 0);
+                        const int32_t d0 = ggml_get_op_params_i32(node, 2);
+
+                        cur = sizeof(float)*ggml_conv_1d_wsize(node->src[0]->ne[0], node->src[0]->ne[1], node->src[1]->ne[2], node->ne[0], s0, d0, n_tasks);
+                    } break;
                 case GGML_OP_CONV_2D:
                     {
                         cur = GGML_IM2COL_WORK_SIZE;
@@ -2776,7 +3204,7 @@ struct ggml_cplan ggml_graph_plan(
                         const int64_t ne10 = node->src[1]->ne[0]; // DK
                         const int64_t ne20 = node->src[2]->ne[0]; // DV
 
-                        cur = sizeof(float)*(1*ne10 + 2*ne20)*n_tasks; // 1x head size K + 2x head size V (per thread)
+                        cur = sizeof(float)*ggml_flash_attn_ext_wsize(ne10, ne20)*n_tasks; // per thread
                     } break;
                 case GGML_OP_FLASH_ATTN_BACK:
                     {
@@ -2838,22 +3266,42 @@ static thread_ret_t ggml_graph_compute_thread(void * data) {
         /*.wsize     =*/ cplan->work_size,
         /*.wdata     =*/ cplan->work_data,
         /*.threadpool=*/ tp,
+        /*.node_n    =*/ 0,
     };
 
-    for (int node_n = 0; node_n < cgraph->n_nodes && atomic_load_explicit(&tp->abort, memory_order_relaxed) != node_n; node_n++) {
+    int n_steps = 0;
+
+    for (int node_n = 0; node_n < cgraph->n_nodes && atomic_load_explicit(&tp->abort, memory_order_relaxed) != node_n; n_steps++) {
         struct ggml_tensor * node = cgraph->nodes[node_n];
 
-        ggml_compute_forward(&params, node);
+        // nodes fused with this one are computed in the same step and skipped
+        const int n_fused   = ggml_graph_compute_n_fused(cgraph, node_n);
+        const int node_next = node_n + n_fused;
+
+        // nobody touches the next step's chunk counter until the barrier below
+        if (state->ith == 0) {
+            atomic_store_explicit(&tp->node_chunk[(n_steps + 1) & 1].value, 0, memory_order_relaxed);
+        }
+
+        params.node_n = n_steps;
+
+        if (n_fused > 1) {
+            ggml_compute_forward_fused(&params, cgraph, node_n, n_fused);
+        } else {
+            ggml_compute_forward(&params, node);
+        }
 
         if (state->ith == 0 && cplan->abort_callback &&
                 cplan->abort_callback(cplan->abort_callback_data)) {
-            atomic_store_explicit(&tp->abort, node_n + 1, memory_order_relaxed);
+            atomic_store_explicit(&tp->abort, node_next, memory_order_relaxed);
             tp->ec    = GGML_STATUS_ABORTED;
         }
 
-        if (node_n + 1 < cgraph->n_nodes) {
+        if (node_next < cgraph->n_nodes) {
             ggml_barrier(state->threadpool);
         }
+
+        node_n = node_next;
     }
 
     ggml_barrier(state->threadpool);
@@ -3022,6 +3470,7 @@ static struct ggml_threadpool * ggml_threadpool_new_impl(
         threadpool->n_barrier        = 0;
         threadpool->n_barrier_passed = 0;
         threadpool->current_chunk    = 0;
+        ggml_threadpool_node_chunk_reset(threadpool);
         threadpool->stop             = false;
         threadpool->pause            = tpp->paused;
         threadpool->abort            = -1;
@@ -3031,6 +3480,17 @@ static struct ggml_threadpool * ggml_threadpool_new_impl(
         threadpool->poll             = tpp->poll;
         threadpool->prio             = tpp->prio;
         threadpool->ec               = GGML_STATUS_SUCCESS;
+
+        threadpool->n_barrier_sleepers = 0;
+        threadpool->barrier            = tpp->barrier;
+#ifndef GGML_USE_OPENMP
+        threadpool->barrier_spin_max   = tpp->barrier_spin > 0 ? (int32_t) MIN(tpp->barrier_spin, INT32_MAX/2) : GGML_BARRIER_SPIN_DEFAULT;
+        threadpool->barrier_spin_max   = MAX(threadpool->barrier_spin_max, GGML_BARRIER_SPIN_MIN);
+        threadpool->barrier_spin       = threadpool->barrier_spin_max;
+#else
+        threadpool->barrier_spin_max   = 0;
+        threadpool->barrier_spin       = 0;
+#endif
     }
 
     // Allocate and init workers state
@@ -3103,6 +3563,7 @@ enum ggml_status ggml_graph_compute(struct ggml_cgraph * cgraph, struct ggml_cpl
         threadpool->cgraph           = cgraph;
         threadpool->cplan            = cplan;
         threadpool->current_chunk    = 0;
+        ggml_threadpool_node_chunk_reset(threadpool);
         threadpool->abort            = -1;
         threadpool->ec               = GGML_STATUS_SUCCESS;
     }
@@ -3546,6 +4007,10 @@ void ggml_cpu_init(void) {
         ggml_init_arm_arch_features();
 #endif
 
+        if (getenv("GGML_CPU_DISABLE_FUSION")) {
+            ggml_cpu_fusion_enabled = false;
+        }
+
         is_first_call = false;
     }
 
@@ -439,6 +439,9 @@ static bool ggml_backend_cpu_device_supports_op(ggml_backend_dev_t dev, const st
         }
         case GGML_OP_IM2COL_BACK:
             return src0->type == GGML_TYPE_F32 && src1->type == GGML_TYPE_F32;
+        case GGML_OP_CONV_1D:
+            return (src0->type == GGML_TYPE_F32 || src0->type == GGML_TYPE_F16 || src0->type == GGML_TYPE_BF16) &&
+                src1->type == GGML_TYPE_F32;
         case GGML_OP_GET_ROWS_BACK:
             return src0->type == GGML_TYPE_F32 || src0->type == GGML_TYPE_F16;
         case GGML_OP_OUT_PROD:
@@ -506,6 +509,10 @@ static ggml_backend_feature * ggml_backend_cpu_get_features(ggml_backend_reg_t r
         ggml_cpu_init();
 
         std::vector<ggml_backend_feature> features;
+    #ifdef GGML_CPU_VARIANT_NAME
+        // the GGML_CPU_ALL_VARIANTS build that ggml_backend_load_best() picked
+        features.push_back({ "VARIANT", GGML_CPU_VARIANT_NAME });
+    #endif
         if (ggml_cpu_has_sse3()) {
             features.push_back({ "SSE3", "1" });
         }
@@ -646,6 +653,12 @@ static void * ggml_backend_cpu_get_proc_address(ggml_backend_reg_t reg, const ch
     if (strcmp(name, "ggml_backend_cpu_set_threadpool") == 0) {
         return (void *)ggml_backend_cpu_set_threadpool;
     }
+    if (strcmp(name, "ggml_threadpool_pause") == 0) {
+        return (void *)ggml_threadpool_pause;
+    }
+    if (strcmp(name, "ggml_threadpool_resume") == 0) {
+        return (void *)ggml_threadpool_resume;
+    }
 
     return NULL;
 
@@ -632,6 +632,11 @@ class tinyBLAS_Q0_ARM {
 #if defined(__AVX2__) || defined(__AVX512F__) || defined(__AVX__)
 template <typename TA, typename TB, typename TC>
 class tinyBLAS_Q0_AVX {
+    // q4_1/q5_1 blocks are d*q + m against q8_1 blocks carrying s = d*sum(q),
+    // so each pair of blocks adds m*s on top of the scaled integer dot product
+    static constexpr bool has_min = std::is_same<TA, block_q4_1>::value ||
+                                    std::is_same<TA, block_q5_1>::value;
+
   public:
     tinyBLAS_Q0_AVX(int64_t k,
                     const TA *A, int64_t lda,
@@ -815,10 +820,16 @@ class tinyBLAS_Q0_AVX {
             int64_t ii = m0 + job / xtiles * 4;
             int64_t jj = n0 + job % xtiles * RN;
             __m256 Cv[RN][4] = {};
+            [[maybe_unused]] __m128 Cm[RN] = {};
             for (int64_t l = 0; l < k; ++l) {
                 uint64_t a_delta = ((uint64_t)A[lda * (ii + 3) + l].d << 48) | ((uint64_t)A[lda * (ii + 2) + l].d << 32) | ((uint64_t)A[lda * (ii + 1) + l].d << 16) | (A[lda * (ii + 0) + l].d);
                 // Convert delta values for four blocks to float values
                 __m128 da = _mm_cvtph_ps(_mm_set_epi64x(0, a_delta));
+                [[maybe_unused]] __m128 ma;
+                if constexpr (has_min) {
+                    uint64_t a_min = ((uint64_t)A[lda * (ii + 3) + l].m << 48) | ((uint64_t)A[lda * (ii + 2) + l].m << 32) | ((uint64_t)A[lda * (ii + 1) + l].m << 16) | (A[lda * (ii + 0) + l].m);
+                    ma = _mm_cvtph_ps(_mm_set_epi64x(0, a_min));
+                }
                 __m256i avec0 = load(A + lda * (ii + 0) + l);
                 __m256i avec1 = load(A + lda * (ii + 1) + l);
                 __m256i avec2 = load(A + lda * (ii + 2) + l);
@@ -845,12 +856,23 @@ class tinyBLAS_Q0_AVX {
                                     updot(_mm256_sign_epi8(avec3, avec3),
                                             _mm256_sign_epi8(load(B + ldb * (jj + j) + l), avec3)),
                                     Cv[j][3]);
+                        if constexpr (has_min) {
+                            Cm[j] = madd(ma, _mm_set1_ps(unhalf(B[ldb * (jj + j) + l].s)), Cm[j]);
+                        }
                 }
             }
 
-            for (int64_t j = 0; j < RN; ++j)
-                for (int64_t i = 0; i < 4; ++i)
-                    C[ldc * (jj + j) + (ii + i)] = hsum(Cv[j][i]);
+            for (int64_t j = 0; j < RN; ++j) {
+                if constexpr (has_min) {
+                    float cm[4];
+                    _mm_storeu_ps(cm, Cm[j]);
+                    for (int64_t i = 0; i < 4; ++i)
+                        C[ldc * (jj + j) + (ii + i)] = hsum(Cv[j][i]) + cm[i];
+                } else {
+                    for (int64_t i = 0; i < 4; ++i)
+                        C[ldc * (jj + j) + (ii + i)] = hsum(Cv[j][i]);
+                }
+            }
         }
     }
 
@@ -869,10 +891,16 @@ class tinyBLAS_Q0_AVX {
             int64_t ii = m0 + job / xtiles * RM;
             int64_t jj = n0 + job % xtiles * 4;
             __m256 Cv[4][RM] = {};
+            [[maybe_unused]] __m128 Cm[RM] = {};
             for (int64_t l = 0; l < k; ++l) {
                 uint64_t b_delta = ((uint64_t)B[ldb * (jj + 3) + l].d << 48) | ((uint64_t)B[ldb * (jj + 2) + l].d << 32) | ((uint64_t)B[ldb * (jj + 1) + l].d << 16) | (B[ldb * (jj + 0) + l].d);
                 // Convert delta values for four blocks to float values
                 __m128 db = _mm_cvtph_ps(_mm_set_epi64x(0, b_delta));
+                [[maybe_unused]] __m128 sb;
+                if constexpr (has_min) {
+                    uint64_t b_sum = ((uint64_t)B[ldb * (jj + 3) + l].s << 48) | ((uint64_t)B[ldb * (jj + 2) + l].s << 32) | ((uint64_t)B[ldb * (jj + 1) + l].s << 16) | (B[ldb * (jj + 0) + l].s);
+                    sb = _mm_cvtph_ps(_mm_set_epi64x(0, b_sum));
+                }
                 __m256i bvec0 = load(B + ldb * (jj + 0) + l);
                 __m256i bvec1 = load(B + ldb * (jj + 1) + l);
                 __m256i bvec2 = load(B + ldb * (jj + 2) + l);
@@ -903,11 +931,23 @@ class tinyBLAS_Q0_AVX {
                                                             load(A + lda * (ii + i) + l)),
                                             _mm256_sign_epi8(bvec3, load(A + lda * (ii + i) + l))),
                                     Cv[3][i]);
+                    if constexpr (has_min) {
+                        Cm[i] = madd(_mm_set1_ps(unhalf(A[lda * (ii + i) + l].m)), sb, Cm[i]);
+                    }
                 }
             }
-            for (int64_t j = 0; j < 4; ++j)
-                for (int64_t i = 0; i < RM; ++i)
-                    C[ldc * (jj + j) + (ii + i)] = hsum(Cv[j][i]);
+            if constexpr (has_min) {
+                for (int64_t i = 0; i < RM; ++i) {
+                    float cm[4];
+                    _mm_storeu_ps(cm, Cm[i]);
+                    for (int64_t j = 0; j < 4; ++j)
+                        C[ldc * (jj + j) + (ii + i)] = hsum(Cv[j][i]) + cm[j];
+                }
+            } else {
+                for (int64_t j = 0; j < 4; ++j)
+                    for (int64_t i = 0; i < RM; ++i)
+                        C[ldc * (jj + j) + (ii + i)] = hsum(Cv[j][i]);
+            }
         }
     }
 #endif
@@ -926,6 +966,7 @@ class tinyBLAS_Q0_AVX {
             int64_t ii = m0 + job / xtiles * RM;
             int64_t jj = n0 + job % xtiles * RN;
             __m256 Cv[RN][RM] = {};
+            [[maybe_unused]] float Cm[RN][RM] = {};
             for (int64_t l = 0; l < k; ++l)
                 for (int64_t j = 0; j < RN; ++j)
                     for (int64_t i = 0; i < RM; ++i) {
@@ -955,10 +996,18 @@ class tinyBLAS_Q0_AVX {
                                                        unhalf(B[ldb * (jj + j) + l].d)),
                                                        udTmp,
                                                        Cv[j][i]);
+                        if constexpr (has_min) {
+                            Cm[j][i] += unhalf(A[lda * (ii + i) + l].m) *
+                                        unhalf(B[ldb * (jj + j) + l].s);
+                        }
                     }
             for (int64_t j = 0; j < RN; ++j)
                 for (int64_t i = 0; i < RM; ++i)
-                    C[ldc * (jj + j) + (ii + i)] = hsum(Cv[j][i]);
+                    if constexpr (has_min) {
+                        C[ldc * (jj + j) + (ii + i)] = hsum(Cv[j][i]) + Cm[j][i];
+                    } else {
+                        C[ldc * (jj + j) + (ii + i)] = hsum(Cv[j][i]);
+                    }
         }
     }
 
@@ -974,6 +1023,18 @@ class tinyBLAS_Q0_AVX {
         return _mm_loadu_si128(((const __m128i *)b->qs) + 1);
     }
 
+    inline __m256i load(const block_q8_1 *b) {
+        return _mm256_loadu_si256((const __m256i *)b->qs);
+    }
+
+    inline __m128i load0(const block_q8_1 *b) {
+        return _mm_loadu_si128((const __m128i *)b->qs);
+    }
+
+    inline __m128i load1(const block_q8_1 *b) {
+        return _mm_loadu_si128(((const __m128i *)b->qs) + 1);
+    }
+
     inline __m256i load(const block_q4_0 *b) {
         return _mm256_sub_epi8(denibble(b->qs), _mm256_set1_epi8(8));
     }
@@ -988,6 +1049,20 @@ class tinyBLAS_Q0_AVX {
         return _mm_sub_epi8(_mm_and_si128(_mm_set1_epi8(15), _mm_srli_epi16(x, 4)), _mm_set1_epi8(8));
     }
 
+    inline __m256i load(const block_q4_1 *b) {
+        return denibble(b->qs);
+    }
+
+    inline __m128i load0(const block_q4_1 *b) {
+        const __m128i x = _mm_loadu_si128((const __m128i *)(b->qs));
+        return _mm_and_si128(_mm_set1_epi8(15), x);
+    }
+
+    inline __m128i load1(const block_q4_1 *b) {
+        const __m128i x = _mm_loadu_si128((const __m128i *)(b->qs));
+        return _mm_and_si128(_mm_set1_epi8(15), _mm_srli_epi16(x, 4));
+    }
+
     inline __m256i load(const block_q5_0 *b) {
         return _mm256_or_si256(denibble(b->qs), bittobyte(b->qh));
     }
@@ -1018,6 +1093,36 @@ class tinyBLAS_Q0_AVX {
         return _mm_or_si128(qxh, bytesh);
     }
 
+    inline __m256i load(const block_q5_1 *b) {
+        return _mm256_or_si256(denibble(b->qs), _mm256_and_si256(bitmask(b->qh), _mm256_set1_epi8(16)));
+    }
+
+    inline __m128i load0(const block_q5_1* b) {
+        const __m128i x = _mm_loadu_si128((const __m128i *)(b->qs));
+        uint32_t x32;
+        memcpy(&x32, b->qh, sizeof(uint32_t));
+        __m128i qxl = _mm_and_si128(_mm_set1_epi8(15), x);
+        __m128i bytesl = _mm_cmpeq_epi8(_mm_set1_epi64x(-1),
+                                        _mm_or_si128(_mm_set1_epi64x(0x7fbfdfeff7fbfdfe),
+                                                     _mm_shuffle_epi8(_mm_set1_epi32(x32),
+                                                                      _mm_set_epi64x(0x0101010101010101, 0x0000000000000000))));
+        bytesl = _mm_and_si128(bytesl, _mm_set1_epi8(16));
+        return _mm_or_si128(qxl, bytesl);
+    }
+
+    inline __m128i load1(const block_q5_1* b) {
+        const __m128i x = _mm_loadu_si128((const __m128i *)(b->qs));
+        uint32_t x32;
+        memcpy(&x32, b->qh, sizeof(uint32_t));
+        __m128i qxh = _mm_and_si128(_mm_set1_epi8(15), _mm_srli_epi16(x, 4));
+        __m128i bytesh = _mm_cmpeq_epi8(_mm_set1_epi64x(-1),
+                                        _mm_or_si128(_mm_set1_epi64x(0x7fbfdfeff7fbfdfe),
+                                                     _mm_shuffle_epi8(_mm_set1_epi32(x32),
+                                                                      _mm_set_epi64x(0x0303030303030303, 0x0202020202020202))));
+        bytesh = _mm_and_si128(bytesh, _mm_set1_epi8(16));
+        return _mm_or_si128(qxh, bytesh);
+    }
+
     inline __m256i load(const block_iq4_nl *b) {
         return MM256_SET_M128I(load1(b), load0(b));
     }
@@ -1051,15 +1156,19 @@ class tinyBLAS_Q0_AVX {
                                                         _mm_srli_epi16(x, 4), 1));
     }
 
-    static inline __m256i bittobyte(const uint8_t *p) {
+    // 0xFF in byte i where bit i of the 32-bit mask at p is set
+    static inline __m256i bitmask(const uint8_t *p) {
         uint32_t x32;
         memcpy(&x32, p, sizeof(uint32_t));
-        __m256i bytes = _mm256_cmpeq_epi8(_mm256_set1_epi64x(-1),
-                                          _mm256_or_si256(_mm256_set1_epi64x(0x7fbfdfeff7fbfdfe),
-                                                          _mm256_shuffle_epi8(_mm256_set1_epi32(x32),
-                                                                              _mm256_set_epi64x(0x0303030303030303, 0x0202020202020202,
-                                                                                                0x0101010101010101, 0x0000000000000000))));
-        return _mm256_andnot_si256(bytes, _mm256_set1_epi8((char)0xF0));
+        return _mm256_cmpeq_epi8(_mm256_set1_epi64x(-1),
+                                 _mm256_or_si256(_mm256_set1_epi64x(0x7fbfdfeff7fbfdfe),
+                                                 _mm256_shuffle_epi8(_mm256_set1_epi32(x32),
+                                                                     _mm256_set_epi64x(0x0303030303030303, 0x0202020202020202,
+                                                                                       0x0101010101010101, 0x0000000000000000))));
+    }
+
+    static inline __m256i bittobyte(const uint8_t *p) {
+        return _mm256_andnot_si256(bitmask(p), _mm256_set1_epi8((char)0xF0));
     }
 
     const TA *const A;
@@ -2670,6 +2779,15 @@ bool llamafile_sgemm(const struct ggml_compute_params * params, int64_t m, int64
 
     case GGML_TYPE_F16: {
 #if defined(__AVX512F__)
+        // F32 activations are consumed as-is: this avoids the F16 copy of
+        // src1 in ggml_compute_forward_mul_mat and keeps their precision
+        if (Btype == GGML_TYPE_F32) {
+            tinyBLAS<16, __m512, __m512, ggml_fp16_t, float, float> tb{ params, k,
+                (const ggml_fp16_t *)A, lda,
+                (const float *)B, ldb,
+                (float *)C, ldc};
+            return tb.matmul(m, n);
+        }
         if (Btype == GGML_TYPE_F16) {
             tinyBLAS<16, __m512, __m512, ggml_fp16_t, ggml_fp16_t, float> tb{ params, k,
                 (const ggml_fp16_t *)A, lda,
@@ -2678,6 +2796,13 @@ bool llamafile_sgemm(const struct ggml_compute_params * params, int64_t m, int64
             return tb.matmul(m, n);
         }
 #elif (defined(__AVX__) || defined(__AVX2__)) && defined(__F16C__)
+        if (Btype == GGML_TYPE_F32) {
+            tinyBLAS<8, __m256, __m256, ggml_fp16_t, float, float> tb{ params, k,
+                (const ggml_fp16_t *)A, lda,
+                (const float *)B, ldb,
+                (float *)C, ldc};
+            return tb.matmul(m, n);
+        }
         if (Btype == GGML_TYPE_F16) {
             tinyBLAS<8, __m256, __m256, ggml_fp16_t, ggml_fp16_t, float> tb{ params, k,
                 (const ggml_fp16_t *)A, lda,
@@ -2686,6 +2811,14 @@ bool llamafile_sgemm(const struct ggml_compute_params * params, int64_t m, int64
             return tb.matmul(m, n);
         }
 #elif defined(__ARM_FEATURE_FP16_VECTOR_ARITHMETIC) && !defined(_MSC_VER)
+        // prefer F32 accumulation when the activations are still F32
+        if (Btype == GGML_TYPE_F32) {
+            tinyBLAS<4, float32x4_t, float32x4_t, ggml_fp16_t, float, float> tb{ params,
+                k, (const ggml_fp16_t *)A, lda,
+                (const float *)B, ldb,
+                (float *)C, ldc};
+            return tb.matmul(m, n);
+        }
         if (n < 8)
             return false;
         if (Btype == GGML_TYPE_F16) {
@@ -2807,6 +2940,38 @@ bool llamafile_sgemm(const struct ggml_compute_params * params, int64_t m, int64
 #endif
     }
 
+    case GGML_TYPE_Q4_1: {
+        if (Btype != GGML_TYPE_Q8_1)
+            return false;
+#if defined(__AVX2__) || defined(__AVX512F__) || defined(__AVX__)
+        tinyBLAS_Q0_AVX<block_q4_1, block_q8_1, float> tb{
+            k, (const block_q4_1 *)A, lda,
+            (const block_q8_1 *)B, ldb,
+            (float *)C, ldc,
+            params->ith, params->nth};
+        tb.matmul(m, n);
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    case GGML_TYPE_Q5_1: {
+        if (Btype != GGML_TYPE_Q8_1)
+            return false;
+#if defined(__AVX2__) || defined(__AVX512F__) || defined(__AVX__)
+        tinyBLAS_Q0_AVX<block_q5_1, block_q8_1, float> tb{
+            k, (const block_q5_1 *)A, lda,
+            (const block_q8_1 *)B, ldb,
+            (float *)C, ldc,
+            params->ith, params->nth};
+        tb.matmul(m, n);
+        return true;
+#else
+        return false;
+#endif
+    }
+
     case GGML_TYPE_IQ4_NL: {
         if (Btype != GGML_TYPE_Q8_0)
             return false;
@@ -665,54 +665,52 @@ static void ggml_compute_forward_dup_f32(
 
     GGML_TENSOR_UNARY_OP_LOCALS
 
-    const int ith = params->ith; // thread index
-    const int nth = params->nth; // number of threads
-
-    // parallelize by rows
-    const int nr = ne01;
-    // number of rows per thread
-    const int dr = (nr + nth - 1) / nth;
-    // row range for this thread
-    const int ir0 = dr * ith;
-    const int ir1 = MIN(ir0 + dr, nr);
+    // rows of the fast paths below are handed out in chunks, the generic path splits them statically
+    const int64_t nr_all = ne01*ne02*ne03;
 
     if (src0->type == dst->type &&
         ne00 == ne0 &&
         nb00 == ggml_type_size(src0->type) && nb0 == ggml_type_size(dst->type)) {
         // copy by rows
         const size_t rs = ne00*nb00;
-        for (int64_t i03 = 0; i03 < ne03; i03++) {
-            for (int64_t i02 = 0; i02 < ne02; i02++) {
-                for (int64_t i01 = ir0; i01 < ir1; i01++) {
-                    memcpy(
-                        ((char *)  dst->data + i01*nb1  + i02*nb2  + i03*nb3),
-                        ((char *) src0->data + i01*nb01 + i02*nb02 + i03*nb03),
-                        rs);
-                }
+        const int64_t dr = get_chunk_size(params, src0);
+
+        int64_t ir0, ir1;
+        while (ggml_compute_chunk_next(params, nr_all, dr, &ir0, &ir1)) {
+            for (int64_t ir = ir0; ir < ir1; ++ir) {
+                const int64_t i03 = ir/(ne02*ne01);
+                const int64_t i02 = (ir - i03*ne02*ne01)/ne01;
+                const int64_t i01 = (ir - i03*ne02*ne01 - i02*ne01);
+
+                memcpy(
+                    ((char *)  dst->data + i01*nb1  + i02*nb2  + i03*nb3),
+                    ((char *) src0->data + i01*nb01 + i02*nb02 + i03*nb03),
+                    rs);
             }
         }
         return;
     }
 
     if (ggml_is_contiguous(dst)) {
+        const int64_t dr = get_chunk_size(params, src0);
+
         // TODO: simplify
         if (nb00 == sizeof(float)) {
             if (ggml_get_type_traits_cpu(dst->type)->from_float) {
                 ggml_from_float_t const from_float = ggml_get_type_traits_cpu(dst->type)->from_float;
 
-                size_t id = 0;
                 size_t rs = nb0 * (ne00 / ggml_blck_size(dst->type));
                 char * dst_ptr = (char *) dst->data;
 
-                for (int i03 = 0; i03 < ne03; i03++) {
-                    for (int i02 = 0; i02 < ne02; i02++) {
-                        id += rs * ir0;
-                        for (int i01 = ir0; i01 < ir1; i01++) {
-                            const float * src0_ptr = (float *) ((char *) src0->data + i01*nb01 + i02*nb02 + i03*nb03);
-                            from_float(src0_ptr, dst_ptr + id, ne00);
-                            id += rs;
-                        }
-                        id += rs * (ne01 - ir1);
+                int64_t ir0, ir1;
+                while (ggml_compute_chunk_next(params, nr_all, dr, &ir0, &ir1)) {
+                    for (int64_t ir = ir0; ir < ir1; ++ir) {
+                        const int64_t i03 = ir/(ne02*ne01);
+                        const int64_t i02 = (ir - i03*ne02*ne01)/ne01;
+                        const int64_t i01 = (ir - i03*ne02*ne01 - i02*ne01);
+
+                        const float * src0_ptr = (float *) ((char *) src0->data + i01*nb01 + i02*nb02 + i03*nb03);
+                        from_float(src0_ptr, dst_ptr + ir*rs, ne00);
                     }
                 }
             } else {
@@ -721,58 +719,26 @@ static void ggml_compute_forward_dup_f32(
         } else {
             //printf("%s: this is not optimal - fix me\n", __func__);
 
-            if (dst->type == GGML_TYPE_F32) {
-                size_t id = 0;
-                float * dst_ptr = (float *) dst->data;
-
-                for (int i03 = 0; i03 < ne03; i03++) {
-                    for (int i02 = 0; i02 < ne02; i02++) {
-                        id += ne00 * ir0;
-                        for (int i01 = ir0; i01 < ir1; i01++) {
-                            for (int i00 = 0; i00 < ne00; i00++) {
-                                const float * src0_ptr = (float *) ((char *) src0->data + i00*nb00 + i01*nb01 + i02*nb02 + i03*nb03);
-
-                                dst_ptr[id] = *src0_ptr;
-                                id++;
-                            }
-                        }
-                        id += ne00 * (ne01 - ir1);
-                    }
-                }
-            } else if (dst->type == GGML_TYPE_F16) {
-                size_t id = 0;
-                ggml_fp16_t * dst_ptr = (ggml_fp16_t *) dst->data;
-
-                for (int i03 = 0; i03 < ne03; i03++) {
-                    for (int i02 = 0; i02 < ne02; i02++) {
-                        id += ne00 * ir0;
-                        for (int i01 = ir0; i01 < ir1; i01++) {
-                            for (int i00 = 0; i00 < ne00; i00++) {
-                                const float * src0_ptr = (float *) ((char *) src0->data + i00*nb00 + i01*nb01 + i02*nb02 + i03*nb03);
-
-                                dst_ptr[id] = GGML_CPU_FP32_TO_FP16(*src0_ptr);
-                                id++;
-                            }
-                        }
-                        id += ne00 * (ne01 - ir1);
-                    }
-                }
-            } else if (dst->type == GGML_TYPE_BF16) {
-                size_t id = 0;
-                ggml_bf16_t * dst_ptr = (ggml_bf16_t *) dst->data;
+            if (dst->type == GGML_TYPE_F32 || dst->type == GGML_TYPE_F16 || dst->type == GGML_TYPE_BF16) {
+                int64_t ir0, ir1;
+                while (ggml_compute_chunk_next(params, nr_all, dr, &ir0, &ir1)) {
+                    for (int64_t ir = ir0; ir < ir1; ++ir) {
+                        const int64_t i03 = ir/(ne02*ne01);
+                        const int64_t i02 = (ir - i03*ne02*ne01)/ne01;
+                        const int64_t i01 = (ir - i03*ne02*ne01 - i02*ne01);
 
-                for (int i03 = 0; i03 < ne03; i03++) {
-                    for (int i02 = 0; i02 < ne02; i02++) {
-                        id += ne00 * ir0;
-                        for (int i01 = ir0; i01 < ir1; i01++) {
-                            for (int i00 = 0; i00 < ne00; i00++) {
-                                const float * src0_ptr = (float *) ((char *) src0->data + i00*nb00 + i01*nb01 + i02*nb02 + i03*nb03);
+                        for (int64_t i00 = 0; i00 < ne00; i00++) {
+                            const float * src0_ptr = (float *) ((char *) src0->data + i00*nb00 + i01*nb01 + i02*nb02 + i03*nb03);
+                            const size_t  id       = ir*ne00 + i00;
 
-                                dst_ptr[id] = GGML_FP32_TO_BF16(*src0_ptr);
-                                id++;
+                            if (dst->type == GGML_TYPE_F32) {
+                                ((float *) dst->data)[id] = *src0_ptr;
+                            } else if (dst->type == GGML_TYPE_F16) {
+                                ((ggml_fp16_t *) dst->data)[id] = GGML_CPU_FP32_TO_FP16(*src0_ptr);
+                            } else {
+                                ((ggml_bf16_t *) dst->data)[id] = GGML_FP32_TO_BF16(*src0_ptr);
                             }
                         }
-                        id += ne00 * (ne01 - ir1);
                     }
                 }
             } else {
@@ -783,6 +749,17 @@ static void ggml_compute_forward_dup_f32(
         return;
     }
 
+    const int ith = params->ith; // thread index
+    const int nth = params->nth; // number of threads
+
+    // parallelize by rows
+    const int nr = ne01;
+    // number of rows per thread
+    const int dr = (nr + nth - 1) / nth;
+    // row range for this thread
+    const int ir0 = dr * ith;
+    const int ir1 = MIN(ir0 + dr, nr);
+
     // dst counters
 
     int64_t i10 = 0;
@@ -2591,32 +2568,28 @@ static void ggml_compute_forward_gelu_f32(
     assert(ggml_is_contiguous_1(dst));
     assert(ggml_are_same_shape(src0, dst));
 
-    const int ith = params->ith;
-    const int nth = params->nth;
-
     const int nc = src0->ne[0];
-    const int nr = ggml_nrows(src0);
-
-    // rows per thread
-    const int dr = (nr + nth - 1)/nth;
+    const int64_t nr = ggml_nrows(src0);
 
-    // row range for this thread
-    const int ir0 = dr*ith;
-    const int ir1 = MIN(ir0 + dr, nr);
+    // rows per chunk
+    const int64_t dr = get_chunk_size(params, src0);
 
-    for (int i1 = ir0; i1 < ir1; i1++) {
-        ggml_vec_gelu_f32(nc,
-                (float *) ((char *) dst->data  + i1*( dst->nb[1])),
-                (float *) ((char *) src0->data + i1*(src0->nb[1])));
+    int64_t ir0, ir1;
+    while (ggml_compute_chunk_next(params, nr, dr, &ir0, &ir1)) {
+        for (int64_t i1 = ir0; i1 < ir1; i1++) {
+            ggml_vec_gelu_f32(nc,
+                    (float *) ((char *) dst->data  + i1*( dst->nb[1])),
+                    (float *) ((char *) src0->data + i1*(src0->nb[1])));
 
 #ifndef NDEBUG
-        for (int k = 0; k < nc; k++) {
-            const float x = ((float *) ((char *) dst->data + i1*( dst->nb[1])))[k];
-            GGML_UNUSED(x);
-            assert(!isnan(x));
-            assert(!isinf(x));
-        }
+            for (int k = 0; k < nc; k++) {
+                const float x = ((float *) ((char *) dst->data + i1*( dst->nb[1])))[k];
+                GGML_UNUSED(x);
+                assert(!isnan(x));
+                assert(!isinf(x));
+            }
 #endif
+        }
     }
 }
 
@@ -2630,33 +2603,29 @@ static void ggml_compute_forward_gelu_f16(
     assert(ggml_is_contiguous_1(dst));
     assert(ggml_are_same_shape(src0, dst));
 
-    const int ith = params->ith;
-    const int nth = params->nth;
-
     const int nc = src0->ne[0];
-    const int nr = ggml_nrows(src0);
-
-    // rows per thread
-    const int dr = (nr + nth - 1)/nth;
+    const int64_t nr = ggml_nrows(src0);
 
-    // row range for this thread
-    const int ir0 = dr*ith;
-    const int ir1 = MIN(ir0 + dr, nr);
+    // rows per chunk
+    const int64_t dr = get_chunk_size(params, src0);
 
-    for (int i1 = ir0; i1 < ir1; i1++) {
-        ggml_vec_gelu_f16(nc,
-                (ggml_fp16_t *) ((char *) dst->data  + i1*( dst->nb[1])),
-                (ggml_fp16_t *) ((char *) src0->data + i1*(src0->nb[1])));
+    int64_t ir0, ir1;
+    while (ggml_compute_chunk_next(params, nr, dr, &ir0, &ir1)) {
+        for (int64_t i1 = ir0; i1 < ir1; i1++) {
+            ggml_vec_gelu_f16(nc,
+                    (ggml_fp16_t *) ((char *) dst->data  + i1*( dst->nb[1])),
+                    (ggml_fp16_t *) ((char *) src0->data + i1*(src0->nb[1])));
 
 #ifndef NDEBUG
-        for (int k = 0; k < nc; k++) {
-            const ggml_fp16_t x = ((ggml_fp16_t *) ((char *) dst->data + i1*( dst->nb[1])))[k];
-            const float v = GGML_CPU_FP16_TO_FP32(x);
-            GGML_UNUSED(v);
-            assert(!isnan(v));
-            assert(!isinf(v));
-        }
+            for (int k = 0; k < nc; k++) {
+                const ggml_fp16_t x = ((ggml_fp16_t *) ((char *) dst->data + i1*( dst->nb[1])))[k];
+                const float v = GGML_CPU_FP16_TO_FP32(x);
+                GGML_UNUSED(v);
+                assert(!isnan(v));
+                assert(!isinf(v));
+            }
 #endif
+        }
     }
 }
 
@@ -3912,9 +3881,6 @@ static void ggml_compute_forward_norm_f32(
 
     GGML_ASSERT(src0->nb[0] == sizeof(float));
 
-    const int ith = params->ith;
-    const int nth = params->nth;
-
     GGML_TENSOR_UNARY_OP_LOCALS
 
     float eps;
@@ -3922,33 +3888,38 @@ static void ggml_compute_forward_norm_f32(
 
     GGML_ASSERT(eps >= 0.0f);
 
-    // TODO: optimize
-    for (int64_t i03 = 0; i03 < ne03; i03++) {
-        for (int64_t i02 = 0; i02 < ne02; i02++) {
-            for (int64_t i01 = ith; i01 < ne01; i01 += nth) {
-                const float * x = (float *) ((char *) src0->data + i01*nb01 + i02*nb02 + i03*nb03);
+    const int64_t nr = ne01*ne02*ne03;
+    const int64_t dr = ggml_compute_chunk_size(params, nr, 4);
 
-                ggml_float sum = 0.0;
-                for (int64_t i00 = 0; i00 < ne00; i00++) {
-                    sum += (ggml_float)x[i00];
-                }
+    int64_t ir0, ir1;
+    while (ggml_compute_chunk_next(params, nr, dr, &ir0, &ir1)) {
+        for (int64_t ir = ir0; ir < ir1; ++ir) {
+            const int64_t i03 = ir/(ne02*ne01);
+            const int64_t i02 = (ir - i03*ne02*ne01)/ne01;
+            const int64_t i01 = (ir - i03*ne02*ne01 - i02*ne01);
 
-                float mean = sum/ne00;
+            const float * x = (float *) ((char *) src0->data + i01*nb01 + i02*nb02 + i03*nb03);
 
-                float * y = (float *) ((char *) dst->data + i01*nb1 + i02*nb2 + i03*nb3);
+            ggml_float sum = 0.0;
+            for (int64_t i00 = 0; i00 < ne00; i00++) {
+                sum += (ggml_float)x[i00];
+            }
 
-                ggml_float sum2 = 0.0;
-                for (int64_t i00 = 0; i00 < ne00; i00++) {
-                    float v = x[i00] - mean;
-                    y[i00] = v;
-                    sum2 += (ggml_float)(v*v);
-                }
+            float mean = sum/ne00;
 
-                float variance = sum2/ne00;
-                const float scale = 1.0f/sqrtf(variance + eps);
+            float * y = (float *) ((char *) dst->data + i01*nb1 + i02*nb2 + i03*nb3);
 
-                ggml_vec_scale_f32(ne00, y, scale);
+            ggml_float sum2 = 0.0;
+            for (int64_t i00 = 0; i00 < ne00; i00++) {
+                float v = x[i00] - mean;
+                y[i00] = v;
+                sum2 += (ggml_float)(v*v);
             }
+
+            float variance = sum2/ne00;
+            const float scale = 1.0f/sqrtf(variance + eps);
+
+            ggml_vec_scale_f32(ne00, y, scale);
         }
     }
 }
@@ -4974,27 +4945,23 @@ static void ggml_compute_forward_get_rows_q(
     assert(nb00 == ggml_type_size(type));
     assert(ggml_nrows(dst) == nr);
 
-    const int ith = params->ith;
-    const int nth = params->nth;
-
-    // rows per thread
-    const int dr = (nr + nth - 1)/nth;
-
-    // row range for this thread
-    const int ir0 = dr*ith;
-    const int ir1 = MIN(ir0 + dr, nr);
+    // rows per chunk
+    const int64_t dr = ggml_compute_chunk_size(params, nr, 8);
 
-    for (int64_t i = ir0; i < ir1; ++i) {
-        const int64_t i12 = i/(ne11*ne10);
-        const int64_t i11 = (i - i12*ne11*ne10)/ne10;
-        const int64_t i10 = (i - i12*ne11*ne10 - i11*ne10);
-        const int64_t i01 = *(int32_t *) ((char *) src1->data + i10*nb10 + i11*nb11 + i12*nb12);
+    int64_t ir0, ir1;
+    while (ggml_compute_chunk_next(params, nr, dr, &ir0, &ir1)) {
+        for (int64_t i = ir0; i < ir1; ++i) {
+            const int64_t i12 = i/(ne11*ne10);
+            const int64_t i11 = (i - i12*ne11*ne10)/ne10;
+            const int64_t i10 = (i - i12*ne11*ne10 - i11*ne10);
+            const int64_t i01 = *(int32_t *) ((char *) src1->data + i10*nb10 + i11*nb11 + i12*nb12);
 
-        GGML_ASSERT(i01 >= 0 && i01 < ne01);
+            GGML_ASSERT(i01 >= 0 && i01 < ne01);
 
-        dequantize_row_q(
-                (const void *) ((char *) src0->data + i01*nb01 + i11*nb02 + i12*nb03),
-                     (float *) ((char *)  dst->data + i10*nb1  + i11*nb2  + i12*nb3), nc);
+            dequantize_row_q(
+                    (const void *) ((char *) src0->data + i01*nb01 + i11*nb02 + i12*nb03),
+                         (float *) ((char *)  dst->data + i10*nb1  + i11*nb2  + i12*nb3), nc);
+        }
     }
 }
 
@@ -5015,27 +4982,23 @@ static void ggml_compute_forward_get_rows_f16(
     assert(nb00 == sizeof(ggml_fp16_t));
     assert(ggml_nrows(dst) == nr);
 
-    const int ith = params->ith;
-    const int nth = params->nth;
-
-    // rows per thread
-    const int dr = (nr + nth - 1)/nth;
-
-    // row range for this thread
-    const int ir0 = dr*ith;
-    const int ir1 = MIN(ir0 + dr, nr);
+    // rows per chunk
+    const int64_t dr = ggml_compute_chunk_size(params, nr, 8);
 
-    for (int64_t i = ir0; i < ir1; ++i) {
-        const int64_t i12 = i/(ne11*ne10);
-        const int64_t i11 = (i - i12*ne11*ne10)/ne10;
-        const int64_t i10 = (i - i12*ne11*ne10 - i11*ne10);
-        const int64_t i01 = *(int32_t *) ((char *) src1->data + i10*nb10 + i11*nb11 + i12*nb12);
+    int64_t ir0, ir1;
+    while (ggml_compute_chunk_next(params, nr, dr, &ir0, &ir1)) {
+        for (int64_t i = ir0; i < ir1; ++i) {
+            const int64_t i12 = i/(ne11*ne10);
+            const int64_t i11 = (i - i12*ne11*ne10)/ne10;
+            const int64_t i10 = (i - i12*ne11*ne10 - i11*ne10);
+            const int64_t i01 = *(int32_t *) ((char *) src1->data + i10*nb10 + i11*nb11 + i12*nb12);
 
-        GGML_ASSERT(i01 >= 0 && i01 < ne01);
+            GGML_ASSERT(i01 >= 0 && i01 < ne01);
 
-        ggml_cpu_fp16_to_fp32(
-            (const ggml_fp16_t*) ((char *) src0->data + i01*nb01 + i11*nb02 + i12*nb03),
-                       (float *) ((char *)  dst->data + i10*nb1  + i11*nb2  + i12*nb3), nc);
+            ggml_cpu_fp16_to_fp32(
+                (const ggml_fp16_t*) ((char *) src0->data + i01*nb01 + i11*nb02 + i12*nb03),
+                           (float *) ((char *)  dst->data + i10*nb1  + i11*nb2  + i12*nb3), nc);
+        }
     }
 }
 
@@ -5056,27 +5019,23 @@ static void ggml_compute_forward_get_rows_bf16(
     assert(nb00 == sizeof(ggml_bf16_t));
     assert(ggml_nrows(dst) == nr);
 
-    const int ith = params->ith;
-    const int nth = params->nth;
-
-    // rows per thread
-    const int dr = (nr + nth - 1)/nth;
-
-    // row range for this thread
-    const int ir0 = dr*ith;
-    const int ir1 = MIN(ir0 + dr, nr);
+    // rows per chunk
+    const int64_t dr = ggml_compute_chunk_size(params, nr, 8);
 
-    for (int64_t i = ir0; i < ir1; ++i) {
-        const int64_t i12 = i/(ne11*ne10);
-        const int64_t i11 = (i - i12*ne11*ne10)/ne10;
-        const int64_t i10 = (i - i12*ne11*ne10 - i11*ne10);
-        const int64_t i01 = *(int32_t *) ((char *) src1->data + i10*nb10 + i11*nb11 + i12*nb12);
+    int64_t ir0, ir1;
+    while (ggml_compute_chunk_next(params, nr, dr, &ir0, &ir1)) {
+        for (int64_t i = ir0; i < ir1; ++i) {
+            const int64_t i12 = i/(ne11*ne10);
+            const int64_t i11 = (i - i12*ne11*ne10)/ne10;
+            const int64_t i10 = (i - i12*ne11*ne10 - i11*ne10);
+            const int64_t i01 = *(int32_t *) ((char *) src1->data + i10*nb10 + i11*nb11 + i12*nb12);
 
-        GGML_ASSERT(i01 >= 0 && i01 < ne01);
+            GGML_ASSERT(i01 >= 0 && i01 < ne01);
 
-        ggml_cpu_bf16_to_fp32(
-            (const ggml_bf16_t *) ((char *) src0->data + i01*nb01 + i11*nb02 + i12*nb03),
-                        (float *) ((char *)  dst->data + i10*nb1  + i11*nb2  + i12*nb3), nc);
+            ggml_cpu_bf16_to_fp32(
+                (const ggml_bf16_t *) ((char *) src0->data + i01*nb01 + i11*nb02 + i12*nb03),
+                            (float *) ((char *)  dst->data + i10*nb1  + i11*nb2  + i12*nb3), nc);
+        }
     }
 }
 
@@ -5097,27 +5056,23 @@ static void ggml_compute_forward_get_rows_f32(
     assert(nb00 == sizeof(float));
     assert(ggml_nrows(dst) == nr);
 
-    const int ith = params->ith;
-    const int nth = params->nth;
-
-    // rows per thread
-    const int dr = (nr + nth - 1)/nth;
-
-    // row range for this thread
-    const int ir0 = dr*ith;
-    const int ir1 = MIN(ir0 + dr, nr);
+    // rows per chunk
+    const int64_t dr = ggml_compute_chunk_size(params, nr, 8);
 
-    for (int64_t i = ir0; i < ir1; ++i) {
-        const int64_t i12 = i/(ne11*ne10);
-        const int64_t i11 = (i - i12*ne11*ne10)/ne10;
-        const int64_t i10 = (i - i12*ne11*ne10 - i11*ne10);
-        const int64_t i01 = *(int32_t *) ((char *) src1->data + i10*nb10 + i11*nb11 + i12*nb12);
+    int64_t ir0, ir1;
+    while (ggml_compute_chunk_next(params, nr, dr, &ir0, &ir1)) {
+        for (int64_t i = ir0; i < ir1; ++i) {
+            const int64_t i12 = i/(ne11*ne10);
+            const int64_t i11 = (i - i12*ne11*ne10)/ne10;
+            const int64_t i10 = (i - i12*ne11*ne10 - i11*ne10);
+            const int64_t i01 = *(int32_t *) ((char *) src1->data + i10*nb10 + i11*nb11 + i12*nb12);
 
-        GGML_ASSERT(i01 >= 0 && i01 < ne01);
+            GGML_ASSERT(i01 >= 0 && i01 < ne01);
 
-        ggml_vec_cpy_f32(nc,
-                (float *) ((char *)  dst->data + i10*nb1  + i11*nb2  + i12*nb3),
-                (float *) ((char *) src0->data + i01*nb01 + i11*nb02 + i12*nb03));
+            ggml_vec_cpy_f32(nc,
+                    (float *) ((char *)  dst->data + i10*nb1  + i11*nb2  + i12*nb3),
+                    (float *) ((char *) src0->data + i01*nb01 + i11*nb02 + i12*nb03));
+        }
     }
 }
 
@@ -5534,7 +5489,6 @@ static void ggml_compute_forward_soft_max_f32(
     memcpy(&max_bias, (float *) dst->op_params + 1, sizeof(float));
 
     const int ith = params->ith;
-    const int nth = params->nth;
 
     GGML_TENSOR_UNARY_OP_LOCALS
 
@@ -5557,61 +5511,67 @@ static void ggml_compute_forward_soft_max_f32(
 
     const bool use_f16 = (src1 && src1->type == GGML_TYPE_F16);
 
-    for (int64_t i03 = 0; i03 < ne03; i03++) {
-        for (int64_t i02 = 0; i02 < ne02; i02++) {
-            for (int64_t i01 = ith; i01 < ne01; i01 += nth) {
-                const int64_t i11 = i01;
-                const int64_t i12 = i02%ne12;
-                const int64_t i13 = i03%ne13;
-
-                // ALiBi
-                const uint32_t h = i02; // head
-                const float slope = (max_bias > 0.0f) ? h < n_head_log2 ? powf(m0, h + 1) : powf(m1, 2*(h - n_head_log2) + 1) : 1.0f;
-
-                float * sp = (float *)((char *) src0->data + i01*nb01 + i02*nb02 + i03*nb03);
-                float * dp = (float *)((char *)  dst->data + i01*nb1  + i02*nb2  + i03*nb3);
-
-                // broadcast the mask across rows
-                ggml_fp16_t * mp_f16 = src1 ? (ggml_fp16_t *)((char *) src1->data + i11*nb11 + i12*nb12 + i13*nb13) : NULL;
-                float       * mp_f32 = src1 ? (float       *)((char *) src1->data + i11*nb11 + i12*nb12 + i13*nb13) : NULL;
-
-                ggml_vec_cpy_f32  (ne00, wp, sp);
-                ggml_vec_scale_f32(ne00, wp, scale);
-                if (mp_f32) {
-                    if (use_f16) {
-                        for (int i = 0; i < ne00; ++i) {
-                            wp[i] += slope*GGML_CPU_FP16_TO_FP32(mp_f16[i]);
-                        }
-                    } else {
-                        for (int i = 0; i < ne00; ++i) {
-                            wp[i] += slope*mp_f32[i];
-                        }
+    const int64_t nr = ne01*ne02*ne03;
+    const int64_t dr = ggml_compute_chunk_size(params, nr, 1);
+
+    int64_t ir0, ir1;
+    while (ggml_compute_chunk_next(params, nr, dr, &ir0, &ir1)) {
+        for (int64_t ir = ir0; ir < ir1; ++ir) {
+            const int64_t i03 = ir/(ne02*ne01);
+            const int64_t i02 = (ir - i03*ne02*ne01)/ne01;
+            const int64_t i01 = (ir - i03*ne02*ne01 - i02*ne01);
+
+            const int64_t i11 = i01;
+            const int64_t i12 = i02%ne12;
+            const int64_t i13 = i03%ne13;
+
+            // ALiBi
+            const uint32_t h = i02; // head
+            const float slope = (max_bias > 0.0f) ? h < n_head_log2 ? powf(m0, h + 1) : powf(m1, 2*(h - n_head_log2) + 1) : 1.0f;
+
+            float * sp = (float *)((char *) src0->data + i01*nb01 + i02*nb02 + i03*nb03);
+            float * dp = (float *)((char *)  dst->data + i01*nb1  + i02*nb2  + i03*nb3);
+
+            // broadcast the mask across rows
+            ggml_fp16_t * mp_f16 = src1 ? (ggml_fp16_t *)((char *) src1->data + i11*nb11 + i12*nb12 + i13*nb13) : NULL;
+            float       * mp_f32 = src1 ? (float       *)((char *) src1->data + i11*nb11 + i12*nb12 + i13*nb13) : NULL;
+
+            ggml_vec_cpy_f32  (ne00, wp, sp);
+            ggml_vec_scale_f32(ne00, wp, scale);
+            if (mp_f32) {
+                if (use_f16) {
+                    for (int i = 0; i < ne00; ++i) {
+                        wp[i] += slope*GGML_CPU_FP16_TO_FP32(mp_f16[i]);
+                    }
+                } else {
+                    for (int i = 0; i < ne00; ++i) {
+                        wp[i] += slope*mp_f32[i];
                     }
                 }
+            }
 
 #ifndef NDEBUG
-                for (int i = 0; i < ne00; ++i) {
-                    //printf("p[%d] = %f\n", i, p[i]);
-                    assert(!isnan(wp[i]));
-                }
+            for (int i = 0; i < ne00; ++i) {
+                //printf("p[%d] = %f\n", i, p[i]);
+                assert(!isnan(wp[i]));
+            }
 #endif
 
-                float max = -INFINITY;
-                ggml_vec_max_f32(ne00, &max, wp);
+            float max = -INFINITY;
+            ggml_vec_max_f32(ne00, &max, wp);
 
-                ggml_float sum = ggml_vec_soft_max_f32(ne00, dp, wp, max);
-                assert(sum > 0.0);
+            ggml_float sum = ggml_vec_soft_max_f32(ne00, dp, wp, max);
+            assert(sum > 0.0);
 
-                sum = 1.0/sum;
-                ggml_vec_scale_f32(ne00, dp, sum);
+            sum = 1.0/sum;
+            ggml_vec_scale_f32(ne00, dp, sum);
 
 #ifndef NDEBUG
-                for (int i = 0; i < ne00; ++i) {
-                    assert(!isnan(dp[i]));
-                    assert(!isinf(dp[i]));
-                }
-#endif
+            for (int i = 0; i < ne00; ++i) {
+                assert(!isnan(dp[i]));
+                assert(!isinf(dp[i]));
             }
+#endif
         }
     }
 }
@@ -6891,39 +6851,269 @@ static void ggml_call_mul_mat(ggml_type type, const ggml_compute_params * params
     ggml_compute_forward_mul_mat(params, &dst);
 }
 
-// ggml_compute_forward_conv_2d
-
-static void ggml_compute_forward_conv_2d_impl(const ggml_compute_params * params,
-                                              const ggml_tensor *         kernel,  // [KW, KH, IC, OC]
-                                              const ggml_tensor *         src,     // [W, H, C, N]
-                                              ggml_tensor *               dst,     // [OW, OH, OC, N]
-                                              ggml_type                   kernel_type) {
+// small F32 GEMMs on tiles in the work buffer, used by the blocked conv_1d and flash_attn_ext
+//
+// C[m x n] += A[m x k] * B[k x n], F32, B and C row-major with leading dimensions ldb/ldc,
+// A[i][p] at A[i*a_rs + p*a_cs] so that it can be read transposed
 
-    GGML_ASSERT(ggml_is_contiguous(kernel));
-    GGML_ASSERT(kernel_type == GGML_TYPE_F16 || kernel_type == GGML_TYPE_F32);
-    GGML_ASSERT(kernel->type == kernel_type);
+#if defined(GGML_SIMD) && !defined(__ARM_FEATURE_SVE) && !defined(__riscv_v_intrinsic)
+template <int RM, int RN>
+static inline void ggml_gemm_f32_tile_kernel(
+        int64_t k, const float * GGML_RESTRICT A, int64_t a_rs, int64_t a_cs,
+        const float * GGML_RESTRICT B, int64_t ldb, float * GGML_RESTRICT C, int64_t ldc) {
+    GGML_F32_VEC c[RM][RN];
 
-    const ggml_type_traits * traits = ggml_get_type_traits(kernel_type);
+    for (int r = 0; r < RM; ++r) {
+        for (int v = 0; v < RN; ++v) {
+            c[r][v] = GGML_F32_VEC_LOAD(C + r*ldc + v*GGML_F32_EPR);
+        }
+    }
 
-    const int32_t stride_x   = dst->op_params[0];
-    const int32_t stride_y   = dst->op_params[1];
-    const int32_t pad_x      = dst->op_params[2];
-    const int32_t pad_y      = dst->op_params[3];
-    const int32_t dilation_x = dst->op_params[4];
-    const int32_t dilation_y = dst->op_params[5];
+    for (int64_t p = 0; p < k; ++p) {
+        GGML_F32_VEC b[RN];
+        for (int v = 0; v < RN; ++v) {
+            b[v] = GGML_F32_VEC_LOAD(B + p*ldb + v*GGML_F32_EPR);
+        }
+        for (int r = 0; r < RM; ++r) {
+            const GGML_F32_VEC a = GGML_F32_VEC_SET1(A[r*a_rs + p*a_cs]);
+            for (int v = 0; v < RN; ++v) {
+                c[r][v] = GGML_F32_VEC_FMA(c[r][v], b[v], a);
+            }
+        }
+    }
 
-    const int64_t c_in  = src->ne[2];
-    const int64_t c_out = kernel->ne[3];
-    GGML_ASSERT(c_in == kernel->ne[2]);
+    for (int r = 0; r < RM; ++r) {
+        for (int v = 0; v < RN; ++v) {
+            GGML_F32_VEC_STORE(C + r*ldc + v*GGML_F32_EPR, c[r][v]);
+        }
+    }
+}
 
-    const int64_t src_w = src->ne[0];
-    const int64_t src_h = src->ne[1];
-    const int64_t knl_w = kernel->ne[0];
-    const int64_t knl_h = kernel->ne[1];
-    const int64_t dst_w = dst->ne[0];
-    const int64_t dst_h = dst->ne[1];
+template <int RM>
+static inline void ggml_gemm_f32_tile_rows(
+        int64_t n, int64_t k, const float * GGML_RESTRICT A, int64_t a_rs, int64_t a_cs,
+        const float * GGML_RESTRICT B, int64_t ldb, float * GGML_RESTRICT C, int64_t ldc) {
+    int64_t j = 0;
+    for (; j + 2*GGML_F32_EPR <= n; j += 2*GGML_F32_EPR) {
+        ggml_gemm_f32_tile_kernel<RM, 2>(k, A, a_rs, a_cs, B + j, ldb, C + j, ldc);
+    }
+    for (; j + GGML_F32_EPR <= n; j += GGML_F32_EPR) {
+        ggml_gemm_f32_tile_kernel<RM, 1>(k, A, a_rs, a_cs, B + j, ldb, C + j, ldc);
+    }
+    for (; j < n; ++j) {
+        for (int r = 0; r < RM; ++r) {
+            float sum = C[r*ldc + j];
+            for (int64_t p = 0; p < k; ++p) {
+                sum += A[r*a_rs + p*a_cs]*B[p*ldb + j];
+            }
+            C[r*ldc + j] = sum;
+        }
+    }
+}
+#endif
 
-    const float * src_data = (float *) src->data;
+static void ggml_gemm_f32_tile(
+        int64_t m, int64_t n, int64_t k, const float * GGML_RESTRICT A, int64_t a_rs, int64_t a_cs,
+        const float * GGML_RESTRICT B, int64_t ldb, float * GGML_RESTRICT C, int64_t ldc) {
+    int64_t i = 0;
+#if defined(GGML_SIMD) && !defined(__ARM_FEATURE_SVE) && !defined(__riscv_v_intrinsic)
+    for (; i + 4 <= m; i += 4) {
+        ggml_gemm_f32_tile_rows<4>(n, k, A + i*a_rs, a_rs, a_cs, B, ldb, C + i*ldc, ldc);
+    }
+    for (; i < m; ++i) {
+        ggml_gemm_f32_tile_rows<1>(n, k, A + i*a_rs, a_rs, a_cs, B, ldb, C + i*ldc, ldc);
+    }
+#else
+    for (; i < m; ++i) {
+        for (int64_t p = 0; p < k; ++p) {
+            ggml_vec_mad_f32(n, C + i*ldc, B + p*ldb, A[i*a_rs + p*a_cs]);
+        }
+    }
+#endif
+}
+
+// ggml_compute_forward_conv_1d
+
+// rows of the convolution kernel to F32, with the SIMD conversions of the CPU backend
+static void ggml_conv_1d_kernel_to_f32(ggml_type type, const void * x, float * y, int64_t n) {
+    switch (type) {
+        case GGML_TYPE_F32:  memcpy(y, x, n*sizeof(float));                            break;
+        case GGML_TYPE_F16:  ggml_cpu_fp16_to_fp32((const ggml_fp16_t *) x, y, n); break;
+        case GGML_TYPE_BF16: ggml_cpu_bf16_to_fp32((const ggml_bf16_t *) x, y, n); break;
+        default:             GGML_ABORT("fatal error");
+    }
+}
+
+// dst[oc][t] = sum_ic sum_k kernel[oc][ic][k] * src[ic][t*s0 + k*d0 - p0], plus bias[oc] and GELU if given
+//
+// Instead of building the [K*IC x OL] im2col matrix, every kernel tap k reads the rows of the input
+// copy at a fixed offset, so the convolution is a sum of K small GEMMs per tile:
+//   dst[OC tile][L tile] += kernel[OC tile][IC block][k] * xs[IC block][L tile + offset(k)]
+static void ggml_compute_forward_conv_1d_impl(
+        const ggml_compute_params * params,
+        const ggml_tensor * conv,
+        const ggml_tensor * bias, // [1, OC] or NULL
+        bool                gelu,
+        ggml_tensor * dst) {
+
+    const ggml_tensor * kernel = conv->src[0]; // [K, IC, OC]
+    const ggml_tensor * src    = conv->src[1]; // [L, IC, N]
+
+    GGML_ASSERT(ggml_is_contiguous(kernel));
+    GGML_ASSERT(src->type == GGML_TYPE_F32 && src->nb[0] == sizeof(float));
+    GGML_ASSERT(dst->type == GGML_TYPE_F32 && dst->nb[0] == sizeof(float));
+
+    const int32_t s0 = ggml_get_op_params_i32(conv, 0);
+    const int32_t p0 = ggml_get_op_params_i32(conv, 1);
+    const int32_t d0 = ggml_get_op_params_i32(conv, 2);
+
+    const int64_t K  = kernel->ne[0];
+    const int64_t IC = kernel->ne[1];
+    const int64_t OC = kernel->ne[2];
+    const int64_t L  = src->ne[0];
+    const int64_t N  = src->ne[2];
+    const int64_t OL = dst->ne[0];
+
+    GGML_ASSERT(src->ne[1] == IC);
+    GGML_ASSERT(dst->ne[1] == OC && dst->ne[2] == N);
+
+    const int ith = params->ith;
+    const int nth = params->nth;
+
+    const int64_t BOC = GGML_CONV_1D_TILE_OC;
+    const int64_t BL  = GGML_CONV_1D_TILE_L;
+    const int64_t BIC = GGML_CONV_1D_TILE_IC;
+
+    const int64_t LP  = ggml_conv_1d_phase_len(OL, K, s0, d0);
+    const int64_t ics = s0*LP; // input channel stride of the copy
+
+    GGML_ASSERT(params->wsize >= sizeof(float)*ggml_conv_1d_wsize(K, IC, N, OL, s0, d0, nth));
+
+    float * xs = (float *) params->wdata;
+    float * wf = xs + N*IC*ics + ith*BOC*BIC*K;
+
+    // xs[n][ic][ph][j] = src[n][ic][j*s0 + ph - p0], zero outside of the input
+    {
+        const int64_t nr  = N*IC;
+        const int64_t dr  = (nr + nth - 1)/nth;
+        const int64_t ir0 = dr*ith;
+        const int64_t ir1 = MIN(ir0 + dr, nr);
+
+        for (int64_t ir = ir0; ir < ir1; ++ir) {
+            const float * x = (const float *) ((const char *) src->data + (ir % IC)*src->nb[1] + (ir / IC)*src->nb[2]);
+
+            for (int64_t ph = 0; ph < s0; ++ph) {
+                float * y = xs + ir*ics + ph*LP;
+
+                const int64_t j0 = MIN(LP, p0 > ph ? (p0 - ph + s0 - 1)/s0 : 0);
+                const int64_t j1 = MAX(j0, MIN(LP, L - 1 + p0 - ph >= 0 ? (L - 1 + p0 - ph)/s0 + 1 : 0));
+
+                memset(y, 0, j0*sizeof(float));
+                if (s0 == 1) {
+                    memcpy(y + j0, x + j0 + ph - p0, (j1 - j0)*sizeof(float));
+                } else {
+                    for (int64_t j = j0; j < j1; ++j) {
+                        y[j] = x[j*s0 + ph - p0];
+                    }
+                }
+                memset(y + j1, 0, (LP - j1)*sizeof(float));
+            }
+        }
+    }
+
+    // src is not read after this point, so dst may share its memory
+    ggml_barrier(params->threadpool);
+
+    const int64_t n_oc = (OC + BOC - 1)/BOC;
+    const int64_t n_l  = (OL + BL  - 1)/BL;
+    const int64_t nr   = N*n_l*n_oc;
+
+    const int64_t ldc = dst->nb[1]/sizeof(float);
+
+    int64_t ir0, ir1;
+    while (ggml_compute_chunk_next(params, nr, 1, &ir0, &ir1)) {
+        for (int64_t ir = ir0; ir < ir1; ++ir) {
+            const int64_t i2  = ir/(n_l*n_oc);
+            const int64_t oc0 = (ir % n_oc)*BOC;
+            const int64_t t0  = ((ir/n_oc) % n_l)*BL;
+            const int64_t noc = MIN(BOC, OC - oc0);
+            const int64_t nt  = MIN(BL,  OL - t0);
+
+            const float * x = xs + i2*IC*ics + t0;
+                  float * y = (float *) ((char *) dst->data + oc0*dst->nb[1] + i2*dst->nb[2]) + t0;
+
+            for (int64_t r = 0; r < noc; ++r) {
+                memset(y + r*ldc, 0, nt*sizeof(float));
+            }
+
+            for (int64_t ic0 = 0; ic0 < IC; ic0 += BIC) {
+                const int64_t nic = MIN(BIC, IC - ic0);
+
+                for (int64_t r = 0; r < noc; ++r) {
+                    const char * w = (const char *) kernel->data + (oc0 + r)*kernel->nb[2] + ic0*kernel->nb[1];
+                    ggml_conv_1d_kernel_to_f32(kernel->type, w, wf + r*nic*K, nic*K);
+                }
+
+                for (int64_t k = 0; k < K; ++k) {
+                    const int64_t off = ((k*d0) % s0)*LP + (k*d0)/s0;
+                    ggml_gemm_f32_tile(noc, nt, nic, wf + k, nic*K, K, x + ic0*ics + off, ics, y, ldc);
+                }
+            }
+
+            if (bias || gelu) {
+                for (int64_t r = 0; r < noc; ++r) {
+                    if (bias) {
+                        ggml_vec_acc1_f32(nt, y + r*ldc, *(const float *) ((const char *) bias->data + (oc0 + r)*bias->nb[1]));
+                    }
+                    if (gelu) {
+                        ggml_vec_gelu_f32(nt, y + r*ldc, y + r*ldc);
+                    }
+                }
+            }
+        }
+    }
+}
+
+void ggml_compute_forward_conv_1d(
+        const ggml_compute_params * params,
+        ggml_tensor * dst) {
+    ggml_compute_forward_conv_1d_impl(params, dst, nullptr, false, dst);
+}
+
+// ggml_compute_forward_conv_2d
+// ggml_compute_forward_conv_2d
+
+static void ggml_compute_forward_conv_2d_impl(const ggml_compute_params * params,
+                                              const ggml_tensor *         kernel,  // [KW, KH, IC, OC]
+                                              const ggml_tensor *         src,     // [W, H, C, N]
+                                              ggml_tensor *               dst,     // [OW, OH, OC, N]
+                                              ggml_type                   kernel_type) {
+
+    GGML_ASSERT(ggml_is_contiguous(kernel));
+    GGML_ASSERT(kernel_type == GGML_TYPE_F16 || kernel_type == GGML_TYPE_F32);
+    GGML_ASSERT(kernel->type == kernel_type);
+
+    const ggml_type_traits * traits = ggml_get_type_traits(kernel_type);
+
+    const int32_t stride_x   = dst->op_params[0];
+    const int32_t stride_y   = dst->op_params[1];
+    const int32_t pad_x      = dst->op_params[2];
+    const int32_t pad_y      = dst->op_params[3];
+    const int32_t dilation_x = dst->op_params[4];
+    const int32_t dilation_y = dst->op_params[5];
+
+    const int64_t c_in  = src->ne[2];
+    const int64_t c_out = kernel->ne[3];
+    GGML_ASSERT(c_in == kernel->ne[2]);
+
+    const int64_t src_w = src->ne[0];
+    const int64_t src_h = src->ne[1];
+    const int64_t knl_w = kernel->ne[0];
+    const int64_t knl_h = kernel->ne[1];
+    const int64_t dst_w = dst->ne[0];
+    const int64_t dst_h = dst->ne[1];
+
+    const float * src_data = (float *) src->data;
     void  * knl_data       = kernel->data;
     float * dst_data       = (float *) dst->data;
 
@@ -8005,7 +8195,6 @@ static void ggml_compute_forward_flash_attn_ext_f16(
     GGML_TENSOR_LOCALS(size_t,  nb,  dst, nb)
 
     const int ith = params->ith;
-    const int nth = params->nth;
 
     const int64_t DK = nek0;
     const int64_t DV = nev0;
@@ -8040,15 +8229,9 @@ static void ggml_compute_forward_flash_attn_ext_f16(
 
     // parallelize by q rows using ggml_vec_dot_f32
 
-    // total rows in q
-    const int nr = neq1*neq2*neq3;
-
-    // rows per thread
-    const int dr = (nr + nth - 1)/nth;
-
-    // row range for this thread
-    const int ir0 = dr*ith;
-    const int ir1 = MIN(ir0 + dr, nr);
+    // total rows in q, handed out in chunks: each row is a full pass over the KV cache
+    const int64_t nr = neq1*neq2*neq3;
+    const int64_t dr = ggml_compute_chunk_size(params, nr, 1);
 
     float scale         = 1.0f;
     float max_bias      = 0.0f;
@@ -8076,133 +8259,403 @@ static void ggml_compute_forward_flash_attn_ext_f16(
     GGML_ASSERT((                            q_to_vec_dot) && "fattn: unsupported K-type");
     GGML_ASSERT((v->type == GGML_TYPE_F32 || v_to_float  ) && "fattn: unsupported V-type");
 
-    // loop over n_batch and n_head
-    for (int ir = ir0; ir < ir1; ++ir) {
-        // q indices
-        const int iq3 = ir/(neq2*neq1);
-        const int iq2 = (ir - iq3*neq2*neq1)/neq1;
-        const int iq1 = (ir - iq3*neq2*neq1 - iq2*neq1);
+    int64_t ir0, ir1;
+    while (ggml_compute_chunk_next(params, nr, dr, &ir0, &ir1)) {
+        // loop over n_batch and n_head
+        for (int64_t ir = ir0; ir < ir1; ++ir) {
+            // q indices
+            const int iq3 = ir/(neq2*neq1);
+            const int iq2 = (ir - iq3*neq2*neq1)/neq1;
+            const int iq1 = (ir - iq3*neq2*neq1 - iq2*neq1);
 
-        const uint32_t h = iq2; // head index
-        const float slope = (max_bias > 0.0f) ? h < n_head_log2 ? powf(m0, h + 1) : powf(m1, 2*(h - n_head_log2) + 1) : 1.0f;
+            const uint32_t h = iq2; // head index
+            const float slope = (max_bias > 0.0f) ? h < n_head_log2 ? powf(m0, h + 1) : powf(m1, 2*(h - n_head_log2) + 1) : 1.0f;
 
-        float S = 0.0f;      // sum
-        float M = -INFINITY; // maximum KQ value
+            float S = 0.0f;      // sum
+            float M = -INFINITY; // maximum KQ value
 
-        float       * VKQ32 = (float       *) params->wdata + ith*(1*DK + 2*DV + CACHE_LINE_SIZE_F32); // FP32 VKQ accumulator
-        float       * V32   =                 (VKQ32 + 1*DV); // (temporary) FP32 V buffer
-        ggml_fp16_t * VKQ16 = (ggml_fp16_t *) (VKQ32 + 1*DV); // (temporary) FP16 VKQ accumulator
-        ggml_fp16_t * Q_q   = (ggml_fp16_t *) (VKQ32 + 2*DV); // (temporary) buffer for Q converted to quantized/FP16
+            float       * VKQ32 = (float       *) params->wdata + ith*(1*DK + 2*DV + CACHE_LINE_SIZE_F32); // FP32 VKQ accumulator
+            float       * V32   =                 (VKQ32 + 1*DV); // (temporary) FP32 V buffer
+            ggml_fp16_t * VKQ16 = (ggml_fp16_t *) (VKQ32 + 1*DV); // (temporary) FP16 VKQ accumulator
+            ggml_fp16_t * Q_q   = (ggml_fp16_t *) (VKQ32 + 2*DV); // (temporary) buffer for Q converted to quantized/FP16
 
-        if (v->type == GGML_TYPE_F16) {
-            memset(VKQ16, 0, DV*sizeof(ggml_fp16_t));
-        } else {
-            memset(VKQ32, 0, DV*sizeof(float));
-        }
+            if (v->type == GGML_TYPE_F16) {
+                memset(VKQ16, 0, DV*sizeof(ggml_fp16_t));
+            } else {
+                memset(VKQ32, 0, DV*sizeof(float));
+            }
 
-        const ggml_fp16_t * mp = mask ? (ggml_fp16_t *)((char *) mask->data + iq1*mask->nb[1] + (iq2%mask->ne[2])*mask->nb[2] + (iq3%mask->ne[3])*mask->nb[3]) : NULL;
+            const ggml_fp16_t * mp = mask ? (ggml_fp16_t *)((char *) mask->data + iq1*mask->nb[1] + (iq2%mask->ne[2])*mask->nb[2] + (iq3%mask->ne[3])*mask->nb[3]) : NULL;
 
-        // k indices
-        const int ik3 = iq3 / rk3;
-        const int ik2 = iq2 / rk2;
+            // k indices
+            const int ik3 = iq3 / rk3;
+            const int ik2 = iq2 / rk2;
 
-        // v indices
-        const int iv3 = iq3 / rv3;
-        const int iv2 = iq2 / rv2;
+            // v indices
+            const int iv3 = iq3 / rv3;
+            const int iv2 = iq2 / rv2;
 
-        const float * pq = (const float *) ((char *) q->data + (iq1*nbq1 + iq2*nbq2 + iq3*nbq3));
-        q_to_vec_dot(pq, Q_q, DK);
+            const float * pq = (const float *) ((char *) q->data + (iq1*nbq1 + iq2*nbq2 + iq3*nbq3));
+            q_to_vec_dot(pq, Q_q, DK);
 
-        // online softmax / attention
-        // loop over n_kv and n_head_kv
-        // ref: https://arxiv.org/pdf/2112.05682.pdf
-        for (int64_t ic = 0; ic < nek1; ++ic) {
-            const float mv = mp ? slope*GGML_CPU_FP16_TO_FP32(mp[ic]) : 0.0f;
-            if (mv == -INFINITY) {
-                continue;
-            }
+            // online softmax / attention
+            // loop over n_kv and n_head_kv
+            // ref: https://arxiv.org/pdf/2112.05682.pdf
+            for (int64_t ic = 0; ic < nek1; ++ic) {
+                const float mv = mp ? slope*GGML_CPU_FP16_TO_FP32(mp[ic]) : 0.0f;
+                if (mv == -INFINITY) {
+                    continue;
+                }
 
-            float s; // KQ value
+                float s; // KQ value
 
-            const char * k_data = (const char *) k->data + ( ic*nbk1 + ik2*nbk2 + ik3*nbk3);
-            kq_vec_dot(DK, &s, 0, k_data, 0, Q_q, 0, 1);
+                const char * k_data = (const char *) k->data + ( ic*nbk1 + ik2*nbk2 + ik3*nbk3);
+                kq_vec_dot(DK, &s, 0, k_data, 0, Q_q, 0, 1);
 
-            s = s*scale; // scale KQ value
+                s = s*scale; // scale KQ value
 
-            if (logit_softcap != 0.0f) {
-                s = logit_softcap*tanhf(s);
-            }
+                if (logit_softcap != 0.0f) {
+                    s = logit_softcap*tanhf(s);
+                }
 
-            s += mv; // apply mask
+                s += mv; // apply mask
 
-            const float Mold = M;
+                const float Mold = M;
 
-            float ms = 1.0f; // upon new higher max val, scale VKQ and KQ sum with this value
-            float vs = 1.0f; // post-softmax KQ value, expf(s - M)
+                float ms = 1.0f; // upon new higher max val, scale VKQ and KQ sum with this value
+                float vs = 1.0f; // post-softmax KQ value, expf(s - M)
 
-            const char * v_data = ((const char *) v->data + (ic*nbv1 + iv2*nbv2 + iv3*nbv3));
+                const char * v_data = ((const char *) v->data + (ic*nbv1 + iv2*nbv2 + iv3*nbv3));
 
-            if (v->type == GGML_TYPE_F16) {
-                if (s > M) {
-                    // s is new maximum, ms < 1.0f, vs == expf(s - s) == 1.0f
-                    M = s;
-                    ms = expf(Mold - M);
+                if (v->type == GGML_TYPE_F16) {
+                    if (s > M) {
+                        // s is new maximum, ms < 1.0f, vs == expf(s - s) == 1.0f
+                        M = s;
+                        ms = expf(Mold - M);
 
-                    // V = V*expf(Mold - M)
-                    ggml_vec_scale_f16(DV, VKQ16, ms);
+                        // V = V*expf(Mold - M)
+                        ggml_vec_scale_f16(DV, VKQ16, ms);
+                    } else {
+                        // no new maximum, ms == 1.0f, vs != 1.0f
+                        vs = expf(s - M);
+                    }
+
+                    // V += v*expf(s - M)
+                    ggml_vec_mad_f16(DV, VKQ16, (const ggml_fp16_t *) v_data, vs);
                 } else {
-                    // no new maximum, ms == 1.0f, vs != 1.0f
-                    vs = expf(s - M);
-                }
+                    if (s > M) {
+                        // s is new maximum, ms < 1.0f, vs == expf(s - s) == 1.0f
+                        M = s;
+                        ms = expf(Mold - M);
 
-                // V += v*expf(s - M)
-                ggml_vec_mad_f16(DV, VKQ16, (const ggml_fp16_t *) v_data, vs);
-            } else {
-                if (s > M) {
-                    // s is new maximum, ms < 1.0f, vs == expf(s - s) == 1.0f
-                    M = s;
-                    ms = expf(Mold - M);
+                        // V = V*expf(Mold - M)
+                        ggml_vec_scale_f32(DV, VKQ32, ms);
+                    } else {
+                        // no new maximum, ms == 1.0f, vs != 1.0f
+                        vs = expf(s - M);
+                    }
 
-                    // V = V*expf(Mold - M)
-                    ggml_vec_scale_f32(DV, VKQ32, ms);
-                } else {
-                    // no new maximum, ms == 1.0f, vs != 1.0f
-                    vs = expf(s - M);
+                    // V += v*expf(s - M)
+                    if (v_to_float) {
+                        v_to_float(v_data, V32, DV);
+                        ggml_vec_mad_f32(DV, VKQ32, V32, vs);
+                    } else {
+                        // V is F32
+                        ggml_vec_mad_f32(DV, VKQ32, (const float *) v_data, vs);
+                    }
                 }
 
-                // V += v*expf(s - M)
-                if (v_to_float) {
-                    v_to_float(v_data, V32, DV);
-                    ggml_vec_mad_f32(DV, VKQ32, V32, vs);
-                } else {
-                    // V is F32
-                    ggml_vec_mad_f32(DV, VKQ32, (const float *) v_data, vs);
+                S = S*ms + vs; // scale and increment sum with partial sum
+            }
+
+            if (v->type == GGML_TYPE_F16) {
+                for (int64_t d = 0; d < DV; ++d) {
+                    VKQ32[d] = GGML_CPU_FP16_TO_FP32(VKQ16[d]);
                 }
             }
 
-            S = S*ms + vs; // scale and increment sum with partial sum
+            // V /= S
+            const float S_inv = 1.0f/S;
+            ggml_vec_scale_f32(DV, VKQ32, S_inv);
+
+            // dst indices
+            const int i1 = iq1;
+            const int i2 = iq2;
+            const int i3 = iq3;
+
+            // original
+            //memcpy((char *) dst->data + (i1*nb1 + i2*nb2 + i3*nb3), V, nev0*sizeof(float));
+
+            // permute(0, 2, 1, 3)
+            memcpy((char *) dst->data + (i3*ne2*ne1 + i2 + i1*ne1)*nb1, VKQ32, nb1);
         }
+    }
+}
+
+// blocked flash attention
+
+// K/V rows to F32, with the SIMD conversions of the CPU backend where there are any
+static void ggml_fa_row_to_f32(ggml_type type, ggml_to_float_t to_float, const void * x, float * y, int64_t n) {
+    switch (type) {
+        case GGML_TYPE_F32:  memcpy(y, x, n*sizeof(float));                         break;
+        case GGML_TYPE_F16:  ggml_cpu_fp16_to_fp32((const ggml_fp16_t *) x, y, n); break;
+        case GGML_TYPE_BF16: ggml_cpu_bf16_to_fp32((const ggml_bf16_t *) x, y, n); break;
+        default:             to_float(x, y, n);                                     break;
+    }
+}
+
+// GGML_FA_TILE_Q rows of Q (one head) at a time, against GGML_FA_TILE_KV rows of K/V at a time
+// the Q tile is stored transposed, so that KQ^T = K*Q^T and VKQ += softmax(KQ)*V are plain GEMMs
+// over row-major K/V tiles, and the online softmax runs down the columns of KQ^T once per KV tile
+// ref: https://arxiv.org/pdf/2205.14135.pdf
+static void ggml_compute_forward_flash_attn_ext_tiled(
+        const ggml_compute_params * params,
+        const ggml_tensor * q,
+        const ggml_tensor * k,
+        const ggml_tensor * v,
+        const ggml_tensor * mask,
+        ggml_tensor * dst) {
+
+    GGML_TENSOR_LOCALS(int64_t, neq, q,   ne)
+    GGML_TENSOR_LOCALS(size_t,  nbq, q,   nb)
+    GGML_TENSOR_LOCALS(int64_t, nek, k,   ne)
+    GGML_TENSOR_LOCALS(size_t,  nbk, k,   nb)
+    GGML_TENSOR_LOCALS(int64_t, nev, v,   ne)
+    GGML_TENSOR_LOCALS(size_t,  nbv, v,   nb)
+    GGML_TENSOR_LOCALS(int64_t, ne,  dst, ne)
+    GGML_TENSOR_LOCALS(size_t,  nb,  dst, nb)
+
+    const int ith = params->ith;
+
+    const int64_t DK = nek0;
+    const int64_t DV = nev0;
+    const int64_t N  = neq1;
+
+    const int64_t BQ  = GGML_FA_TILE_Q;
+    const int64_t BKV = GGML_FA_TILE_KV;
 
-        if (v->type == GGML_TYPE_F16) {
-            for (int64_t d = 0; d < DV; ++d) {
-                VKQ32[d] = GGML_CPU_FP16_TO_FP32(VKQ16[d]);
+    GGML_ASSERT(ne0 == DV);
+    GGML_ASSERT(ne2 == N);
+
+    // input tensor rows must be contiguous
+    GGML_ASSERT(nbq0 == ggml_type_size(q->type));
+    GGML_ASSERT(nbk0 == ggml_type_size(k->type));
+    GGML_ASSERT(nbv0 == ggml_type_size(v->type));
+
+    GGML_ASSERT(q->type == GGML_TYPE_F32);
+    GGML_ASSERT(neq0 == DK);
+
+    // dst cannot be transposed or permuted
+    GGML_ASSERT(nb0 == sizeof(float));
+    GGML_ASSERT(nb0 <= nb1);
+    GGML_ASSERT(nb1 <= nb2);
+    GGML_ASSERT(nb2 <= nb3);
+
+    // broadcast factors
+    const int64_t rk2 = neq2/nek2;
+    const int64_t rk3 = neq3/nek3;
+
+    const int64_t rv2 = neq2/nev2;
+    const int64_t rv3 = neq3/nev3;
+
+    // parallelize by query tiles
+    const int64_t nqt = (N + BQ - 1)/BQ;
+    const int64_t nr  = nqt*neq2*neq3;
+    const int64_t dr  = ggml_compute_chunk_size(params, nr, 1);
+
+    float scale         = 1.0f;
+    float max_bias      = 0.0f;
+    float logit_softcap = 0.0f;
+
+    memcpy(&scale,         (float *) dst->op_params + 0, sizeof(float));
+    memcpy(&max_bias,      (float *) dst->op_params + 1, sizeof(float));
+    memcpy(&logit_softcap, (float *) dst->op_params + 2, sizeof(float));
+
+    if (logit_softcap != 0) {
+        scale /= logit_softcap;
+    }
+
+    const uint32_t n_head      = neq2;
+    const uint32_t n_head_log2 = 1u << (uint32_t) floor(log2(n_head));
+
+    const float m0 = powf(2.0f, -(max_bias       ) / n_head_log2);
+    const float m1 = powf(2.0f, -(max_bias / 2.0f) / n_head_log2);
+
+    ggml_to_float_t const k_to_float = ggml_get_type_traits(k->type)->to_float;
+    ggml_to_float_t const v_to_float = ggml_get_type_traits(v->type)->to_float;
+
+    GGML_ASSERT((k->type == GGML_TYPE_F32 || k_to_float) && "fattn: unsupported K-type");
+    GGML_ASSERT((v->type == GGML_TYPE_F32 || v_to_float) && "fattn: unsupported V-type");
+
+    float * QT  = (float *) params->wdata + ith*(ggml_flash_attn_ext_wsize(DK, DV) + CACHE_LINE_SIZE_F32);
+    float * K32 = QT  + DK*BQ;  // [BKV][DK]
+    float * V32 = K32 + BKV*DK; // [BKV][DV]
+    float * ST  = V32 + BKV*DV; // [BKV][BQ], KQ^T and then softmax(KQ)^T
+    float * O   = ST  + BKV*BQ; // [BQ][DV]
+    float * M   = O   + BQ*DV;  // running max per query
+    float * L   = M   + BQ;     // running sum per query
+    float * MS  = L   + BQ;     // max subtracted in the current tile
+
+    int64_t ir0, ir1;
+    while (ggml_compute_chunk_next(params, nr, dr, &ir0, &ir1)) {
+        for (int64_t ir = ir0; ir < ir1; ++ir) {
+            // q indices
+            const int64_t iq3 = ir/(neq2*nqt);
+            const int64_t iq2 = (ir - iq3*neq2*nqt)/nqt;
+            const int64_t iqt = (ir - iq3*neq2*nqt - iq2*nqt);
+
+            const int64_t iq1 = iqt*BQ;
+            const int64_t nq  = MIN(BQ, N - iq1);
+
+            // a short last tile is padded with zero queries up to a multiple of the vector width
+            const int64_t nq_pad = MIN(BQ, GGML_PAD(nq, 16));
+
+            const uint32_t h = iq2; // head index
+            const float slope = (max_bias > 0.0f) ? h < n_head_log2 ? powf(m0, h + 1) : powf(m1, 2*(h - n_head_log2) + 1) : 1.0f;
+
+            // k indices
+            const int64_t ik3 = iq3 / rk3;
+            const int64_t ik2 = iq2 / rk2;
+
+            // v indices
+            const int64_t iv3 = iq3 / rv3;
+            const int64_t iv2 = iq2 / rv2;
+
+            // scaled Q tile, transposed
+            for (int64_t i = 0; i < nq; ++i) {
+                const float * pq = (const float *) ((const char *) q->data + ((iq1 + i)*nbq1 + iq2*nbq2 + iq3*nbq3));
+                for (int64_t d = 0; d < DK; ++d) {
+                    QT[d*BQ + i] = pq[d]*scale;
+                }
+
+                M[i] = -INFINITY;
+                L[i] = 0.0f;
             }
-        }
+            for (int64_t d = 0; d < DK; ++d) {
+                for (int64_t i = nq; i < nq_pad; ++i) {
+                    QT[d*BQ + i] = 0.0f;
+                }
+            }
+            memset(O, 0, nq*DV*sizeof(float));
 
-        // V /= S
-        const float S_inv = 1.0f/S;
-        ggml_vec_scale_f32(DV, VKQ32, S_inv);
+            for (int64_t ic0 = 0; ic0 < nek1; ic0 += BKV) {
+                const int64_t nkv_tile = MIN(BKV, nek1 - ic0);
 
-        // dst indices
-        const int i1 = iq1;
-        const int i2 = iq2;
-        const int i3 = iq3;
+                // keys masked with -INFINITY for every query of the tile are left out, like the per-row
+                // path skips them: their K/V rows may hold anything (e.g. unused KV cache cells)
+                bool keep[GGML_FA_TILE_KV];
+                for (int64_t j = 0; j < nkv_tile; ++j) {
+                    keep[j] = mask == NULL;
+                }
+                for (int64_t i = 0; mask && i < nq; ++i) {
+                    const ggml_fp16_t * mp = (const ggml_fp16_t *) ((const char *) mask->data + (iq1 + i)*mask->nb[1] + (iq2%mask->ne[2])*mask->nb[2] + (iq3%mask->ne[3])*mask->nb[3]) + ic0;
+                    for (int64_t j = 0; j < nkv_tile; ++j) {
+                        keep[j] = keep[j] || GGML_CPU_FP16_TO_FP32(mp[j]) != -INFINITY;
+                    }
+                }
 
-        // original
-        //memcpy((char *) dst->data + (i1*nb1 + i2*nb2 + i3*nb3), V, nev0*sizeof(float));
+                int64_t jr[GGML_FA_TILE_KV]; // tile row -> KV row
+                int64_t nkv = 0;
+                for (int64_t j = 0; j < nkv_tile; ++j) {
+                    if (keep[j]) {
+                        jr[nkv++] = ic0 + j;
+                    }
+                }
 
-        // permute(0, 2, 1, 3)
-        memcpy((char *) dst->data + (i3*ne2*ne1 + i2 + i1*ne1)*nb1, VKQ32, nb1);
+                if (nkv == 0) {
+                    continue;
+                }
+
+                // K and V tiles as F32 rows, F32 tensors are used in place when no row is left out
+                const bool gather = nkv < nkv_tile;
+
+                const float * kt  = K32;
+                int64_t       ldk = DK;
+                if (k->type == GGML_TYPE_F32 && !gather) {
+                    kt  = (const float *) ((const char *) k->data + (ic0*nbk1 + ik2*nbk2 + ik3*nbk3));
+                    ldk = nbk1/sizeof(float);
+                } else {
+                    for (int64_t j = 0; j < nkv; ++j) {
+                        ggml_fa_row_to_f32(k->type, k_to_float, (const char *) k->data + (jr[j]*nbk1 + ik2*nbk2 + ik3*nbk3), K32 + j*DK, DK);
+                    }
+                }
+
+                const float * vt  = V32;
+                int64_t       ldv = DV;
+                if (v->type == GGML_TYPE_F32 && !gather) {
+                    vt  = (const float *) ((const char *) v->data + (ic0*nbv1 + iv2*nbv2 + iv3*nbv3));
+                    ldv = nbv1/sizeof(float);
+                } else {
+                    for (int64_t j = 0; j < nkv; ++j) {
+                        ggml_fa_row_to_f32(v->type, v_to_float, (const char *) v->data + (jr[j]*nbv1 + iv2*nbv2 + iv3*nbv3), V32 + j*DV, DV);
+                    }
+                }
+
+                // KQ^T = K*Q^T
+                memset(ST, 0, nkv*BQ*sizeof(float));
+                ggml_gemm_f32_tile(nkv, nq_pad, DK, kt, ldk, 1, QT, BQ, ST, BQ);
+
+                if (logit_softcap != 0.0f) {
+                    for (int64_t j = 0; j < nkv; ++j) {
+                        for (int64_t i = 0; i < nq; ++i) {
+                            ST[j*BQ + i] = logit_softcap*tanhf(ST[j*BQ + i]);
+                        }
+                    }
+                }
+
+                if (mask) {
+                    for (int64_t i = 0; i < nq; ++i) {
+                        const ggml_fp16_t * mp = (const ggml_fp16_t *) ((const char *) mask->data + (iq1 + i)*mask->nb[1] + (iq2%mask->ne[2])*mask->nb[2] + (iq3%mask->ne[3])*mask->nb[3]);
+                        for (int64_t j = 0; j < nkv; ++j) {
+                            // a masked key is -INFINITY whatever its KQ value, so that it gets no weight
+                            const float mv = GGML_CPU_FP16_TO_FP32(mp[jr[j]]);
+                            ST[j*BQ + i] = mv == -INFINITY ? -INFINITY : ST[j*BQ + i] + slope*mv;
+                        }
+                    }
+                }
+
+                // online softmax, one update per KV tile and query
+                for (int64_t i = 0; i < nq; ++i) {
+                    MS[i] = M[i];
+                }
+                for (int64_t j = 0; j < nkv; ++j) {
+                    for (int64_t i = 0; i < nq; ++i) {
+                        MS[i] = MAX(MS[i], ST[j*BQ + i]);
+                    }
+                }
+                for (int64_t i = 0; i < nq; ++i) {
+                    if (MS[i] > M[i]) {
+                        // new maximum, VKQ and the sum so far scale by expf(Mold - Mnew)
+                        const float ms = expf(M[i] - MS[i]);
+                        ggml_vec_scale_f32(DV, O + i*DV, ms);
+                        L[i] *= ms;
+                        M[i]  = MS[i];
+                    }
+                    // no key of this query has been unmasked yet: expf(-INFINITY - 0) == 0
+                    MS[i] = M[i] == -INFINITY ? 0.0f : M[i];
+                }
+                for (int64_t j = 0; j < nkv; ++j) {
+                    for (int64_t i = 0; i < nq; ++i) {
+                        ST[j*BQ + i] -= MS[i];
+                    }
+                    ggml_vec_soft_max_f32(nq, ST + j*BQ, ST + j*BQ, 0.0f);
+                    for (int64_t i = 0; i < nq; ++i) {
+                        L[i] += ST[j*BQ + i];
+                    }
+                }
+
+                // VKQ += softmax(KQ)*V
+                ggml_gemm_f32_tile(nq, DV, nkv, ST, 1, BQ, vt, ldv, O, DV);
+            }
+
+            for (int64_t i = 0; i < nq; ++i) {
+                // V /= S
+                ggml_vec_scale_f32(DV, O + i*DV, 1.0f/L[i]);
+
+                // permute(0, 2, 1, 3)
+                memcpy((char *) dst->data + (iq3*ne2*ne1 + iq2 + (iq1 + i)*ne1)*nb1, O + i*DV, nb1);
+            }
+        }
     }
 }
 
@@ -8218,7 +8671,12 @@ void ggml_compute_forward_flash_attn_ext(
         case GGML_PREC_F32:
             {
                 // uses F32 accumulators
-                ggml_compute_forward_flash_attn_ext_f16(params, q, k, v, mask, dst);
+                // single queries (decoding) walk the KV cache once per row, batches of queries go tiled
+                if (q->ne[1] >= GGML_FA_TILE_Q/4 && q->type == GGML_TYPE_F32) {
+                    ggml_compute_forward_flash_attn_ext_tiled(params, q, k, v, mask, dst);
+                } else {
+                    ggml_compute_forward_flash_attn_ext_f16(params, q, k, v, mask, dst);
+                }
             } break;
         default:
             {
@@ -10184,3 +10642,156 @@ void ggml_compute_forward_opt_step_adamw(
             }
     }
 }
+
+// fused elementwise chains
+//
+// Each computes a chain of nodes in one pass over the rows of the last one (dst), using the same
+// vec functions in the same order as the separate ops, so the results are bitwise identical.
+// ggml_graph_compute_n_fused() checks the types, shapes and aliasing before these are called.
+
+// row (i1, i2, i3) of dst in a src that may be broadcast over rows
+static inline const float * ggml_fused_src_row(const ggml_tensor * src, int64_t i1, int64_t i2, int64_t i3) {
+    return (const float *) ((const char *) src->data + (i1 % src->ne[1])*src->nb[1] + (i2 % src->ne[2])*src->nb[2] + (i3 % src->ne[3])*src->nb[3]);
+}
+
+// ggml_norm -> ggml_mul(w) -> ggml_add(b): layer norm with its affine transform
+void ggml_compute_forward_norm_mul_add(
+        const ggml_compute_params * params,
+        const ggml_tensor * norm,
+        const ggml_tensor * mul,
+        ggml_tensor * dst) {
+
+    const ggml_tensor * src0 = norm->src[0];
+    const ggml_tensor * w    = mul->src[1];
+    const ggml_tensor * b    = dst->src[1];
+
+    GGML_ASSERT(ggml_are_same_shape(src0, dst));
+    GGML_ASSERT(src0->nb[0] == sizeof(float));
+    GGML_ASSERT(mul->src[0] == norm && dst->src[0] == mul);
+
+    GGML_TENSOR_UNARY_OP_LOCALS
+
+    float eps;
+    memcpy(&eps, norm->op_params, sizeof(float));
+
+    GGML_ASSERT(eps >= 0.0f);
+
+    const int64_t nr = ne01*ne02*ne03;
+    const int64_t dr = ggml_compute_chunk_size(params, nr, 4);
+
+    int64_t ir0, ir1;
+    while (ggml_compute_chunk_next(params, nr, dr, &ir0, &ir1)) {
+        for (int64_t ir = ir0; ir < ir1; ++ir) {
+            const int64_t i03 = ir/(ne02*ne01);
+            const int64_t i02 = (ir - i03*ne02*ne01)/ne01;
+            const int64_t i01 = (ir - i03*ne02*ne01 - i02*ne01);
+
+            const float * x = (float *) ((char *) src0->data + i01*nb01 + i02*nb02 + i03*nb03);
+
+            ggml_float sum = 0.0;
+            for (int64_t i00 = 0; i00 < ne00; i00++) {
+                sum += (ggml_float)x[i00];
+            }
+
+            float mean = sum/ne00;
+
+            float * y = (float *) ((char *) dst->data + i01*nb1 + i02*nb2 + i03*nb3);
+
+            ggml_float sum2 = 0.0;
+            for (int64_t i00 = 0; i00 < ne00; i00++) {
+                float v = x[i00] - mean;
+                y[i00] = v;
+                sum2 += (ggml_float)(v*v);
+            }
+
+            float variance = sum2/ne00;
+            const float scale = 1.0f/sqrtf(variance + eps);
+
+            ggml_vec_scale_f32(ne00, y, scale);
+            ggml_vec_mul_f32  (ne00, y, y, ggml_fused_src_row(w, i01, i02, i03));
+            ggml_vec_add_f32  (ne00, y, y, ggml_fused_src_row(b, i01, i02, i03));
+        }
+    }
+}
+
+// ggml_add(b) -> ggml_gelu: bias and activation of the MLP's first projection
+void ggml_compute_forward_add_gelu(
+        const ggml_compute_params * params,
+        const ggml_tensor * add,
+        ggml_tensor * dst) {
+
+    const ggml_tensor * src0 = add->src[0];
+    const ggml_tensor * b    = add->src[1];
+
+    GGML_ASSERT(ggml_are_same_shape(src0, dst));
+    GGML_ASSERT(src0->nb[0] == sizeof(float) && dst->nb[0] == sizeof(float));
+    GGML_ASSERT(dst->src[0] == add);
+
+    GGML_TENSOR_UNARY_OP_LOCALS
+
+    const int64_t nr = ggml_nrows(dst);
+    const int64_t dr = get_chunk_size(params, dst);
+
+    int64_t ir0, ir1;
+    while (ggml_compute_chunk_next(params, nr, dr, &ir0, &ir1)) {
+        for (int64_t ir = ir0; ir < ir1; ++ir) {
+            const int64_t i03 = ir/(ne02*ne01);
+            const int64_t i02 = (ir - i03*ne02*ne01)/ne01;
+            const int64_t i01 = (ir - i03*ne02*ne01 - i02*ne01);
+
+            const float * x = (float *) ((char *) src0->data + i01*nb01 + i02*nb02 + i03*nb03);
+                  float * y = (float *) ((char *)  dst->data + i01*nb1  + i02*nb2  + i03*nb3);
+
+            ggml_vec_add_f32 (ne00, y, x, ggml_fused_src_row(b, i01, i02, i03));
+            ggml_vec_gelu_f32(ne00, y, y);
+        }
+    }
+}
+
+// ggml_add(b) -> ggml_add(r): bias of an output projection and the residual connection
+void ggml_compute_forward_add_add(
+        const ggml_compute_params * params,
+        const ggml_tensor * add,
+        ggml_tensor * dst) {
+
+    const ggml_tensor * src0 = add->src[0];
+    const ggml_tensor * b    = add->src[1];
+    const ggml_tensor * r    = dst->src[0] == add ? dst->src[1] : dst->src[0];
+
+    GGML_ASSERT(ggml_are_same_shape(src0, dst));
+    GGML_ASSERT(src0->nb[0] == sizeof(float) && dst->nb[0] == sizeof(float));
+
+    GGML_TENSOR_UNARY_OP_LOCALS
+
+    const int64_t nr = ggml_nrows(dst);
+    const int64_t dr = get_chunk_size(params, dst);
+
+    int64_t ir0, ir1;
+    while (ggml_compute_chunk_next(params, nr, dr, &ir0, &ir1)) {
+        for (int64_t ir = ir0; ir < ir1; ++ir) {
+            const int64_t i03 = ir/(ne02*ne01);
+            const int64_t i02 = (ir - i03*ne02*ne01)/ne01;
+            const int64_t i01 = (ir - i03*ne02*ne01 - i02*ne01);
+
+            const float * x  = (float *) ((char *) src0->data + i01*nb01 + i02*nb02 + i03*nb03);
+            const float * xb = ggml_fused_src_row(b, i01, i02, i03);
+            const float * xr = ggml_fused_src_row(r, i01, i02, i03);
+                  float * y  = (float *) ((char *)  dst->data + i01*nb1  + i02*nb2  + i03*nb3);
+
+            // one pass, dst may be computed in place of r
+            for (int64_t i00 = 0; i00 < ne00; i00++) {
+                const float t = x[i00] + xb[i00];
+                y[i00] = t + xr[i00];
+            }
+        }
+    }
+}
+
+// ggml_conv_1d -> ggml_add(b) [-> ggml_gelu]: the encoder front-end, bias and activation applied per tile
+void ggml_compute_forward_conv_1d_add(
+        const ggml_compute_params * params,
+        const ggml_tensor * conv,
+        const ggml_tensor * add,
+        ggml_tensor * dst) {
+    ggml_compute_forward_conv_1d_impl(params, conv, add->src[1], dst != add, dst);
+}
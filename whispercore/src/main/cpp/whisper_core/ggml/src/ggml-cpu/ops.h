@@ -68,6 +68,7 @@ void ggml_compute_forward_clamp(const struct ggml_compute_params * params, struc
 void ggml_compute_forward_conv_transpose_1d(const struct ggml_compute_params * params, struct ggml_tensor * dst);
 void ggml_compute_forward_im2col(const struct ggml_compute_params * params, struct ggml_tensor * dst);
 void ggml_compute_forward_im2col_back_f32(const struct ggml_compute_params * params, struct ggml_tensor * dst);
+void ggml_compute_forward_conv_1d(const struct ggml_compute_params * params, struct ggml_tensor * dst);
 void ggml_compute_forward_conv_2d(const struct ggml_compute_params * params, struct ggml_tensor * dst);
 void ggml_compute_forward_conv_transpose_2d(const struct ggml_compute_params * params, struct ggml_tensor * dst);
 void ggml_compute_forward_conv_2d_dw(const struct ggml_compute_params * params, struct ggml_tensor * dst);
@@ -113,6 +114,12 @@ void ggml_compute_forward_cross_entropy_loss_back(const struct ggml_compute_para
 void ggml_compute_forward_opt_step_adamw(const struct ggml_compute_params * params, struct ggml_tensor * dst);
 void ggml_compute_forward_mul_mat(const struct ggml_compute_params * params, struct ggml_tensor * dst);
 
+// fused elementwise chains, see ggml_graph_compute_n_fused()
+void ggml_compute_forward_norm_mul_add(const struct ggml_compute_params * params, const struct ggml_tensor * norm, const struct ggml_tensor * mul, struct ggml_tensor * dst);
+void ggml_compute_forward_add_gelu(const struct ggml_compute_params * params, const struct ggml_tensor * add, struct ggml_tensor * dst);
+void ggml_compute_forward_add_add(const struct ggml_compute_params * params, const struct ggml_tensor * add, struct ggml_tensor * dst);
+void ggml_compute_forward_conv_1d_add(const struct ggml_compute_params * params, const struct ggml_tensor * conv, const struct ggml_tensor * add, struct ggml_tensor * dst);
+
 #ifdef __cplusplus
 }
 #endif
@@ -233,6 +233,115 @@ void ggml_vec_dot_f16(int n, float * GGML_RESTRICT s, size_t bs, ggml_fp16_t * G
     *s = sumf;
 }
 
+// GGML_F32_EPR F16 values loaded as a GGML_F32_VEC, on the architectures where it is a single conversion
+#if defined(__AVX512F__)
+#define GGML_VEC_DOT_COLS_LOAD_F16(p) GGML_F32Cx16_LOAD(p)
+#elif defined(__AVX__) && defined(__F16C__)
+#define GGML_VEC_DOT_COLS_LOAD_F16(p) GGML_F32Cx8_LOAD(p)
+#elif defined(__ARM_NEON) && defined(__ARM_FEATURE_FMA) && !defined(__ARM_FEATURE_SVE)
+#define GGML_VEC_DOT_COLS_LOAD_F16(p) vcvt_f32_f16(vld1_f16((const __fp16 *)(p)))
+#endif
+
+// elsewhere the row is converted in segments that stay in L1, every segment is then read once per column
+#define GGML_VEC_DOT_COLS_SEG 256
+
+template <int nc>
+static void ggml_vec_dot_f16_f32_cols_impl(int n, float * GGML_RESTRICT s, const ggml_fp16_t * GGML_RESTRICT x, const float * GGML_RESTRICT y, size_t by) {
+    const float * yc[nc];
+    for (int c = 0; c < nc; ++c) {
+        yc[c] = (const float *) ((const char *) y + c*by);
+    }
+
+#if defined(GGML_SIMD) && !defined(__ARM_FEATURE_SVE) && !defined(__riscv_v_intrinsic)
+    // independent accumulators per column, so that few columns still keep the FMA units busy
+    constexpr int na   = nc >= 4 ? 1 : 4/nc;
+    constexpr int step = na*GGML_F32_EPR;
+
+    static_assert(na <= GGML_F32_ARR, "too many accumulators for GGML_F32_VEC_REDUCE");
+
+    GGML_F32_VEC sum[nc][na];
+    for (int c = 0; c < nc; ++c) {
+        for (int j = 0; j < na; ++j) {
+            sum[c][j] = GGML_F32_VEC_ZERO;
+        }
+    }
+
+    const int np = n & ~(step - 1);
+
+#if defined(GGML_VEC_DOT_COLS_LOAD_F16)
+    for (int i = 0; i < np; i += step) {
+        for (int j = 0; j < na; ++j) {
+            const GGML_F32_VEC ax = GGML_VEC_DOT_COLS_LOAD_F16(x + i + j*GGML_F32_EPR);
+            for (int c = 0; c < nc; ++c) {
+                sum[c][j] = GGML_F32_VEC_FMA(sum[c][j], ax, GGML_F32_VEC_LOAD(yc[c] + i + j*GGML_F32_EPR));
+            }
+        }
+    }
+#else
+    float xf[GGML_VEC_DOT_COLS_SEG];
+
+    for (int i0 = 0; i0 < np; i0 += GGML_VEC_DOT_COLS_SEG) {
+        const int ns = MIN(GGML_VEC_DOT_COLS_SEG, np - i0);
+
+        ggml_cpu_fp16_to_fp32(x + i0, xf, ns);
+
+        for (int i = 0; i < ns; i += step) {
+            for (int j = 0; j < na; ++j) {
+                const GGML_F32_VEC ax = GGML_F32_VEC_LOAD(xf + i + j*GGML_F32_EPR);
+                for (int c = 0; c < nc; ++c) {
+                    sum[c][j] = GGML_F32_VEC_FMA(sum[c][j], ax, GGML_F32_VEC_LOAD(yc[c] + i0 + i + j*GGML_F32_EPR));
+                }
+            }
+        }
+    }
+#endif
+
+    for (int c = 0; c < nc; ++c) {
+        GGML_F32_VEC acc[GGML_F32_ARR];
+        for (int j = 0; j < GGML_F32_ARR; ++j) {
+            acc[j] = j < na ? sum[c][j] : GGML_F32_VEC_ZERO;
+        }
+
+        ggml_float sumf = 0.0;
+        GGML_F32_VEC_REDUCE(sumf, acc);
+
+        // leftovers
+        for (int i = np; i < n; ++i) {
+            sumf += (ggml_float)(GGML_CPU_FP16_TO_FP32(x[i])*yc[c][i]);
+        }
+
+        s[c] = sumf;
+    }
+#else
+    ggml_float sumf[nc] = { 0.0 };
+
+    for (int i = 0; i < n; ++i) {
+        const float xi = GGML_CPU_FP16_TO_FP32(x[i]);
+        for (int c = 0; c < nc; ++c) {
+            sumf[c] += (ggml_float)(xi*yc[c][i]);
+        }
+    }
+
+    for (int c = 0; c < nc; ++c) {
+        s[c] = sumf[c];
+    }
+#endif
+}
+
+void ggml_vec_dot_f16_f32_cols(int n, float * GGML_RESTRICT s, const ggml_fp16_t * GGML_RESTRICT x, const float * GGML_RESTRICT y, size_t by, int nc) {
+    switch (nc) {
+        case 1: ggml_vec_dot_f16_f32_cols_impl<1>(n, s, x, y, by); break;
+        case 2: ggml_vec_dot_f16_f32_cols_impl<2>(n, s, x, y, by); break;
+        case 3: ggml_vec_dot_f16_f32_cols_impl<3>(n, s, x, y, by); break;
+        case 4: ggml_vec_dot_f16_f32_cols_impl<4>(n, s, x, y, by); break;
+        case 5: ggml_vec_dot_f16_f32_cols_impl<5>(n, s, x, y, by); break;
+        case 6: ggml_vec_dot_f16_f32_cols_impl<6>(n, s, x, y, by); break;
+        case 7: ggml_vec_dot_f16_f32_cols_impl<7>(n, s, x, y, by); break;
+        case 8: ggml_vec_dot_f16_f32_cols_impl<8>(n, s, x, y, by); break;
+        default: GGML_ABORT("fatal error");
+    }
+}
+
 void ggml_vec_silu_f32(const int n, float * y, const float * x) {
     int i = 0;
 #if defined(__AVX512F__) && defined(__AVX512DQ__)
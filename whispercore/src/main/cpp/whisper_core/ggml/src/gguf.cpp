@@ -3,6 +3,8 @@
 #include "ggml-impl.h"
 #include "../include/gguf.h"
 
+#include <algorithm>
+#include <cerrno>
 #include <cinttypes>
 #include <cstddef>
 #include <cstdint>
@@ -10,11 +12,25 @@
 #include <cstdlib>
 #include <cstring>
 #include <map>
+#include <memory>
 #include <new>
 #include <stdexcept>
 #include <string>
 #include <vector>
 
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#ifndef NOMINMAX
+    #define NOMINMAX
+#endif
+#include <windows.h>
+#include <io.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 template <typename T>
 struct type_to_gguf_type;
 
@@ -203,6 +219,93 @@ struct gguf_tensor_info {
     uint64_t offset;      // offset from start of `data`, must be a multiple of `ALIGNMENT`
 };
 
+// private copy-on-write mapping of a whole file: pages are shared with the page cache until written to
+struct gguf_mmap {
+    void * addr = nullptr;
+    size_t size = 0;
+#if defined(_WIN32)
+    HANDLE mapping = nullptr;
+#endif
+
+    gguf_mmap() = default;
+    gguf_mmap(const gguf_mmap &) = delete;
+    gguf_mmap & operator=(const gguf_mmap &) = delete;
+
+    ~gguf_mmap() {
+#if defined(_WIN32)
+        if (addr) {
+            UnmapViewOfFile(addr);
+        }
+        if (mapping) {
+            CloseHandle(mapping);
+        }
+#else
+        if (addr) {
+            munmap(addr, size);
+        }
+#endif
+    }
+
+    bool map(FILE * file) {
+#if defined(_WIN32)
+        HANDLE hfile = (HANDLE) _get_osfhandle(_fileno(file));
+        LARGE_INTEGER file_size;
+        if (hfile == INVALID_HANDLE_VALUE || !GetFileSizeEx(hfile, &file_size) || file_size.QuadPart == 0) {
+            return false;
+        }
+        mapping = CreateFileMappingA(hfile, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+        if (!mapping) {
+            return false;
+        }
+        addr = MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+        if (!addr) {
+            return false;
+        }
+        size = (size_t) file_size.QuadPart;
+        return true;
+#else
+        const int fd = fileno(file);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0 || st.st_size == 0) {
+            return false;
+        }
+        void * ptr = mmap(nullptr, (size_t) st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        if (ptr == MAP_FAILED) {
+            return false;
+        }
+        addr = ptr;
+        size = (size_t) st.st_size;
+        return true;
+#endif
+    }
+
+    // the hint applies to the pages of [offset, offset + len) and is best-effort
+    void advise(size_t offset, size_t len, enum gguf_mmap_advice advice) const {
+#if defined(_WIN32)
+        // PrefetchVirtualMemory would need Windows 8, the other hints have no equivalent
+        GGML_UNUSED(offset);
+        GGML_UNUSED(len);
+        GGML_UNUSED(advice);
+#else
+        int flag;
+        switch (advice) {
+            case GGUF_MMAP_ADVICE_SEQUENTIAL: flag = MADV_SEQUENTIAL; break;
+            case GGUF_MMAP_ADVICE_RANDOM:     flag = MADV_RANDOM;     break;
+            case GGUF_MMAP_ADVICE_WILLNEED:   flag = MADV_WILLNEED;   break;
+            default: return;
+        }
+        const size_t page_size = (size_t) sysconf(_SC_PAGESIZE);
+        const size_t begin     = offset - offset % page_size;
+        if (len == 0 || begin >= size) {
+            return;
+        }
+        if (madvise((char *) addr + begin, std::min(size, offset + len) - begin, flag) != 0) {
+            GGML_LOG_WARN("%s: madvise failed: %s\n", __func__, strerror(errno));
+        }
+#endif
+    }
+};
+
 struct gguf_context {
     uint32_t version = GGUF_VERSION;
 
@@ -214,6 +317,8 @@ struct gguf_context {
     size_t size      = 0; // size of `data` in bytes
 
     void * data = nullptr;
+
+    std::unique_ptr<gguf_mmap> mapping; // owns `data` if the file was mapped
 };
 
 struct gguf_reader {
@@ -642,22 +747,43 @@ struct gguf_context * gguf_init_from_file_impl(FILE * file, struct gguf_init_par
         }
     }
 
+    // map the tensor data if requested
+    if (params.use_mmap && ctx->size > 0) {
+        std::unique_ptr<gguf_mmap> mapping(new gguf_mmap);
+        if (!mapping->map(file)) {
+            GGML_LOG_WARN("%s: failed to map the file, reading it instead\n", __func__);
+        } else if (mapping->size < ctx->offset + ctx->size) {
+            GGML_LOG_ERROR("%s: file is too small for the tensor data: %zu bytes, expected %zu\n",
+                __func__, mapping->size, ctx->offset + ctx->size);
+            gguf_free(ctx);
+            return nullptr;
+        } else {
+            mapping->advise(ctx->offset, ctx->size, params.mmap_advice);
+            ctx->data    = (char *) mapping->addr + ctx->offset;
+            ctx->mapping = std::move(mapping);
+        }
+    }
+
     // load the tensor data only if requested
     if (params.ctx != nullptr) {
         // if the provided gguf_context is no_alloc, then we create "empty" tensors and do not read the binary blob
         // otherwise, we load the binary blob into the created ggml_context as well, and point the "data" members of
         //   the ggml_tensor structs to the appropriate locations in the binary blob
 
+        // if the file is mapped, the tensors point into the mapping instead
+
+        const bool read_data = !params.no_alloc && !ctx->mapping;
+
         // compute the exact size needed for the new ggml_context
         const size_t mem_size =
-            params.no_alloc ?
+            !read_data ?
             (n_tensors    )*ggml_tensor_overhead() :
             (n_tensors + 1)*ggml_tensor_overhead() + ctx->size;
 
         struct ggml_init_params pdata = {
             /*mem_size   =*/ mem_size,
             /*mem_buffer =*/ nullptr,
-            /*no_alloc   =*/ params.no_alloc,
+            /*no_alloc   =*/ !read_data,
         };
 
         *params.ctx = ggml_init(pdata);
@@ -669,10 +795,8 @@ struct gguf_context * gguf_init_from_file_impl(FILE * file, struct gguf_init_par
 
         struct ggml_context * ctx_data = *params.ctx;
 
-        struct ggml_tensor * data = nullptr;
-
-        if (!params.no_alloc) {
-            data = ggml_new_tensor_1d(ctx_data, GGML_TYPE_I8, ctx->size);
+        if (read_data) {
+            struct ggml_tensor * data = ggml_new_tensor_1d(ctx_data, GGML_TYPE_I8, ctx->size);
 
             ok = ok && data != nullptr;
 
@@ -712,7 +836,7 @@ struct gguf_context * gguf_init_from_file_impl(FILE * file, struct gguf_init_par
 
             // point the data member to the appropriate location in the binary blob using the tensor info
             if (!params.no_alloc) {
-                cur->data = (char *) data->data + info.offset;
+                cur->data = (char *) ctx->data + info.offset;
             }
         }
 
@@ -946,6 +1070,18 @@ size_t gguf_get_tensor_size(const struct gguf_context * ctx, int64_t tensor_id)
     return ggml_nbytes(&ctx->info[tensor_id].t);
 }
 
+const void * gguf_get_tensor_data(const struct gguf_context * ctx, int64_t tensor_id) {
+    GGML_ASSERT(tensor_id >= 0 && tensor_id < gguf_get_n_tensors(ctx));
+    if (ctx->data == nullptr) {
+        return nullptr;
+    }
+    return (const char *) ctx->data + ctx->info[tensor_id].offset;
+}
+
+bool gguf_is_mmap(const struct gguf_context * ctx) {
+    return ctx->mapping != nullptr;
+}
+
 int64_t gguf_remove_key(struct gguf_context * ctx, const char * key) {
     const int64_t key_id = gguf_find_key(ctx, key);
     if (key_id >= 0) {
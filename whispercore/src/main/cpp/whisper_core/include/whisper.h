@@ -35,6 +35,8 @@
 #define WHISPER_HOP_LENGTH  160
 #define WHISPER_CHUNK_SIZE  30
 
+#define WHISPER_N_THREADS_AUTO -1
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -113,11 +115,42 @@ extern "C" {
         const whisper_ahead * heads;
     } whisper_aheads;
 
+    // Persistent CPU threadpool, one per state, reused by every graph the state computes
+    // cpumask, prio, poll, strict_cpu and barrier only take effect when ggml is built without OpenMP (GGML_OPENMP=OFF)
+    typedef struct whisper_threadpool_params {
+        bool         enabled;
+        int          n_threads;  // pool size (0 - the number of cores in cpumask, or all hardware threads)
+        const char * cpumask;    // hex mask of the cores to run on, e.g. "0xf0" for cores 4-7 (NULL - default affinity)
+        int          prio;       // enum ggml_sched_priority
+        int          poll;       // 0 - sleep between graphs, 100 - spin (lowest latency, highest power)
+        bool         strict_cpu; // pin each thread to a single core of cpumask
+        int          barrier;    // enum ggml_barrier_mode, GGML_BARRIER_HYBRID sleeps instead of spinning through long waits
+    } whisper_threadpool_params;
+
     struct whisper_context_params {
         bool  use_gpu;
         bool  flash_attn;
         int   gpu_device;  // CUDA device
 
+        bool  use_extra_bufts; // place weights in the CPU extra buffer types (repacked / AMX) when supported
+
+        // [EXPERIMENTAL] type of the K and V caches of the decoder
+        // self-attention: GGML_TYPE_F16 (default) or GGML_TYPE_Q8_0
+        // cross-attention: GGML_TYPE_F16 (default), GGML_TYPE_Q8_0 or GGML_TYPE_Q4_0
+        // quantized caches are read by flash attention only, without flash_attn F16 is used
+        enum ggml_type type_kv_self;
+        enum ggml_type type_kv_cross;
+
+        // [EXPERIMENTAL] type of a separate copy of the token embedding used only for the output logits
+        // GGML_TYPE_COUNT (default) - no copy, GGML_TYPE_Q8_0 or GGML_TYPE_Q6_K
+        // the embedding lookups keep the table of the model, the copy is made at load for F32/F16 models
+        enum ggml_type type_logits;
+
+        // [EXPERIMENTAL] per-op profiling, see whisper_get_profile()
+        bool  profile;
+
+        whisper_threadpool_params threadpool;
+
         // [EXPERIMENTAL] Token-level timestamps with DTW
         bool dtw_token_timestamps;
         enum whisper_alignment_heads_preset dtw_aheads_preset;
@@ -125,7 +158,7 @@ extern "C" {
         int dtw_n_top;
         struct whisper_aheads dtw_aheads;
 
-        size_t dtw_mem_size; // TODO: remove
+        size_t dtw_mem_size; // unused
     };
 
     typedef struct whisper_token_data {
@@ -446,6 +479,134 @@ extern "C" {
     WHISPER_API void whisper_print_timings(struct whisper_context * ctx);
     WHISPER_API void whisper_reset_timings(struct whisper_context * ctx);
 
+    // [EXPERIMENTAL] Per-op profiling
+    // Enabled with whisper_context_params.profile. Every graph node is computed and timed
+    // separately via the scheduler eval callback, which adds dispatch overhead - use it to
+    // see where the time goes, not to measure absolute speed.
+    struct whisper_profile_entry {
+        const char * name; // op (e.g. "MUL_MAT"), scope (e.g. "encoder.blocks.3.mlp") or graph (e.g. "encode")
+        int64_t      n;    // number of evaluations
+        int64_t      t_us; // total time
+    };
+
+    // all lists are sorted by time, descending
+    struct whisper_profile {
+        int64_t t_total_us;
+
+        int n_ops;
+        const struct whisper_profile_entry * ops;
+
+        // nodes are attributed to the layer block of the weights they use (or of the next node that uses weights)
+        int n_scopes;
+        const struct whisper_profile_entry * scopes;
+
+        int n_graphs; // conv, encode, cross, decode
+        const struct whisper_profile_entry * graphs;
+    };
+
+    // Returns NULL if profiling is not enabled
+    // The returned data is owned by the state and is valid until the next call
+    WHISPER_API const struct whisper_profile * whisper_get_profile           (struct whisper_context * ctx);
+    WHISPER_API const struct whisper_profile * whisper_get_profile_from_state(struct whisper_state   * state);
+    WHISPER_API void whisper_print_profile(struct whisper_context * ctx);
+    WHISPER_API void whisper_reset_profile(struct whisper_context * ctx);
+
+    // Write the pipeline spans recorded so far (mel, encode, decode steps, sampling, ...) as
+    // Chrome trace-event JSON, viewable in chrome://tracing or Perfetto
+    // Spans are only recorded when built with -DWHISPER_TRACE=ON
+    // Returns 0 on success, -1 on failure or if tracing is not compiled in
+    WHISPER_API int whisper_trace_dump(const char * path);
+
+    // Memory accounting
+    // "cur" is what is allocated now, "peak" the largest value seen since the state was created
+    struct whisper_memory_entry {
+        const char * name;
+        size_t       cur;
+        size_t       peak;
+    };
+
+    struct whisper_memory_usage {
+        // model weights, one entry per backend buffer type (e.g. "CPU", "CPU_REPACK")
+        int n_weights;
+        const struct whisper_memory_entry * weights;
+
+        struct whisper_memory_entry kv_self;
+        struct whisper_memory_entry kv_cross;
+        struct whisper_memory_entry kv_pad;
+
+        // scheduler compute buffers and graph metadata
+        struct whisper_memory_entry compute_conv;
+        struct whisper_memory_entry compute_encode;
+        struct whisper_memory_entry compute_cross;
+        struct whisper_memory_entry compute_decode;
+
+        struct whisper_memory_entry mel;
+        struct whisper_memory_entry logits;
+        struct whisper_memory_entry host;      // other host-side buffers: decoder work vectors, graph inputs, batch, results
+
+        struct whisper_memory_entry vad;       // VAD model, LSTM state and compute buffer (when VAD is used)
+        struct whisper_memory_entry dtw_masks; // alignment heads masks
+        struct whisper_memory_entry dtw_work;  // DTW workspace, sized by the longest window aligned so far
+
+        size_t total;      // sum of cur
+        size_t total_peak; // sum of peak (upper bound, the peaks do not need to coincide)
+    };
+
+    // If state is NULL, the context's default state is used (only the weights are reported for contexts created without one)
+    // The weights array is owned by the context and is valid until the next call
+    WHISPER_API struct whisper_memory_usage whisper_get_memory_usage(struct whisper_context * ctx, struct whisper_state * state);
+    WHISPER_API void whisper_print_memory_usage(struct whisper_context * ctx, struct whisper_state * state);
+
+    // Auto-tuning
+    // Times short encoder runs and single-token decoder steps for a range of thread counts, with and
+    // without flash attention, and picks the fastest setting for each phase.
+    // Flash attention changes the graphs of both phases, so one value is chosen and applied to the context.
+    // It is not tried on contexts with dtw_token_timestamps, which need the graphs without it.
+    // The thread counts are returned for the caller to pass in whisper_full_params.
+    // The extra buffer types are fixed at load time, so they are only compared when the model was loaded
+    // from a file (by loading a second copy); the result applies to the next load via use_extra_bufts.
+    // Uses the context's default state if it has one - its previous results are lost.
+    struct whisper_autotune_params {
+        int  n_threads_max; // largest thread count to try (0 - all hardware threads)
+        int  n_iter;        // timed runs per configuration, the fastest one counts
+        int  n_audio_ctx;   // length of the encoder micro-run, in encoder frames
+        int  n_decode;      // number of timed single-token decoder steps
+
+        bool tune_flash_attn;
+        bool tune_extra_bufts;
+
+        // results are stored here keyed by CPU model, build features, model shape and the context's KV,
+        // logits, DTW and flash attention settings, and reused on later calls (NULL - always tune, do not persist)
+        const char * cache_path;
+    };
+
+    struct whisper_autotune_result {
+        int   n_threads_encode;
+        int   n_threads_decode;
+        bool  flash_attn;
+        bool  use_extra_bufts;
+
+        float t_encode_ms; // encoder micro-run with the chosen setting
+        float t_decode_ms; // per decoder step with the chosen setting
+
+        bool  from_cache;
+    };
+
+    WHISPER_API struct whisper_autotune_params whisper_autotune_default_params(void);
+
+    // Returns 0 on success
+    WHISPER_API int whisper_autotune(
+            struct whisper_context * ctx,
+            struct whisper_autotune_params params,
+            struct whisper_autotune_result * result);
+
+    // Park the threads of the state's threadpool (e.g. between requests, to save power)
+    // The next computation resumes them automatically
+    WHISPER_API void whisper_threadpool_pause (struct whisper_context * ctx);
+    WHISPER_API void whisper_threadpool_resume(struct whisper_context * ctx);
+    WHISPER_API void whisper_threadpool_pause_with_state (struct whisper_state * state);
+    WHISPER_API void whisper_threadpool_resume_with_state(struct whisper_state * state);
+
     // Print system information
     WHISPER_API const char * whisper_print_system_info(void);
 
@@ -488,6 +649,16 @@ extern "C" {
         enum whisper_sampling_strategy strategy;
 
         int n_threads;
+
+        // per-phase thread counts
+        // 0 - use n_threads, WHISPER_N_THREADS_AUTO - at most n_threads, and for mel one thread per 10 s
+        // of audio, for decoder steps (and prompts under 16 tokens) at most 4
+        int n_threads_mel;
+        int n_threads_encode;
+        int n_threads_prompt;   // prompt decoding (and the DTW pass)
+        int n_threads_decode;   // decoder steps (one token per decoder)
+        int n_threads_sample;   // sampling, one decoder per thread
+
         int n_max_text_ctx;     // max tokens to use from past text as prompt for the decoder
         int offset_ms;          // start offset in ms
         int duration_ms;        // audio duration to process in ms
@@ -587,6 +758,9 @@ extern "C" {
         const char * vad_model_path;              // Path to VAD model
 
         whisper_vad_params vad_params;
+
+        // whisper_full_parallel(): move each split point to the nearest silence, see whisper_full_parallel()
+        bool parallel_split_on_silence;
     };
 
     // NOTE: this function allocates memory, and it is the responsibility of the caller to free the pointer - see whisper_free_context_params & whisper_free_params()
@@ -617,6 +791,11 @@ extern "C" {
     // Not thread safe if executed in parallel on the same context.
     // It seems this approach can offer some speedup in some cases.
     // However, the transcription accuracy can be worse at the beginning and end of each chunk.
+    // With params.parallel_split_on_silence, each split point moves (by up to a quarter of a chunk) to the
+    // quietest 0.2 s of the signal nearby if it is 10 dB under the median, and a segment that repeats the
+    // previous one across a split is dropped. A split point without such a silence stays where it is.
+    // The states of the extra processors are kept in the context and reused by the next call, each starting
+    // without the text of the previous call as context.
     WHISPER_API int whisper_full_parallel(
                 struct whisper_context * ctx,
             struct whisper_full_params   params,
@@ -28,14 +28,21 @@
 #include <fstream>
 #include <functional>
 #include <map>
+#include <memory>
 #include <mutex>
 #include <random>
 #include <regex>
 #include <set>
+#include <sstream>
 #include <string>
 #include <thread>
+#include <unordered_map>
 #include <vector>
 
+#if defined(GGML_BACKEND_DL) && !defined(_WIN32)
+#include <dlfcn.h>
+#endif
+
 #if defined(WHISPER_BIG_ENDIAN)
 template<typename T>
 static T byteswap(T value) {
@@ -155,15 +162,250 @@ static std::string format(const char * fmt, ...) {
     return std::string(buf.data(), size);
 }
 
+//
+// tracing
+//
+// Spans are recorded with WHISPER_TRACE_SCOPE("name") and written as Chrome trace-event
+// JSON by whisper_trace_dump(). Only compiled in with -DWHISPER_TRACE, otherwise the
+// macros expand to nothing.
+//
+
+#ifdef WHISPER_TRACE
+
+struct whisper_trace_event {
+    const char * name; // must be a string literal
+    int64_t      t_beg_us;
+    int64_t      t_end_us;
+    int64_t      arg;
+};
+
+static const int64_t WHISPER_TRACE_NO_ARG = INT64_MIN;
+
+// Each thread appends to its own buffer, so recording takes no locks. The buffer grows
+// by whole chunks, and a chunk is published before the event count that covers it, so
+// whisper_trace_dump() can read concurrently with the writer.
+struct whisper_trace_buffer {
+    static const size_t CHUNK_SIZE = 1024;
+    static const size_t MAX_CHUNKS = 1024;
+
+    const int tid;
+
+    std::atomic<whisper_trace_event *> chunks[MAX_CHUNKS];
+    std::atomic<size_t> n_events;
+    std::atomic<size_t> n_dropped;
+
+    explicit whisper_trace_buffer(int tid) : tid(tid), n_events(0), n_dropped(0) {
+        for (auto & chunk : chunks) {
+            chunk.store(nullptr, std::memory_order_relaxed);
+        }
+    }
+
+    ~whisper_trace_buffer() {
+        for (auto & chunk : chunks) {
+            delete [] chunk.load(std::memory_order_relaxed);
+        }
+    }
+
+    void push(const whisper_trace_event & ev) {
+        const size_t n  = n_events.load(std::memory_order_relaxed);
+        const size_t ic = n/CHUNK_SIZE;
+
+        if (ic >= MAX_CHUNKS) {
+            n_dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+
+        whisper_trace_event * chunk = chunks[ic].load(std::memory_order_relaxed);
+        if (chunk == nullptr) {
+            chunk = new whisper_trace_event[CHUNK_SIZE];
+            chunks[ic].store(chunk, std::memory_order_release);
+        }
+
+        chunk[n % CHUNK_SIZE] = ev;
+
+        n_events.store(n + 1, std::memory_order_release);
+    }
+};
+
+// Buffers outlive their threads so that short-lived workers (mel, sampling) still show
+// up in the dump. When a thread exits, its buffer is handed to the next new thread, so a
+// trace "thread" is a lane of non-overlapping OS threads rather than a single one.
+struct whisper_trace_registry {
+    std::mutex mutex;
+    std::vector<std::unique_ptr<whisper_trace_buffer>> buffers;
+    std::vector<whisper_trace_buffer *> free;
+};
+
+static whisper_trace_registry & whisper_trace_get_registry() {
+    static whisper_trace_registry * registry = new whisper_trace_registry(); // intentionally leaked
+    return *registry;
+}
+
+struct whisper_trace_thread {
+    whisper_trace_buffer * buf = nullptr;
+
+    ~whisper_trace_thread() {
+        if (buf) {
+            auto & reg = whisper_trace_get_registry();
+            std::lock_guard<std::mutex> lock(reg.mutex);
+            reg.free.push_back(buf);
+        }
+    }
+};
+
+static whisper_trace_buffer * whisper_trace_get_buffer() {
+    static thread_local whisper_trace_thread tl;
+
+    if (tl.buf == nullptr) {
+        auto & reg = whisper_trace_get_registry();
+        std::lock_guard<std::mutex> lock(reg.mutex);
+
+        if (!reg.free.empty()) {
+            tl.buf = reg.free.back();
+            reg.free.pop_back();
+        } else {
+            reg.buffers.emplace_back(new whisper_trace_buffer((int) reg.buffers.size()));
+            tl.buf = reg.buffers.back().get();
+        }
+    }
+
+    return tl.buf;
+}
+
+struct whisper_trace_scope {
+    const char * name;
+    int64_t      arg;
+    int64_t      t_beg_us;
+
+    explicit whisper_trace_scope(const char * name, int64_t arg = WHISPER_TRACE_NO_ARG) : name(name), arg(arg), t_beg_us(ggml_time_us()) {}
+
+    ~whisper_trace_scope() {
+        whisper_trace_get_buffer()->push({ name, t_beg_us, ggml_time_us(), arg });
+    }
+};
+
+#define WHISPER_TRACE_CONCAT_IMPL(a, b) a##b
+#define WHISPER_TRACE_CONCAT(a, b) WHISPER_TRACE_CONCAT_IMPL(a, b)
+
+#define WHISPER_TRACE_SCOPE(name)          whisper_trace_scope WHISPER_TRACE_CONCAT(whisper_trace_scope_, __LINE__)(name)
+#define WHISPER_TRACE_SCOPE_ARG(name, arg) whisper_trace_scope WHISPER_TRACE_CONCAT(whisper_trace_scope_, __LINE__)(name, (int64_t) (arg))
+
+#else
+
+#define WHISPER_TRACE_SCOPE(name)
+#define WHISPER_TRACE_SCOPE_ARG(name, arg)
+
+#endif // WHISPER_TRACE
+
 //
 // ggml helpers
 //
 
+// value of a backend feature as reported by ggml_backend_get_features, or nullptr
+static const char * whisper_backend_feature(ggml_backend_reg_t reg, const char * name) {
+    auto * get_features_fn = (ggml_backend_get_features_t) ggml_backend_reg_get_proc_address(reg, "ggml_backend_get_features");
+    if (get_features_fn == nullptr) {
+        return nullptr;
+    }
+
+    for (ggml_backend_feature * f = get_features_fn(reg); f->name; f++) {
+        if (strcmp(f->name, name) == 0) {
+            return f->value;
+        }
+    }
+
+    return nullptr;
+}
+
+#ifdef GGML_BACKEND_DL
+// directory of the loaded libwhisper, empty if unknown
+static std::string whisper_library_dir() {
+#if defined(_WIN32)
+    return {};
+#else
+    Dl_info info;
+    if (dladdr((const void *) &whisper_print_system_info, &info) == 0 || info.dli_fname == nullptr) {
+        return {};
+    }
+
+    const std::string path = info.dli_fname;
+    const size_t pos = path.find_last_of('/');
+
+    return pos == std::string::npos ? std::string() : path.substr(0, pos);
+#endif
+}
+#endif
+
+// With GGML_BACKEND_DL the backends are shared objects loaded at runtime. For a
+// GGML_CPU_ALL_VARIANTS build, ggml_backend_load_best() scores every
+// libggml-cpu-<variant> against the features of the running CPU and loads the
+// best one. The build puts them next to libwhisper, so look there first.
+static void whisper_load_backends() {
+#ifdef GGML_BACKEND_DL
+    static std::once_flag flag;
+    std::call_once(flag, []() {
+        const std::string dir = whisper_library_dir();
+        if (!dir.empty()) {
+            ggml_backend_load_all_from_path(dir.c_str());
+        }
+        if (ggml_backend_dev_by_type(GGML_BACKEND_DEVICE_TYPE_CPU) == nullptr) {
+            ggml_backend_load_all();
+        }
+
+        ggml_backend_dev_t cpu_dev = ggml_backend_dev_by_type(GGML_BACKEND_DEVICE_TYPE_CPU);
+        if (cpu_dev == nullptr) {
+            WHISPER_LOG_ERROR("%s: no CPU backend found in '%s' or the default search paths\n", "whisper_load_backends", dir.c_str());
+            return;
+        }
+
+        const char * variant = whisper_backend_feature(ggml_backend_dev_backend_reg(cpu_dev), "VARIANT");
+        WHISPER_LOG_INFO("%s: CPU backend variant = %s\n", "whisper_load_backends", variant ? variant : "(single build)");
+    });
+#endif
+}
+
+static bool whisper_backend_is_cpu(ggml_backend_t backend) {
+    ggml_backend_dev_t dev = ggml_backend_get_device(backend);
+    return dev && ggml_backend_dev_type(dev) == GGML_BACKEND_DEVICE_TYPE_CPU;
+}
+
+// The threadpool lives in the CPU backend, which may be a runtime-loaded
+// variant, so resolve its functions through the registry instead of linking them.
+struct whisper_cpu_threadpool_api {
+    decltype(ggml_threadpool_new)             * tp_new         = nullptr;
+    decltype(ggml_threadpool_free)            * tp_free        = nullptr;
+    decltype(ggml_threadpool_pause)           * tp_pause       = nullptr;
+    decltype(ggml_threadpool_resume)          * tp_resume      = nullptr;
+    decltype(ggml_backend_cpu_set_threadpool) * set_threadpool = nullptr;
+};
+
+static const whisper_cpu_threadpool_api & whisper_cpu_threadpool() {
+    static const whisper_cpu_threadpool_api api = []() {
+        whisper_cpu_threadpool_api api;
+
+        ggml_backend_dev_t dev = ggml_backend_dev_by_type(GGML_BACKEND_DEVICE_TYPE_CPU);
+        ggml_backend_reg_t reg = dev ? ggml_backend_dev_backend_reg(dev) : nullptr;
+        if (reg) {
+            api.tp_new         = (decltype(api.tp_new))         ggml_backend_reg_get_proc_address(reg, "ggml_threadpool_new");
+            api.tp_free        = (decltype(api.tp_free))        ggml_backend_reg_get_proc_address(reg, "ggml_threadpool_free");
+            api.tp_pause       = (decltype(api.tp_pause))       ggml_backend_reg_get_proc_address(reg, "ggml_threadpool_pause");
+            api.tp_resume      = (decltype(api.tp_resume))      ggml_backend_reg_get_proc_address(reg, "ggml_threadpool_resume");
+            api.set_threadpool = (decltype(api.set_threadpool)) ggml_backend_reg_get_proc_address(reg, "ggml_backend_cpu_set_threadpool");
+        }
+
+        return api;
+    }();
+
+    return api;
+}
+
 static bool ggml_graph_compute_helper(
           struct ggml_cgraph * graph,
                          int   n_threads,
          ggml_abort_callback   abort_callback,
                         void * abort_callback_data) {
+    whisper_load_backends();
+
     ggml_backend_ptr backend { ggml_backend_init_by_type(GGML_BACKEND_DEVICE_TYPE_CPU, nullptr) };
 
     auto * reg = ggml_backend_dev_backend_reg(ggml_backend_get_device(backend.get()));
@@ -206,52 +448,6 @@ static bool ggml_graph_compute_helper(
     return t;
 }
 
-// TODO: move these functions to ggml-base with support for ggml-backend?
-
-static ggml_tensor * whisper_set_f32(struct ggml_tensor * t, float v) {
-    GGML_ASSERT(t->type == GGML_TYPE_F32);
-    GGML_ASSERT(ggml_is_contiguous(t));
-    size_t nels = ggml_nelements(t);
-    for (size_t i = 0; i < nels; ++i) {
-        ((float *) t->data)[i] = v;
-    }
-    return t;
-}
-
-static ggml_tensor * whisper_set_i32(struct ggml_tensor * t, int32_t v) {
-    GGML_ASSERT(t->type == GGML_TYPE_I32);
-    GGML_ASSERT(ggml_is_contiguous(t));
-    size_t nels = ggml_nelements(t);
-    for (size_t i = 0; i < nels; ++i) {
-        ((int32_t *) t->data)[i] = v;
-    }
-    return t;
-}
-
-static float whisper_get_f32_nd(const struct ggml_tensor * t, int64_t i0, int64_t i1, int64_t i2, int64_t i3) {
-    GGML_ASSERT(t->type == GGML_TYPE_F32);
-    void * data = (char *) t->data + i0*t->nb[0] + i1*t->nb[1] + i2*t->nb[2] + i3*t->nb[3];
-    return *(float *) data;
-}
-
-static void whisper_set_f32_nd(struct ggml_tensor * t, int64_t i0, int64_t i1, int64_t i2, int64_t i3, float v) {
-    GGML_ASSERT(t->type == GGML_TYPE_F32);
-    void * data = (char *) t->data + i0*t->nb[0] + i1*t->nb[1] + i2*t->nb[2] + i3*t->nb[3];
-    *(float *) data = v;
-}
-
-static int32_t whisper_get_i32_nd(const struct ggml_tensor * t, int64_t i0, int64_t i1, int64_t i2, int64_t i3) {
-    GGML_ASSERT(t->type == GGML_TYPE_I32);
-    void * data = (char *) t->data + i0*t->nb[0] + i1*t->nb[1] + i2*t->nb[2] + i3*t->nb[3];
-    return *(int32_t *) data;
-}
-
-static void whisper_set_i32_nd(struct ggml_tensor * t, int64_t i0, int64_t i1, int64_t i2, int64_t i3, int32_t v) {
-    GGML_ASSERT(t->type == GGML_TYPE_I32);
-    void * data = (char *) t->data + i0*t->nb[0] + i1*t->nb[1] + i2*t->nb[2] + i3*t->nb[3];
-    *(int32_t *) data = v;
-}
-
 // faster matrix multiplications for tensors that do not have dimension 0 divisible by "pad"
 // the idea is to represent the original matrix multiplication:
 //
@@ -459,14 +655,248 @@ struct whisper_filters {
     std::vector<float> data;
 };
 
+// byte trie of the token texts, for the longest-match search of tokenize()
+// the nodes are laid out breadth-first, so that the children of a node are contiguous and sorted by byte
+struct whisper_token_trie {
+    struct node {
+        int32_t  id;      // token ending at this node, -1 if none
+        uint32_t child;   // index of the first child
+        uint32_t n_child;
+    };
+
+    std::vector<node>    nodes;
+    std::vector<uint8_t> labels; // byte on the edge to each node
+
+    // token i is text + offs[i], offs[i + 1] - offs[i] - 1 bytes long
+    // if several tokens have the same text, the last one wins
+    void build(const char * text, const uint32_t * offs, int n_tokens) {
+        auto str = [&](int32_t i) { return (const uint8_t *) text + offs[i]; };
+        auto len = [&](int32_t i) { return offs[i + 1] - offs[i] - 1; };
+
+        std::vector<int32_t> order(n_tokens);
+        for (int32_t i = 0; i < n_tokens; ++i) {
+            order[i] = i;
+        }
+        std::sort(order.begin(), order.end(), [&](int32_t a, int32_t b) {
+            const int cmp = memcmp(str(a), str(b), std::min(len(a), len(b)));
+            if (cmp != 0) {
+                return cmp < 0;
+            }
+            return len(a) != len(b) ? len(a) < len(b) : a < b;
+        });
+
+        nodes.assign(1, { -1, 0, 0 });
+        labels.assign(1, 0);
+
+        // node and the range of sorted tokens below it
+        struct item {
+            uint32_t node;
+            uint32_t lo;
+            uint32_t hi;
+            uint32_t depth;
+        };
+
+        std::vector<item> queue;
+        queue.push_back({ 0, 0, (uint32_t) n_tokens, 0 });
+
+        for (size_t q = 0; q < queue.size(); ++q) {
+            const item cur = queue[q];
+
+            uint32_t lo = cur.lo;
+            while (lo < cur.hi && len(order[lo]) == cur.depth) {
+                nodes[cur.node].id = order[lo++];
+            }
+
+            nodes[cur.node].child = nodes.size();
+            while (lo < cur.hi) {
+                const uint8_t c = str(order[lo])[cur.depth];
+                uint32_t hi = lo + 1;
+                while (hi < cur.hi && str(order[hi])[cur.depth] == c) {
+                    hi++;
+                }
+                queue.push_back({ (uint32_t) nodes.size(), lo, hi, cur.depth + 1 });
+                nodes.push_back({ -1, 0, 0 });
+                labels.push_back(c);
+                nodes[cur.node].n_child++;
+                lo = hi;
+            }
+        }
+    }
+
+    // returns the child of node for byte c, 0 if none
+    uint32_t next(uint32_t node, uint8_t c) const {
+        const uint8_t * first = labels.data() + nodes[node].child;
+        const uint8_t * last  = first + nodes[node].n_child;
+        const uint8_t * it    = std::lower_bound(first, last, c);
+        return it != last && *it == c ? it - labels.data() : 0;
+    }
+
+    // length of the longest token that [s, s + n) starts with and its id, 0 if none
+    size_t longest_prefix(const char * s, size_t n, int32_t & id) const {
+        size_t   best = 0;
+        uint32_t node = 0;
+        for (size_t i = 0; i < n; ++i) {
+            node = next(node, s[i]);
+            if (node == 0) {
+                break;
+            }
+            if (nodes[node].id >= 0) {
+                best = i + 1;
+                id   = nodes[node].id;
+            }
+        }
+        return best;
+    }
+
+    // -1 if [s, s + n) is not a token
+    int32_t find(const char * s, size_t n) const {
+        uint32_t node = 0;
+        for (size_t i = 0; i < n; ++i) {
+            node = next(node, s[i]);
+            if (node == 0) {
+                return -1;
+            }
+        }
+        return nodes.empty() ? -1 : nodes[node].id;
+    }
+};
+
+struct whisper_partial_utf8 {
+    uint32_t value;    // bit value so far (unshifted)
+    int      n_remain; // num bytes remaining; -1 indicates invalid sequence
+};
+
+static std::pair<std::vector<uint32_t>, whisper_partial_utf8> decode_utf8(
+        const char         * src,
+        whisper_partial_utf8   partial_start);
+
+// code-point trie of the text tokens, for grammar sampling: the UTF-8 of each token is decoded once per model
+// and the tokens that start with the same code points share the path to them, so they are matched together
+struct whisper_grammar_trie {
+    struct node {
+        uint32_t child;   // index of the first child
+        uint32_t n_child;
+        uint32_t tok;     // index of the first token ending at this node
+        uint32_t n_tok;
+    };
+
+    struct token {
+        int32_t              id;
+        whisper_partial_utf8 partial_utf8; // incomplete UTF-8 sequence at the end of the token
+    };
+
+    std::vector<node>     nodes;
+    std::vector<uint32_t> labels; // code point on the edge to each node
+    std::vector<token>    tokens;
+
+    // tokens [0, n_tokens) of the vocabulary, decoded from the start of a code point; empty tokens are skipped
+    void build(const char * text, const uint32_t * offs, int n_tokens) {
+        std::vector<uint32_t> cps;
+        std::vector<uint32_t> cps_offs = { 0 };
+        std::vector<token>    toks;
+
+        for (int32_t i = 0; i < n_tokens; ++i) {
+            if (offs[i + 1] - offs[i] == 1) {
+                continue;
+            }
+            // the decoded code points end with a 0
+            const auto decoded = decode_utf8(text + offs[i], { 0, 0 });
+            cps.insert(cps.end(), decoded.first.begin(), decoded.first.end() - 1);
+            cps_offs.push_back(cps.size());
+            toks.push_back({ i, decoded.second });
+        }
+
+        auto str = [&](uint32_t k) { return cps.data() + cps_offs[k]; };
+        auto len = [&](uint32_t k) { return cps_offs[k + 1] - cps_offs[k]; };
+
+        std::vector<uint32_t> order(toks.size());
+        for (uint32_t k = 0; k < order.size(); ++k) {
+            order[k] = k;
+        }
+        std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+            return std::lexicographical_compare(str(a), str(a) + len(a), str(b), str(b) + len(b));
+        });
+
+        nodes.assign(1, { 0, 0, 0, 0 });
+        labels.assign(1, 0);
+        tokens.clear();
+        tokens.reserve(toks.size());
+
+        // node and the range of sorted tokens below it
+        struct item {
+            uint32_t node;
+            uint32_t lo;
+            uint32_t hi;
+            uint32_t depth;
+        };
+
+        std::vector<item> queue;
+        queue.push_back({ 0, 0, (uint32_t) order.size(), 0 });
+
+        for (size_t q = 0; q < queue.size(); ++q) {
+            const item cur = queue[q];
+
+            uint32_t lo = cur.lo;
+            nodes[cur.node].tok = tokens.size();
+            while (lo < cur.hi && len(order[lo]) == cur.depth) {
+                tokens.push_back(toks[order[lo++]]);
+                nodes[cur.node].n_tok++;
+            }
+
+            nodes[cur.node].child = nodes.size();
+            while (lo < cur.hi) {
+                const uint32_t c = str(order[lo])[cur.depth];
+                uint32_t hi = lo + 1;
+                while (hi < cur.hi && str(order[hi])[cur.depth] == c) {
+                    hi++;
+                }
+                queue.push_back({ (uint32_t) nodes.size(), lo, hi, cur.depth + 1 });
+                nodes.push_back({ 0, 0, 0, 0 });
+                labels.push_back(c);
+                nodes[cur.node].n_child++;
+                lo = hi;
+            }
+        }
+    }
+};
+
 struct whisper_vocab {
     using id    = int32_t;
     using token = std::string;
 
     int n_vocab = 51864;
 
-    std::map<token, id> token_to_id;
-    std::map<id, token> id_to_token;
+    // token texts back to back, each NUL-terminated: token i starts at token_text[token_offs[i]]
+    std::vector<char>     token_text;
+    std::vector<uint32_t> token_offs = { 0 }; // [n_tokens() + 1]
+
+    whisper_token_trie   token_trie;   // built once all the tokens are added
+    whisper_grammar_trie grammar_trie; // text tokens only, built by the first grammar compiled for this model
+
+    std::once_flag grammar_trie_once;
+
+    int n_tokens() const {
+        return (int) token_offs.size() - 1;
+    }
+
+    const char * id_to_token(id i) const {
+        return token_text.data() + token_offs[i];
+    }
+
+    size_t token_len(id i) const {
+        return token_offs[i + 1] - token_offs[i] - 1;
+    }
+
+    // -1 if the text is not a token
+    id token_to_id(const std::string & text) const {
+        return token_trie.find(text.data(), text.size());
+    }
+
+    void add_token(const std::string & text) {
+        token_text.insert(token_text.end(), text.begin(), text.end());
+        token_text.push_back('\0');
+        token_offs.push_back(token_text.size());
+    }
 
     // reference: https://github.com/openai/whisper/blob/248b6cb124225dd263bb9bd32d060b6517e067f8/whisper/tokenizer.py#L334-L349
     id token_eot        = 50256;
@@ -574,7 +1004,7 @@ struct whisper_sched {
     std::vector<uint8_t> meta;
 };
 
-static size_t whisper_sched_size(struct whisper_sched & allocr) {
+static size_t whisper_sched_size(const struct whisper_sched & allocr) {
     size_t size = allocr.meta.size();
     for (int i = 0; i < ggml_backend_sched_get_n_backends(allocr.sched); ++i) {
         ggml_backend_t backend = ggml_backend_sched_get_backend(allocr.sched, i);
@@ -583,6 +1013,12 @@ static size_t whisper_sched_size(struct whisper_sched & allocr) {
     return size;
 }
 
+static void whisper_memory_entry_set(whisper_memory_entry & entry, const char * name, size_t cur) {
+    entry.name = name;
+    entry.cur  = cur;
+    entry.peak = std::max(entry.peak, cur);
+}
+
 // measure the memory usage of a graph and prepare the allocr's internal data buffer
 static bool whisper_sched_graph_init(struct whisper_sched & allocr, std::vector<ggml_backend_t> backends, std::function<struct ggml_cgraph *()> && get_graph) {
     auto & sched = allocr.sched;
@@ -605,78 +1041,252 @@ static bool whisper_sched_graph_init(struct whisper_sched & allocr, std::vector<
     return true;
 }
 
-// medium
-// hparams: {
-// 'n_mels': 80,
-// 'n_vocab': 51864,
-// 'n_audio_ctx': 1500,
-// 'n_audio_state': 1024,
-// 'n_audio_head': 16,
-// 'n_audio_layer': 24,
-// 'n_text_ctx': 448,
-// 'n_text_state': 1024,
-// 'n_text_head': 16,
-// 'n_text_layer': 24
-// }
-//
-// default hparams (Whisper tiny)
-struct whisper_hparams {
-    int32_t n_vocab       = 51864;
-    int32_t n_audio_ctx   = 1500;
-    int32_t n_audio_state = 384;
-    int32_t n_audio_head  = 6;
-    int32_t n_audio_layer = 4;
-    int32_t n_text_ctx    = 448;
-    int32_t n_text_state  = 384;
-    int32_t n_text_head   = 6;
-    int32_t n_text_layer  = 4;
-    int32_t n_mels        = 80;
-    int32_t ftype         = 1;
-    float   eps           = 1e-5f;
-};
+// [EXPERIMENTAL] per-op profiling via the scheduler eval callback
 
-// audio encoding layer
-struct whisper_layer_encoder {
-    // encoder.blocks.*.attn_ln
-    struct ggml_tensor * attn_ln_0_w;
-    struct ggml_tensor * attn_ln_0_b;
+enum whisper_profile_graph {
+    WHISPER_PROFILE_GRAPH_CONV = 0,
+    WHISPER_PROFILE_GRAPH_ENCODE,
+    WHISPER_PROFILE_GRAPH_CROSS,
+    WHISPER_PROFILE_GRAPH_DECODE,
+    WHISPER_PROFILE_GRAPH_COUNT,
+};
 
-    // encoder.blocks.*.attn.out
-    struct ggml_tensor * attn_ln_1_w;
-    struct ggml_tensor * attn_ln_1_b;
+static const char * WHISPER_PROFILE_GRAPH_NAMES[WHISPER_PROFILE_GRAPH_COUNT] = {
+    "conv", "encode", "cross", "decode",
+};
 
-    // encoder.blocks.*.attn.query
-    struct ggml_tensor * attn_q_w;
-    struct ggml_tensor * attn_q_b;
+struct whisper_profile_stat {
+    int64_t n    = 0;
+    int64_t t_us = 0;
+};
 
-    // encoder.blocks.*.attn.key
-    struct ggml_tensor * attn_k_w;
+struct whisper_profiler {
+    bool enabled = false;
 
-    // encoder.blocks.*.attn.value
-    struct ggml_tensor * attn_v_w;
-    struct ggml_tensor * attn_v_b;
+    int     graph           = -1; // graph currently being computed
+    int64_t t_node_start_us = 0;
 
-    // encoder.blocks.*.mlp_ln
-    struct ggml_tensor * mlp_ln_w;
-    struct ggml_tensor * mlp_ln_b;
+    // scope of each node of the current graph
+    std::unordered_map<const ggml_tensor *, whisper_profile_stat *> node_scope;
 
-    // encoder.blocks.*.mlp.0
-    struct ggml_tensor * mlp_0_w;
-    struct ggml_tensor * mlp_0_b;
+    std::map<std::string, whisper_profile_stat> ops;
+    std::map<std::string, whisper_profile_stat> scopes;
+    whisper_profile_stat graphs[WHISPER_PROFILE_GRAPH_COUNT];
 
-    // encoder.blocks.*.mlp.2
-    struct ggml_tensor * mlp_1_w;
-    struct ggml_tensor * mlp_1_b;
+    // storage for whisper_get_profile()
+    std::vector<whisper_profile_entry> res_ops;
+    std::vector<whisper_profile_entry> res_scopes;
+    std::vector<whisper_profile_entry> res_graphs;
+    whisper_profile res;
 };
 
-// token decoding layer
-struct whisper_layer_decoder {
-    // decoder.blocks.*.attn_ln
-    struct ggml_tensor * attn_ln_0_w;
-    struct ggml_tensor * attn_ln_0_b;
-
-    // decoder.blocks.*.attn.out
-    struct ggml_tensor * attn_ln_1_w;
+// "encoder.blocks.3.attn.query.weight" -> "encoder.blocks.3.attn"
+// "decoder.blocks.1.cross_attn_ln.bias" -> "decoder.blocks.1.cross_attn"
+// "encoder.conv1.weight"                -> "encoder.conv1"
+static std::string whisper_profile_scope_name(const char * name) {
+    std::vector<std::string> parts;
+    {
+        std::string part;
+        for (const char * p = name; ; ++p) {
+            if (*p == '.' || *p == '\0') {
+                parts.push_back(part);
+                part.clear();
+                if (*p == '\0') {
+                    break;
+                }
+            } else {
+                part += *p;
+            }
+        }
+    }
+
+    if (parts.size() > 1 && (parts.back() == "weight" || parts.back() == "bias")) {
+        parts.pop_back();
+    }
+
+    if (parts.size() > 3 && parts[1] == "blocks") {
+        std::string block = parts[3];
+        if (block.size() > 3 && block.compare(block.size() - 3, 3, "_ln") == 0) {
+            block.resize(block.size() - 3);
+        }
+        return parts[0] + "." + parts[1] + "." + parts[2] + "." + block;
+    }
+
+    std::string res;
+    for (size_t i = 0; i < parts.size(); ++i) {
+        res += (i > 0 ? "." : "") + parts[i];
+    }
+    return res;
+}
+
+// the weight read by a node, if any
+static const ggml_tensor * whisper_profile_node_weight(const ggml_tensor * t) {
+    for (int i = 0; i < GGML_MAX_SRC; ++i) {
+        const ggml_tensor * src = t->src[i];
+        if (src == nullptr) {
+            continue;
+        }
+        if (src->view_src) {
+            src = src->view_src;
+        }
+        if (src->buffer && ggml_backend_buffer_get_usage(src->buffer) == GGML_BACKEND_BUFFER_USAGE_WEIGHTS && src->name[0] != '\0') {
+            return src;
+        }
+    }
+    return nullptr;
+}
+
+// called before computing a graph: assign every node to the scope of the weights it uses,
+// or of the next node that uses weights (e.g. the norm before a block belongs to the block)
+static void whisper_profile_graph_begin(whisper_profiler & prof, whisper_profile_graph graph, ggml_cgraph * gf) {
+    if (!prof.enabled) {
+        return;
+    }
+
+    prof.graph = graph;
+    prof.graphs[graph].n++;
+    prof.node_scope.clear();
+
+    const int n_nodes = ggml_graph_n_nodes(gf);
+
+    std::vector<whisper_profile_stat *> scope(n_nodes, nullptr);
+    for (int i = 0; i < n_nodes; ++i) {
+        const ggml_tensor * w = whisper_profile_node_weight(ggml_graph_node(gf, i));
+        if (w) {
+            scope[i] = &prof.scopes[whisper_profile_scope_name(w->name)];
+        }
+    }
+
+    whisper_profile_stat * cur = nullptr;
+    for (int i = n_nodes - 1; i >= 0; --i) {
+        if (scope[i]) {
+            cur = scope[i];
+        }
+        scope[i] = cur;
+    }
+
+    // nodes after the last weight (e.g. KV cache copies) belong to the last scope
+    cur = &prof.scopes[WHISPER_PROFILE_GRAPH_NAMES[graph]];
+    for (int i = 0; i < n_nodes; ++i) {
+        if (scope[i]) {
+            cur = scope[i];
+        }
+        prof.node_scope[ggml_graph_node(gf, i)] = scope[i] ? scope[i] : cur;
+    }
+}
+
+static bool whisper_profile_eval_callback(struct ggml_tensor * t, bool ask, void * user_data) {
+    auto & prof = *(whisper_profiler *) user_data;
+
+    if (ask) {
+        switch (t->op) {
+            case GGML_OP_NONE:
+            case GGML_OP_VIEW:
+            case GGML_OP_RESHAPE:
+            case GGML_OP_PERMUTE:
+            case GGML_OP_TRANSPOSE:
+                // no-ops, computed together with the next node
+                return false;
+            default:
+                break;
+        }
+
+        prof.t_node_start_us = ggml_time_us();
+
+        return true;
+    }
+
+    const int64_t t_us = ggml_time_us() - prof.t_node_start_us;
+
+    auto & op = prof.ops[ggml_op_desc(t)];
+    op.n++;
+    op.t_us += t_us;
+
+    auto it = prof.node_scope.find(t);
+    if (it != prof.node_scope.end()) {
+        it->second->n++;
+        it->second->t_us += t_us;
+    }
+
+    if (prof.graph >= 0) {
+        prof.graphs[prof.graph].t_us += t_us;
+    }
+
+    return true;
+}
+
+// medium
+// hparams: {
+// 'n_mels': 80,
+// 'n_vocab': 51864,
+// 'n_audio_ctx': 1500,
+// 'n_audio_state': 1024,
+// 'n_audio_head': 16,
+// 'n_audio_layer': 24,
+// 'n_text_ctx': 448,
+// 'n_text_state': 1024,
+// 'n_text_head': 16,
+// 'n_text_layer': 24
+// }
+//
+// default hparams (Whisper tiny)
+struct whisper_hparams {
+    int32_t n_vocab       = 51864;
+    int32_t n_audio_ctx   = 1500;
+    int32_t n_audio_state = 384;
+    int32_t n_audio_head  = 6;
+    int32_t n_audio_layer = 4;
+    int32_t n_text_ctx    = 448;
+    int32_t n_text_state  = 384;
+    int32_t n_text_head   = 6;
+    int32_t n_text_layer  = 4;
+    int32_t n_mels        = 80;
+    int32_t ftype         = 1;
+    float   eps           = 1e-5f;
+};
+
+// audio encoding layer
+struct whisper_layer_encoder {
+    // encoder.blocks.*.attn_ln
+    struct ggml_tensor * attn_ln_0_w;
+    struct ggml_tensor * attn_ln_0_b;
+
+    // encoder.blocks.*.attn.out
+    struct ggml_tensor * attn_ln_1_w;
+    struct ggml_tensor * attn_ln_1_b;
+
+    // encoder.blocks.*.attn.query
+    struct ggml_tensor * attn_q_w;
+    struct ggml_tensor * attn_q_b;
+
+    // encoder.blocks.*.attn.key
+    struct ggml_tensor * attn_k_w;
+
+    // encoder.blocks.*.attn.value
+    struct ggml_tensor * attn_v_w;
+    struct ggml_tensor * attn_v_b;
+
+    // encoder.blocks.*.mlp_ln
+    struct ggml_tensor * mlp_ln_w;
+    struct ggml_tensor * mlp_ln_b;
+
+    // encoder.blocks.*.mlp.0
+    struct ggml_tensor * mlp_0_w;
+    struct ggml_tensor * mlp_0_b;
+
+    // encoder.blocks.*.mlp.2
+    struct ggml_tensor * mlp_1_w;
+    struct ggml_tensor * mlp_1_b;
+};
+
+// token decoding layer
+struct whisper_layer_decoder {
+    // decoder.blocks.*.attn_ln
+    struct ggml_tensor * attn_ln_0_w;
+    struct ggml_tensor * attn_ln_0_b;
+
+    // decoder.blocks.*.attn.out
+    struct ggml_tensor * attn_ln_1_w;
     struct ggml_tensor * attn_ln_1_b;
 
     // decoder.blocks.*.attn.query
@@ -775,6 +1385,7 @@ struct whisper_model {
 
     // decoder.token_embedding
     struct ggml_tensor * d_te;
+    struct ggml_tensor * d_te_out; // copy of d_te for the output logits (whisper_context_params::type_logits) or d_te
 
     // decoder.ln
     struct ggml_tensor * d_ln_w;
@@ -794,23 +1405,17 @@ struct whisper_model {
     std::map<std::string, struct ggml_tensor *> tensors;
 };
 
-struct whisper_partial_utf8 {
-    uint32_t value;    // bit value so far (unshifted)
-    int      n_remain; // num bytes remaining; -1 indicates invalid sequence
-};
+struct whisper_grammar_automaton;
 
 struct whisper_grammar {
-    /*const*/ std::vector<std::vector<whisper_grammar_element>> rules;
-    std::vector<std::vector<const whisper_grammar_element *>>   stacks;
+    // compiled rules and interned stacks, shared by all the decoders of a whisper_full() call
+    std::shared_ptr<whisper_grammar_automaton> automaton;
 
-    // buffer for partially generated UTF-8 sequence from accepted tokens
-    whisper_partial_utf8 partial_utf8;
-};
+    // id of the current set of stacks in the automaton, 0 if there are none
+    int32_t stacks = 0;
 
-struct whisper_grammar_candidate {
-    whisper_token          id;
-    const uint32_t       * code_points;
-    whisper_partial_utf8   partial_utf8;
+    // buffer for partially generated UTF-8 sequence from accepted tokens
+    whisper_partial_utf8 partial_utf8 = { 0, 0 };
 };
 
 struct whisper_sequence {
@@ -864,6 +1469,18 @@ struct vad_time_mapping {
     int64_t original_time;   // Corresponding time in original audio
 };
 
+// scratch of whisper_exp_compute_token_level_timestamps_dtw(), reused across calls
+struct whisper_dtw_workspace {
+    std::vector<float>   w;      // [n_heads][n_audio][n_tokens] attention weights
+    std::vector<float>   x;      // [N + M - 1][N] DTW input, by anti-diagonal
+    std::vector<float>   cost;   // [3][N + 1] last three anti-diagonals of the cost matrix
+    std::vector<uint8_t> trace;  // [N + M + 1][N + 1] step into each cell, by anti-diagonal
+    std::vector<float>   window; // [n_threads][filter_width][n_tokens] median filter windows
+    std::vector<double>  sum;    // [n_threads][n_tokens] sums over the heads
+
+    std::vector<std::pair<int32_t, int32_t>> path; // (token, audio frame) pairs of the alignment
+};
+
 struct whisper_state {
     int64_t t_sample_us = 0;
     int64_t t_encode_us = 0;
@@ -907,6 +1524,13 @@ struct whisper_state {
     whisper_sched sched_cross;
     whisper_sched sched_decode;
 
+    // [EXPERIMENTAL] per-op profiling
+    whisper_profiler profiler;
+
+    // persistent threadpool attached to the CPU backend (see whisper_threadpool_params)
+    ggml_threadpool_t threadpool = nullptr;
+    int threadpool_n_threads = 0;
+
     // result of the encoder
     struct ggml_tensor * embd_conv = nullptr;
     struct ggml_tensor * embd_enc  = nullptr;
@@ -946,6 +1570,7 @@ struct whisper_state {
     whisper_aheads_masks aheads_masks;
     ggml_tensor * aheads_cross_QKs = nullptr;
     std::vector<float> aheads_cross_QKs_data;
+    whisper_dtw_workspace dtw_ws;
 
     // [EXPERIMENTAL] speed-up techniques
     int32_t exp_n_audio_ctx = 0; // 0 - use default
@@ -962,6 +1587,9 @@ struct whisper_state {
     bool has_vad_segments = false;
 
     std::vector<vad_time_mapping> vad_mapping_table;
+
+    // memory accounting, updated by whisper_state_memory_update()
+    whisper_memory_usage mem = {};
 };
 
 struct whisper_context {
@@ -978,7 +1606,13 @@ struct whisper_context {
 
     whisper_state * state = nullptr;
 
+    // states of the extra processors of whisper_full_parallel(), kept between calls
+    std::vector<whisper_state *> parallel_states;
+
     std::string path_model; // populated by whisper_init_from_file_with_params()
+
+    // returned by whisper_get_memory_usage()
+    std::vector<whisper_memory_entry> mem_weights;
 };
 
 struct whisper_global {
@@ -1042,6 +1676,32 @@ static bool whisper_kv_cache_init(
     return true;
 }
 
+// type of a KV cache for the requested one: quantized caches are only read through flash attention,
+// the other graphs store V transposed and read it with mul_mat
+static ggml_type whisper_kv_cache_type(ggml_type type, bool flash_attn, bool allow_q4_0, const char * name) {
+    switch (type) {
+        case GGML_TYPE_F16:
+            return type;
+        case GGML_TYPE_Q8_0:
+            break;
+        case GGML_TYPE_Q4_0:
+            if (allow_q4_0) {
+                break;
+            }
+            // fallthrough
+        default:
+            WHISPER_LOG_WARN("%s: %s cache type %s is not supported - using f16\n", __func__, name, ggml_type_name(type));
+            return GGML_TYPE_F16;
+    }
+
+    if (!flash_attn) {
+        WHISPER_LOG_WARN("%s: %s cache type %s requires flash_attn - using f16\n", __func__, name, ggml_type_name(type));
+        return GGML_TYPE_F16;
+    }
+
+    return type;
+}
+
 static void whisper_kv_cache_free(struct whisper_kv_cache & cache) {
     ggml_backend_buffer_free(cache.buffer);
 }
@@ -1415,7 +2075,7 @@ static buft_list_t make_buft_list(whisper_context_params & params) {
     auto * cpu_reg = ggml_backend_dev_backend_reg(cpu_dev);
     auto get_extra_bufts_fn = (ggml_backend_dev_get_extra_bufts_t)
         ggml_backend_reg_get_proc_address(cpu_reg, "ggml_backend_dev_get_extra_bufts");
-    if (get_extra_bufts_fn) {
+    if (get_extra_bufts_fn && params.use_extra_bufts) {
         ggml_backend_buffer_type_t * extra_bufts = get_extra_bufts_fn(cpu_dev);
         while (extra_bufts && *extra_bufts) {
             buft_list.emplace_back(cpu_dev, *extra_bufts);
@@ -1496,6 +2156,98 @@ static ggml_backend_buffer_type_t select_weight_buft(const whisper_hparams & hpa
     return nullptr;
 }
 
+// type of the copy of the token embedding used for the output logits, GGML_TYPE_COUNT - no copy
+// the copy is quantized from the loaded table, so it is only made for F32/F16/BF16 models
+static ggml_type whisper_logits_type(ggml_type type, ggml_type wtype, int n_text_state) {
+    if (type == GGML_TYPE_COUNT || type == wtype) {
+        return GGML_TYPE_COUNT;
+    }
+
+    if (type != GGML_TYPE_Q8_0 && type != GGML_TYPE_Q6_K) {
+        WHISPER_LOG_WARN("%s: logits type %s is not supported - using the token embedding\n", __func__, ggml_type_name(type));
+        return GGML_TYPE_COUNT;
+    }
+
+    if (ggml_is_quantized(wtype)) {
+        WHISPER_LOG_WARN("%s: the model is already quantized (%s) - using the token embedding\n", __func__, ggml_type_name(wtype));
+        return GGML_TYPE_COUNT;
+    }
+
+    if (n_text_state % ggml_blck_size(type) != 0) {
+        WHISPER_LOG_WARN("%s: n_text_state = %d is not a multiple of the %s block size - using q8_0\n", __func__, n_text_state, ggml_type_name(type));
+        type = GGML_TYPE_Q8_0;
+    }
+
+    return type;
+}
+
+// quantize the token embedding into d_te_out, in chunks of rows split across threads
+static void whisper_model_init_logits(whisper_model & model) {
+    ggml_tensor * src = model.d_te;
+    ggml_tensor * dst = model.d_te_out;
+
+    const int64_t n_per_row = src->ne[0];
+    const int64_t nrows     = src->ne[1];
+
+    // the loader reads the weights directly into host buffers, others are copied out first
+    std::vector<uint8_t> src_buf;
+    const uint8_t * src_data = (const uint8_t *) src->data;
+    if (!ggml_backend_buffer_is_host(src->buffer)) {
+        src_buf.resize(ggml_nbytes(src));
+        ggml_backend_tensor_get(src, src_buf.data(), 0, src_buf.size());
+        src_data = src_buf.data();
+    }
+
+    // repacked buffers have to be set in one call
+    std::vector<uint8_t> dst_buf;
+    uint8_t * dst_data = (uint8_t *) dst->data;
+    if (!ggml_backend_buffer_is_host(dst->buffer)) {
+        dst_buf.resize(ggml_nbytes(dst));
+        dst_data = dst_buf.data();
+    }
+
+    const ggml_to_float_t to_float = ggml_get_type_traits(src->type)->to_float;
+
+    constexpr int64_t chunk_rows = 256;
+
+    const int64_t n_chunks  = (nrows + chunk_rows - 1)/chunk_rows;
+    const int     n_threads = (int) std::min<int64_t>(n_chunks, std::max(1u, std::min(8u, std::thread::hardware_concurrency())));
+
+    std::atomic<int64_t> next_chunk(0);
+
+    auto worker = [&]() {
+        std::vector<float> f32(src->type == GGML_TYPE_F32 ? 0 : chunk_rows*n_per_row);
+
+        for (int64_t ic = next_chunk++; ic < n_chunks; ic = next_chunk++) {
+            const int64_t ir0 = ic*chunk_rows;
+            const int64_t nr  = std::min(chunk_rows, nrows - ir0);
+
+            const uint8_t * s = src_data + ir0*src->nb[1];
+
+            const float * x = (const float *) s;
+            if (src->type != GGML_TYPE_F32) {
+                to_float(s, f32.data(), nr*n_per_row);
+                x = f32.data();
+            }
+
+            ggml_quantize_chunk(dst->type, x, dst_data + ir0*dst->nb[1], 0, nr, n_per_row, nullptr);
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (int i = 1; i < n_threads; ++i) {
+        workers.emplace_back(worker);
+    }
+    worker();
+    for (auto & w : workers) {
+        w.join();
+    }
+
+    if (!dst_buf.empty()) {
+        ggml_backend_tensor_set(dst, dst_buf.data(), 0, dst_buf.size());
+    }
+}
+
 // load the model from a ggml file
 //
 // file format:
@@ -1640,8 +2392,7 @@ static bool whisper_model_load(struct whisper_model_loader * loader, whisper_con
                 word = "";
             }
 
-            vocab.token_to_id[word] = i;
-            vocab.id_to_token[i] = word;
+            vocab.add_token(word);
 
             //printf("%s: vocab[%d] = '%s'\n", __func__, i, word.c_str());
         }
@@ -1691,11 +2442,12 @@ static bool whisper_model_load(struct whisper_model_loader * loader, whisper_con
                 } else {
                     word = "[_extra_token_" + std::to_string(i) + "]";
                 }
-                vocab.token_to_id[word] = i;
-                vocab.id_to_token[i] = word;
+                vocab.add_token(word);
             }
         }
 
+        vocab.token_trie.build(vocab.token_text.data(), vocab.token_offs.data(), vocab.n_tokens());
+
         WHISPER_LOG_INFO("%s: n_langs       = %d\n", __func__, vocab.num_languages());
     }
 
@@ -1707,7 +2459,7 @@ static bool whisper_model_load(struct whisper_model_loader * loader, whisper_con
     const int n_audio_layer = hparams.n_audio_layer;
     const int n_text_layer  = hparams.n_text_layer;
 
-    const size_t n_tensors = 10 /* input */ + 15 + 15*n_audio_layer + 24*n_text_layer;
+    const size_t n_tensors = 10 /* input */ + 15 + 15*n_audio_layer + 24*n_text_layer + 1 /* d_te_out */;
 
     std::map<ggml_backend_buffer_type_t, ggml_context *> ctx_map;
     auto get_ctx = [&](ggml_backend_buffer_type_t buft) -> ggml_context * {
@@ -1746,7 +2498,12 @@ static bool whisper_model_load(struct whisper_model_loader * loader, whisper_con
         ggml_context * ctx = get_ctx(buft);
         ggml_tensor * tensor = ggml_dup_tensor(ctx, meta);
 
-        model.tensors[format(ASR_TENSOR_NAMES.at(system).at(type), layer)] = tensor;
+        const std::string name = format(ASR_TENSOR_NAMES.at(system).at(type), layer);
+
+        // named so that graph nodes can be attributed to layers (e.g. by the profiler)
+        ggml_set_name(tensor, name.c_str());
+
+        model.tensors[name] = tensor;
 
         return tensor;
     };
@@ -1823,6 +2580,23 @@ static bool whisper_model_load(struct whisper_model_loader * loader, whisper_con
 
         model.d_te = create_tensor(ASR_TENSOR_DEC_TOKEN_EMBD_WEIGHT, ASR_SYSTEM_DECODER, ggml_new_tensor_2d(ctx, wtype, n_text_state, n_vocab));
 
+        // the output logits can read a lower precision copy: it is the largest matrix read per decoded token
+        // the copy is not part of the model file, so it is kept out of model.tensors
+        model.d_te_out = model.d_te;
+        {
+            const ggml_type ltype = whisper_logits_type(wctx.params.type_logits, wtype, n_text_state);
+            if (ltype != GGML_TYPE_COUNT) {
+                ggml_tensor * meta = ggml_new_tensor_2d(ctx, ltype, n_text_state, n_vocab);
+                ggml_backend_buffer_type_t buft = select_weight_buft(hparams, meta, GGML_OP_MUL_MAT, buft_list);
+                if (!buft) {
+                    throw std::runtime_error("failed to find a compatible buffer type for the logits copy of the token embedding");
+                }
+
+                model.d_te_out = ggml_dup_tensor(get_ctx(buft), meta);
+                ggml_set_name(model.d_te_out, "decoder.token_embedding.logits");
+            }
+        }
+
         model.d_ln_w = create_tensor(ASR_TENSOR_LN_WEIGHT, ASR_SYSTEM_DECODER, ggml_new_tensor_1d(ctx, GGML_TYPE_F32, n_text_state));
         model.d_ln_b = create_tensor(ASR_TENSOR_LN_BIAS, ASR_SYSTEM_DECODER, ggml_new_tensor_1d(ctx, GGML_TYPE_F32, n_text_state));
 
@@ -1971,6 +2745,15 @@ static bool whisper_model_load(struct whisper_model_loader * loader, whisper_con
         }
     }
 
+    if (model.d_te_out != model.d_te) {
+        const int64_t t_start_logits_us = ggml_time_us();
+
+        whisper_model_init_logits(model);
+
+        WHISPER_LOG_INFO("%s: logits copy   = %s, %7.2f MB, %7.2f ms\n", __func__,
+                ggml_type_name(model.d_te_out->type), ggml_nbytes(model.d_te_out)/1e6, (ggml_time_us() - t_start_logits_us)/1e3);
+    }
+
     for (auto & buf : model.buffers) {
         ggml_backend_buffer_set_usage(buf, GGML_BACKEND_BUFFER_USAGE_WEIGHTS);
     }
@@ -2027,13 +2810,15 @@ static struct ggml_cgraph * whisper_build_graph_conv(
 
     if (!whisper_encode_external(wstate)) {
         // convolution + gelu
+        // the direct convolution reads the input instead of building an F16 im2col buffer of [3*n_state x n_ctx],
+        // and the CPU backend applies the bias and the gelu to each output tile (see ggml_graph_compute_n_fused)
         {
-            cur = ggml_conv_1d_ph(ctx0, model.e_conv_1_w, mel, 1, 1);
+            cur = ggml_conv_1d_direct(ctx0, model.e_conv_1_w, mel, 1, model.e_conv_1_w->ne[0]/2, 1);
             cur = ggml_add(ctx0, cur, model.e_conv_1_b);
 
             cur = ggml_gelu(ctx0, cur);
 
-            cur = ggml_conv_1d_ph(ctx0, model.e_conv_2_w, cur, 2, 1);
+            cur = ggml_conv_1d_direct(ctx0, model.e_conv_2_w, cur, 2, model.e_conv_2_w->ne[0]/2, 1);
             cur = ggml_add(ctx0, cur, model.e_conv_2_b);
 
             cur = ggml_gelu(ctx0, cur);
@@ -2124,6 +2909,8 @@ static struct ggml_cgraph * whisper_build_graph_encoder(
         const auto & layer = model.layers_encoder[il];
 
         // norm
+        // the CPU backend runs norm -> mul -> add, and bias -> gelu / bias -> residual add further down,
+        // as single passes, as long as the intermediate results have no other users
         {
             cur = ggml_norm(ctx0, inpL, hparams.eps);
 
@@ -2344,10 +3131,10 @@ static struct ggml_cgraph * whisper_build_graph_cross(
 
         if (wctx.params.flash_attn) {
             k = ggml_view_1d(ctx0, wstate.kv_cross.k, n_state*n_ctx,
-                    (ggml_element_size(wstate.kv_cross.k)*n_state)*(il*n_ctx_pad));
+                    ggml_row_size(wstate.kv_cross.k->type, n_state)*(il*n_ctx_pad));
 
             v = ggml_view_1d(ctx0, wstate.kv_cross.v, n_state*n_ctx,
-                    (ggml_element_size(wstate.kv_cross.v)*n_state)*(il*n_ctx_pad));
+                    ggml_row_size(wstate.kv_cross.v->type, n_state)*(il*n_ctx_pad));
         } else {
             Vcross = ggml_transpose(ctx0, ggml_reshape_2d(ctx0, Vcross, n_state, n_ctx));
 
@@ -2380,6 +3167,118 @@ static struct ggml_cgraph * whisper_build_graph_cross(
 //   - n_threads:  number of threads to use
 //   - mel_offset: offset in the mel spectrogram (i.e. audio offset)
 //
+//
+// threadpool
+//
+
+// "0xf0" -> cores 4-7
+static bool whisper_parse_cpumask(const char * str, bool * mask) {
+    std::fill(mask, mask + GGML_MAX_N_THREADS, false);
+
+    if (str[0] == '0' && (str[1] == 'x' || str[1] == 'X')) {
+        str += 2;
+    }
+
+    const size_t len = strlen(str);
+    if (len == 0) {
+        return false;
+    }
+
+    // the last digit holds cores 0-3
+    for (size_t i = 0; i < len; ++i) {
+        const char c = str[len - 1 - i];
+
+        int v;
+        if (c >= '0' && c <= '9') {
+            v = c - '0';
+        } else if (c >= 'a' && c <= 'f') {
+            v = c - 'a' + 10;
+        } else if (c >= 'A' && c <= 'F') {
+            v = c - 'A' + 10;
+        } else {
+            return false;
+        }
+
+        for (int b = 0; b < 4; ++b) {
+            const size_t core = 4*i + b;
+            if ((v >> b) & 1) {
+                if (core >= GGML_MAX_N_THREADS) {
+                    return false;
+                }
+                mask[core] = true;
+            }
+        }
+    }
+
+    return true;
+}
+
+// (re)create the state's threadpool with room for n_threads and attach it to the CPU backend
+static bool whisper_threadpool_init(whisper_state & state, const whisper_threadpool_params & params, int n_threads) {
+    ggml_threadpool_params tpp = ggml_threadpool_params_default(n_threads);
+
+    if (params.cpumask && params.cpumask[0]) {
+        if (!whisper_parse_cpumask(params.cpumask, tpp.cpumask)) {
+            WHISPER_LOG_ERROR("%s: invalid cpumask '%s'\n", __func__, params.cpumask);
+            return false;
+        }
+    }
+
+    tpp.prio       = (ggml_sched_priority) params.prio;
+    tpp.poll       = (uint32_t) std::max(0, std::min(100, params.poll));
+    tpp.strict_cpu = params.strict_cpu;
+    tpp.barrier    = (ggml_barrier_mode) params.barrier;
+
+    const auto & api = whisper_cpu_threadpool();
+    if (!api.tp_new || !api.tp_free || !api.set_threadpool) {
+        WHISPER_LOG_ERROR("%s: the CPU backend does not export the threadpool API\n", __func__);
+        return false;
+    }
+
+    ggml_threadpool_t threadpool = api.tp_new(&tpp);
+    if (threadpool == nullptr) {
+        WHISPER_LOG_ERROR("%s: failed to create a threadpool with %d threads\n", __func__, n_threads);
+        return false;
+    }
+
+    for (auto * backend : state.backends) {
+        if (whisper_backend_is_cpu(backend)) {
+            api.set_threadpool(backend, threadpool);
+        }
+    }
+
+    if (state.threadpool) {
+        api.tp_free(state.threadpool);
+    }
+
+    state.threadpool           = threadpool;
+    state.threadpool_n_threads = n_threads;
+
+    return true;
+}
+
+// the pool is sized up front, but grow it if a caller asks for more threads than it has
+static void whisper_threadpool_reserve(whisper_context & wctx, whisper_state & wstate, int n_threads) {
+    if (wstate.threadpool == nullptr || n_threads <= wstate.threadpool_n_threads) {
+        return;
+    }
+
+    WHISPER_LOG_WARN("%s: growing the threadpool from %d to %d threads\n", __func__, wstate.threadpool_n_threads, n_threads);
+
+    if (!whisper_threadpool_init(wstate, wctx.params.threadpool, n_threads)) {
+        // fall back to the threads managed by the CPU backend
+        const auto & api = whisper_cpu_threadpool();
+        for (auto * backend : wstate.backends) {
+            if (whisper_backend_is_cpu(backend)) {
+                api.set_threadpool(backend, nullptr);
+            }
+        }
+        api.tp_free(wstate.threadpool);
+        wstate.threadpool = nullptr;
+        wstate.threadpool_n_threads = 0;
+    }
+}
+
 static bool whisper_encode_internal(
         whisper_context & wctx,
           whisper_state & wstate,
@@ -2387,10 +3286,16 @@ static bool whisper_encode_internal(
               const int   n_threads,
     ggml_abort_callback   abort_callback,
                    void * abort_callback_data) {
+    WHISPER_TRACE_SCOPE_ARG("encode", mel_offset);
+
+    whisper_threadpool_reserve(wctx, wstate, n_threads);
+
     const int64_t t_start_us = ggml_time_us();
 
     // conv
     {
+        WHISPER_TRACE_SCOPE("conv");
+
         auto & sched = wstate.sched_conv.sched;
 
         ggml_cgraph * gf = whisper_build_graph_conv(wctx, wstate);
@@ -2400,6 +3305,10 @@ static bool whisper_encode_internal(
             return false;
         }
 
+        // the allocation grows the buffer when the graph needs more than the one measured at init, so sample
+        // the compute buffers after every allocation
+        whisper_memory_entry_set(wstate.mem.compute_conv, "compute_conv", whisper_sched_size(wstate.sched_conv));
+
         struct ggml_tensor * mel = ggml_graph_get_tensor(gf, "mel");
 
         // set the input
@@ -2428,6 +3337,8 @@ static bool whisper_encode_internal(
         }
 
         if (!whisper_encode_external(wstate)) {
+            whisper_profile_graph_begin(wstate.profiler, WHISPER_PROFILE_GRAPH_CONV, gf);
+
             if (!ggml_graph_compute_helper(sched, gf, n_threads)) {
                 return false;
             }
@@ -2442,6 +3353,8 @@ static bool whisper_encode_internal(
 
     // encoder
     if (!whisper_encode_external(wstate)) {
+        WHISPER_TRACE_SCOPE("encoder");
+
         auto & sched = wstate.sched_encode.sched;
 
         ggml_cgraph * gf = whisper_build_graph_encoder(wctx, wstate);
@@ -2451,6 +3364,10 @@ static bool whisper_encode_internal(
             return false;
         }
 
+        whisper_memory_entry_set(wstate.mem.compute_encode, "compute_encode", whisper_sched_size(wstate.sched_encode));
+
+        whisper_profile_graph_begin(wstate.profiler, WHISPER_PROFILE_GRAPH_ENCODE, gf);
+
         if (!ggml_graph_compute_helper(sched, gf, n_threads)) {
             return false;
         }
@@ -2458,6 +3375,8 @@ static bool whisper_encode_internal(
 
     // cross
     {
+        WHISPER_TRACE_SCOPE("cross");
+
         auto & sched = wstate.sched_cross.sched;
 
         ggml_cgraph * gf = whisper_build_graph_cross(wctx, wstate);
@@ -2467,6 +3386,10 @@ static bool whisper_encode_internal(
             return false;
         }
 
+        whisper_memory_entry_set(wstate.mem.compute_cross, "compute_cross", whisper_sched_size(wstate.sched_cross));
+
+        whisper_profile_graph_begin(wstate.profiler, WHISPER_PROFILE_GRAPH_CROSS, gf);
+
         if (!ggml_graph_compute_helper(sched, gf, n_threads)) {
             return false;
         }
@@ -2594,10 +3517,10 @@ static struct ggml_cgraph * whisper_build_graph_decoder(
 
                 if (wctx.params.flash_attn) {
                     k = ggml_view_1d(ctx0, kv_self.k, n_tokens*n_state,
-                            (ggml_element_size(kv_self.k)*n_state)*(il*n_ctx + kv_head));
+                            ggml_row_size(kv_self.k->type, n_state)*(il*n_ctx + kv_head));
 
                     v = ggml_view_1d(ctx0, kv_self.v, n_tokens*n_state,
-                            (ggml_element_size(kv_self.v)*n_state)*(il*n_ctx + kv_head));
+                            ggml_row_size(kv_self.v->type, n_state)*(il*n_ctx + kv_head));
                 } else {
                     Vcur = ggml_transpose(ctx0, ggml_reshape_2d(ctx0, Vcur, n_state, n_tokens));
 
@@ -2623,17 +3546,17 @@ static struct ggml_cgraph * whisper_build_graph_decoder(
             struct ggml_tensor * K =
                 ggml_view_3d(ctx0, kv_self.k,
                         n_state_head, n_kv, n_head,
-                        ggml_element_size(kv_self.k)*n_state,
-                        ggml_element_size(kv_self.k)*n_state_head,
-                        ggml_element_size(kv_self.k)*n_state*n_ctx*il);
+                        ggml_row_size(kv_self.k->type, n_state),
+                        ggml_row_size(kv_self.k->type, n_state_head),
+                        ggml_row_size(kv_self.k->type, n_state)*n_ctx*il);
 
             if (wctx.params.flash_attn) {
                 struct ggml_tensor * V =
                     ggml_view_3d(ctx0, kv_self.v,
                             n_state_head, n_kv, n_head,
-                            ggml_element_size(kv_self.v)*n_state,
-                            ggml_element_size(kv_self.v)*n_state_head,
-                            ggml_element_size(kv_self.v)*n_state*n_ctx*il);
+                            ggml_row_size(kv_self.v->type, n_state),
+                            ggml_row_size(kv_self.v->type, n_state_head),
+                            ggml_row_size(kv_self.v->type, n_state)*n_ctx*il);
 
                 cur = ggml_flash_attn_ext(ctx0, Q, K, V, KQ_mask_f16, 1.0f, 0.0f, 0.0f);
 
@@ -2704,16 +3627,16 @@ static struct ggml_cgraph * whisper_build_graph_decoder(
                 struct ggml_tensor * Kcross =
                     ggml_view_3d(ctx0, wstate.kv_cross.k,
                             n_state_head, n_audio_ctx_pad, n_head,
-                            ggml_element_size(wstate.kv_cross.k)*n_state,
-                            ggml_element_size(wstate.kv_cross.k)*n_state_head,
-                            ggml_element_size(wstate.kv_cross.k)*n_state*n_audio_ctx_pad*il);
+                            ggml_row_size(wstate.kv_cross.k->type, n_state),
+                            ggml_row_size(wstate.kv_cross.k->type, n_state_head),
+                            ggml_row_size(wstate.kv_cross.k->type, n_state)*n_audio_ctx_pad*il);
 
                 struct ggml_tensor * Vcross =
                     ggml_view_3d(ctx0, wstate.kv_cross.v,
                             n_state_head, n_audio_ctx_pad, n_head,
-                            ggml_element_size(wstate.kv_cross.v)*n_state,
-                            ggml_element_size(wstate.kv_cross.v)*n_state_head,
-                            ggml_element_size(wstate.kv_cross.v)*n_state*n_audio_ctx_pad*il);
+                            ggml_row_size(wstate.kv_cross.v->type, n_state),
+                            ggml_row_size(wstate.kv_cross.v->type, n_state_head),
+                            ggml_row_size(wstate.kv_cross.v->type, n_state)*n_audio_ctx_pad*il);
 
                 cur = ggml_flash_attn_ext(ctx0, Q, Kcross, Vcross, nullptr, KQscale, 0.0f, 0.0f);
 
@@ -2839,7 +3762,7 @@ static struct ggml_cgraph * whisper_build_graph_decoder(
     // might be useful in the future
     //cur = ggml_view_2d(ctx0, cur, cur->ne[0], 1, cur->nb[1], (cur->ne[1] - 1)*cur->nb[1]);
 
-    struct ggml_tensor * logits = ggml_mul_mat(ctx0, model.d_te, cur);
+    struct ggml_tensor * logits = ggml_mul_mat(ctx0, model.d_te_out, cur);
 
     // [EXPERIMENTAL] Token-level timestamps with DTW
     if (wctx.params.dtw_token_timestamps && aheads_cross_QKs != nullptr) {
@@ -2876,6 +3799,10 @@ static bool whisper_decode_internal(
                    bool   save_alignment_heads_QKs,
     ggml_abort_callback   abort_callback,
                    void * abort_callback_data) {
+    WHISPER_TRACE_SCOPE_ARG("decode", batch.n_tokens);
+
+    whisper_threadpool_reserve(wctx, wstate, n_threads);
+
     const int64_t t_start_us = ggml_time_us();
 
     const auto & model   = wctx.model;
@@ -2914,6 +3841,8 @@ static bool whisper_decode_internal(
             return false;
         }
 
+        whisper_memory_entry_set(wstate.mem.compute_decode, "compute_decode", whisper_sched_size(wstate.sched_decode));
+
         // set the inputs
         {
             struct ggml_tensor * embd = ggml_graph_get_tensor(gf, "embd");
@@ -2964,6 +3893,8 @@ static bool whisper_decode_internal(
 
         logits = ggml_graph_node(gf, -1);
 
+        whisper_profile_graph_begin(wstate.profiler, WHISPER_PROFILE_GRAPH_DECODE, gf);
+
         if (!ggml_graph_compute_helper(sched, gf, n_threads)) {
             return false;
         }
@@ -3127,6 +4058,8 @@ static void fft(float* in, int N, float* out) {
 static void log_mel_spectrogram_worker_thread(int ith, const float * hann, const std::vector<float> & samples,
                                               int n_samples, int frame_size, int frame_step, int n_threads,
                                               const whisper_filters & filters, whisper_mel & mel) {
+    WHISPER_TRACE_SCOPE_ARG("mel_worker", ith);
+
     std::vector<float> fft_in(frame_size * 2, 0.0);
     std::vector<float> fft_out(frame_size * 2 * 2 * 2);
 
@@ -3202,6 +4135,8 @@ static bool log_mel_spectrogram(
               const whisper_filters & filters,
               const bool   debug,
               whisper_mel & mel) {
+    WHISPER_TRACE_SCOPE("mel");
+
     const int64_t t_start_us = ggml_time_us();
 
     // Hann window
@@ -3282,9 +4217,16 @@ static bool log_mel_spectrogram(
     return true;
 }
 
-// split text into tokens
-//
-// ref: https://github.com/openai/gpt-2/blob/a74da5d99abaaba920de8131d64da2862a8f213b/src/encoder.py#L53
+// the character classes of the regex below in the "C" locale, which std::regex used
+static bool whisper_is_space(char c) { return c == ' ' || (c >= '\t' && c <= '\r'); }
+static bool whisper_is_alpha(char c) { return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'); }
+static bool whisper_is_digit(char c) { return c >= '0' && c <= '9'; }
+
+static int whisper_char_class(char c) {
+    return whisper_is_space(c) ? 0 : whisper_is_alpha(c) ? 1 : whisper_is_digit(c) ? 2 : 3;
+}
+
+// length of the word that [s, s + n) starts with, n > 0
 //
 // Regex (Python):
 // r"""'s|'t|'re|'ve|'m|'ll|'d| ?\p{L}+| ?\p{N}+| ?[^\s\p{L}\p{N}]+|\s+(?!\S)|\s+"""
@@ -3292,54 +4234,68 @@ static bool log_mel_spectrogram(
 // Regex (C++):
 // R"('s|'t|'re|'ve|'m|'ll|'d| ?[[:alpha:]]+| ?[[:digit:]]+| ?[^\s[:alpha:][:digit:]]+|\s+(?!\S)|\s+)"
 //
-static std::vector<whisper_vocab::id> tokenize(const whisper_vocab & vocab, const std::string & text) {
-    std::vector<std::string> words;
-
-    // first split the text into words
-    {
-        std::string str = text;
-        std::string pat = R"('s|'t|'re|'ve|'m|'ll|'d| ?[[:alpha:]]+| ?[[:digit:]]+| ?[^\s[:alpha:][:digit:]]+|\s+(?!\S)|\s+)";
-
-        std::regex re(pat);
-        std::smatch m;
+// the alternatives are tried in order, as std::regex_search did
+static size_t whisper_word_len(const char * s, size_t n) {
+    // 's|'t|'re|'ve|'m|'ll|'d
+    if (s[0] == '\'' && n >= 2) {
+        const char c = s[1];
+        if (c == 's' || c == 't' || c == 'm' || c == 'd') {
+            return 2;
+        }
+        if (n >= 3 && ((c == 'r' && s[2] == 'e') || (c == 'v' && s[2] == 'e') || (c == 'l' && s[2] == 'l'))) {
+            return 3;
+        }
+    }
 
-        while (std::regex_search(str, m, re)) {
-            for (auto x : m) {
-                words.push_back(x);
-            }
-            str = m.suffix();
+    // ` ?[[:alpha:]]+| ?[[:digit:]]+| ?[^\s[:alpha:][:digit:]]+`: a run of one class, after an optional space
+    const size_t i0  = s[0] == ' ' && n >= 2 && !whisper_is_space(s[1]) ? 1 : 0;
+    const int    cls = whisper_char_class(s[i0]);
+    if (cls != 0) {
+        size_t i = i0 + 1;
+        while (i < n && whisper_char_class(s[i]) == cls) {
+            i++;
         }
+        return i;
     }
 
-    // find the longest tokens that form the words:
-    std::vector<whisper_vocab::id> tokens;
-    for (const auto & word : words) {
-        if (word.empty()) continue;
+    // `\s+(?!\S)|\s+`: the whitespace up to the end, or all of it but the last character before a word
+    size_t i = 1;
+    while (i < n && whisper_is_space(s[i])) {
+        i++;
+    }
+    return i < n && i > 1 ? i - 1 : i;
+}
 
-        int i = 0;
-        int n = word.size();
-        while (i < n) {
-            int j = n;
-            bool found = false;
-            while (j > i) {
-                auto sub = word.substr(i, j-i);
-                auto it = vocab.token_to_id.find(sub);
-                if (it != vocab.token_to_id.end()) {
-                    tokens.push_back(it->second);
-                    i = j;
-                    found = true;
-                    break;
-                }
-                --j;
-            }
-            if (!found) {
+// split text into tokens: the words of the GPT-2 pre-tokenizer, each split greedily into the longest tokens
+// returns the number of tokens, of which at most n_max_tokens are written
+//
+// ref: https://github.com/openai/gpt-2/blob/a74da5d99abaaba920de8131d64da2862a8f213b/src/encoder.py#L53
+//
+static int tokenize(const whisper_vocab & vocab, const char * text, size_t n, whisper_vocab::id * tokens, int n_max_tokens) {
+    int n_tokens = 0;
+
+    size_t i = 0;
+    while (i < n) {
+        const size_t end = i + whisper_word_len(text + i, n - i);
+
+        // find the longest tokens that form the word:
+        while (i < end) {
+            whisper_vocab::id id = -1;
+            const size_t len = vocab.token_trie.longest_prefix(text + i, end - i, id);
+            if (len == 0) {
                 WHISPER_LOG_ERROR("unknown token\n");
                 ++i;
+                continue;
             }
+            if (n_tokens < n_max_tokens) {
+                tokens[n_tokens] = id;
+            }
+            n_tokens++;
+            i += len;
         }
     }
 
-    return tokens;
+    return n_tokens;
 }
 
 //
@@ -3394,6 +4350,93 @@ static std::string whisper_openvino_get_path_cache(std::string path_bin) {
 }
 #endif
 
+//
+// memory accounting
+//
+
+static size_t whisper_vad_memory_size(const whisper_vad_context * vctx);
+
+static size_t whisper_kv_cache_size(const whisper_kv_cache & cache) {
+    return (cache.buffer ? ggml_backend_buffer_get_size(cache.buffer) : 0) + cache.ctx_buf.capacity() + cache.cells.capacity()*sizeof(whisper_kv_cell);
+}
+
+template<typename T>
+static size_t whisper_vector_size(const std::vector<T> & v) {
+    return v.capacity()*sizeof(T);
+}
+
+// sample the current sizes and fold them into the peaks
+// called after every allocation that can grow or be replaced, and on each query
+static void whisper_state_memory_update(const whisper_context & ctx, whisper_state & state) {
+    auto & mem = state.mem;
+
+    whisper_memory_entry_set(mem.kv_self,  "kv_self",  whisper_kv_cache_size(state.kv_self));
+    whisper_memory_entry_set(mem.kv_cross, "kv_cross", whisper_kv_cache_size(state.kv_cross));
+    whisper_memory_entry_set(mem.kv_pad,   "kv_pad",   whisper_kv_cache_size(state.kv_pad));
+
+    whisper_memory_entry_set(mem.compute_conv,   "compute_conv",   state.sched_conv.sched   ? whisper_sched_size(state.sched_conv)   : 0);
+    whisper_memory_entry_set(mem.compute_encode, "compute_encode", state.sched_encode.sched ? whisper_sched_size(state.sched_encode) : 0);
+    whisper_memory_entry_set(mem.compute_cross,  "compute_cross",  state.sched_cross.sched  ? whisper_sched_size(state.sched_cross)  : 0);
+    whisper_memory_entry_set(mem.compute_decode, "compute_decode", state.sched_decode.sched ? whisper_sched_size(state.sched_decode) : 0);
+
+    whisper_memory_entry_set(mem.mel,    "mel",    whisper_vector_size(state.mel.data));
+    whisper_memory_entry_set(mem.logits, "logits", whisper_vector_size(state.logits));
+
+    {
+        size_t size = 0;
+
+        size += whisper_vector_size(state.inp_mel);
+        size += whisper_vector_size(state.inp_mask);
+        size += whisper_vector_size(state.energy);
+        size += whisper_vector_size(state.aheads_cross_QKs_data);
+        size += whisper_vector_size(state.prompt_past);
+        size += whisper_vector_size(state.vad_segments);
+        size += whisper_vector_size(state.vad_mapping_table);
+        size += whisper_vector_size(state.result_all);
+
+        for (const auto & segment : state.result_all) {
+            size += segment.text.capacity() + whisper_vector_size(segment.tokens);
+        }
+
+        for (const auto & decoder : state.decoders) {
+            size += whisper_vector_size(decoder.sequence.tokens);
+            size += whisper_vector_size(decoder.probs);
+            size += whisper_vector_size(decoder.logits);
+            size += whisper_vector_size(decoder.logprobs);
+            size += whisper_vector_size(decoder.logits_id);
+        }
+
+        // whisper_batch_init(n_text_ctx, WHISPER_MAX_DECODERS)
+        {
+            const size_t n_tokens = ctx.model.hparams.n_text_ctx;
+
+            size += n_tokens*(sizeof(whisper_token) + sizeof(whisper_pos) + sizeof(int32_t) + sizeof(whisper_seq_id *) + sizeof(int8_t));
+            size += n_tokens*WHISPER_MAX_DECODERS*sizeof(whisper_seq_id);
+        }
+
+        whisper_memory_entry_set(mem.host, "host", size);
+    }
+
+    whisper_memory_entry_set(mem.vad, "vad", whisper_vad_memory_size(state.vad_context));
+
+    whisper_memory_entry_set(mem.dtw_masks, "dtw_masks", state.aheads_masks.buffer ? ggml_backend_buffer_get_size(state.aheads_masks.buffer) : 0);
+
+    {
+        const auto & ws = state.dtw_ws;
+
+        size_t size = 0;
+        size += whisper_vector_size(ws.w);
+        size += whisper_vector_size(ws.x);
+        size += whisper_vector_size(ws.cost);
+        size += whisper_vector_size(ws.trace);
+        size += whisper_vector_size(ws.window);
+        size += whisper_vector_size(ws.sum);
+        size += whisper_vector_size(ws.path);
+
+        whisper_memory_entry_set(mem.dtw_work, "dtw_work", size);
+    }
+}
+
 struct whisper_state * whisper_init_state(whisper_context * ctx) {
     whisper_state * state = new whisper_state;
 
@@ -3407,7 +4450,7 @@ struct whisper_state * whisper_init_state(whisper_context * ctx) {
     // at this point, we don't know yet how many decoders will be used
     // later during decoding, if more decoders are used, we will recreate the KV cache respectively
     state->kv_self_n_dec = 1;
-    if (!whisper_kv_cache_init(state->kv_self, state->backends[0], ctx->itype,
+    if (!whisper_kv_cache_init(state->kv_self, state->backends[0], ctx->params.type_kv_self,
                 ctx->model.hparams.n_text_state,
                 ctx->model.hparams.n_text_layer,
                 GGML_PAD(ctx->model.hparams.n_text_ctx, 256))) {
@@ -3418,10 +4461,10 @@ struct whisper_state * whisper_init_state(whisper_context * ctx) {
 
     {
         const size_t memory_size = ggml_nbytes(state->kv_self.k) + ggml_nbytes(state->kv_self.v);
-        WHISPER_LOG_INFO("%s: kv self size  = %7.2f MB\n", __func__, memory_size / 1e6);
+        WHISPER_LOG_INFO("%s: kv self size  = %7.2f MB (%s)\n", __func__, memory_size / 1e6, ggml_type_name(state->kv_self.k->type));
     }
 
-    if (!whisper_kv_cache_init(state->kv_cross, state->backends[0], ctx->itype,
+    if (!whisper_kv_cache_init(state->kv_cross, state->backends[0], ctx->params.type_kv_cross,
                 ctx->model.hparams.n_text_state,
                 ctx->model.hparams.n_text_layer,
                 GGML_PAD(ctx->model.hparams.n_audio_ctx, 256))) {
@@ -3432,7 +4475,7 @@ struct whisper_state * whisper_init_state(whisper_context * ctx) {
 
     {
         const size_t memory_size = ggml_nbytes(state->kv_cross.k) + ggml_nbytes(state->kv_cross.v);
-        WHISPER_LOG_INFO("%s: kv cross size = %7.2f MB\n", __func__, memory_size / 1e6);
+        WHISPER_LOG_INFO("%s: kv cross size = %7.2f MB (%s)\n", __func__, memory_size / 1e6, ggml_type_name(state->kv_cross.k->type));
     }
 
     if (!whisper_kv_cache_init(state->kv_pad, state->backends[0], ctx->itype,
@@ -3564,6 +4607,42 @@ struct whisper_state * whisper_init_state(whisper_context * ctx) {
         WHISPER_LOG_INFO("%s: compute buffer (decode) = %7.2f MB\n", __func__, whisper_sched_size(state->sched_decode) / 1e6);
     }
 
+    if (ctx->params.profile) {
+        state->profiler.enabled = true;
+
+        for (auto * sched : { &state->sched_conv, &state->sched_encode, &state->sched_cross, &state->sched_decode }) {
+            ggml_backend_sched_set_eval_callback(sched->sched, whisper_profile_eval_callback, &state->profiler);
+        }
+
+        WHISPER_LOG_INFO("%s: profiling enabled\n", __func__);
+    }
+
+    if (ctx->params.threadpool.enabled) {
+        const auto & tp = ctx->params.threadpool;
+
+        int n_threads = tp.n_threads;
+        if (n_threads <= 0 && tp.cpumask && tp.cpumask[0]) {
+            bool mask_data[GGML_MAX_N_THREADS];
+            if (whisper_parse_cpumask(tp.cpumask, mask_data)) {
+                n_threads = (int) std::count(mask_data, mask_data + GGML_MAX_N_THREADS, true);
+            }
+        }
+        if (n_threads <= 0) {
+            n_threads = (int) std::thread::hardware_concurrency();
+        }
+        n_threads = std::max(1, std::min(n_threads, GGML_MAX_N_THREADS));
+
+        if (!whisper_threadpool_init(*state, tp, n_threads)) {
+            whisper_free_state(state);
+            return nullptr;
+        }
+
+        WHISPER_LOG_INFO("%s: threadpool: n_threads = %d, cpumask = %s, prio = %d, poll = %d, barrier = %s\n", __func__,
+                n_threads, tp.cpumask ? tp.cpumask : "default", tp.prio, tp.poll, tp.barrier == GGML_BARRIER_HYBRID ? "hybrid" : "spin");
+    }
+
+    whisper_state_memory_update(*ctx, *state);
+
     return state;
 }
 
@@ -3631,6 +4710,21 @@ struct whisper_context_params whisper_context_default_params() {
         /*.use_gpu              =*/ true,
         /*.flash_attn           =*/ false,
         /*.gpu_device           =*/ 0,
+        /*.use_extra_bufts      =*/ true,
+        /*.type_kv_self         =*/ GGML_TYPE_F16,
+        /*.type_kv_cross        =*/ GGML_TYPE_F16,
+        /*.type_logits          =*/ GGML_TYPE_COUNT,
+        /*.profile              =*/ false,
+
+        /*.threadpool           =*/ {
+            /*.enabled          =*/ true,
+            /*.n_threads        =*/ 0,
+            /*.cpumask          =*/ NULL,
+            /*.prio             =*/ GGML_SCHED_PRIO_NORMAL,
+            /*.poll             =*/ 50,
+            /*.strict_cpu       =*/ false,
+            /*.barrier          =*/ GGML_BARRIER_HYBRID,
+        },
 
         /*.dtw_token_timestamps =*/ false,
         /*.dtw_aheads_preset    =*/ WHISPER_AHEADS_NONE,
@@ -3727,16 +4821,21 @@ struct whisper_context * whisper_init_from_buffer_with_params_no_state(void * bu
 
 struct whisper_context * whisper_init_with_params_no_state(struct whisper_model_loader * loader, struct whisper_context_params params) {
     ggml_time_init();
+    whisper_load_backends();
 
     if (params.flash_attn && params.dtw_token_timestamps) {
         WHISPER_LOG_WARN("%s: dtw_token_timestamps is not supported with flash_attn - disabling\n", __func__);
         params.dtw_token_timestamps = false;
     }
 
+    params.type_kv_self  = whisper_kv_cache_type(params.type_kv_self,  params.flash_attn, false, "kv self");
+    params.type_kv_cross = whisper_kv_cache_type(params.type_kv_cross, params.flash_attn, true,  "kv cross");
+
     WHISPER_LOG_INFO("%s: use gpu    = %d\n", __func__, params.use_gpu);
     WHISPER_LOG_INFO("%s: flash attn = %d\n", __func__, params.flash_attn);
     WHISPER_LOG_INFO("%s: gpu_device = %d\n", __func__, params.gpu_device);
     WHISPER_LOG_INFO("%s: dtw        = %d\n", __func__, params.dtw_token_timestamps);
+    WHISPER_LOG_INFO("%s: kv types   = %s (self), %s (cross)\n", __func__, ggml_type_name(params.type_kv_self), ggml_type_name(params.type_kv_cross));
     WHISPER_LOG_INFO("%s: devices    = %zu\n", __func__, ggml_backend_dev_count());
     WHISPER_LOG_INFO("%s: backends   = %zu\n", __func__, ggml_backend_reg_count());
 
@@ -3855,6 +4954,10 @@ void whisper_free_state(struct whisper_state * state) {
             ggml_backend_free(backend);
         }
 
+        if (state->threadpool) {
+            whisper_cpu_threadpool().tp_free(state->threadpool);
+        }
+
         // [EXPERIMENTAL] Token-level timestamps with DTW
         aheads_masks_free(state->aheads_masks);
 
@@ -3879,6 +4982,10 @@ void whisper_free(struct whisper_context * ctx) {
 
         whisper_free_state(ctx->state);
 
+        for (whisper_state * state : ctx->parallel_states) {
+            whisper_free_state(state);
+        }
+
         delete ctx;
     }
 }
@@ -3978,18 +5085,14 @@ int whisper_decode(struct whisper_context * ctx, const whisper_token * tokens, i
 }
 
 int whisper_tokenize(struct whisper_context * ctx, const char * text, whisper_token * tokens, int n_max_tokens) {
-    const auto res = tokenize(ctx->vocab, text);
+    const int n_tokens = tokenize(ctx->vocab, text, strlen(text), tokens, n_max_tokens);
 
-    if (n_max_tokens < (int) res.size()) {
-        WHISPER_LOG_ERROR("%s: too many resulting tokens: %d (max %d)\n", __func__, (int) res.size(), n_max_tokens);
-        return -(int) res.size();
+    if (n_max_tokens < n_tokens) {
+        WHISPER_LOG_ERROR("%s: too many resulting tokens: %d (max %d)\n", __func__, n_tokens, n_max_tokens);
+        return -n_tokens;
     }
 
-    for (int i = 0; i < (int) res.size(); i++) {
-        tokens[i] = res[i];
-    }
-
-    return res.size();
+    return n_tokens;
 }
 
 int whisper_token_count(struct whisper_context * ctx, const char * text) {
@@ -4067,256 +5170,934 @@ int whisper_lang_auto_detect_with_state(
 
     const std::vector<whisper_token> prompt = { whisper_token_sot(ctx) };
 
-    if (whisper_decode_with_state(ctx, state, prompt.data(), prompt.size(), 0, n_threads) != 0) {
-        WHISPER_LOG_ERROR("%s: failed to decode\n", __func__);
-        return -7;
+    if (whisper_decode_with_state(ctx, state, prompt.data(), prompt.size(), 0, n_threads) != 0) {
+        WHISPER_LOG_ERROR("%s: failed to decode\n", __func__);
+        return -7;
+    }
+
+    auto & logits_id = state->decoders[0].logits_id;
+    logits_id.clear();
+
+    for (const auto & kv : g_lang) {
+        const auto token_lang = whisper_token_lang(ctx, kv.second.first);
+        logits_id.emplace_back(state->logits[token_lang], kv.second.first);
+    }
+
+    // sort descending
+    {
+        using pair_type = std::remove_reference<decltype(logits_id)>::type::value_type;
+        std::sort(logits_id.begin(), logits_id.end(), [](const pair_type & a, const pair_type & b) {
+            return a.first > b.first;
+        });
+    }
+
+    // softmax
+    {
+        const auto max = logits_id[0].first;
+
+        double sum = 0.0f;
+        for (auto & kv : logits_id) {
+            kv.first = exp(kv.first - max);
+            sum += kv.first;
+        }
+
+        for (auto & kv : logits_id) {
+            kv.first /= sum;
+        }
+    }
+
+    {
+        for (const auto & prob : logits_id) {
+            if (lang_probs) {
+                lang_probs[prob.second] = prob.first;
+            }
+
+            //printf("%s: lang %2d (%3s): %f\n", __func__, prob.second, whisper_lang_str(prob.second), prob.first);
+        }
+    }
+
+    return logits_id[0].second;
+}
+
+int whisper_lang_auto_detect(
+        struct whisper_context * ctx,
+                           int   offset_ms,
+                           int   n_threads,
+                         float * lang_probs) {
+    return whisper_lang_auto_detect_with_state(ctx, ctx->state, offset_ms, n_threads, lang_probs);
+}
+
+int whisper_model_n_vocab(struct whisper_context * ctx) {
+    return ctx->model.hparams.n_vocab;
+}
+
+int whisper_model_n_audio_ctx(struct whisper_context * ctx) {
+    return ctx->model.hparams.n_audio_ctx;
+}
+
+int whisper_model_n_audio_state(struct whisper_context * ctx) {
+    return ctx->model.hparams.n_audio_state;
+}
+
+int whisper_model_n_audio_head(struct whisper_context * ctx) {
+    return ctx->model.hparams.n_audio_head;
+}
+
+int whisper_model_n_audio_layer(struct whisper_context * ctx) {
+    return ctx->model.hparams.n_audio_layer;
+}
+
+int whisper_model_n_text_ctx(struct whisper_context * ctx) {
+    return ctx->model.hparams.n_text_ctx;
+}
+
+int whisper_model_n_text_state(struct whisper_context * ctx) {
+    return ctx->model.hparams.n_text_state;
+}
+
+int whisper_model_n_text_head(struct whisper_context * ctx) {
+    return ctx->model.hparams.n_text_head;
+}
+
+int whisper_model_n_text_layer(struct whisper_context * ctx) {
+    return ctx->model.hparams.n_text_layer;
+}
+
+int whisper_model_n_mels(struct whisper_context * ctx) {
+    return ctx->model.hparams.n_mels;
+}
+
+int whisper_model_ftype(struct whisper_context * ctx) {
+    return ctx->model.hparams.ftype;
+}
+
+int whisper_model_type(struct whisper_context * ctx) {
+    return ctx->model.type;
+}
+
+const char *whisper_model_type_readable(struct whisper_context * ctx) {
+    switch (ctx->model.type) {
+    case e_model::MODEL_TINY:
+        return "tiny";
+    case e_model::MODEL_BASE:
+        return "base";
+    case e_model::MODEL_SMALL:
+        return "small";
+    case e_model::MODEL_MEDIUM:
+        return "medium";
+    case e_model::MODEL_LARGE:
+        return "large";
+    default:
+        return "unknown";
+    }
+}
+
+int whisper_n_len_from_state(struct whisper_state * state) {
+    return state->mel.n_len_org;
+}
+
+int whisper_n_len(struct whisper_context * ctx) {
+    return ctx->state->mel.n_len_org;
+}
+
+int whisper_n_vocab(struct whisper_context * ctx) {
+    return ctx->vocab.n_vocab;
+}
+
+int whisper_n_text_ctx(struct whisper_context * ctx) {
+    return ctx->model.hparams.n_text_ctx;
+}
+
+int whisper_n_audio_ctx(struct whisper_context * ctx) {
+    return ctx->model.hparams.n_audio_ctx;
+}
+
+int whisper_is_multilingual(struct whisper_context * ctx) {
+    return ctx->vocab.is_multilingual() ? 1 : 0;
+}
+
+float * whisper_get_logits(struct whisper_context * ctx) {
+    return ctx->state->logits.data();
+}
+
+float * whisper_get_logits_from_state(struct whisper_state * state) {
+    return state->logits.data();
+}
+
+const char * whisper_token_to_str(struct whisper_context * ctx, whisper_token token) {
+    WHISPER_ASSERT(token >= 0 && token < ctx->vocab.n_tokens());
+    return ctx->vocab.id_to_token(token);
+}
+
+whisper_token whisper_token_eot(struct whisper_context * ctx) {
+    return ctx->vocab.token_eot;
+}
+
+whisper_token whisper_token_sot(struct whisper_context * ctx) {
+    return ctx->vocab.token_sot;
+}
+
+whisper_token whisper_token_solm(struct whisper_context * ctx) {
+    return ctx->vocab.token_solm;
+}
+
+whisper_token whisper_token_prev(struct whisper_context * ctx) {
+    return ctx->vocab.token_prev;
+}
+
+whisper_token whisper_token_nosp(struct whisper_context * ctx) {
+    return ctx->vocab.token_nosp;
+}
+
+whisper_token whisper_token_not(struct whisper_context * ctx) {
+    return ctx->vocab.token_not;
+}
+
+whisper_token whisper_token_beg(struct whisper_context * ctx) {
+    return ctx->vocab.token_beg;
+}
+
+whisper_token whisper_token_lang(struct whisper_context * ctx, int lang_id) {
+    return whisper_token_sot(ctx) + 1 + lang_id;
+}
+
+whisper_token whisper_token_translate(struct whisper_context * ctx) {
+    return ctx->vocab.token_translate;
+}
+
+whisper_token whisper_token_transcribe(struct whisper_context * ctx) {
+    return ctx->vocab.token_transcribe;
+}
+
+struct whisper_timings * whisper_get_timings(struct whisper_context * ctx) {
+    if (ctx->state == nullptr) {
+        return nullptr;
+    }
+    whisper_timings * timings = new whisper_timings;
+    timings->sample_ms = 1e-3f * ctx->state->t_sample_us / std::max(1, ctx->state->n_sample);
+    timings->encode_ms = 1e-3f * ctx->state->t_encode_us / std::max(1, ctx->state->n_encode);
+    timings->decode_ms = 1e-3f * ctx->state->t_decode_us / std::max(1, ctx->state->n_decode);
+    timings->batchd_ms = 1e-3f * ctx->state->t_batchd_us / std::max(1, ctx->state->n_batchd);
+    timings->prompt_ms = 1e-3f * ctx->state->t_prompt_us / std::max(1, ctx->state->n_prompt);
+    return timings;
+}
+
+void whisper_print_timings(struct whisper_context * ctx) {
+    const int64_t t_end_us = ggml_time_us();
+
+    WHISPER_LOG_INFO("\n");
+    WHISPER_LOG_INFO("%s:     load time = %8.2f ms\n", __func__, ctx->t_load_us / 1000.0f);
+    if (ctx->state != nullptr) {
+
+        const int32_t n_sample = std::max(1, ctx->state->n_sample);
+        const int32_t n_encode = std::max(1, ctx->state->n_encode);
+        const int32_t n_decode = std::max(1, ctx->state->n_decode);
+        const int32_t n_batchd = std::max(1, ctx->state->n_batchd);
+        const int32_t n_prompt = std::max(1, ctx->state->n_prompt);
+
+        WHISPER_LOG_INFO("%s:     fallbacks = %3d p / %3d h\n", __func__, ctx->state->n_fail_p, ctx->state->n_fail_h);
+        WHISPER_LOG_INFO("%s:      mel time = %8.2f ms\n", __func__, ctx->state->t_mel_us / 1000.0f);
+        WHISPER_LOG_INFO("%s:   sample time = %8.2f ms / %5d runs ( %8.2f ms per run)\n", __func__, 1e-3f * ctx->state->t_sample_us, n_sample, 1e-3f * ctx->state->t_sample_us / n_sample);
+        WHISPER_LOG_INFO("%s:   encode time = %8.2f ms / %5d runs ( %8.2f ms per run)\n", __func__, 1e-3f * ctx->state->t_encode_us, n_encode, 1e-3f * ctx->state->t_encode_us / n_encode);
+        WHISPER_LOG_INFO("%s:   decode time = %8.2f ms / %5d runs ( %8.2f ms per run)\n", __func__, 1e-3f * ctx->state->t_decode_us, n_decode, 1e-3f * ctx->state->t_decode_us / n_decode);
+        WHISPER_LOG_INFO("%s:   batchd time = %8.2f ms / %5d runs ( %8.2f ms per run)\n", __func__, 1e-3f * ctx->state->t_batchd_us, n_batchd, 1e-3f * ctx->state->t_batchd_us / n_batchd);
+        WHISPER_LOG_INFO("%s:   prompt time = %8.2f ms / %5d runs ( %8.2f ms per run)\n", __func__, 1e-3f * ctx->state->t_prompt_us, n_prompt, 1e-3f * ctx->state->t_prompt_us / n_prompt);
+    }
+    WHISPER_LOG_INFO("%s:    total time = %8.2f ms\n", __func__, (t_end_us - ctx->t_start_us)/1000.0f);
+}
+
+static void whisper_reset_state_timings(whisper_state * state) {
+    state->t_mel_us = 0;
+    state->t_sample_us = 0;
+    state->t_encode_us = 0;
+    state->t_decode_us = 0;
+    state->t_batchd_us = 0;
+    state->t_prompt_us = 0;
+    state->n_sample = 0;
+    state->n_encode = 0;
+    state->n_decode = 0;
+    state->n_batchd = 0;
+    state->n_prompt = 0;
+}
+
+void whisper_reset_timings(struct whisper_context * ctx) {
+    ctx->t_start_us = ggml_time_us();
+    if (ctx->state != nullptr) {
+        whisper_reset_state_timings(ctx->state);
+    }
+}
+
+static void whisper_profile_collect(
+        const std::map<std::string, whisper_profile_stat> & stats,
+        std::vector<whisper_profile_entry> & res) {
+    res.clear();
+    for (const auto & kv : stats) {
+        if (kv.second.n > 0) {
+            res.push_back({ kv.first.c_str(), kv.second.n, kv.second.t_us });
+        }
+    }
+    std::sort(res.begin(), res.end(), [](const whisper_profile_entry & a, const whisper_profile_entry & b) {
+        return a.t_us > b.t_us;
+    });
+}
+
+const struct whisper_profile * whisper_get_profile_from_state(struct whisper_state * state) {
+    if (state == nullptr || !state->profiler.enabled) {
+        return nullptr;
+    }
+
+    auto & prof = state->profiler;
+
+    whisper_profile_collect(prof.ops,    prof.res_ops);
+    whisper_profile_collect(prof.scopes, prof.res_scopes);
+
+    prof.res_graphs.clear();
+    int64_t t_total_us = 0;
+    for (int i = 0; i < WHISPER_PROFILE_GRAPH_COUNT; ++i) {
+        prof.res_graphs.push_back({ WHISPER_PROFILE_GRAPH_NAMES[i], prof.graphs[i].n, prof.graphs[i].t_us });
+        t_total_us += prof.graphs[i].t_us;
+    }
+
+    prof.res.t_total_us = t_total_us;
+    prof.res.n_ops      = (int) prof.res_ops.size();
+    prof.res.ops        = prof.res_ops.data();
+    prof.res.n_scopes   = (int) prof.res_scopes.size();
+    prof.res.scopes     = prof.res_scopes.data();
+    prof.res.n_graphs   = (int) prof.res_graphs.size();
+    prof.res.graphs     = prof.res_graphs.data();
+
+    return &prof.res;
+}
+
+const struct whisper_profile * whisper_get_profile(struct whisper_context * ctx) {
+    return whisper_get_profile_from_state(ctx->state);
+}
+
+void whisper_print_profile(struct whisper_context * ctx) {
+    const whisper_profile * prof = whisper_get_profile(ctx);
+    if (prof == nullptr) {
+        WHISPER_LOG_WARN("%s: profiling is not enabled (whisper_context_params.profile)\n", __func__);
+        return;
+    }
+
+    const double t_total_ms = std::max<int64_t>(1, prof->t_total_us)/1000.0;
+
+    const char * func = __func__;
+
+    auto print_table = [&](const char * title, const whisper_profile_entry * entries, int n) {
+        WHISPER_LOG_INFO("\n");
+        WHISPER_LOG_INFO("%s: %-30s %10s %12s %7s %10s\n", func, title, "calls", "total ms", "%", "avg us");
+        for (int i = 0; i < n; ++i) {
+            const auto & e = entries[i];
+            WHISPER_LOG_INFO("%s: %-30s %10lld %12.2f %6.2f%% %10.2f\n", func,
+                    e.name, (long long) e.n, e.t_us/1000.0, 100.0*(e.t_us/1000.0)/t_total_ms, (double) e.t_us/std::max<int64_t>(1, e.n));
+        }
+    };
+
+    print_table("graph", prof->graphs, prof->n_graphs);
+    print_table("op",    prof->ops,    prof->n_ops);
+    print_table("scope", prof->scopes, prof->n_scopes);
+
+    WHISPER_LOG_INFO("\n");
+    WHISPER_LOG_INFO("%s: total = %8.2f ms\n", __func__, t_total_ms);
+}
+
+void whisper_reset_profile(struct whisper_context * ctx) {
+    if (ctx->state == nullptr) {
+        return;
+    }
+
+    auto & prof = ctx->state->profiler;
+
+    prof.ops.clear();
+    prof.scopes.clear();
+    prof.node_scope.clear();
+    for (auto & g : prof.graphs) {
+        g = whisper_profile_stat();
+    }
+}
+
+int whisper_trace_dump(const char * path) {
+#ifdef WHISPER_TRACE
+    FILE * f = fopen(path, "w");
+    if (f == nullptr) {
+        WHISPER_LOG_ERROR("%s: failed to open '%s' for writing\n", __func__, path);
+        return -1;
+    }
+
+    auto & reg = whisper_trace_get_registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+
+    fprintf(f, "{\"traceEvents\":[\n");
+    fprintf(f, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"whisper\"}}");
+
+    size_t n_dropped = 0;
+
+    for (const auto & buf : reg.buffers) {
+        fprintf(f, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"thread %d\"}}", buf->tid, buf->tid);
+
+        const size_t n = buf->n_events.load(std::memory_order_acquire);
+        for (size_t i = 0; i < n; ++i) {
+            const whisper_trace_event & ev = buf->chunks[i/whisper_trace_buffer::CHUNK_SIZE].load(std::memory_order_acquire)[i % whisper_trace_buffer::CHUNK_SIZE];
+
+            fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%lld,\"dur\":%lld",
+                    ev.name, buf->tid, (long long) ev.t_beg_us, (long long) (ev.t_end_us - ev.t_beg_us));
+            if (ev.arg != WHISPER_TRACE_NO_ARG) {
+                fprintf(f, ",\"args\":{\"arg\":%lld}", (long long) ev.arg);
+            }
+            fprintf(f, "}");
+        }
+
+        n_dropped += buf->n_dropped.load(std::memory_order_relaxed);
+    }
+
+    fprintf(f, "\n]}\n");
+
+    if (n_dropped > 0) {
+        WHISPER_LOG_WARN("%s: %zu events were dropped (trace buffer full)\n", __func__, n_dropped);
+    }
+
+    const bool ok = !ferror(f);
+    if (fclose(f) != 0 || !ok) {
+        WHISPER_LOG_ERROR("%s: failed to write '%s'\n", __func__, path);
+        return -1;
+    }
+
+    return 0;
+#else
+    WHISPER_LOG_ERROR("%s: tracing is not enabled, rebuild with -DWHISPER_TRACE=ON\n", __func__);
+    GGML_UNUSED(path);
+    return -1;
+#endif
+}
+
+void whisper_threadpool_pause_with_state(struct whisper_state * state) {
+    if (state && state->threadpool && whisper_cpu_threadpool().tp_pause) {
+        whisper_cpu_threadpool().tp_pause(state->threadpool);
+    }
+}
+
+void whisper_threadpool_resume_with_state(struct whisper_state * state) {
+    if (state && state->threadpool && whisper_cpu_threadpool().tp_resume) {
+        whisper_cpu_threadpool().tp_resume(state->threadpool);
+    }
+}
+
+void whisper_threadpool_pause(struct whisper_context * ctx) {
+    whisper_threadpool_pause_with_state(ctx->state);
+}
+
+void whisper_threadpool_resume(struct whisper_context * ctx) {
+    whisper_threadpool_resume_with_state(ctx->state);
+}
+
+struct whisper_memory_usage whisper_get_memory_usage(struct whisper_context * ctx, struct whisper_state * state) {
+    whisper_memory_usage result = {};
+
+    if (state == nullptr) {
+        state = ctx->state;
+    }
+
+    if (state) {
+        whisper_state_memory_update(*ctx, *state);
+        result = state->mem;
+    }
+
+    // group the weights by buffer type
+    ctx->mem_weights.clear();
+    for (ggml_backend_buffer_t buf : ctx->model.buffers) {
+        const char * name = ggml_backend_buft_name(ggml_backend_buffer_get_type(buf));
+        const size_t size = ggml_backend_buffer_get_size(buf);
+
+        auto it = std::find_if(ctx->mem_weights.begin(), ctx->mem_weights.end(), [&](const whisper_memory_entry & e) {
+            return strcmp(e.name, name) == 0;
+        });
+        if (it == ctx->mem_weights.end()) {
+            ctx->mem_weights.push_back({ name, size, size });
+        } else {
+            it->cur  += size;
+            it->peak += size;
+        }
+    }
+
+    result.n_weights = (int) ctx->mem_weights.size();
+    result.weights   = ctx->mem_weights.data();
+
+    const whisper_memory_entry * entries[] = {
+        &result.kv_self, &result.kv_cross, &result.kv_pad,
+        &result.compute_conv, &result.compute_encode, &result.compute_cross, &result.compute_decode,
+        &result.mel, &result.logits, &result.host,
+        &result.vad, &result.dtw_masks, &result.dtw_work,
+    };
+
+    result.total      = 0;
+    result.total_peak = 0;
+
+    for (const auto & e : ctx->mem_weights) {
+        result.total      += e.cur;
+        result.total_peak += e.peak;
+    }
+
+    for (const auto * e : entries) {
+        result.total      += e->cur;
+        result.total_peak += e->peak;
+    }
+
+    return result;
+}
+
+void whisper_print_memory_usage(struct whisper_context * ctx, struct whisper_state * state) {
+    if (state == nullptr) {
+        state = ctx->state;
+    }
+
+    const whisper_memory_usage mem = whisper_get_memory_usage(ctx, state);
+
+    WHISPER_LOG_INFO("\n");
+    WHISPER_LOG_INFO("%s: %-16s %10s %10s\n", __func__, "", "cur MB", "peak MB");
+    for (int i = 0; i < mem.n_weights; ++i) {
+        WHISPER_LOG_INFO("%s: weights %-8s %10.2f %10.2f\n", __func__, mem.weights[i].name, mem.weights[i].cur/1e6, mem.weights[i].peak/1e6);
+    }
+
+    if (state) {
+        for (const auto * e : { &mem.kv_self, &mem.kv_cross, &mem.kv_pad,
+                                &mem.compute_conv, &mem.compute_encode, &mem.compute_cross, &mem.compute_decode,
+                                &mem.mel, &mem.logits, &mem.host,
+                                &mem.vad, &mem.dtw_masks, &mem.dtw_work }) {
+            WHISPER_LOG_INFO("%s: %-16s %10.2f %10.2f\n", __func__, e->name, e->cur/1e6, e->peak/1e6);
+        }
+    }
+
+    WHISPER_LOG_INFO("%s: %-16s %10.2f %10.2f\n", __func__, "total", mem.total/1e6, mem.total_peak/1e6);
+}
+
+//
+// auto-tuning
+//
+
+struct whisper_autotune_params whisper_autotune_default_params(void) {
+    struct whisper_autotune_params result = {
+        /*.n_threads_max    =*/ 0,
+        /*.n_iter           =*/ 2,
+        /*.n_audio_ctx      =*/ 512,
+        /*.n_decode         =*/ 16,
+        /*.tune_flash_attn  =*/ true,
+        /*.tune_extra_bufts =*/ true,
+        /*.cache_path       =*/ nullptr,
+    };
+
+    return result;
+}
+
+// the number of single-token decoder steps per encoder window used to weigh the two phases
+// when a setting (flash attention, extra buffer types) applies to both
+static const int WHISPER_AUTOTUNE_DECODE_PER_ENCODE = 64;
+
+static uint64_t whisper_fnv1a(uint64_t h, const void * data, size_t size) {
+    const uint8_t * p = (const uint8_t *) data;
+    for (size_t i = 0; i < size; ++i) {
+        h ^= p[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+// the tuning depends only on the shapes and types of the weights, so two fine-tunes of
+// the same model size share their entry
+static uint64_t whisper_autotune_model_hash(const whisper_context & ctx) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+
+    const auto & hparams = ctx.model.hparams;
+    h = whisper_fnv1a(h, &hparams, sizeof(hparams));
+
+    for (const auto & kv : ctx.model.tensors) {
+        const ggml_tensor * t = kv.second;
+
+        h = whisper_fnv1a(h, kv.first.data(), kv.first.size());
+        h = whisper_fnv1a(h, &t->type, sizeof(t->type));
+        h = whisper_fnv1a(h, t->ne, sizeof(t->ne));
+    }
+
+    return h;
+}
+
+static std::string whisper_autotune_cpu_name() {
+    std::string name;
+    std::set<std::string> parts;
+
+    std::ifstream fin("/proc/cpuinfo");
+    std::string line;
+    while (std::getline(fin, line)) {
+        const auto pos = line.find(':');
+        if (pos == std::string::npos) {
+            continue;
+        }
+
+        std::string key   = line.substr(0, pos);
+        std::string value = line.substr(pos + 1);
+        key.erase(key.find_last_not_of(" \t") + 1);
+        value.erase(0, value.find_first_not_of(" \t"));
+
+        if (name.empty() && (key == "model name" || key == "Hardware")) {
+            name = value;
+        } else if (key == "CPU part") {
+            // big.LITTLE SoCs: the set of core types identifies the cluster layout
+            parts.insert(value);
+        }
     }
 
-    auto & logits_id = state->decoders[0].logits_id;
-    logits_id.clear();
+    for (const auto & part : parts) {
+        name += (name.empty() ? "" : "/") + part;
+    }
 
-    for (const auto & kv : g_lang) {
-        const auto token_lang = whisper_token_lang(ctx, kv.second.first);
-        logits_id.emplace_back(state->logits[token_lang], kv.second.first);
+    if (name.empty()) {
+        name = "unknown";
     }
 
-    // sort descending
-    {
-        using pair_type = std::remove_reference<decltype(logits_id)>::type::value_type;
-        std::sort(logits_id.begin(), logits_id.end(), [](const pair_type & a, const pair_type & b) {
-            return a.first > b.first;
-        });
+    for (auto & c : name) {
+        if (isspace((unsigned char) c)) {
+            c = '_';
+        }
     }
 
-    // softmax
-    {
-        const auto max = logits_id[0].first;
+    return name + "-" + std::to_string(std::thread::hardware_concurrency());
+}
 
-        double sum = 0.0f;
-        for (auto & kv : logits_id) {
-            kv.first = exp(kv.first - max);
-            sum += kv.first;
+// the context settings that change the graphs are part of the key: the KV cache and logits types, DTW,
+// and the flash attention setting when it is not tuned
+static std::string whisper_autotune_key(const whisper_context & ctx, const whisper_autotune_params & params) {
+    const char * sysinfo = whisper_print_system_info();
+
+    char buf[192];
+    snprintf(buf, sizeof(buf), "%016llx-%016llx-%d-%d.%d.%d-%d-%d",
+            (unsigned long long) whisper_fnv1a(0xcbf29ce484222325ULL, sysinfo, strlen(sysinfo)),
+            (unsigned long long) whisper_autotune_model_hash(ctx),
+            params.n_threads_max,
+            (int) ctx.params.type_kv_self, (int) ctx.params.type_kv_cross, (int) ctx.params.type_logits,
+            ctx.params.dtw_token_timestamps ? 1 : 0,
+            params.tune_flash_attn ? 2 : (ctx.params.flash_attn ? 1 : 0));
+
+    return whisper_autotune_cpu_name() + "-" + buf;
+}
+
+static bool whisper_autotune_cache_load(const char * path, const std::string & key, whisper_autotune_result & result) {
+    std::ifstream fin(path);
+    std::string line;
+    while (std::getline(fin, line)) {
+        std::istringstream iss(line);
+
+        std::string k;
+        int fa = 0;
+        int eb = 0;
+        whisper_autotune_result r = {};
+        if (!(iss >> k >> r.n_threads_encode >> r.n_threads_decode >> fa >> eb >> r.t_encode_ms >> r.t_decode_ms)) {
+            continue;
         }
 
-        for (auto & kv : logits_id) {
-            kv.first /= sum;
+        if (k == key) {
+            r.flash_attn      = fa != 0;
+            r.use_extra_bufts = eb != 0;
+            r.from_cache      = true;
+            result = r;
+            return true;
         }
     }
 
+    return false;
+}
+
+static bool whisper_autotune_cache_save(const char * path, const std::string & key, const whisper_autotune_result & result) {
+    std::vector<std::string> lines;
     {
-        for (const auto & prob : logits_id) {
-            if (lang_probs) {
-                lang_probs[prob.second] = prob.first;
+        std::ifstream fin(path);
+        std::string line;
+        while (std::getline(fin, line)) {
+            if (!line.empty() && line.compare(0, key.size() + 1, key + " ") != 0) {
+                lines.push_back(line);
             }
-
-            //printf("%s: lang %2d (%3s): %f\n", __func__, prob.second, whisper_lang_str(prob.second), prob.first);
         }
     }
 
-    return logits_id[0].second;
-}
+    char buf[256];
+    snprintf(buf, sizeof(buf), "%s %d %d %d %d %.3f %.3f", key.c_str(),
+            result.n_threads_encode, result.n_threads_decode, result.flash_attn ? 1 : 0, result.use_extra_bufts ? 1 : 0,
+            result.t_encode_ms, result.t_decode_ms);
+    lines.push_back(buf);
 
-int whisper_lang_auto_detect(
-        struct whisper_context * ctx,
-                           int   offset_ms,
-                           int   n_threads,
-                         float * lang_probs) {
-    return whisper_lang_auto_detect_with_state(ctx, ctx->state, offset_ms, n_threads, lang_probs);
-}
+    std::ofstream fout(path, std::ios::trunc);
+    for (const auto & line : lines) {
+        fout << line << "\n";
+    }
 
-int whisper_model_n_vocab(struct whisper_context * ctx) {
-    return ctx->model.hparams.n_vocab;
+    return (bool) fout;
 }
 
-int whisper_model_n_audio_ctx(struct whisper_context * ctx) {
-    return ctx->model.hparams.n_audio_ctx;
-}
+struct whisper_autotune_timing {
+    int    n_threads_encode = 0;
+    int    n_threads_decode = 0;
+    double t_encode_ms      = DBL_MAX;
+    double t_decode_ms      = DBL_MAX;
 
-int whisper_model_n_audio_state(struct whisper_context * ctx) {
-    return ctx->model.hparams.n_audio_state;
-}
+    double cost() const {
+        return t_encode_ms + WHISPER_AUTOTUNE_DECODE_PER_ENCODE*t_decode_ms;
+    }
+};
 
-int whisper_model_n_audio_head(struct whisper_context * ctx) {
-    return ctx->model.hparams.n_audio_head;
-}
+// time one encoder micro-run and the per-token cost of single-token decoding for each thread count
+// the caller has set ctx.params.flash_attn
+static bool whisper_autotune_run(
+        whisper_context & ctx,
+        whisper_state & state,
+        const whisper_autotune_params & params,
+        const std::vector<int> & threads,
+        whisper_autotune_timing & timing) {
+    const auto & hparams = ctx.model.hparams;
 
-int whisper_model_n_audio_layer(struct whisper_context * ctx) {
-    return ctx->model.hparams.n_audio_layer;
-}
+    const int n_audio_ctx = std::min(params.n_audio_ctx > 0 ? params.n_audio_ctx : hparams.n_audio_ctx, hparams.n_audio_ctx);
+    const int n_decode    = std::max(1, std::min(params.n_decode, hparams.n_text_ctx/2));
 
-int whisper_model_n_text_ctx(struct whisper_context * ctx) {
-    return ctx->model.hparams.n_text_ctx;
-}
+    state.exp_n_audio_ctx = n_audio_ctx;
 
-int whisper_model_n_text_state(struct whisper_context * ctx) {
-    return ctx->model.hparams.n_text_state;
-}
+    state.mel.n_mel     = hparams.n_mels;
+    state.mel.n_len     = 2*n_audio_ctx;
+    state.mel.n_len_org = 2*n_audio_ctx;
+    state.mel.data.assign(state.mel.n_len*state.mel.n_mel, 0.0f);
 
-int whisper_model_n_text_head(struct whisper_context * ctx) {
-    return ctx->model.hparams.n_text_head;
-}
+    const whisper_token token = whisper_token_sot(&ctx);
 
-int whisper_model_n_text_layer(struct whisper_context * ctx) {
-    return ctx->model.hparams.n_text_layer;
-}
+    timing = whisper_autotune_timing();
 
-int whisper_model_n_mels(struct whisper_context * ctx) {
-    return ctx->model.hparams.n_mels;
-}
+    for (const int n_threads : threads) {
+        double t_encode_ms = DBL_MAX;
+        double t_decode_ms = DBL_MAX;
 
-int whisper_model_ftype(struct whisper_context * ctx) {
-    return ctx->model.hparams.ftype;
-}
+        // the first run (re)allocates the compute buffers and warms up the caches
+        for (int it = 0; it <= params.n_iter; ++it) {
+            const int64_t t_start_us = ggml_time_us();
 
-int whisper_model_type(struct whisper_context * ctx) {
-    return ctx->model.type;
-}
+            if (!whisper_encode_internal(ctx, state, 0, n_threads, nullptr, nullptr)) {
+                return false;
+            }
 
-const char *whisper_model_type_readable(struct whisper_context * ctx) {
-    switch (ctx->model.type) {
-    case e_model::MODEL_TINY:
-        return "tiny";
-    case e_model::MODEL_BASE:
-        return "base";
-    case e_model::MODEL_SMALL:
-        return "small";
-    case e_model::MODEL_MEDIUM:
-        return "medium";
-    case e_model::MODEL_LARGE:
-        return "large";
-    default:
-        return "unknown";
+            const int64_t t_encode_us = ggml_time_us() - t_start_us;
+
+            whisper_kv_cache_clear(state.kv_self);
+
+            int64_t t_decode_us = 0;
+            for (int i = 0; i < n_decode; ++i) {
+                whisper_batch_prep_legacy(state.batch, &token, 1, i, 0);
+
+                const int64_t t_step_us = ggml_time_us();
+
+                if (!whisper_decode_internal(ctx, state, state.batch, n_threads, false, nullptr, nullptr)) {
+                    return false;
+                }
+
+                t_decode_us += ggml_time_us() - t_step_us;
+            }
+
+            if (it > 0) {
+                t_encode_ms = std::min(t_encode_ms, t_encode_us/1000.0);
+                t_decode_ms = std::min(t_decode_ms, t_decode_us/1000.0/n_decode);
+            }
+        }
+
+        WHISPER_LOG_INFO("%s: flash_attn = %d, n_threads = %2d: encode = %8.2f ms, decode = %6.2f ms/token\n",
+                __func__, ctx.params.flash_attn, n_threads, t_encode_ms, t_decode_ms);
+
+        if (t_encode_ms < timing.t_encode_ms) {
+            timing.t_encode_ms      = t_encode_ms;
+            timing.n_threads_encode = n_threads;
+        }
+
+        if (t_decode_ms < timing.t_decode_ms) {
+            timing.t_decode_ms      = t_decode_ms;
+            timing.n_threads_decode = n_threads;
+        }
     }
-}
 
-int whisper_n_len_from_state(struct whisper_state * state) {
-    return state->mel.n_len_org;
+    return true;
 }
 
-int whisper_n_len(struct whisper_context * ctx) {
-    return ctx->state->mel.n_len_org;
-}
+// run the micro-runs on the given context, saving and restoring the parts of the state they clobber
+static bool whisper_autotune_context(
+        whisper_context & ctx,
+        whisper_state & state,
+        const whisper_autotune_params & params,
+        const std::vector<int> & threads,
+        const std::vector<bool> & flash_attn,
+        whisper_autotune_timing & best,
+        bool & best_flash_attn) {
+    const bool    flash_attn_org      = ctx.params.flash_attn;
+    const int32_t exp_n_audio_ctx_org = state.exp_n_audio_ctx;
 
-int whisper_n_vocab(struct whisper_context * ctx) {
-    return ctx->vocab.n_vocab;
-}
+    whisper_mel mel_org = {};
+    std::swap(mel_org, state.mel);
 
-int whisper_n_text_ctx(struct whisper_context * ctx) {
-    return ctx->model.hparams.n_text_ctx;
-}
+    // the micro-runs should not show up in the caller's timings
+    const int64_t t_encode_us = state.t_encode_us;
+    const int64_t t_decode_us = state.t_decode_us;
+    const int32_t n_encode    = state.n_encode;
+    const int32_t n_decode    = state.n_decode;
 
-int whisper_n_audio_ctx(struct whisper_context * ctx) {
-    return ctx->model.hparams.n_audio_ctx;
-}
+    bool ok = true;
 
-int whisper_is_multilingual(struct whisper_context * ctx) {
-    return ctx->vocab.is_multilingual() ? 1 : 0;
-}
+    best = whisper_autotune_timing();
+    best_flash_attn = flash_attn_org;
 
-float * whisper_get_logits(struct whisper_context * ctx) {
-    return ctx->state->logits.data();
-}
+    for (const bool fa : flash_attn) {
+        ctx.params.flash_attn = fa;
 
-float * whisper_get_logits_from_state(struct whisper_state * state) {
-    return state->logits.data();
-}
+        whisper_autotune_timing timing;
+        if (!whisper_autotune_run(ctx, state, params, threads, timing)) {
+            ok = false;
+            break;
+        }
 
-const char * whisper_token_to_str(struct whisper_context * ctx, whisper_token token) {
-    return ctx->vocab.id_to_token.at(token).c_str();
-}
+        if (timing.cost() < best.cost()) {
+            best = timing;
+            best_flash_attn = fa;
+        }
+    }
 
-whisper_token whisper_token_eot(struct whisper_context * ctx) {
-    return ctx->vocab.token_eot;
-}
+    ctx.params.flash_attn = flash_attn_org;
+    state.exp_n_audio_ctx = exp_n_audio_ctx_org;
+    std::swap(mel_org, state.mel);
 
-whisper_token whisper_token_sot(struct whisper_context * ctx) {
-    return ctx->vocab.token_sot;
-}
+    state.t_encode_us = t_encode_us;
+    state.t_decode_us = t_decode_us;
+    state.n_encode    = n_encode;
+    state.n_decode    = n_decode;
 
-whisper_token whisper_token_solm(struct whisper_context * ctx) {
-    return ctx->vocab.token_solm;
-}
+    whisper_kv_cache_clear(state.kv_self);
 
-whisper_token whisper_token_prev(struct whisper_context * ctx) {
-    return ctx->vocab.token_prev;
+    return ok;
 }
 
-whisper_token whisper_token_nosp(struct whisper_context * ctx) {
-    return ctx->vocab.token_nosp;
-}
+static bool whisper_has_extra_bufts() {
+    whisper_context_params params = whisper_context_default_params();
+    params.use_gpu = false;
 
-whisper_token whisper_token_not(struct whisper_context * ctx) {
-    return ctx->vocab.token_not;
+    return make_buft_list(params).size() > 1;
 }
 
-whisper_token whisper_token_beg(struct whisper_context * ctx) {
-    return ctx->vocab.token_beg;
-}
+// the flash attention settings the context can run with
+// quantized KV caches are only read through flash attention, and DTW timestamps read the cross-attention
+// weights, which the flash attention graph does not build
+static std::vector<bool> whisper_autotune_flash_attn_candidates(const whisper_context & ctx, const whisper_autotune_params & params) {
+    const bool kv_quantized = ctx.params.type_kv_self != GGML_TYPE_F16 || ctx.params.type_kv_cross != GGML_TYPE_F16;
 
-whisper_token whisper_token_lang(struct whisper_context * ctx, int lang_id) {
-    return whisper_token_sot(ctx) + 1 + lang_id;
-}
+    if (params.tune_flash_attn && !kv_quantized && !ctx.params.dtw_token_timestamps) {
+        return { false, true };
+    }
 
-whisper_token whisper_token_translate(struct whisper_context * ctx) {
-    return ctx->vocab.token_translate;
+    return { ctx.params.flash_attn };
 }
 
-whisper_token whisper_token_transcribe(struct whisper_context * ctx) {
-    return ctx->vocab.token_transcribe;
-}
+int whisper_autotune(
+        struct whisper_context * ctx,
+        struct whisper_autotune_params params,
+        struct whisper_autotune_result * result) {
+    if (params.n_threads_max <= 0) {
+        params.n_threads_max = std::max(1, (int) std::thread::hardware_concurrency());
+    }
+    params.n_iter = std::max(1, params.n_iter);
 
-struct whisper_timings * whisper_get_timings(struct whisper_context * ctx) {
-    if (ctx->state == nullptr) {
-        return nullptr;
+    const std::string key = whisper_autotune_key(*ctx, params);
+
+    const std::vector<bool> flash_attn = whisper_autotune_flash_attn_candidates(*ctx, params);
+
+    if (params.cache_path && whisper_autotune_cache_load(params.cache_path, key, *result)) {
+        if (std::find(flash_attn.begin(), flash_attn.end(), result->flash_attn) == flash_attn.end()) {
+            WHISPER_LOG_WARN("%s: ignoring cached result for '%s' with flash_attn = %d, not usable with this context\n", __func__,
+                    key.c_str(), result->flash_attn);
+        } else {
+            WHISPER_LOG_INFO("%s: using cached result for '%s'\n", __func__, key.c_str());
+            ctx->params.flash_attn = result->flash_attn;
+            return 0;
+        }
     }
-    whisper_timings * timings = new whisper_timings;
-    timings->sample_ms = 1e-3f * ctx->state->t_sample_us / std::max(1, ctx->state->n_sample);
-    timings->encode_ms = 1e-3f * ctx->state->t_encode_us / std::max(1, ctx->state->n_encode);
-    timings->decode_ms = 1e-3f * ctx->state->t_decode_us / std::max(1, ctx->state->n_decode);
-    timings->batchd_ms = 1e-3f * ctx->state->t_batchd_us / std::max(1, ctx->state->n_batchd);
-    timings->prompt_ms = 1e-3f * ctx->state->t_prompt_us / std::max(1, ctx->state->n_prompt);
-    return timings;
-}
 
-void whisper_print_timings(struct whisper_context * ctx) {
-    const int64_t t_end_us = ggml_time_us();
+    // 1, 2, 3, 4, 6, 9, 13, 19, ... and the maximum itself
+    std::vector<int> threads;
+    for (int n = 1; n <= params.n_threads_max; n = n < 4 ? n + 1 : n + n/2) {
+        threads.push_back(n);
+    }
+    if (threads.back() != params.n_threads_max) {
+        threads.push_back(params.n_threads_max);
+    }
 
-    WHISPER_LOG_INFO("\n");
-    WHISPER_LOG_INFO("%s:     load time = %8.2f ms\n", __func__, ctx->t_load_us / 1000.0f);
-    if (ctx->state != nullptr) {
+    whisper_state * state = ctx->state;
+    if (state == nullptr) {
+        state = whisper_init_state(ctx);
+        if (state == nullptr) {
+            WHISPER_LOG_ERROR("%s: failed to create a state for the micro-runs\n", __func__);
+            return -1;
+        }
+    }
 
-        const int32_t n_sample = std::max(1, ctx->state->n_sample);
-        const int32_t n_encode = std::max(1, ctx->state->n_encode);
-        const int32_t n_decode = std::max(1, ctx->state->n_decode);
-        const int32_t n_batchd = std::max(1, ctx->state->n_batchd);
-        const int32_t n_prompt = std::max(1, ctx->state->n_prompt);
+    whisper_autotune_timing best;
+    bool best_flash_attn = false;
 
-        WHISPER_LOG_INFO("%s:     fallbacks = %3d p / %3d h\n", __func__, ctx->state->n_fail_p, ctx->state->n_fail_h);
-        WHISPER_LOG_INFO("%s:      mel time = %8.2f ms\n", __func__, ctx->state->t_mel_us / 1000.0f);
-        WHISPER_LOG_INFO("%s:   sample time = %8.2f ms / %5d runs ( %8.2f ms per run)\n", __func__, 1e-3f * ctx->state->t_sample_us, n_sample, 1e-3f * ctx->state->t_sample_us / n_sample);
-        WHISPER_LOG_INFO("%s:   encode time = %8.2f ms / %5d runs ( %8.2f ms per run)\n", __func__, 1e-3f * ctx->state->t_encode_us, n_encode, 1e-3f * ctx->state->t_encode_us / n_encode);
-        WHISPER_LOG_INFO("%s:   decode time = %8.2f ms / %5d runs ( %8.2f ms per run)\n", __func__, 1e-3f * ctx->state->t_decode_us, n_decode, 1e-3f * ctx->state->t_decode_us / n_decode);
-        WHISPER_LOG_INFO("%s:   batchd time = %8.2f ms / %5d runs ( %8.2f ms per run)\n", __func__, 1e-3f * ctx->state->t_batchd_us, n_batchd, 1e-3f * ctx->state->t_batchd_us / n_batchd);
-        WHISPER_LOG_INFO("%s:   prompt time = %8.2f ms / %5d runs ( %8.2f ms per run)\n", __func__, 1e-3f * ctx->state->t_prompt_us, n_prompt, 1e-3f * ctx->state->t_prompt_us / n_prompt);
+    const bool ok = whisper_autotune_context(*ctx, *state, params, threads, flash_attn, best, best_flash_attn);
+
+    if (state != ctx->state) {
+        whisper_free_state(state);
     }
-    WHISPER_LOG_INFO("%s:    total time = %8.2f ms\n", __func__, (t_end_us - ctx->t_start_us)/1000.0f);
-}
 
-void whisper_reset_timings(struct whisper_context * ctx) {
-    ctx->t_start_us = ggml_time_us();
-    if (ctx->state != nullptr) {
-        ctx->state->t_mel_us = 0;
-        ctx->state->t_sample_us = 0;
-        ctx->state->t_encode_us = 0;
-        ctx->state->t_decode_us = 0;
-        ctx->state->t_batchd_us = 0;
-        ctx->state->t_prompt_us = 0;
-        ctx->state->n_sample = 0;
-        ctx->state->n_encode = 0;
-        ctx->state->n_decode = 0;
-        ctx->state->n_batchd = 0;
-        ctx->state->n_prompt = 0;
+    if (!ok) {
+        WHISPER_LOG_ERROR("%s: micro-run failed\n", __func__);
+        return -1;
+    }
+
+    bool use_extra_bufts = ctx->params.use_extra_bufts;
+
+    if (params.tune_extra_bufts && !ctx->path_model.empty() && whisper_has_extra_bufts()) {
+        whisper_context_params cparams = ctx->params;
+        cparams.use_extra_bufts = !ctx->params.use_extra_bufts;
+        cparams.flash_attn      = best_flash_attn;
+
+        WHISPER_LOG_INFO("%s: loading a second copy of the model with use_extra_bufts = %d\n", __func__, cparams.use_extra_bufts);
+
+        whisper_context * ctx_alt = whisper_init_from_file_with_params(ctx->path_model.c_str(), cparams);
+        if (ctx_alt == nullptr) {
+            WHISPER_LOG_WARN("%s: failed to load the model with use_extra_bufts = %d, skipping\n", __func__, cparams.use_extra_bufts);
+        } else {
+            whisper_autotune_timing best_alt;
+            bool unused;
+
+            if (whisper_autotune_context(*ctx_alt, *ctx_alt->state, params, threads, { best_flash_attn }, best_alt, unused) &&
+                best_alt.cost() < best.cost()) {
+                best = best_alt;
+                use_extra_bufts = cparams.use_extra_bufts;
+            }
+
+            whisper_free(ctx_alt);
+        }
+    }
+
+    result->n_threads_encode = best.n_threads_encode;
+    result->n_threads_decode = best.n_threads_decode;
+    result->flash_attn       = best_flash_attn;
+    result->use_extra_bufts  = use_extra_bufts;
+    result->t_encode_ms      = (float) best.t_encode_ms;
+    result->t_decode_ms      = (float) best.t_decode_ms;
+    result->from_cache       = false;
+
+    ctx->params.flash_attn = best_flash_attn;
+
+    WHISPER_LOG_INFO("%s: encode: n_threads = %d, decode: n_threads = %d, flash_attn = %d, use_extra_bufts = %d\n", __func__,
+            result->n_threads_encode, result->n_threads_decode, result->flash_attn, result->use_extra_bufts);
+
+    if (use_extra_bufts != ctx->params.use_extra_bufts) {
+        WHISPER_LOG_INFO("%s: reload the model with use_extra_bufts = %d to apply the buffer type setting\n", __func__, use_extra_bufts);
     }
+
+    if (params.cache_path && !whisper_autotune_cache_save(params.cache_path, key, *result)) {
+        WHISPER_LOG_WARN("%s: failed to write '%s'\n", __func__, params.cache_path);
+    }
+
+    return 0;
 }
 
 static int whisper_has_coreml(void) {
@@ -4338,6 +6119,8 @@ static int whisper_has_openvino(void) {
 const char * whisper_print_system_info(void) {
     static std::string s;
 
+    whisper_load_backends();
+
     s  = "";
     s += "WHISPER : ";
     s += "COREML = "    + std::to_string(whisper_has_coreml())     + " | ";
@@ -4782,6 +6565,8 @@ struct whisper_vad_context * whisper_vad_init_from_file_with_params(
 struct whisper_vad_context * whisper_vad_init_with_params(
             struct whisper_model_loader * loader,
             struct whisper_vad_context_params params) {
+    whisper_load_backends();
+
     // Read the VAD model
     {
         uint32_t magic;
@@ -5108,6 +6893,8 @@ bool whisper_vad_detect_speech(
         struct whisper_vad_context * vctx,
         const float * samples,
         int n_samples) {
+    WHISPER_TRACE_SCOPE("vad_detect");
+
     int n_chunks = n_samples / vctx->n_window;
     if (n_samples % vctx->n_window != 0) {
         n_chunks += 1;  // Add one more chunk for remaining samples.
@@ -5140,6 +6927,8 @@ bool whisper_vad_detect_speech(
     const int64_t t_start_vad_us = ggml_time_us();
 
     for (int i = 0; i < n_chunks; i++) {
+        WHISPER_TRACE_SCOPE_ARG("vad_chunk", i);
+
         const int idx_start = i * vctx->n_window;
         const int idx_end = std::min(idx_start + vctx->n_window, n_samples);
 
@@ -5452,7 +7241,32 @@ struct whisper_vad_segments * whisper_vad_segments_from_samples(
         WHISPER_LOG_ERROR("%s: failed to detect speech\n", __func__);
         return nullptr;
     }
-    return whisper_vad_segments_from_probs(vctx, params);
+    return whisper_vad_segments_from_probs(vctx, params);
+}
+
+static size_t whisper_vad_memory_size(const whisper_vad_context * vctx) {
+    if (vctx == nullptr) {
+        return 0;
+    }
+
+    size_t size = 0;
+
+    for (ggml_backend_buffer_t buf : vctx->model.buffers) {
+        size += ggml_backend_buffer_get_size(buf);
+    }
+
+    if (vctx->buffer) {
+        size += ggml_backend_buffer_get_size(vctx->buffer);
+    }
+
+    if (vctx->sched.sched) {
+        size += whisper_sched_size(vctx->sched);
+    }
+
+    size += vctx->ctx_buf.capacity();
+    size += vctx->probs.capacity()*sizeof(float);
+
+    return size;
 }
 
 void whisper_vad_free(whisper_vad_context * ctx) {
@@ -5629,190 +7443,246 @@ static bool whisper_grammar_match_partial_char(
 }
 
 
-// transforms a grammar pushdown stack into N possible stacks, all ending
-// at a character range (terminal element)
-static void whisper_grammar_advance_stack(
-        const std::vector<std::vector<whisper_grammar_element>>   & rules,
-        const std::vector<const whisper_grammar_element *>        & stack,
-        std::vector<std::vector<const whisper_grammar_element *>> & new_stacks) {
+// the grammar stacks are interned: a stack is a node holding the element on top and the id of the stack
+// below it, so pushing and popping copy nothing and equal stacks have equal ids. the sets of stacks the
+// grammar can be in are interned as well, and the transition of a set on a code point is memoized the
+// first time it is taken - the automaton is compiled lazily, once for all the decoders of a whisper_full()
+struct whisper_grammar_automaton {
+    std::vector<std::vector<whisper_grammar_element>> rules;
 
-    if (stack.empty()) {
-        new_stacks.emplace_back();
-        return;
-    }
+    struct stack_node {
+        const whisper_grammar_element * pos;
+        int32_t                         below;
+    };
 
-    const whisper_grammar_element * pos = stack.back();
+    // stack 0 is the empty stack
+    std::vector<stack_node> stacks = { { nullptr, 0 } };
+    std::vector<int32_t>    stacks_next = { -1 }; // set after matching the char range on top, -1 if not known yet
+    std::map<std::pair<const whisper_grammar_element *, int32_t>, int32_t> stack_ids;
 
-    switch (pos->type) {
-        case WHISPER_GRETYPE_RULE_REF: {
-            const size_t                  rule_id = static_cast<size_t>(pos->value);
-            const whisper_grammar_element * subpos  = rules[rule_id].data();
-            do {
-                // init new stack without the top (pos)
-                std::vector<const whisper_grammar_element *> new_stack(stack.begin(), stack.end() - 1);
-                if (!whisper_grammar_is_end_of_sequence(pos + 1)) {
-                    // if this rule ref is followed by another element, add that to stack
-                    new_stack.push_back(pos + 1);
-                }
-                if (!whisper_grammar_is_end_of_sequence(subpos)) {
-                    // if alternate is nonempty, add to stack
-                    new_stack.push_back(subpos);
-                }
-                whisper_grammar_advance_stack(rules, new_stack, new_stacks);
-                while (!whisper_grammar_is_end_of_sequence(subpos)) {
-                    // scan to end of alternate def
-                    subpos++;
-                }
-                if (subpos->type == WHISPER_GRETYPE_ALT) {
-                    // there's another alternate def of this rule to process
-                    subpos++;
-                } else {
-                    break;
-                }
-            } while (true);
-            break;
-        }
-        case WHISPER_GRETYPE_CHAR:
-        case WHISPER_GRETYPE_CHAR_NOT:
-            new_stacks.push_back(stack);
-            break;
-        default:
-            // end of alternate (WHISPER_GRETYPE_END, WHISPER_GRETYPE_ALT) or middle of char range
-            // (WHISPER_GRETYPE_CHAR_ALT, WHISPER_GRETYPE_CHAR_RNG_UPPER); stack should never be left on
-            // those
-            WHISPER_ASSERT(false);
-    }
-}
+    // sorted stack ids, set 0 is the empty set
+    std::vector<std::vector<int32_t>> sets = { {} };
+    std::vector<int32_t>              sets_next = { 0 }; // union of stacks_next of the stacks, -1 if not known yet
+    std::map<std::vector<int32_t>, int32_t> set_ids;
 
-// takes a set of possible pushdown stacks on a grammar, which are required to
-// be positioned at a character range (see `whisper_grammar_advance_stack`), and
-// produces the N possible stacks if the given char is accepted at those
-// positions
-static std::vector<std::vector<const whisper_grammar_element *>> whisper_grammar_accept(
-        const std::vector<std::vector<whisper_grammar_element>>         & rules,
-        const std::vector<std::vector<const whisper_grammar_element *>> & stacks,
-        const uint32_t                                                  chr) {
+    // (set, code point) -> set
+    std::unordered_map<uint64_t, int32_t> steps;
 
-    std::vector<std::vector<const whisper_grammar_element *>> new_stacks;
+    // set -> bitset of the text tokens it rejects, when the last token did not end inside a UTF-8 sequence
+    // (n_text/64 words, ~6 KB per set, whatever the grammar)
+    std::unordered_map<int32_t, std::vector<uint64_t>> rejects;
 
-    for (const auto & stack : stacks) {
-        if (stack.empty()) {
-            continue;
-        }
+    int32_t start = 0;
 
-        auto match = whisper_grammar_match_char(stack.back(), chr);
-        if (match.first) {
-            const whisper_grammar_element * pos = match.second;
+    // the decoders sample in parallel
+    std::mutex mutex;
 
-            // update top of stack to next element, if any
-            std::vector<const whisper_grammar_element *> new_stack(stack.begin(), stack.end() - 1);
-            if (!whisper_grammar_is_end_of_sequence(pos)) {
-                new_stack.push_back(pos);
-            }
-            whisper_grammar_advance_stack(rules, new_stack, new_stacks);
+    std::vector<uint8_t> accepted; // [n_text] scratch of whisper_suppress_invalid_grammar()
+
+    int32_t push(int32_t stack, const whisper_grammar_element * pos) {
+        const auto key = std::make_pair(pos, stack);
+        const auto it = stack_ids.find(key);
+        if (it != stack_ids.end()) {
+            return it->second;
         }
+        const int32_t id = stacks.size();
+        stacks.push_back({ pos, stack });
+        stacks_next.push_back(-1);
+        stack_ids.emplace(key, id);
+        return id;
     }
 
-    return new_stacks;
-}
-
-static std::vector<whisper_grammar_candidate> whisper_grammar_reject_candidates(
-        const std::vector<std::vector<whisper_grammar_element>>         & rules,
-        const std::vector<std::vector<const whisper_grammar_element *>> & stacks,
-        const std::vector<whisper_grammar_candidate>                    & candidates);
-
-static std::vector<whisper_grammar_candidate> whisper_grammar_reject_candidates_for_stack(
-        const std::vector<std::vector<whisper_grammar_element>> & rules,
-        const std::vector<const whisper_grammar_element *>      & stack,
-        const std::vector<whisper_grammar_candidate>            & candidates) {
+    int32_t intern(std::vector<int32_t> & set) {
+        if (set.empty()) {
+            return 0;
+        }
+        std::sort(set.begin(), set.end());
+        set.erase(std::unique(set.begin(), set.end()), set.end());
+        const auto it = set_ids.find(set);
+        if (it != set_ids.end()) {
+            return it->second;
+        }
+        const int32_t id = sets.size();
+        sets.push_back(set);
+        sets_next.push_back(-1);
+        set_ids.emplace(std::move(set), id);
+        return id;
+    }
+
+    // transforms a grammar pushdown stack into N possible stacks, all ending
+    // at a character range (terminal element)
+    void advance(int32_t stack, std::vector<int32_t> & out) {
+        if (stack == 0) {
+            out.push_back(0);
+            return;
+        }
+
+        const whisper_grammar_element * pos   = stacks[stack].pos;
+        const int32_t                   below = stacks[stack].below;
+
+        switch (pos->type) {
+            case WHISPER_GRETYPE_RULE_REF: {
+                const size_t                    rule_id = static_cast<size_t>(pos->value);
+                const whisper_grammar_element * subpos  = rules[rule_id].data();
+                do {
+                    // new stack without the top (pos)
+                    int32_t new_stack = below;
+                    if (!whisper_grammar_is_end_of_sequence(pos + 1)) {
+                        // if this rule ref is followed by another element, add that to stack
+                        new_stack = push(new_stack, pos + 1);
+                    }
+                    if (!whisper_grammar_is_end_of_sequence(subpos)) {
+                        // if alternate is nonempty, add to stack
+                        new_stack = push(new_stack, subpos);
+                    }
+                    advance(new_stack, out);
+                    while (!whisper_grammar_is_end_of_sequence(subpos)) {
+                        // scan to end of alternate def
+                        subpos++;
+                    }
+                    if (subpos->type == WHISPER_GRETYPE_ALT) {
+                        // there's another alternate def of this rule to process
+                        subpos++;
+                    } else {
+                        break;
+                    }
+                } while (true);
+                break;
+            }
+            case WHISPER_GRETYPE_CHAR:
+            case WHISPER_GRETYPE_CHAR_NOT:
+                out.push_back(stack);
+                break;
+            default:
+                // end of alternate (WHISPER_GRETYPE_END, WHISPER_GRETYPE_ALT) or middle of char range
+                // (WHISPER_GRETYPE_CHAR_ALT, WHISPER_GRETYPE_CHAR_RNG_UPPER); stack should never be left on
+                // those
+                WHISPER_ASSERT(false);
+        }
+    }
 
-    std::vector<whisper_grammar_candidate> rejects;
+    // the set of stacks once the char range on top of a (non-empty) stack has matched - it does not
+    // depend on the char
+    int32_t next(int32_t stack) {
+        if (stacks_next[stack] < 0) {
+            const whisper_grammar_element * pos = whisper_grammar_match_char(stacks[stack].pos, 0).second;
 
-    if (stack.empty()) {
-        for (auto tok : candidates) {
-            if (*tok.code_points != 0 || tok.partial_utf8.n_remain != 0) {
-                rejects.push_back(tok);
+            // update top of stack to next element, if any
+            int32_t new_stack = stacks[stack].below;
+            if (!whisper_grammar_is_end_of_sequence(pos)) {
+                new_stack = push(new_stack, pos);
             }
+
+            std::vector<int32_t> out;
+            advance(new_stack, out);
+            stacks_next[stack] = intern(out);
         }
-        return rejects;
+        return stacks_next[stack];
     }
 
-    const whisper_grammar_element * stack_pos = stack.back();
+    // the set of stacks after accepting chr, 0 if no stack accepts it
+    int32_t step(int32_t set, uint32_t chr) {
+        const uint64_t key = ((uint64_t) set << 32) | chr;
+        const auto it = steps.find(key);
+        if (it != steps.end()) {
+            return it->second;
+        }
 
-    std::vector<whisper_grammar_candidate> next_candidates;
-    for (auto tok : candidates) {
-        if (*tok.code_points == 0) {
-            // reached end of full codepoints in token, reject iff it ended in a partial sequence
-            // that cannot satisfy this position in grammar
-            if (tok.partial_utf8.n_remain != 0 && !whisper_grammar_match_partial_char(stack_pos, tok.partial_utf8)) {
-                rejects.push_back(tok);
+        std::vector<int32_t> matched;
+        for (const int32_t stack : sets[set]) {
+            if (stack != 0 && whisper_grammar_match_char(stacks[stack].pos, chr).first) {
+                matched.push_back(stack);
             }
-        } else if (whisper_grammar_match_char(stack_pos, *tok.code_points).first) {
-            next_candidates.push_back({ tok.id, tok.code_points + 1, tok.partial_utf8 });
-        } else {
-            rejects.push_back(tok);
         }
-    }
 
-    const auto * stack_pos_after = whisper_grammar_match_char(stack_pos, 0).second;
+        // sets with the same matching stacks have the same successor, e.g. all the letters in [a-z]
+        const int32_t id = intern(matched);
+        if (sets_next[id] < 0) {
+            std::vector<int32_t> out;
+            for (size_t i = 0; i < sets[id].size(); ++i) {
+                const int32_t n = next(sets[id][i]);
+                out.insert(out.end(), sets[n].begin(), sets[n].end());
+            }
+            sets_next[id] = intern(out);
+        }
 
-    // update top of stack to next element, if any
-    std::vector<const whisper_grammar_element *> stack_after(stack.begin(), stack.end() - 1);
-    if (!whisper_grammar_is_end_of_sequence(stack_pos_after)) {
-        stack_after.push_back(stack_pos_after);
+        steps.emplace(key, sets_next[id]);
+        return sets_next[id];
     }
-    std::vector<std::vector<const whisper_grammar_element *>> next_stacks;
-    whisper_grammar_advance_stack(rules, stack_after, next_stacks);
 
-    auto next_rejects = whisper_grammar_reject_candidates(rules, next_stacks, next_candidates);
-    for (auto tok : next_rejects) {
-        rejects.push_back({ tok.id, tok.code_points - 1, tok.partial_utf8 });
+    // whether a token that ends with partial_utf8 can end in the (non-empty) set of stacks
+    bool accepts_end(int32_t set, whisper_partial_utf8 partial_utf8) const {
+        if (partial_utf8.n_remain == 0) {
+            return true;
+        }
+        // the partial sequence must be able to satisfy the char range on top of some stack
+        for (const int32_t stack : sets[set]) {
+            if (stack != 0 && whisper_grammar_match_partial_char(stacks[stack].pos, partial_utf8)) {
+                return true;
+            }
+        }
+        return false;
     }
+};
 
-    return rejects;
-}
+// marks the tokens below a node of the code-point trie that the grammar accepts from the given set of stacks
+// the tokens that share a prefix are matched against the grammar once for the whole prefix, and a subtree
+// is skipped as soon as no stack accepts its prefix
+static void whisper_grammar_accept_trie(
+        whisper_grammar_automaton  & ga,
+        const whisper_grammar_trie & trie,
+                          uint32_t   node,
+                           int32_t   set,
+              std::vector<uint8_t> & accepted) {
+    const auto & cur = trie.nodes[node];
 
-static std::vector<whisper_grammar_candidate> whisper_grammar_reject_candidates(
-        const std::vector<std::vector<whisper_grammar_element>>         & rules,
-        const std::vector<std::vector<const whisper_grammar_element *>> & stacks,
-        const std::vector<whisper_grammar_candidate>                    & candidates) {
-    if (candidates.empty() || stacks.empty()) {
-        return std::vector<whisper_grammar_candidate>();
+    for (uint32_t i = cur.tok; i < cur.tok + cur.n_tok; ++i) {
+        const auto & tok = trie.tokens[i];
+        if (ga.accepts_end(set, tok.partial_utf8)) {
+            accepted[tok.id] = 1;
+        }
     }
 
-    auto rejects = whisper_grammar_reject_candidates_for_stack(rules, stacks.front(), candidates);
-
-    for (size_t i = 1, size = stacks.size(); i < size; ++i) {
-        rejects = whisper_grammar_reject_candidates_for_stack(rules, stacks[i], rejects);
+    for (uint32_t child = cur.child; child < cur.child + cur.n_child; ++child) {
+        const int32_t next = ga.step(set, trie.labels[child]);
+        if (next != 0) {
+            whisper_grammar_accept_trie(ga, trie, child, next, accepted);
+        }
     }
-    return rejects;
 }
 
-static struct whisper_grammar whisper_grammar_init(
+static std::shared_ptr<whisper_grammar_automaton> whisper_grammar_compile(
+                   whisper_context         & ctx,
             const whisper_grammar_element ** rules,
                                  size_t      n_rules,
                                  size_t      i_start_rule) {
-    const whisper_grammar_element * pos;
+    // the trie costs tens of ms to build, so models that are never used with a grammar do not pay for it
+    auto & vocab = ctx.vocab;
+    std::call_once(vocab.grammar_trie_once, [&vocab]() {
+        vocab.grammar_trie.build(vocab.token_text.data(), vocab.token_offs.data(), vocab.token_eot);
+    });
+
+    auto ga = std::make_shared<whisper_grammar_automaton>();
 
     // copy rule definitions into vectors
-    std::vector<std::vector<whisper_grammar_element>> vec_rules(n_rules);
+    ga->rules.resize(n_rules);
     for (size_t i = 0; i < n_rules; i++) {
-        for (pos = rules[i]; pos->type != WHISPER_GRETYPE_END; pos++) {
-            vec_rules[i].push_back(*pos);
+        for (const whisper_grammar_element * pos = rules[i]; pos->type != WHISPER_GRETYPE_END; pos++) {
+            ga->rules[i].push_back(*pos);
         }
-        vec_rules[i].push_back({WHISPER_GRETYPE_END, 0});
+        ga->rules[i].push_back({WHISPER_GRETYPE_END, 0});
     }
 
     // loop over alternates of start rule to build initial stacks
-    std::vector<std::vector<const whisper_grammar_element *>> stacks;
-    pos = rules[i_start_rule];
+    std::vector<int32_t> stacks;
+    const whisper_grammar_element * pos = ga->rules[i_start_rule].data();
     do {
-        std::vector<const whisper_grammar_element *> stack;
+        int32_t stack = 0;
         if (!whisper_grammar_is_end_of_sequence(pos)) {
             // if alternate is nonempty, add to stack
-            stack.push_back(pos);
+            stack = ga->push(stack, pos);
         }
-        whisper_grammar_advance_stack(vec_rules, stack, stacks);
+        ga->advance(stack, stacks);
         while (!whisper_grammar_is_end_of_sequence(pos)) {
             // scan to end of alternate def
             pos++;
@@ -5825,7 +7695,20 @@ static struct whisper_grammar whisper_grammar_init(
         }
     } while (true);
 
-    return { std::move(vec_rules), std::move(stacks), {} };
+    ga->start = ga->intern(stacks);
+
+    return ga;
+}
+
+static whisper_grammar whisper_grammar_init(const std::shared_ptr<whisper_grammar_automaton> & automaton) {
+    whisper_grammar grammar;
+
+    if (automaton) {
+        grammar.automaton = automaton;
+        grammar.stacks    = automaton->start;
+    }
+
+    return grammar;
 }
 
 static void whisper_suppress_invalid_grammar(
@@ -5834,64 +7717,89 @@ static void whisper_suppress_invalid_grammar(
            std::vector<float> & logits,
     const     whisper_grammar & grammar) {
 
-    if (grammar.rules.empty() || grammar.stacks.empty()) {
+    if (!grammar.automaton || grammar.stacks == 0) {
         return;
     }
 
-    //bool allow_eot = false;
-    //for (const auto & stack : grammar.stacks) {
-    //    if (stack.empty()) {
-    //        allow_eot = true;
-    //        break;
-    //    }
-    //}
+    auto & ga = *grammar.automaton;
+
+    std::lock_guard<std::mutex> lock(ga.mutex);
 
     const whisper_token eot = whisper_token_eot(&ctx);
 
-    std::vector<std::pair<std::vector<uint32_t>, whisper_partial_utf8>> candidates_decoded;
-    std::vector<whisper_grammar_candidate>                              candidates_grammar;
+    if (grammar.partial_utf8.n_remain == 0) {
+        // the tokens decode the same way every time the grammar is in this set of stacks
+        auto it = ga.rejects.find(grammar.stacks);
+        if (it == ga.rejects.end()) {
+            auto & accepted = ga.accepted;
+            accepted.assign(eot, 0);
+            whisper_grammar_accept_trie(ga, ctx.vocab.grammar_trie, 0, grammar.stacks, accepted);
+
+            std::vector<uint64_t> rejects((eot + 63)/64, 0);
+            for (whisper_token id = 0; id < eot; ++id) {
+                if (!accepted[id] && ctx.vocab.token_len(id) != 0) {
+                    rejects[id/64] |= uint64_t(1) << (id % 64);
+                }
+            }
+            it = ga.rejects.emplace(grammar.stacks, std::move(rejects)).first;
+        }
 
-    for (whisper_token id = 0; id < eot; ++id) {
-        const std::string & text = ctx.vocab.id_to_token[id];
-        if (!text.empty()) {
-            candidates_decoded.push_back(decode_utf8(text.c_str(), grammar.partial_utf8));
-            candidates_grammar.push_back({ id, candidates_decoded.back().first.data(), candidates_decoded.back().second });
+        const auto & rejects = it->second;
+        for (size_t i = 0; i < rejects.size(); ++i) {
+            int b = 0;
+            for (uint64_t bits = rejects[i]; bits != 0; bits >>= 1, ++b) {
+                if (bits & 1) {
+                    logits[i*64 + b] -= params.grammar_penalty;
+                }
+            }
         }
-    }
+    } else {
+        // the last token ended inside a UTF-8 sequence, which changes how every token decodes
+        for (whisper_token id = 0; id < eot; ++id) {
+            if (ctx.vocab.token_len(id) == 0) {
+                continue;
+            }
 
-    const auto rejects = whisper_grammar_reject_candidates(grammar.rules, grammar.stacks, candidates_grammar);
+            // Note terminating 0 in decoded string
+            const auto   decoded     = decode_utf8(ctx.vocab.id_to_token(id), grammar.partial_utf8);
+            const auto & code_points = decoded.first;
 
-    for (const auto & reject : rejects) {
-        logits[reject.id] -= params.grammar_penalty;
-    }
+            int32_t set = grammar.stacks;
+            for (auto it = code_points.begin(), end = code_points.end() - 1; it != end && set != 0; ++it) {
+                set = ga.step(set, *it);
+            }
 
-    // when the grammar allows a continuation, we penalize the end-of-text token
-    //if (!allow_eot) {
-    //    logits[eot] -= params.grammar_penalty;
-    //}
-    //fprintf(stderr, "Allowed: (%zu tokens)\n", size - rejects.size());
+            if (set == 0 || !ga.accepts_end(set, decoded.second)) {
+                logits[id] -= params.grammar_penalty;
+            }
+        }
+    }
 }
 
 static void whisper_grammar_accept_token(whisper_context & ctx, whisper_grammar & grammar, whisper_token token) {
-    if (grammar.rules.empty() || grammar.stacks.empty()) {
+    if (!grammar.automaton || grammar.stacks == 0) {
         return;
     }
 
-    //fprintf(stderr, "Accept: '%s'\n", ctx.vocab.id_to_token[token].c_str());
+    //fprintf(stderr, "Accept: '%s'\n", ctx.vocab.id_to_token(token));
 
-    const std::string & text = ctx.vocab.id_to_token[token];
+    const char * text = ctx.vocab.id_to_token(token);
 
-    if (text.rfind("[_", 0) == 0) {
+    if (strncmp(text, "[_", 2) == 0) {
         // fprintf(stderr, " (skipped)\n");
         return;
     }
     // fprintf(stderr, "\n");
 
+    auto & ga = *grammar.automaton;
+
+    std::lock_guard<std::mutex> lock(ga.mutex);
+
     // Note terminating 0 in decoded string
-    const auto   decoded     = decode_utf8(text.c_str(), grammar.partial_utf8);
+    const auto   decoded     = decode_utf8(text, grammar.partial_utf8);
     const auto & code_points = decoded.first;
     for (auto it = code_points.begin(), end = code_points.end() - 1; it != end; ++it) {
-        grammar.stacks = whisper_grammar_accept(grammar.rules, grammar.stacks, *it);
+        grammar.stacks = ga.step(grammar.stacks, *it);
     }
     grammar.partial_utf8 = decoded.second;
 }
@@ -5923,6 +7831,11 @@ struct whisper_full_params whisper_full_default_params(enum whisper_sampling_str
         /*.strategy          =*/ strategy,
 
         /*.n_threads         =*/ std::min(4, (int32_t) std::thread::hardware_concurrency()),
+        /*.n_threads_mel     =*/ 0,
+        /*.n_threads_encode  =*/ 0,
+        /*.n_threads_prompt  =*/ WHISPER_N_THREADS_AUTO,
+        /*.n_threads_decode  =*/ WHISPER_N_THREADS_AUTO,
+        /*.n_threads_sample  =*/ WHISPER_N_THREADS_AUTO,
         /*.n_max_text_ctx    =*/ 16384,
         /*.offset_ms         =*/ 0,
         /*.duration_ms       =*/ 0,
@@ -6003,6 +7916,8 @@ struct whisper_full_params whisper_full_default_params(enum whisper_sampling_str
         /*.vad_model_path              =*/ nullptr,
 
         /* vad_params =*/ whisper_vad_default_params(),
+
+        /*.parallel_split_on_silence =*/ false,
     };
 
     switch (strategy) {
@@ -6163,7 +8078,7 @@ static void whisper_process_logits(
     const auto & tokens_cur = decoder.sequence.tokens;
 
     const bool is_initial = tokens_cur.size() == 0;
-    const int  n_logits   = vocab.id_to_token.size();
+    const int  n_logits   = vocab.n_tokens();
 
     WHISPER_ASSERT(n_logits == ctx.vocab.n_vocab);
 
@@ -6195,7 +8110,10 @@ static void whisper_process_logits(
         if (params.suppress_blank) {
             if (is_initial) {
                 logits[vocab.token_eot]           = -INFINITY;
-                logits[vocab.token_to_id.at(" ")] = -INFINITY;
+                const whisper_vocab::id id_space = vocab.token_to_id(" ");
+                if (id_space >= 0) {
+                    logits[id_space] = -INFINITY;
+                }
             }
         }
 
@@ -6238,9 +8156,14 @@ static void whisper_process_logits(
         // ref: https://github.com/openai/whisper/discussions/1041
         if (params.suppress_regex != nullptr) {
             std::regex re(params.suppress_regex);
-            for (std::pair<whisper_vocab::token, whisper_vocab::id> token_id : vocab.token_to_id) {
-                if (std::regex_match(token_id.first, re)) {
-                    logits[token_id.second] = -INFINITY;
+            for (whisper_vocab::id id = 0; id < n_logits; ++id) {
+                const char * text = vocab.id_to_token(id);
+                // a text shared by several tokens maps to the last of them only
+                if (vocab.token_trie.find(text, vocab.token_len(id)) != id) {
+                    continue;
+                }
+                if (std::regex_match(text, text + vocab.token_len(id), re)) {
+                    logits[id] = -INFINITY;
                 }
             }
         }
@@ -6251,18 +8174,19 @@ static void whisper_process_logits(
             for (const std::string & token : non_speech_tokens) {
                 const std::string suppress_tokens[] = {token, " " + token};
                 for (const std::string & suppress_token : suppress_tokens) {
-                    if (vocab.token_to_id.find(suppress_token) != vocab.token_to_id.end()) {
-                        logits[vocab.token_to_id.at(suppress_token)] = -INFINITY;
+                    const whisper_vocab::id id = vocab.token_to_id(suppress_token);
+                    if (id >= 0) {
+                        logits[id] = -INFINITY;
                     }
                 }
             }
 
             // allow hyphens "-" and single quotes "'" between words, but not at the beginning of a word
-            if (vocab.token_to_id.find(" -") != vocab.token_to_id.end()) {
-                logits[vocab.token_to_id.at(" -")] = -INFINITY;
-            }
-            if (vocab.token_to_id.find(" '") != vocab.token_to_id.end()) {
-                logits[vocab.token_to_id.at(" '")] = -INFINITY;
+            for (const char * suppress_token : { " -", " '" }) {
+                const whisper_vocab::id id = vocab.token_to_id(suppress_token);
+                if (id >= 0) {
+                    logits[id] = -INFINITY;
+                }
             }
         }
 
@@ -6372,7 +8296,7 @@ static void whisper_process_logits(
 #if 0
     // print first 100 logits - token string : logit
     //for (int i = 0; i < 10; i++) {
-    //    const auto token   = vocab.id_to_token.at(i);
+    //    const auto token   = vocab.id_to_token(i);
     //    const auto prob    = probs[i];
     //    const auto logit   = logits[i];
     //    const auto logprob = logprobs[i];
@@ -6392,34 +8316,34 @@ static void whisper_process_logits(
         });
 
         for (int i = 0; i < 10; i++) {
-            const auto token   = vocab.id_to_token.at(pairs[i].second);
+            const auto token   = vocab.id_to_token(pairs[i].second);
             const auto prob    = pairs[i].first;
             const auto logit   = logits[pairs[i].second];
             const auto logprob = logprobs[pairs[i].second];
-            printf("%16s : id=%6d prob=%9.5f logit=%9.5f logprob=%9.5f '%s'\n", token.c_str(), pairs[i].second, prob, logit, logprob, token.c_str());
+            printf("%16s : id=%6d prob=%9.5f logit=%9.5f logprob=%9.5f '%s'\n", token, pairs[i].second, prob, logit, logprob, token);
         }
 
         printf("----------------\n");
     }
 
     // "And", "and", " And", " and"
-    //printf("logits[\"and\"]  = %f\n", logits[vocab.token_to_id.at("and")]);
-    //printf("logits[\"And\"]  = %f\n", logits[vocab.token_to_id.at("And")]);
-    //printf("logits[\" and\"] = %f\n", logits[vocab.token_to_id.at(" and")]);
-    //printf("logits[\" And\"] = %f\n", logits[vocab.token_to_id.at(" And")]);
-    //printf("logits[\" so\"]  = %f\n", logits[vocab.token_to_id.at(" so")]);
-
-    //printf("logprobs[\"and\"]  = %f\n", logprobs[vocab.token_to_id.at("and")]);
-    //printf("logprobs[\"And\"]  = %f\n", logprobs[vocab.token_to_id.at("And")]);
-    //printf("logprobs[\" and\"] = %f\n", logprobs[vocab.token_to_id.at(" and")]);
-    //printf("logprobs[\" And\"] = %f\n", logprobs[vocab.token_to_id.at(" And")]);
-    //printf("logprobs[\" so\"]  = %f\n", logprobs[vocab.token_to_id.at(" so")]);
-
-    //printf("probs[\"and\"]  = %f\n", probs[vocab.token_to_id.at("and")]);
-    //printf("probs[\"And\"]  = %f\n", probs[vocab.token_to_id.at("And")]);
-    //printf("probs[\" and\"] = %f\n", probs[vocab.token_to_id.at(" and")]);
-    //printf("probs[\" And\"] = %f\n", probs[vocab.token_to_id.at(" And")]);
-    //printf("probs[\" so\"]  = %f\n", probs[vocab.token_to_id.at(" so")]);
+    //printf("logits[\"and\"]  = %f\n", logits[vocab.token_to_id("and")]);
+    //printf("logits[\"And\"]  = %f\n", logits[vocab.token_to_id("And")]);
+    //printf("logits[\" and\"] = %f\n", logits[vocab.token_to_id(" and")]);
+    //printf("logits[\" And\"] = %f\n", logits[vocab.token_to_id(" And")]);
+    //printf("logits[\" so\"]  = %f\n", logits[vocab.token_to_id(" so")]);
+
+    //printf("logprobs[\"and\"]  = %f\n", logprobs[vocab.token_to_id("and")]);
+    //printf("logprobs[\"And\"]  = %f\n", logprobs[vocab.token_to_id("And")]);
+    //printf("logprobs[\" and\"] = %f\n", logprobs[vocab.token_to_id(" and")]);
+    //printf("logprobs[\" And\"] = %f\n", logprobs[vocab.token_to_id(" And")]);
+    //printf("logprobs[\" so\"]  = %f\n", logprobs[vocab.token_to_id(" so")]);
+
+    //printf("probs[\"and\"]  = %f\n", probs[vocab.token_to_id("and")]);
+    //printf("probs[\"And\"]  = %f\n", probs[vocab.token_to_id("And")]);
+    //printf("probs[\" and\"] = %f\n", probs[vocab.token_to_id(" and")]);
+    //printf("probs[\" And\"] = %f\n", probs[vocab.token_to_id(" And")]);
+    //printf("probs[\" so\"]  = %f\n", probs[vocab.token_to_id(" so")]);
 #endif
 }
 
@@ -6626,6 +8550,8 @@ static bool whisper_vad(
                    const float * samples,
                            int   n_samples,
             std::vector<float> & filtered_samples) {
+    WHISPER_TRACE_SCOPE("vad");
+
     WHISPER_LOG_INFO("%s: VAD is enabled, processing speech segments only\n", __func__);
     int filtered_n_samples = 0;
 
@@ -6648,6 +8574,8 @@ static bool whisper_vad(
 
     whisper_vad_segments * vad_segments = whisper_vad_segments_from_samples(vctx, vad_params, samples, n_samples);
 
+    whisper_memory_entry_set(state->mem.vad, "vad", whisper_vad_memory_size(vctx));
+
     if (vad_segments->data.size() > 0) {
         state->has_vad_segments = true;
         ctx->state->vad_segments.clear();
@@ -6799,20 +8727,75 @@ static bool whisper_vad(
     return true;
 }
 
+// thread counts of the whisper_full phases, resolved from whisper_full_params
+struct whisper_full_threads {
+    int mel;
+    int encode;
+    int prompt_small; // prompt batches that are too small to be compute bound
+    int prompt;
+    int decode;
+    int sample;
+
+    int get_prompt(int n_tokens) const {
+        // below this many rows the matrix multiplications stream the weights like single-token decoding
+        return n_tokens < 16 ? prompt_small : prompt;
+    }
+};
+
+static int whisper_resolve_n_threads(int n, int n_threads, int n_auto) {
+    if (n == 0) {
+        return n_threads;
+    }
+    if (n < 0) {
+        return std::max(1, std::min(n_threads, n_auto));
+    }
+    return n;
+}
+
+static whisper_full_threads whisper_full_resolve_threads(const whisper_full_params & params, int n_samples) {
+    const int n_threads = std::max(1, params.n_threads);
+
+    // decoding one token per decoder is a matrix-vector product bound by memory bandwidth, which
+    // saturates after a few cores - more threads only add barrier overhead
+    // the logits matmul alone streams tens of MB even for tiny, so every model has enough work for 4
+    const int n_decode_auto = 4;
+
+    whisper_full_threads res;
+
+    // each mel thread handles an interleaved subset of the frames - about 10 s of audio per thread is
+    // enough to hide the thread start-up
+    res.mel    = whisper_resolve_n_threads(params.n_threads_mel,    n_threads, n_samples/(10*WHISPER_SAMPLE_RATE));
+    res.encode = whisper_resolve_n_threads(params.n_threads_encode, n_threads, n_threads);
+    res.prompt = whisper_resolve_n_threads(params.n_threads_prompt, n_threads, n_threads);
+    res.decode = whisper_resolve_n_threads(params.n_threads_decode, n_threads, n_decode_auto);
+    res.sample = whisper_resolve_n_threads(params.n_threads_sample, n_threads, n_threads);
+
+    res.prompt_small = params.n_threads_prompt < 0 ? res.decode : res.prompt;
+
+    return res;
+}
+
 int whisper_full_with_state(
         struct whisper_context * ctx,
           struct whisper_state * state,
     struct whisper_full_params   params,
                    const float * samples,
                            int   n_samples) {
+    WHISPER_TRACE_SCOPE("whisper_full");
+
     // clear old results
     auto & result_all = state->result_all;
 
     result_all.clear();
 
+    const whisper_full_threads n_threads = whisper_full_resolve_threads(params, n_samples);
+
+    WHISPER_LOG_DEBUG("%s: n_threads: mel = %d, encode = %d, prompt = %d/%d, decode = %d, sample = %d\n", __func__,
+            n_threads.mel, n_threads.encode, n_threads.prompt_small, n_threads.prompt, n_threads.decode, n_threads.sample);
+
     if (n_samples > 0) {
         // compute log mel spectrogram
-        if (whisper_pcm_to_mel_with_state(ctx, state, samples, n_samples, params.n_threads) != 0) {
+        if (whisper_pcm_to_mel_with_state(ctx, state, samples, n_samples, n_threads.mel) != 0) {
             WHISPER_LOG_ERROR("%s: failed to compute log mel spectrogram\n", __func__);
             return -2;
         }
@@ -6822,7 +8805,7 @@ int whisper_full_with_state(
     if (params.language == nullptr || strlen(params.language) == 0 || strcmp(params.language, "auto") == 0 || params.detect_language) {
         std::vector<float> probs(whisper_lang_max_id() + 1, 0.0f);
 
-        const auto lang_id = whisper_lang_auto_detect_with_state(ctx, state, 0, params.n_threads, probs.data());
+        const auto lang_id = whisper_lang_auto_detect_with_state(ctx, state, 0, n_threads.encode, probs.data());
         if (lang_id < 0) {
             WHISPER_LOG_ERROR("%s: failed to auto-detect language\n", __func__);
             return -3;
@@ -6971,6 +8954,12 @@ int whisper_full_with_state(
         prompt_init.push_back(whisper_token_not(ctx));
     }
 
+    // compiled once, the decoders start from it at every window
+    std::shared_ptr<whisper_grammar_automaton> grammar_automaton;
+    if (params.grammar_rules != nullptr) {
+        grammar_automaton = whisper_grammar_compile(*ctx, params.grammar_rules, params.n_grammar_rules, params.i_start_rule);
+    }
+
     int seek = seek_start;
 
     std::vector<whisper_token> prompt;
@@ -7011,7 +9000,7 @@ int whisper_full_with_state(
         }
 
         // encode audio features starting at offset seek
-        if (!whisper_encode_internal(*ctx, *state, seek, params.n_threads, params.abort_callback, params.abort_callback_user_data)) {
+        if (!whisper_encode_internal(*ctx, *state, seek, n_threads.encode, params.abort_callback, params.abort_callback_user_data)) {
             WHISPER_LOG_ERROR("%s: failed to encode\n", __func__);
             return -6;
         }
@@ -7027,6 +9016,8 @@ int whisper_full_with_state(
         for (int it = 0; it < (int) temperatures.size(); ++it) {
             const float t_cur = temperatures[it];
 
+            WHISPER_TRACE_SCOPE_ARG("temperature", std::lround(100.0f*t_cur));
+
             int n_decoders_cur = 1;
 
             switch (params.strategy) {
@@ -7068,16 +9059,14 @@ int whisper_full_with_state(
                 decoder.completed = false;
                 decoder.has_ts    = false;
 
-                if (params.grammar_rules != nullptr) {
-                    decoder.grammar = whisper_grammar_init(params.grammar_rules, params.n_grammar_rules, params.i_start_rule);
-                } else {
-                    decoder.grammar = {};
-                }
+                decoder.grammar = whisper_grammar_init(grammar_automaton);
             }
 
             // init prompt and kv cache for the current iteration
             // TODO: do not recompute the prompt if it is the same as previous time
             {
+                WHISPER_TRACE_SCOPE("prompt");
+
                 prompt.clear();
 
                 // if we have already generated some text, use it as a prompt to condition the next generation
@@ -7094,7 +9083,7 @@ int whisper_full_with_state(
                 // print the prompt
                 WHISPER_LOG_DEBUG("\n\n");
                 for (int i = 0; i < (int) prompt.size(); i++) {
-                    WHISPER_LOG_DEBUG("%s: prompt[%d] = %s\n", __func__, i, ctx->vocab.id_to_token.at(prompt[i]).c_str());
+                    WHISPER_LOG_DEBUG("%s: prompt[%d] = %s\n", __func__, i, ctx->vocab.id_to_token(prompt[i]));
                 }
                 WHISPER_LOG_DEBUG("\n\n");
 
@@ -7102,12 +9091,14 @@ int whisper_full_with_state(
                 if (state->kv_self_n_dec < n_decoders_cur) {
                     WHISPER_LOG_DEBUG("%s: recreating KV cache: n_decoders_cur = %d\n", __func__, n_decoders_cur);
 
+                    whisper_state_memory_update(*ctx, *state);
+
                     whisper_kv_cache_free(state->kv_self);
 
                     // overallocate to workaround KV cache fragmentation issues
                     const int factor = n_decoders_cur > 1 ? n_decoders_cur + 2 : 1;
 
-                    if (!whisper_kv_cache_init(state->kv_self, state->backends[0], ctx->itype,
+                    if (!whisper_kv_cache_init(state->kv_self, state->backends[0], ctx->params.type_kv_self,
                                 ctx->model.hparams.n_text_state,
                                 ctx->model.hparams.n_text_layer,
                                 GGML_PAD(ctx->model.hparams.n_text_ctx, 256)*factor)) {
@@ -7117,13 +9108,15 @@ int whisper_full_with_state(
                     }
 
                     state->kv_self_n_dec = n_decoders_cur;
+
+                    whisper_state_memory_update(*ctx, *state);
                 }
 
                 whisper_kv_cache_clear(state->kv_self);
 
                 whisper_batch_prep_legacy(state->batch, prompt.data(), prompt.size(), 0, 0);
 
-                if (!whisper_decode_internal(*ctx, *state, state->batch, params.n_threads, false, params.abort_callback, params.abort_callback_user_data)) {
+                if (!whisper_decode_internal(*ctx, *state, state->batch, n_threads.get_prompt(prompt.size()), false, params.abort_callback, params.abort_callback_user_data)) {
                     WHISPER_LOG_ERROR("%s: failed to decode\n", __func__);
                     return -8;
                 }
@@ -7131,7 +9124,7 @@ int whisper_full_with_state(
                 // Calculate no_speech probability after first decode.
                 // This has to be done before any logit filtering. Hence we cannot use the probs from the whisper_process_logits.
                 {
-                    const int n_logits = ctx->vocab.id_to_token.size();
+                    const int n_logits = ctx->vocab.n_tokens();
                     std::vector<float> logprobs(n_logits);
                     std::vector<float> probs(n_logits);
 
@@ -7162,6 +9155,8 @@ int whisper_full_with_state(
             }
 
             for (int i = 0, n_max = whisper_n_text_ctx(ctx)/2 - 4; i < n_max; ++i) {
+                WHISPER_TRACE_SCOPE_ARG("decode_step", i);
+
                 const int64_t t_start_sample_us = ggml_time_us();
 
                 if (params.strategy == whisper_sampling_strategy::WHISPER_SAMPLING_BEAM_SEARCH) {
@@ -7189,6 +9184,8 @@ int whisper_full_with_state(
                                 continue;
                             }
 
+                            WHISPER_TRACE_SCOPE_ARG("sample", j);
+
                             switch (params.strategy) {
                                 case whisper_sampling_strategy::WHISPER_SAMPLING_GREEDY:
                                     {
@@ -7214,20 +9211,20 @@ int whisper_full_with_state(
                         }
                     };
 
-                    const int n_threads = std::min(params.n_threads, n_decoders_cur);
+                    const int n_threads_sample = std::min(n_threads.sample, n_decoders_cur);
 
-                    if (n_threads == 1) {
+                    if (n_threads_sample == 1) {
                         process();
                     } else {
-                        std::vector<std::thread> threads(n_threads - 1);
+                        std::vector<std::thread> threads(n_threads_sample - 1);
 
-                        for (int t = 0; t < n_threads - 1; ++t) {
+                        for (int t = 0; t < n_threads_sample - 1; ++t) {
                             threads[t] = std::thread(process);
                         }
 
                         process();
 
-                        for (int t = 0; t < n_threads - 1; ++t) {
+                        for (int t = 0; t < n_threads_sample - 1; ++t) {
                             threads[t].join();
                         }
                     }
@@ -7281,7 +9278,7 @@ int whisper_full_with_state(
                         whisper_kv_cache_seq_cp(state->kv_self, cur.decoder_idx, WHISPER_MAX_DECODERS + j, -1, -1);
 
                         WHISPER_LOG_DEBUG("%s: beam search: decoder %d: from decoder %d: token = %10s, plog = %8.5f, sum_logprobs = %8.5f\n",
-                                __func__, j, cur.decoder_idx, ctx->vocab.id_to_token.at(decoder.sequence.tokens.back().id).c_str(), decoder.sequence.tokens.back().plog, decoder.sequence.sum_logprobs_all);
+                                __func__, j, cur.decoder_idx, ctx->vocab.id_to_token(decoder.sequence.tokens.back().id), decoder.sequence.tokens.back().plog, decoder.sequence.sum_logprobs_all);
                     }
 
                     for (int j = 0; j < n_decoders_cur; ++j) {
@@ -7337,9 +9334,9 @@ int whisper_full_with_state(
 
 #ifdef WHISPER_DEBUG
                         {
-                            const auto tt = token.pt > 0.10 ? ctx->vocab.id_to_token.at(token.tid) : "[?]";
+                            const char * tt = token.pt > 0.10 ? ctx->vocab.id_to_token(token.tid) : "[?]";
                             WHISPER_LOG_DEBUG("%s: id = %3d, decoder = %d, token = %6d, p = %6.3f, ts = %10s, %6.3f, result_len = %4d '%s'\n",
-                                    __func__, i, j, token.id, token.p, tt.c_str(), token.pt, result_len, ctx->vocab.id_to_token.at(token.id).c_str());
+                                    __func__, i, j, token.id, token.p, tt, token.pt, result_len, ctx->vocab.id_to_token(token.id));
                         }
 #endif
 
@@ -7435,7 +9432,7 @@ int whisper_full_with_state(
 
                     assert(batch.n_tokens > 0);
 
-                    if (!whisper_decode_internal(*ctx, *state, state->batch, params.n_threads, false, params.abort_callback, params.abort_callback_user_data)) {
+                    if (!whisper_decode_internal(*ctx, *state, state->batch, n_threads.decode, false, params.abort_callback, params.abort_callback_user_data)) {
                         WHISPER_LOG_ERROR("%s: failed to decode\n", __func__);
                         return -9;
                     }
@@ -7460,24 +9457,26 @@ int whisper_full_with_state(
                                     continue;
                                 }
 
+                                WHISPER_TRACE_SCOPE_ARG("process_logits", j);
+
                                 whisper_process_logits(*ctx, *state, decoder, params, t_cur);
                             }
                         };
 
-                        const int n_threads = std::min(params.n_threads, n_decoders_cur);
+                        const int n_threads_sample = std::min(n_threads.sample, n_decoders_cur);
 
-                        if (n_threads == 1) {
+                        if (n_threads_sample == 1) {
                             process();
                         } else {
-                            std::vector<std::thread> threads(n_threads - 1);
+                            std::vector<std::thread> threads(n_threads_sample - 1);
 
-                            for (int t = 0; t < n_threads - 1; ++t) {
+                            for (int t = 0; t < n_threads_sample - 1; ++t) {
                                 threads[t] = std::thread(process);
                             }
 
                             process();
 
-                            for (int t = 0; t < n_threads - 1; ++t) {
+                            for (int t = 0; t < n_threads_sample - 1; ++t) {
                                 threads[t].join();
                             }
                         }
@@ -7541,7 +9540,7 @@ int whisper_full_with_state(
 
             if (success) {
                 //for (auto & token : ctx->decoders[best_decoder_id].sequence.tokens) {
-                //    WHISPER_LOG_DEBUG("%s: token = %d, p = %6.3f, pt = %6.3f, ts = %s, str = %s\n", __func__, token.id, token.p, token.pt, ctx->vocab.id_to_token.at(token.tid).c_str(), ctx->vocab.id_to_token.at(token.id).c_str());
+                //    WHISPER_LOG_DEBUG("%s: token = %d, p = %6.3f, pt = %6.3f, ts = %s, str = %s\n", __func__, token.id, token.p, token.pt, ctx->vocab.id_to_token(token.tid), ctx->vocab.id_to_token(token.id));
                 //}
 
                 break;
@@ -7586,8 +9585,8 @@ int whisper_full_with_state(
 
                 for (int i = 0; i < (int) tokens_cur.size(); i++) {
                     //printf("%s: %18s %6.3f %18s %6.3f\n", __func__,
-                    //        ctx->vocab.id_to_token[tokens_cur[i].id].c_str(), tokens_cur[i].p,
-                    //        ctx->vocab.id_to_token[tokens_cur[i].tid].c_str(), tokens_cur[i].pt);
+                    //        ctx->vocab.id_to_token(tokens_cur[i].id), tokens_cur[i].p,
+                    //        ctx->vocab.id_to_token(tokens_cur[i].tid), tokens_cur[i].pt);
 
                     if (params.print_special || tokens_cur[i].id < whisper_token_eot(ctx)) {
                         text += whisper_token_to_str(ctx, tokens_cur[i].id);
@@ -7614,7 +9613,7 @@ int whisper_full_with_state(
                                 }
                             }
 
-                            //printf("tt0 = %d, tt1 = %d, text = %s, token = %s, token_id = %d, tid = %d\n", tt0, tt1, text.c_str(), ctx->vocab.id_to_token[tokens_cur[i].id].c_str(), tokens_cur[i].id, tokens_cur[i].tid);
+                            //printf("tt0 = %d, tt1 = %d, text = %s, token = %s, token_id = %d, tid = %d\n", tt0, tt1, text.c_str(), ctx->vocab.id_to_token(tokens_cur[i].id), tokens_cur[i].id, tokens_cur[i].tid);
 
                             result_all.push_back({ tt0, tt1, text, state->no_speech_prob, {}, speaker_turn_next });
                             for (int j = i0; j <= i; j++) {
@@ -7689,7 +9688,7 @@ int whisper_full_with_state(
                 if (ctx->params.dtw_token_timestamps && n_segments) {
                     const int n_frames = std::min(std::min(WHISPER_CHUNK_SIZE * 100, seek_delta), seek_end - seek);
                     whisper_exp_compute_token_level_timestamps_dtw(
-                            ctx, state, params, result_all.size() - n_segments, n_segments, seek, n_frames, 7, params.n_threads);
+                            ctx, state, params, result_all.size() - n_segments, n_segments, seek, n_frames, 7, n_threads.prompt);
                     if (params.new_segment_callback) {
                         for (int seg = (int) result_all.size() - n_segments; seg < n_segments; seg++) {
                             params.new_segment_callback(ctx, state, seg, params.new_segment_callback_user_data);
@@ -7740,6 +9739,104 @@ int whisper_full(
     return whisper_full_with_state(ctx, ctx->state, params, samples, n_samples);
 }
 
+// chunk boundaries of whisper_full_parallel(): offset_samples, the n_processors - 1 split points, n_samples
+// with params.parallel_split_on_silence each split point moves from its equal-length target to the nearest
+// silence within a quarter of a chunk, and on_silence tells which ones found one
+static std::vector<int> whisper_parallel_split(
+    const whisper_full_params  & params,
+                   const float * samples,
+                           int   n_samples,
+                           int   offset_samples,
+                           int   n_processors,
+             std::vector<bool> & on_silence) {
+    const int n_samples_per_processor = (n_samples - offset_samples)/n_processors;
+
+    std::vector<int> bounds(n_processors + 1);
+    for (int i = 0; i < n_processors; ++i) {
+        bounds[i] = offset_samples + i*n_samples_per_processor;
+    }
+    bounds[n_processors] = n_samples;
+
+    on_silence.assign(n_processors + 1, false);
+
+    if (!params.parallel_split_on_silence) {
+        return bounds;
+    }
+
+    const int max_shift = n_samples_per_processor/4;
+
+    // energy of 10 ms frames, the split goes in the middle of the quietest 0.2 s if that is 10 dB under the
+    // median frame (or under -60 dBFS, for mostly silent audio)
+    const int n_frame  = WHISPER_SAMPLE_RATE/100;
+    const int n_window = 20;
+    const int n_frames = n_samples/n_frame;
+
+    std::vector<double> frames(n_frames);
+    std::vector<double> energy(n_frames + 1, 0.0); // prefix sums over the frames
+    for (int f = 0; f < n_frames; ++f) {
+        double sum = 0.0;
+        for (int j = 0; j < n_frame; ++j) {
+            const float v = samples[f*n_frame + j];
+            sum += v*v;
+        }
+        frames[f] = sum;
+        energy[f + 1] = energy[f] + sum;
+    }
+
+    double median = 0.0;
+    if (n_frames > 0) {
+        std::nth_element(frames.begin(), frames.begin() + n_frames/2, frames.end());
+        median = frames[n_frames/2];
+    }
+
+    // largest energy of a silent window
+    const double energy_max = n_window*std::max(0.1*median, 1e-6*n_frame);
+
+    for (int i = 1; i < n_processors; ++i) {
+        const int target = bounds[i];
+
+        // chunks stay at least half as long as the equal-length ones
+        const int lo = std::max(target - max_shift, bounds[i - 1] + n_samples_per_processor/2);
+        const int hi = std::min(target + max_shift, n_samples - n_samples_per_processor/2);
+        if (lo > hi) {
+            continue;
+        }
+
+        // centers of the windows, on frame boundaries within [lo, hi]
+        const int c0 = std::max((lo + n_frame - 1)/n_frame, n_window/2);
+        const int c1 = std::min(hi/n_frame, n_frames - n_window/2);
+
+        int    best        = -1;
+        double best_energy = 0.0;
+        for (int c = c0; c <= c1; ++c) {
+            const double e = energy[c + n_window/2] - energy[c - n_window/2];
+            const int    p = c*n_frame;
+            if (best < 0 || e < best_energy || (e == best_energy && std::abs(p - target) < std::abs(best - target))) {
+                best = p;
+                best_energy = e;
+            }
+        }
+
+        if (best >= 0 && best_energy < energy_max) {
+            bounds[i]     = best;
+            on_silence[i] = true;
+        }
+    }
+
+    return bounds;
+}
+
+// letters and digits of a segment text, lowercased
+static std::string whisper_parallel_seam_key(const std::string & text) {
+    std::string key;
+    for (const char c : text) {
+        if (isalnum((unsigned char) c) || (unsigned char) c >= 0x80) {
+            key.push_back(tolower((unsigned char) c));
+        }
+    }
+    return key;
+}
+
 int whisper_full_parallel(
         struct whisper_context * ctx,
         struct whisper_full_params params,
@@ -7766,22 +9863,33 @@ int whisper_full_parallel(
     }
     int ret = 0;
 
-    // prepare separate states for each thread
-    std::vector<whisper_state*> states;
+    // the states of the other threads are created on first use and kept in the context
+    while ((int) ctx->parallel_states.size() < n_processors - 1) {
+        whisper_state * state = whisper_init_state(ctx);
+        if (state == nullptr) {
+            WHISPER_LOG_ERROR("%s: failed to initialize a state for processor %d\n", __func__, (int) ctx->parallel_states.size() + 1);
+            return -1;
+        }
+        ctx->parallel_states.push_back(state);
+    }
+    const std::vector<whisper_state *> states(ctx->parallel_states.begin(), ctx->parallel_states.begin() + n_processors - 1);
 
     const int offset_samples = (WHISPER_SAMPLE_RATE*params.offset_ms)/1000;
-    const int n_samples_per_processor = (n_samples - offset_samples)/n_processors;
+
+    std::vector<bool> on_silence;
+    const std::vector<int> bounds = whisper_parallel_split(params, samples, n_samples, offset_samples, n_processors, on_silence);
 
     // the calling thread will process the first chunk
     // while the other threads will process the remaining chunks
 
     std::vector<std::thread> workers(n_processors - 1);
     for (int i = 0; i < n_processors - 1; ++i) {
-        // create a new state for each thread
-        states.push_back(whisper_init_state(ctx));
+        // a pooled state starts like a fresh one, without the text of the previous call to condition on
+        whisper_reset_state_timings(states[i]);
+        states[i]->prompt_past.clear();
 
-        const int start_samples = offset_samples + (i + 1)*n_samples_per_processor;
-        const int n_samples_cur = (i == n_processors - 2) ? n_samples - start_samples : n_samples_per_processor;
+        const int start_samples = bounds[i + 1];
+        const int n_samples_cur = bounds[i + 2] - start_samples;
 
         auto params_cur = params;
 
@@ -7805,23 +9913,43 @@ int whisper_full_parallel(
         params_cur.print_realtime = false;
 
         // Run the first transformation using default state but only for the first chunk.
-        ret = whisper_full_with_state(ctx, ctx->state, std::move(params_cur), samples, offset_samples + n_samples_per_processor);
+        ret = whisper_full_with_state(ctx, ctx->state, std::move(params_cur), samples, bounds[1]);
     }
 
     for (int i = 0; i < n_processors - 1; ++i) {
         workers[i].join();
     }
 
-    const int64_t offset_t = (int64_t) params.offset_ms/10.0;
-
     // combine results into result_state->result_all from all other states
     for (int i = 0; i < n_processors - 1; ++i) {
         auto& results_i = states[i]->result_all;
 
+        // start of the chunk, in the time of the whole audio (the offset is included in bounds)
+        const int64_t t_seam = (100*(int64_t) bounds[i + 1])/WHISPER_SAMPLE_RATE;
+
         for (auto& result : results_i) {
-            // correct the segment timestamp taking into account the offset
-            result.t0 += 100 * ((i + 1) * n_samples_per_processor) / WHISPER_SAMPLE_RATE + offset_t;
-            result.t1 += 100 * ((i + 1) * n_samples_per_processor) / WHISPER_SAMPLE_RATE + offset_t;
+            // correct the segment and token timestamps taking into account the offset
+            result.t0 += t_seam;
+            result.t1 += t_seam;
+
+            for (auto & token : result.tokens) {
+                if (token.t0 >= 0) {
+                    token.t0 += t_seam;
+                    token.t1 += t_seam;
+                }
+                if (token.t_dtw >= 0) {
+                    token.t_dtw += t_seam;
+                }
+            }
+
+            if (params.parallel_split_on_silence && !ctx->state->result_all.empty() && result.t0 < t_seam + 300) {
+                // right after a split, drop a segment that is empty or repeats the previous one
+                const std::string key = whisper_parallel_seam_key(result.text);
+                if (key.empty() || key == whisper_parallel_seam_key(ctx->state->result_all.back().text)) {
+                    WHISPER_LOG_DEBUG("%s: dropping segment '%s' at split %d\n", __func__, result.text.c_str(), i + 1);
+                    continue;
+                }
+            }
 
             // make sure that segments are not overlapping
             if (!ctx->state->result_all.empty()) {
@@ -7836,6 +9964,8 @@ int whisper_full_parallel(
             }
         }
 
+        results_i.clear();
+
         ctx->state->t_mel_us += states[i]->t_mel_us;
 
         ctx->state->t_sample_us += states[i]->t_sample_us;
@@ -7849,8 +9979,6 @@ int whisper_full_parallel(
         ctx->state->n_decode += states[i]->n_decode;
         ctx->state->n_batchd += states[i]->n_batchd;
         ctx->state->n_prompt += states[i]->n_prompt;
-
-        whisper_free_state(states[i]);
     }
 
     // average the timings
@@ -7860,12 +9988,17 @@ int whisper_full_parallel(
     ctx->state->t_decode_us /= n_processors;
 
     // print information about the audio boundaries
+    bool degraded = false;
     WHISPER_LOG_WARN("\n");
     WHISPER_LOG_WARN("%s: the audio has been split into %d chunks at the following times:\n", __func__, n_processors);
-    for (int i = 0; i < n_processors - 1; ++i) {
-        WHISPER_LOG_WARN("%s: split %d - %s\n", __func__, (i + 1), to_timestamp(100*((i + 1)*n_samples_per_processor)/WHISPER_SAMPLE_RATE + offset_t).c_str());
+    for (int i = 1; i < n_processors; ++i) {
+        WHISPER_LOG_WARN("%s: split %d - %s%s\n", __func__, i, to_timestamp((100*(int64_t) bounds[i])/WHISPER_SAMPLE_RATE).c_str(),
+                on_silence[i] ? " (silence)" : "");
+        degraded = degraded || !on_silence[i];
+    }
+    if (degraded) {
+        WHISPER_LOG_WARN("%s: the transcription quality may be degraded near these boundaries\n", __func__);
     }
-    WHISPER_LOG_WARN("%s: the transcription quality may be degraded near these boundaries\n", __func__);
 
     return ret;
 }
@@ -8000,11 +10133,11 @@ int whisper_full_n_tokens(struct whisper_context * ctx, int i_segment) {
 }
 
 const char * whisper_full_get_token_text_from_state(struct whisper_context * ctx, struct whisper_state * state, int i_segment, int i_token) {
-    return ctx->vocab.id_to_token[state->result_all[i_segment].tokens[i_token].id].c_str();
+    return ctx->vocab.id_to_token(state->result_all[i_segment].tokens[i_token].id);
 }
 
 const char* whisper_full_get_token_text(struct whisper_context * ctx, int i_segment, int i_token) {
-    return ctx->vocab.id_to_token[ctx->state->result_all[i_segment].tokens[i_token].id].c_str();
+    return ctx->vocab.id_to_token(ctx->state->result_all[i_segment].tokens[i_token].id);
 }
 
 whisper_token whisper_full_get_token_id_from_state(struct whisper_state * state, int i_segment, int i_token) {
@@ -8648,132 +10781,165 @@ static std::vector<uint32_t> get_alignment_heads_by_layer(const whisper_context_
     return ret;
 }
 
+// normalizes rows [ir0, ir1) of the attention weights over the tokens, the same way as ggml_norm
+static void dtw_norm_rows(float * w, int64_t n_tokens, int64_t ir0, int64_t ir1, float eps) {
+    for (int64_t ir = ir0; ir < ir1; ++ir) {
+        float * x = w + ir*n_tokens;
+
+        double sum = 0.0;
+        for (int64_t i = 0; i < n_tokens; ++i) {
+            sum += (double) x[i];
+        }
+
+        const float mean = sum/n_tokens;
+
+        double sum2 = 0.0;
+        for (int64_t i = 0; i < n_tokens; ++i) {
+            const float v = x[i] - mean;
+            x[i] = v;
+            sum2 += (double) (v*v);
+        }
+
+        const float variance = sum2/n_tokens;
+        const float scale = 1.0f/sqrtf(variance + eps);
+
+        for (int64_t i = 0; i < n_tokens; ++i) {
+            x[i] *= scale;
+        }
+    }
+}
+
+// median filter over the audio frames [a0, a1) with "reflect" padding, followed by the mean over the
+// heads, negated - the result is written to the DTW input without the SOT sequence and EOT
+//
+// the window of a frame is gathered as filter_width rows of n_tokens values and sorted column-wise with
+// an odd-even transposition network, so every compare-exchange is a min/max over all the tokens at once
+static void dtw_median_filter_mean(
+        whisper_dtw_workspace & ws,
+                          int   ith,
+                          int   filter_width,
+                      int64_t   n_tokens,
+                      int64_t   n_audio,
+                      int64_t   n_heads,
+                      int64_t   sot,
+                      int64_t   N,
+                      int64_t   a0,
+                      int64_t   a1) {
+    float  * window = ws.window.data() + ith*filter_width*n_tokens;
+    double * sum    = ws.sum.data()    + ith*n_tokens;
+
+    for (int64_t a = a0; a < a1; ++a) {
+        std::fill(sum, sum + n_tokens, 0.0);
+
+        for (int64_t h = 0; h < n_heads; ++h) {
+            const float * wh = ws.w.data() + h*n_audio*n_tokens;
+
+            for (int off = 0; off < filter_width; ++off) {
+                int64_t idx = a + off - filter_width/2;
+                if (idx < 0) {
+                    idx = -idx;
+                } else if (idx >= n_audio) {
+                    idx = 2*(n_audio - 1) - idx;
+                }
+                memcpy(window + off*n_tokens, wh + idx*n_tokens, n_tokens*sizeof(float));
+            }
+
+            for (int pass = 0; pass < filter_width; ++pass) {
+                for (int r = pass & 1; r + 1 < filter_width; r += 2) {
+                    float * lo = window + r*n_tokens;
+                    float * hi = lo + n_tokens;
+                    for (int64_t t = 0; t < n_tokens; ++t) {
+                        const float v0 = lo[t];
+                        const float v1 = hi[t];
+                        lo[t] = std::min(v0, v1);
+                        hi[t] = std::max(v0, v1);
+                    }
+                }
+            }
+
+            const float * median = window + (filter_width/2)*n_tokens;
+            for (int64_t t = 0; t < n_tokens; ++t) {
+                sum[t] += (double) median[t];
+            }
+        }
+
+        // x(i, a) is stored on its anti-diagonal, at x[(i + a)*N + i]
+        for (int64_t i = 0; i < N; ++i) {
+            ws.x[(i + a)*N + i] = -((float) sum[sot + i]/(float) n_heads);
+        }
+    }
+}
+
 // dtw + backtrace to return found path
 // based on
 // https://github.com/openai/whisper/blob/main/whisper/timing.py#L83
-static ggml_tensor * dtw_and_backtrace(ggml_context * ctx, ggml_tensor * x) {
-    WHISPER_ASSERT(ggml_n_dims(x) == 2);
-
-    int64_t N = x->ne[0];
-    int64_t M = x->ne[1];
-    struct ggml_tensor * cost = ggml_new_tensor_2d(ctx, GGML_TYPE_F32, N + 1, M + 1);
-    struct ggml_tensor * trace = ggml_new_tensor_2d(ctx, GGML_TYPE_I32, N + 1, M + 1);
-
-    cost = whisper_set_f32(cost, INFINITY);
-    trace = whisper_set_i32(trace, -1);
-    whisper_set_f32_nd(cost, 0, 0, 0, 0, 0.0);
-
-    // dtw
-    // supposedly can be optmized by computing diagonals in parallel ?
-    // Not sure it is worth it since x will be GENERATED_TOKENS*1500 size at most.
-    for (int64_t j = 1; j < M + 1; ++j) {
-        for (int64_t i = 1; i < N + 1; ++i) {
-            float c0 = whisper_get_f32_nd(cost, i - 1, j - 1, 0, 0);
-            float c1 = whisper_get_f32_nd(cost, i - 1, j, 0, 0);
-            float c2 = whisper_get_f32_nd(cost, i, j - 1, 0, 0);
-
-            float c;
-            int32_t t;
-            if (c0 < c1 && c0 < c2) {
-                c = c0;
-                t = 0;
-            } else if (c1 < c0 && c1 < c2) {
-                c = c1;
-                t = 1;
-            } else {
-                c = c2;
-                t = 2;
-            }
+//
+// a cell of the cost matrix only depends on cells of the two previous anti-diagonals, so the matrix is
+// filled one anti-diagonal at a time and only the last three of them are kept - the inner loop over the
+// cells of an anti-diagonal has no dependencies and vectorizes
+// the (token, frame) pairs of the path are left in ws.path
+static void dtw_and_backtrace(whisper_dtw_workspace & ws, int64_t N, int64_t M) {
+    const int64_t n_diag = N + M + 1;
+
+    ws.cost.resize(3*(N + 1));
+    ws.trace.resize(n_diag*(N + 1));
+
+    for (int64_t d = 0; d < n_diag; ++d) {
+        float       * cost  = ws.cost.data() + ((d    )%3)*(N + 1);
+        const float * cost1 = ws.cost.data() + ((d + 2)%3)*(N + 1); // d - 1
+        const float * cost2 = ws.cost.data() + ((d + 1)%3)*(N + 1); // d - 2
+        uint8_t     * trace = ws.trace.data() + d*(N + 1);
+
+        // cost[0, 0] = 0, the rest of the first row and column is infinite
+        if (d <= M) {
+            cost[0] = d == 0 ? 0.0f : INFINITY;
+        }
+        if (d > 0 && d <= N) {
+            cost[d] = INFINITY;
+        }
+
+        const int64_t i0 = std::max<int64_t>(1, d - M);
+        const int64_t i1 = std::min<int64_t>(N, d - 1);
+        if (i0 > i1) {
+            continue;
+        }
+
+        // x(i - 1, j - 1) with j = d - i, at x[(d - 2)*N + i - 1]
+        const float * x = ws.x.data() + (d - 2)*N;
+
+        for (int64_t i = i0; i <= i1; ++i) {
+            const float c0 = cost2[i - 1];
+            const float c1 = cost1[i - 1];
+            const float c2 = cost1[i];
+
+            const bool t0 = c0 < c1 && c0 < c2;
+            const bool t1 = c1 < c0 && c1 < c2;
 
-            c = whisper_get_f32_nd(x, i - 1, j - 1, 0, 0) + c;
-            whisper_set_f32_nd(cost, i, j, 0, 0, c);
-            whisper_set_i32_nd(trace, i, j, 0, 0, t);
+            cost[i]  = x[i - 1] + (t0 ? c0 : t1 ? c1 : c2);
+            trace[i] = t0 ? 0 : t1 ? 1 : 2;
         }
     }
 
-    // Backtrace
-    const int64_t BT_MAX_ROWS = N + M - 1;
-    struct ggml_tensor * bt = ggml_new_tensor_2d(ctx, GGML_TYPE_I32, BT_MAX_ROWS, 2);
-    // trace[0, :] = 2;
-    for (int64_t i = 0; i < M + 1; ++i)
-        whisper_set_i32_nd(trace, 0, i, 0, 0, 2);
-    //trace[:, 0] = 1;
-    for (int64_t i = 0; i < N + 1; ++i)
-        whisper_set_i32_nd(trace, i, 0, 0, 0, 1);
-    int bt_row_idx = BT_MAX_ROWS - 1;
+    // backtrace, with trace[0, :] = 2 and trace[:, 0] = 1
+    ws.path.clear();
+
     int64_t i = N;
     int64_t j = M;
     while (i > 0 || j > 0) {
-        whisper_set_i32_nd(bt, bt_row_idx, 0, 0, 0, i - 1);
-        whisper_set_i32_nd(bt, bt_row_idx, 1, 0, 0, j - 1);
-        --bt_row_idx;
+        ws.path.emplace_back(i - 1, j - 1);
 
-        int32_t t = whisper_get_i32_nd(trace, i, j, 0, 0);
+        const int t = i == 0 ? 2 : j == 0 ? 1 : ws.trace[(i + j)*(N + 1) + i];
         if (t == 0) {
             --i;
             --j;
         } else if (t == 1) {
             --i;
-        } else if (t == 2) {
-            --j;
         } else {
-            WHISPER_ASSERT(0);
-        }
-    }
-
-    // FIXME: manual clip/transpose might not be the most efficient way? (e.g. use ggml funcs)
-    // Clip + transpose
-    // This might not be entirely necessary for our case, but leaving it for now so output matrix
-    // is identical to dtw on openAI timing.py
-    const int64_t result_n_cols = BT_MAX_ROWS-bt_row_idx-1;
-    ggml_tensor * r = ggml_new_tensor_2d(ctx, GGML_TYPE_I32, 2, result_n_cols);
-    for (int64_t i = 0; i < 2; ++i) {
-        for (int64_t j = 0; j < result_n_cols; ++j) {
-            int32_t v = whisper_get_i32_nd(bt, j+bt_row_idx+1, i, 0, 0);
-            whisper_set_i32_nd(r, i, j, 0, 0, v);
+            --j;
         }
     }
 
-    return r;
-}
-
-struct median_filter_user_data {
-    int filter_width;
-};
-
-static void median_filter(struct ggml_tensor * dst , const struct ggml_tensor * a, int ith, int /*nth*/, void * userdata) {
-    if (ith != 0) {
-        return;
-    }
-    int filter_width = ((median_filter_user_data *) userdata)->filter_width;
-    WHISPER_ASSERT(filter_width < a->ne[2]);
-    WHISPER_ASSERT(filter_width % 2);
-    WHISPER_ASSERT(ggml_n_dims(a) == 3);
-    WHISPER_ASSERT(a->type == GGML_TYPE_F32);
-
-    std::vector<float> filter;
-    filter.reserve(filter_width);
-    for (int64_t i = 0; i < a->ne[0]; ++i) {
-        for (int64_t j = 0; j < a->ne[1]; ++j) {
-            for (int64_t k = 0; k < a->ne[2]; ++k) {
-                for (int64_t off = -filter_width/2; off <= filter_width/2; ++off) {
-                    // "reflect" padding
-                    int64_t idx = k + off;
-                    if (idx < 0) {
-                        idx = -idx;
-                    } else if (idx >= a->ne[2]) {
-                        idx = 2*(a->ne[2] - 1) - idx;
-                    }
-
-                    filter.push_back(whisper_get_f32_nd(a, i, j, idx, 0));
-                }
-                std::sort(filter.begin(), filter.end());
-                const float v = filter[filter.size()/2];
-                whisper_set_f32_nd(dst, i, j, k, 0, v);
-                filter.clear();
-            }
-        }
-    }
+    std::reverse(ws.path.begin(), ws.path.end());
 }
 
 static void whisper_exp_compute_token_level_timestamps_dtw(
@@ -8787,21 +10953,13 @@ static void whisper_exp_compute_token_level_timestamps_dtw(
                                int   medfilt_width,
                                int   n_threads)
 {
+    WHISPER_TRACE_SCOPE("dtw");
+
     const int n_audio_ctx = state->exp_n_audio_ctx > 0 ? state->exp_n_audio_ctx : ctx->model.hparams.n_audio_ctx;
     WHISPER_ASSERT(medfilt_width % 2);
     WHISPER_ASSERT(n_frames <= n_audio_ctx * 2);
     WHISPER_ASSERT(ctx->params.dtw_aheads_preset != WHISPER_AHEADS_NONE);
 
-    // FIXME: Allocating mem everytime we call this func
-    // Our ggml buffer should be pre-allocated somewhere during init and reused
-    // when we call this function
-    struct ggml_init_params gparams = {
-        /*.mem_size   =*/ ctx->params.dtw_mem_size,
-        /*.mem_buffer =*/ NULL,
-        /*.no_alloc   =*/ false,
-    };
-    struct ggml_context * gctx = ggml_init(gparams);
-
     // Build token sequence that will be passed to decoder
     // sot + [lang] + text result + eot
     std::vector<whisper_token> tokens = { whisper_token_sot(ctx), };
@@ -8836,75 +10994,78 @@ static void whisper_exp_compute_token_level_timestamps_dtw(
     }
     WHISPER_ASSERT(state->aheads_cross_QKs != nullptr);
 
-    const auto n_audio_tokens = n_frames/2;
-    WHISPER_ASSERT(state->aheads_cross_QKs != NULL);
+    const int64_t n_audio_tokens = n_frames/2;
     WHISPER_ASSERT(n_audio_tokens <= state->aheads_cross_QKs->ne[1]);
-    const auto n_tokens = state->aheads_cross_QKs->ne[0];
-    const auto n_heads = state->aheads_cross_QKs->ne[2];
+    WHISPER_ASSERT(medfilt_width < n_audio_tokens);
+    const int64_t n_tokens = state->aheads_cross_QKs->ne[0];
+    const int64_t n_heads  = state->aheads_cross_QKs->ne[2];
+
+    // DTW input, without the SOT sequence and EOT
+    const int64_t N = n_tokens - sot_sequence_length - 1;
+    const int64_t M = n_audio_tokens;
+
+    auto & ws = state->dtw_ws;
+
+    const int nth = std::max(1, std::min<int>(n_threads, M));
 
-    // Copy data from decoder buffer to a local CPU tensor, discarding unused audio
-    // tokens (i.e. discarding rows at the end of tensor)
-    // IN: Tensor with N_TOKENS*audio_ctx*N_ALIGNMENT_HEADS dims
-    // OUT: Tensor with N_TOKENS*N_AUDIO_TOKENS*N_ALIGNMENT_HEADS dims
+    ws.w.resize(n_heads*n_audio_tokens*n_tokens);
+    ws.x.resize((N + M - 1)*N);
+    ws.window.resize(nth*medfilt_width*n_tokens);
+    ws.sum.resize(nth*n_tokens);
+
+    // Copy data from decoder buffer, discarding unused audio tokens (i.e. discarding rows at the end of tensor)
+    // IN: N_TOKENS*audio_ctx*N_ALIGNMENT_HEADS
+    // OUT: N_TOKENS*N_AUDIO_TOKENS*N_ALIGNMENT_HEADS
     WHISPER_ASSERT(state->aheads_cross_QKs->type == GGML_TYPE_F32);
     WHISPER_ASSERT(ggml_is_contiguous(state->aheads_cross_QKs));
-    ggml_tensor * w = ggml_new_tensor_3d(gctx, GGML_TYPE_F32, n_tokens, n_audio_tokens, n_heads);
     auto & data = state->aheads_cross_QKs_data;
     data.resize(n_tokens * n_audio_ctx * n_heads);
     ggml_backend_tensor_get(state->aheads_cross_QKs, data.data(), 0, sizeof(float) * n_tokens * n_audio_ctx * n_heads);
-    for (int k = 0; k < n_heads; ++k) {
-        for (int j = 0; j < n_audio_tokens; ++j) {
+    for (int64_t k = 0; k < n_heads; ++k) {
+        for (int64_t j = 0; j < n_audio_tokens; ++j) {
             memcpy(
-                (char *) w->data + j * w->nb[1] + k * w->nb[2],
+                ws.w.data() + (k * n_audio_tokens + j) * n_tokens,
                 data.data() + j * n_tokens + k * n_tokens * n_audio_ctx,
                 n_tokens * sizeof(float)
             );
         }
     }
 
-    // Normalize - in original OpenAI code, this is done over dim=-2. In this case,
-    // we already permuted N_TOKENS dimension to columns on last loop, becase ggml_norm
-    // operates over columns. Afterwards, permute to a shape that facilitates mean
-    // operation (after median filter)
-    // IN: Tensor with N_TOKENS*N_AUDIO_TOKENS*N_ALIGNMENT_HEADS dims
-    // OUT: Tensor with N_ALIGNMENT_HEADS*N_TOKENS*N_AUDIO_TOKENS dims
-    w = ggml_norm(gctx, w, 1e-9f);
-    w = ggml_permute(gctx, ggml_permute(gctx, w, 2, 1, 0 ,3), 0, 2, 1, 3);
-
-    // Pass median filter - this is done over AUDIO_TOKENS dimension.
-    // IN: Tensor with N_ALIGNMENT_HEADS*N_TOKENS*N_AUDIO_TOKENS dims
-    // OUT: Same dims
-    median_filter_user_data mf_user_data = {medfilt_width};
-    w = ggml_map_custom1(gctx, w, median_filter, 1, &mf_user_data);
-
-    // Take mean over columns, scale by -1, reshape to 2D tensor, remove SOT sequence and EOT
-    // IN: Tensor with N_ALIGNMENT_HEADS*N_TOKENS*N_AUDIO_TOKENS dims
-    // OUT: Tensor with N_TOKENS*N_AUDIO_TOKENS dims
-    w = ggml_mean(gctx, w);
-    w = ggml_scale(gctx, w, -1.0);
-    w = ggml_reshape_2d(gctx, w, w->ne[1], w->ne[2]);
-
-    // Remove SOT sequence and EOT
-    // Out dimension is (N_TOKENS-sot_sequence_length-1)*N_AUDIO_TOKENS
-    w = ggml_view_2d(gctx, w, w->ne[0] - sot_sequence_length - 1, w->ne[1], w->nb[1], sot_sequence_length * w->nb[0]);
+    auto run = [nth](const std::function<void(int)> & fn) {
+        std::vector<std::thread> workers(nth - 1);
+        for (int ith = 1; ith < nth; ++ith) {
+            workers[ith - 1] = std::thread(fn, ith);
+        }
+        fn(0);
+        for (auto & worker : workers) {
+            worker.join();
+        }
+    };
 
-    // Compute
-    struct ggml_cgraph * gf = ggml_new_graph(gctx);
-    ggml_build_forward_expand(gf, w);
+    // Normalize - in original OpenAI code, this is done over dim=-2, which holds the tokens
+    {
+        const int64_t n_rows = n_heads*n_audio_tokens;
+        run([&](int ith) {
+            dtw_norm_rows(ws.w.data(), n_tokens, (n_rows*ith)/nth, (n_rows*(ith + 1))/nth, 1e-9f);
+        });
+    }
 
-    ggml_backend_ptr backend { ggml_backend_init_by_type(GGML_BACKEND_DEVICE_TYPE_CPU, nullptr) };
-    ggml_backend_graph_compute(backend.get(), gf);
+    // Median filter over the audio tokens, mean over the heads, scale by -1
+    run([&](int ith) {
+        dtw_median_filter_mean(ws, ith, medfilt_width, n_tokens, n_audio_tokens, n_heads, sot_sequence_length, N,
+                (M*ith)/nth, (M*(ith + 1))/nth);
+    });
 
-    ggml_tensor * alignment = dtw_and_backtrace(gctx, w);
+    dtw_and_backtrace(ws, N, M);
 
     // Place timestamps on segments
     int32_t last_v = 0;
     auto seg_i = state->result_all.begin() + i_segment;
     auto tok_i = seg_i->tokens.begin();
-    for (int i = 0; i < alignment->ne[1]; ++i) {
-        int32_t v = whisper_get_i32_nd(alignment, 0, i, 0, 0);
+    for (const auto & p : ws.path) {
+        int32_t v = p.first;
         if (v != last_v) {
-            int32_t time_index = whisper_get_i32_nd(alignment, 1, i, 0, 0);
+            int32_t time_index = p.second;
             int64_t timestamp = (time_index * 2) + seek; // Each index on DTW result = 20mS audio
             last_v = v;
 
@@ -8935,8 +11096,6 @@ static void whisper_exp_compute_token_level_timestamps_dtw(
         }
         fprintf(stderr, "\n");
     }*/
-
-    ggml_free(gctx);
 }
 
 void whisper_log_set(ggml_log_callback log_callback, void * user_data) {
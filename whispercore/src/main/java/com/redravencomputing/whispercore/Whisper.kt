@@ -346,6 +346,23 @@ class Whisper(applicationContext: Context) {
 		}
 	}
 
+	/**
+	 * Measures the loaded model on this device and picks the thread count and flash-attention
+	 * setting used for later transcriptions. The first run per device and model takes a few
+	 * seconds; the result is cached in the app's files directory and reused afterwards.
+	 */
+	fun autotune() {
+		Log.d(TAG, "autotune called.")
+		if (!isModelLoaded) {
+			Log.w(TAG, "Autotune skipped: Model not loaded.")
+			controller.messageLog.append("Autotune skipped: Model not loaded.\n")
+			return
+		}
+		apiScope.launch(Dispatchers.Default) {
+			controller.autotuneCurrentModel()
+		}
+	}
+
 	/**
 	 * Gets system information relevant to the Whisper library's native components.
 	 * (No direct public Swift equivalent, but useful for debugging)
@@ -13,7 +13,8 @@ internal interface IWhisperJNI {
 	fun initContextFromInputStream(stream: InputStream): Long
 	fun freeContext(ptr: Long)
 	fun getSystemInfo(): String
-	fun fullTranscribe(ptr: Long, numThreads: Int, data: FloatArray)
+	fun fullTranscribe(ptr: Long, numThreads: Int, numThreadsDecode: Int, data: FloatArray) // numThreadsDecode 0 - auto
+	fun autotune(ptr: Long, cachePath: String): IntArray? // [encode threads, decode threads, flash attn, extra bufts]
 	fun getTextSegmentCount(ptr: Long): Int
 	fun getTextSegment(ptr: Long, index: Int): String
 	fun getTextSegmentT0(ptr: Long, index: Int): Long
@@ -31,14 +32,19 @@ internal class WhisperContext private constructor(
 		Executors.newSingleThreadExecutor().asCoroutineDispatcher()
 	)
 
+	// Set by autotune(); 0 until then, which keeps the default encoder count and lets the
+	// native side pick the decoder count
+	private var tunedEncodeThreadCount: Int = 0
+	private var tunedDecodeThreadCount: Int = 0
+
 	private val numThreadsForTranscription: Int
-		get() = WhisperCpuConfig.preferredThreadCount // This remains the same
+		get() = if (tunedEncodeThreadCount > 0) tunedEncodeThreadCount else WhisperCpuConfig.preferredThreadCount
 
 	suspend fun transcribeData(data: FloatArray, printTimestamp: Boolean = true): String =
 		withContext(scope.coroutineContext) {
 		require(ptr != 0L) { "Context has been released or was not initialized." }
 		// Use the injected 'jni' instance
-		jni.fullTranscribe(ptr, numThreadsForTranscription, data) // << CHANGE HERE
+		jni.fullTranscribe(ptr, numThreadsForTranscription, tunedDecodeThreadCount, data) // << CHANGE HERE
 		val textCount = jni.getTextSegmentCount(ptr)              // << CHANGE HERE
 		buildString {
 			for (i in 0 until textCount) {
@@ -61,6 +67,20 @@ internal class WhisperContext private constructor(
 		}
 	}
 
+	/**
+	 * Times short native encoder/decoder runs to pick the thread count and flash-attention setting
+	 * for this device. Results are cached in [cachePath], so only the first call per device and
+	 * model shape is slow. Returns the chosen encoder and decoder thread counts, or (0, 0) if
+	 * tuning failed.
+	 */
+	suspend fun autotune(cachePath: String): Pair<Int, Int> = withContext(scope.coroutineContext) {
+		require(ptr != 0L)
+		val result = jni.autotune(ptr, cachePath) ?: return@withContext Pair(0, 0)
+		tunedEncodeThreadCount = result[0]
+		tunedDecodeThreadCount = result[1]
+		Pair(tunedEncodeThreadCount, tunedDecodeThreadCount)
+	}
+
 	suspend fun benchMemory(nthreads: Int): String = withContext(scope.coroutineContext) {
 		require(ptr != 0L)
 		require(nthreads >= 1) { "Benchmark nthreads must be >= 1" }
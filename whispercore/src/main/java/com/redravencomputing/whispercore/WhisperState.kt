@@ -473,6 +473,29 @@ internal class WhisperState(
 		// delegate callbacks for state change?
 	}
 
+	// --- Auto-tuning ---
+	suspend fun autotuneCurrentModel() {
+		val ctx = whisperContext
+		if (ctx == null || !isModelLoaded) {
+			appendToLog("Model not loaded. Cannot autotune.\n")
+			return
+		}
+		if (!canTranscribe) {
+			return
+		}
+		canTranscribe = false
+
+		val cacheFile = File(applicationContext.filesDir, "whisper-autotune.txt")
+		val (nThreadsEncode, nThreadsDecode) = ctx.autotune(cacheFile.absolutePath)
+		if (nThreadsEncode > 0) {
+			appendToLog("Autotune: using $nThreadsEncode encoder and $nThreadsDecode decoder threads.\n")
+		} else {
+			appendToLog("Autotune failed, keeping the default thread count.\n")
+		}
+
+		canTranscribe = true
+	}
+
 	// --- Benchmarking ---
 	suspend fun benchmarkCurrentModel() {
 		if(whisperContext == null) {
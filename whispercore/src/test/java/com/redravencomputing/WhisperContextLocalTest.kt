@@ -45,7 +45,7 @@ class WhisperContextLocalTest {
 		every { mockJni.initContextFromInputStream(any()) } returns defaultMockContextPtr
 		every { mockJni.freeContext(any<Long>()) } just Runs
 		every { mockJni.getSystemInfo() } returns "Mocked System Info"
-		every { mockJni.fullTranscribe(any<Long>(), any<Int>(), any<FloatArray>()) } just Runs
+		every { mockJni.fullTranscribe(any<Long>(), any<Int>(), any<Int>(), any<FloatArray>()) } just Runs
 		every { mockJni.getTextSegmentCount(any<Long>()) } returns 0 // Default
 		every { mockJni.getTextSegment(any<Long>(), any<Int>()) } returns "" // Default
 		every { mockJni.getTextSegmentT0(any<Long>(), any<Int>()) } returns 0L // Default
@@ -115,7 +115,7 @@ class WhisperContextLocalTest {
 		val whisperContext = WhisperContext.createContextFromFile(mockModelPath, jniBridgeForTest = mockJni)
 		val audioData = FloatArray(16000)
 
-		every { mockJni.fullTranscribe(specificTestContextPtr, expectedThreadCount, audioData) } just Runs
+		every { mockJni.fullTranscribe(specificTestContextPtr, expectedThreadCount, 0, audioData) } just Runs
 		every { mockJni.getTextSegmentCount(specificTestContextPtr) } returns 1
 		every { mockJni.getTextSegment(specificTestContextPtr, 0) } returns "Test transcription."
 		every { mockJni.getTextSegmentT0(specificTestContextPtr, 0) } returns 0L
@@ -139,7 +139,7 @@ class WhisperContextLocalTest {
 			result.contains("[00:00:00.000 --> 00:00:10.000]: Test transcription.") // Adjusted based on T1=1000L
 		)
 
-		verify { mockJni.fullTranscribe(specificTestContextPtr, expectedThreadCount, audioData) }
+		verify { mockJni.fullTranscribe(specificTestContextPtr, expectedThreadCount, 0, audioData) }
 		verify { mockJni.getTextSegmentCount(specificTestContextPtr) }
 		verify { mockJni.getTextSegment(specificTestContextPtr, 0) }
 		verify { mockJni.getTextSegmentT0(specificTestContextPtr, 0) }
@@ -156,7 +156,7 @@ class WhisperContextLocalTest {
 		val whisperContext = WhisperContext.createContextFromFile(mockModelPath, jniBridgeForTest = mockJni)
 		val audioData = FloatArray(32000)
 
-		every { mockJni.fullTranscribe(specificTestContextPtr, expectedThreadCount, audioData) } just Runs
+		every { mockJni.fullTranscribe(specificTestContextPtr, expectedThreadCount, 0, audioData) } just Runs
 		every { mockJni.getTextSegmentCount(specificTestContextPtr) } returns 2
 		every { mockJni.getTextSegment(specificTestContextPtr, 0) } returns "First part."
 		every { mockJni.getTextSegmentT0(specificTestContextPtr, 0) } returns 0L      // 0s
@@ -172,7 +172,7 @@ class WhisperContextLocalTest {
 		assertTrue(result.contains("[00:00:00.000 --> 00:00:00.500]: First part."))
 		assertTrue(result.contains("[00:00:00.500 --> 00:00:01.200]: Second part."))
 
-		verify { mockJni.fullTranscribe(specificTestContextPtr, expectedThreadCount, audioData) }
+		verify { mockJni.fullTranscribe(specificTestContextPtr, expectedThreadCount, 0, audioData) }
 		verify { mockJni.getTextSegmentCount(specificTestContextPtr) }
 		verify { mockJni.getTextSegment(specificTestContextPtr, 0) } // And T0, T1 for segment 0
 		verify { mockJni.getTextSegment(specificTestContextPtr, 1) } // And T0, T1 for segment 1